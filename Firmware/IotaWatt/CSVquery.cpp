@@ -3,6 +3,7 @@
 CSVquery::CSVquery()
     :_oldRec(nullptr)
     ,_newRec(nullptr)
+    ,_recent(nullptr)
     ,_begin(0)
     ,_end(0)
     ,_limit(1000)
@@ -17,15 +18,23 @@ CSVquery::CSVquery()
     ,_missingNull(true)
     ,_missingZero(false)
     ,_timeOnly(false)
+    ,_unread(false)
+    ,_cache(0)
     ,_columns(nullptr)
+    ,_binBlock(nullptr)
+    ,_binBlockRows(0)
+    ,_binRows(0)
+    ,_binColumns(0)
     {}
 
 CSVquery::~CSVquery(){
     trace(T_CSVquery,1,0);
     delete _oldRec;
     delete _newRec;
+    delete _recent;
     trace(T_CSVquery,1,2);
     delete _columns;
+    delete[] _binBlock;
     trace(T_CSVquery,1,3);
 }
 
@@ -54,14 +63,24 @@ bool    CSVquery::setup(){
         }
        
         _begin = parseTimeArg(server.arg(F("begin")));
-        if(_begin % Current_log.interval()){
-            _begin += Current_log.interval() - (_begin % Current_log.interval());
-        }
         _end = parseTimeArg(server.arg(F("end")));
-        if(_end % Current_log.interval()){
-            _end -= _end % Current_log.interval();
-        }
         if(_end == 0 || _begin == 0 || _end < _begin) return false;
+
+            // The last few minutes come from recentData at one second resolution,
+            // otherwise align to the log interval.
+
+        if(recentData.covers(_begin, _end)){
+            _recent = new recentCursor;
+        }
+        else {
+            if(_begin % Current_log.interval()){
+                _begin += Current_log.interval() - (_begin % Current_log.interval());
+            }
+            if(_end % Current_log.interval()){
+                _end -= _end % Current_log.interval();
+            }
+            if(_end < _begin) return false;
+        }
         trace(T_CSVquery,10);
 
         if(server.hasArg(F("resolution"))){
@@ -84,7 +103,10 @@ bool    CSVquery::setup(){
             const uint16_t intervals[] = {5, 10, 15, 20, 30, 60, 120, 300, 600, 1200, 1800, 3600, 7200, 14400, 21600, 28800};
             uint32_t rawInterval = (_end - _begin) / (_highRes ? 800 : 400);
             uint32_t interval = 86400;
-            for(int i=0; i<16; i++){
+            if(_recent && rawInterval < intervals[0]){
+                interval = MAX(rawInterval, 1);
+            }
+            else for(int i=0; i<16; i++){
                 if(rawInterval <= intervals[i]){
                     interval = intervals[i];
                     break; 
@@ -104,7 +126,7 @@ bool    CSVquery::setup(){
             else if(group.endsWith("w")) _groupUnits = tUnitsWeeks;
             else if(group.endsWith("M")) _groupUnits = tUnitsMonths;
             else if(group.endsWith("y")) _groupUnits = tUnitsYears;
-            else if(_groupMult > 0 && _groupMult % 5 == 0) _groupUnits = tUnitsSeconds;
+            else if(_groupMult > 0 && _groupMult % (_recent ? 1 : 5) == 0) _groupUnits = tUnitsSeconds;
             else {
                 _failReason = F("Invalid group");
                 return false;
@@ -136,6 +158,9 @@ bool    CSVquery::setup(){
             else if(arg.equalsIgnoreCase("CSV")){
                 _format = formatCSV;
             }
+            else if(arg.equalsIgnoreCase("bin")){
+                _format = formatBin;
+            }
             else {
                 _failReason = F("Invalid format");
                 return false;
@@ -214,38 +239,32 @@ bool    CSVquery::setup(){
             
             if(col->source == ' '){
                 trace(T_CSVquery,14);
-                for(int j=0; j<maxInputs; j++){
-                    if(inputChannel[j]->isActive() && name.equals(inputChannel[j]->_name)){
-                        col->source = 'I';
-                        if(inputChannel[j]->_type == channelTypeVoltage){
-                            col->unit = Volts;
-                        } else {
-                            col->unit = Watts;
-                        }
-                        col->input = inputChannel[j]->_channel;
-                        break;
+                IotaInputChannel* input = findInput(name.c_str());
+                if(input){
+                    col->source = 'I';
+                    if(input->_type == channelTypeVoltage){
+                        col->unit = Volts;
+                    } else {
+                        col->unit = Watts;
                     }
+                    col->input = input->_channel;
                 }
             }
 
             if(col->source == ' '){
                 trace(T_CSVquery,16);
-                Script* script = outputs->first();
-                while(script){
-                    if(name.equals(script->name())){
-                        col->source = 'O';
-                        if(strcmp(script->getUnits(),"Volts") == 0){
-                            col->unit = Volts;
-                        }
-                        else if(strcmp(script->getUnits(),"Watts") == 0){
-                            col->unit = Watts;
-                        }
-                        else col->decimals = script->precision();
-                        col->script = script;
-                        break;
-                    } 
-                    script = script->next(); 
-                }  
+                Script* script = outputs->script(name.c_str());
+                if(script){
+                    col->source = 'O';
+                    if(strcmp(script->getUnits(),"Volts") == 0){
+                        col->unit = Volts;
+                    }
+                    else if(strcmp(script->getUnits(),"Watts") == 0){
+                        col->unit = Watts;
+                    }
+                    else col->decimals = script->precision();
+                    col->script = script;
+                }
             }
 
             if(col->source == ' '){
@@ -363,7 +382,10 @@ bool    CSVquery::setup(){
         }
 
         trace(T_CSVquery,19);
-        if(_header){
+        if(_format == formatBin){
+            buildBinHeader();
+        }
+        else if(_header){
             buildHeader();
         }
         if(_format == formatJson){
@@ -372,7 +394,16 @@ bool    CSVquery::setup(){
         _oldRec = new IotaLogRecord;
         _newRec = new IotaLogRecord;
         _newRec->UNIXtime = _begin;
-        logReadKey(_newRec);
+        readKey(_newRec);
+
+            // Points are cached by the resolved group, as group=auto spaces them by the window length.
+            // group=all is one point over the whole window, not worth keeping.
+
+        if(_format != formatBin && ! _timeOnly && ! _recent && ! server.arg(F("group")).equals("all")){
+            _cache = queryResults.open(String(F("query:")) + server.arg(F("format")) + ':' + server.arg(F("select")) + ':' +
+                                       String(_groupMult) + ':' + String((int)_groupUnits) + (_integrations ? "i:" : ":") +
+                                       server.arg(F("missing")));
+        }
         trace(T_CSVquery,20);
         _query = select;
         return true;
@@ -385,6 +416,15 @@ bool    CSVquery::setup(){
     }
 }
 
+    // Read a record from recentData or the logs.
+
+uint32_t CSVquery::readKey(IotaLogRecord* record){
+    if(_recent){
+        return _recent->read(record);
+    }
+    return logReadKey(record);
+}
+
 const char*  CSVquery::unitstr(units units){
     if(units == Volts) return "Volts";
     if(units == Watts) return "Watts";
@@ -405,6 +445,9 @@ bool    CSVquery::isJson(){
 bool    CSVquery::isCSV(){
     return _format == formatCSV;
 }
+bool    CSVquery::isBin(){
+    return _format == formatBin;
+}
 
 String  CSVquery::failReason(){
     return _failReason.length() ? _failReason : "unspecified";
@@ -461,10 +504,11 @@ void CSVquery::buildHeader(){
 //*****************************************************************************************
 //                  buildLine
 //*****************************************************************************************
-void CSVquery::buildLine(){
+void CSVquery::buildLine(xbuf& out){
     trace(T_CSVquery,60);
     column* col = _columns;
     double elapsedHours = _newRec->logHours - _oldRec->logHours;
+    scriptDeltas deltas(_oldRec, _newRec);
     bool first = true;
         
     while(col){
@@ -472,9 +516,9 @@ void CSVquery::buildLine(){
 
         if( ! first){
             if(_format == formatJson){
-                _buffer.print(',');
+                out.print(',');
             } else {
-                _buffer.print(", ");
+                out.print(", ");
             }
         } 
         first = false;
@@ -484,19 +528,19 @@ void CSVquery::buildLine(){
         }
 
         else if(col->source == 'T'){
-            time_t Time = col->timeLocal ? UTC2Local(_oldRec->UNIXtime) : _oldRec->UNIXtime;
+            time_t Time = col->timeLocal ? UTC2Local(_oldRec->UNIXtime, _localSpan) : _oldRec->UNIXtime;
             if(col->timeFormat == unix){
-                _buffer.print(Time);
+                out.print(Time);
             }
             else {
                 trace(T_CSVquery,62);
                 _tm = gmtime(&Time); 
-                char out[80];
-                strftime(out, 80, "%FT%T", _tm);
+                char timeStr[80];
+                strftime(timeStr, 80, "%FT%T", _tm);
                 if(_format == formatJson){
-                    _buffer.printf("\"%s\"", out);    
+                    out.printf("\"%s\"", timeStr);    
                 } else {
-                    _buffer.print(out);
+                    out.print(timeStr);
                 }
             }
         }
@@ -504,19 +548,19 @@ void CSVquery::buildLine(){
         else if(elapsedHours == 0){
             trace(T_CSVquery,63);
             if(_missingZero){
-                _buffer.print('0');
+                out.print('0');
             }
             else if(_missingNull){
-                _buffer.print("null");
+                out.print("null");
             }
         }
 
         else {
             trace(T_CSVquery,64);
             double value = 0.0;
-            value = col->script->run(_oldRec, _newRec, col->unit);
+            value = col->script->run(deltas, col->unit);
             trace(T_CSVquery,65);
-            printValue(value, col->decimals);
+            printValue(out, value, col->decimals);
         }
 
     col = col->next;
@@ -524,14 +568,92 @@ void CSVquery::buildLine(){
 
 }
 
-void CSVquery::printValue(const double value, const int8_t decimals){
+//*****************************************************************************************
+//                  Binary format - see CSVquery.h
+//  Rows are collected column-wise in _binBlock and written a block at a time,
+//  so the client can map each column straight into an array.  The block and its
+//  copy in _buffer are both held while it's sent, so a block is at most half the
+//  payload share, up to CSVQUERY_BIN_ROWS rows.  Text formats only hold a line
+//  at a time in _buffer.
+//*****************************************************************************************
+void CSVquery::buildBinHeader(){
+    _binColumns = 0;
+    for(column* col = _columns; col; col = col->next){
+        _binColumns++;
+    }
+    int32_t share = _payload.limit(_buffer.available());
+    int32_t rowBytes = 2 * MAX(_binColumns, 1) * sizeof(binValue);
+    _binBlockRows = MIN(CSVQUERY_BIN_ROWS, MAX(share / rowBytes, 1));
+    _binBlock = new binValue[_binColumns * _binBlockRows];
+    _binRows = 0;
+
+    uint16_t rows = _binBlockRows;
+    _buffer.write("IOTB");
+    _buffer.write((uint8_t)CSVQUERY_BIN_VERSION);
+    _buffer.write(_binColumns);
+    _buffer.write((uint8_t*)&rows, 2);
+    _buffer.write((uint8_t*)&_begin, 4);
+    _buffer.write((uint8_t*)&_end, 4);
+    for(column* col = _columns; col; col = col->next){
+        const char* name = "Time";
+        const char* unit = col->timeLocal ? "local" : "utc";
+        if(col->source != 'T'){
+            name = col->source == 'I' ? inputChannel[col->input]->_name : col->script->name();
+            unit = unitstr(col->unit);
+        }
+        uint8_t nameLen = MIN(strlen(name), 255);
+        uint8_t unitLen = strlen(unit);
+        _buffer.write((uint8_t)(col->source == 'T' ? 'T' : 'F'));
+        _buffer.write((uint8_t)col->decimals);
+        _buffer.write(nameLen);
+        _buffer.write((uint8_t*)name, nameLen);
+        _buffer.write(unitLen);
+        _buffer.write((uint8_t*)unit, unitLen);
+    }
+}
+
+void CSVquery::buildBinRow(){
+    trace(T_CSVquery,66);
+    double elapsedHours = _newRec->logHours - _oldRec->logHours;
+    scriptDeltas deltas(_oldRec, _newRec);
+    binValue* value = _binBlock + _binRows;
+    for(column* col = _columns; col; col = col->next){
+        if(col->source == 'T'){
+            value->time = col->timeLocal ? UTC2Local(_oldRec->UNIXtime, _localSpan) : _oldRec->UNIXtime;
+        }
+        else if(elapsedHours == 0){
+            value->value = _missingZero ? 0.0f : NAN;
+        }
+        else {
+            value->value = col->script->run(deltas, col->unit);
+        }
+        value += _binBlockRows;
+    }
+    if(++_binRows == _binBlockRows){
+        flushBin();
+    }
+}
+
+void CSVquery::flushBin(){
+    if(_binRows == 0){
+        return;
+    }
+    trace(T_CSVquery,67);
+    _buffer.write((uint8_t*)&_binRows, 2);
+    for(int i=0; i<_binColumns; i++){
+        _buffer.write((uint8_t*)(_binBlock + i * _binBlockRows), _binRows * sizeof(binValue));
+    }
+    _binRows = 0;
+}
+
+void CSVquery::printValue(xbuf& out, const double value, const int8_t decimals){
     char str[20];
     snprintf(str,20,"%#.*f",decimals,value);
     int len = strlen(str);
     while(str[--len] == '0');
     if(str[len] == '.') --len;
     str[len+1] = 0;
-    _buffer.write(str);
+    out.write(str);
 }
 
 //*****************************************************************************************
@@ -540,6 +662,7 @@ void CSVquery::printValue(const double value, const int8_t decimals){
 size_t  CSVquery::readResult(uint8_t* buf, int len){
 
     trace(T_CSVquery,20);
+    _payload.hold(_buffer.available() + (_binBlock ? _binColumns * _binBlockRows * sizeof(binValue) : 0));
     switch (_query){
 
         default:
@@ -630,6 +753,15 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
 
                 else if(_newRec->UNIXtime >= _end || _limit == 0){
                     trace(T_CSVquery,45);
+                    if(_format == formatBin){
+                        flushBin();
+                        uint16_t trailer = 0;
+                        uint32_t limitKey = (_limit == 0 && _newRec->UNIXtime < _end) ? _newRec->UNIXtime : 0;
+                        _buffer.write((uint8_t*)&trailer, 2);
+                        _buffer.write((uint8_t*)&limitKey, 4);
+                        _lastLine = true;
+                        continue;
+                    }
                     if(_format == formatJson){
                         _buffer.print(']');
                     }
@@ -658,12 +790,21 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                     _oldRec = _newRec;
                     _newRec = swapRec;
 
-                        // Read group end record
+                        // Read group end record,
+                        // unless the line is in queryResults.
 
                     _newRec->UNIXtime = (uint32_t)nextGroup((time_t)_oldRec->UNIXtime, _groupUnits, _groupMult);
-                    if( ! _timeOnly){
+                    const char* cached = queryResults.get(_cache, _oldRec->UNIXtime);
+                    if(cached){
+                        _unread = true;
+                    }
+                    else if( ! _timeOnly){
                         trace(T_CSVquery,51);
-                        logReadKey(_newRec);
+                        if(_unread){
+                            readKey(_oldRec);
+                            _unread = false;
+                        }
+                        readKey(_newRec);
                     }
 
                         // Belt and suspenders,
@@ -676,9 +817,55 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
 
                         // If there is data or not skipping missing data, 
                         // Generate a line.             
+                        // A cached empty line is one that was skipped.
 
-                    if( _timeOnly || (! (_newRec->logHours == _oldRec->logHours && _missingSkip))){
+                    if(cached){
+                        if(*cached){
+                            if( ! _firstLine){
+                                _buffer.print(_format == formatJson ? "," : "\r\n");
+                            }
+                            _buffer.print(cached);
+                            _limit--;
+                            _firstLine = false;
+                        }
+                    }
+                    else if( ! _timeOnly && _newRec->logHours == _oldRec->logHours && _missingSkip){
+                        if(_newRec->UNIXtime <= Current_log.lastKey()){
+                            queryResults.put(_cache, _oldRec->UNIXtime, "");
+                        }
+                    }
+                    else if(_cache){
+                        trace(T_CSVquery,57);
+                        if( ! _firstLine){
+                            _buffer.print(_format == formatJson ? "," : "\r\n");
+                        }
+                        xbuf line;
+                        if(_format == formatJson){
+                            line.print('[');
+                        }
+                        buildLine(line);
+                        if(_format == formatJson){
+                            line.print(']');
+                        }
+                        size_t len = line.available();
+                        char* text = new char[len + 1];
+                        line.read((uint8_t*)text, len);
+                        text[len] = 0;
+                        _buffer.write((uint8_t*)text, len);
+                        if(_newRec->UNIXtime <= Current_log.lastKey()){
+                            queryResults.put(_cache, _oldRec->UNIXtime, text);
+                        }
+                        delete[] text;
+                        _limit--;
+                        _firstLine = false;
+                    }
+                    else if( _timeOnly || (! (_newRec->logHours == _oldRec->logHours && _missingSkip))){
                         trace(T_CSVquery,53);    
+                        if(_format == formatBin){
+                            buildBinRow();
+                            _limit--;
+                            continue;
+                        }
                         if( ! _firstLine){
                             if(_format == formatJson){
                                 _buffer.print(',');
@@ -692,7 +879,7 @@ size_t  CSVquery::readResult(uint8_t* buf, int len){
                             _buffer.print('[');
                         }
                         trace(T_CSVquery,54);    
-                        buildLine();
+                        buildLine(_buffer);
                         _limit--;
                         trace(T_CSVquery,55);
 
@@ -892,4 +1079,36 @@ time_t  CSVquery::parseTimeArg(String timeArg){
 
 int    CSVquery::parseInt(char** ptr){
     return strtoul(*ptr, ptr, 10);
-}
\ No newline at end of file
+}
+
+/*******************************************************************************************************
+ * queryBenchmark(query) - GET /query?<query>&bench
+ * 
+ * Produces the response of a set up query, discarding it, and reports the size and how long it
+ * took.  Run twice to see the effect of the query results cache.  It runs in the web server
+ * handler, so it needs admin authorization and stops after QUERY_BENCH_CHUNKS chunks (about 46K);
+ * time a longer query over several shorter ranges.  This and logbench run on the device against
+ * the real card, there's no host build to run them on.
+ ******************************************************************************************************/
+
+String  queryBenchmark(CSVquery* query){
+    uint8_t* buf = new uint8_t[WEB_STREAM_CHUNK];
+    size_t bytes = 0;
+    uint32_t chunks = 0;
+    uint32_t reads = Current_log.readKeyIO() + History_log.readKeyIO();
+    uint32_t startUs = micros();
+    size_t len;
+    while(chunks < QUERY_BENCH_CHUNKS && (len = query->readResult(buf, WEB_STREAM_CHUNK))){
+        bytes += len;
+        chunks++;
+        yield();
+    }
+    uint32_t elapsedUs = micros() - startUs;
+    reads = Current_log.readKeyIO() + History_log.readKeyIO() - reads;
+    delete[] buf;
+    char line[140];
+    snprintf_P(line, sizeof(line), PSTR("%u bytes in %u chunks%s, %.1fms, %u keyed read I/Os, %.2fus per byte\r\n"),
+          bytes, chunks, chunks >= QUERY_BENCH_CHUNKS ? " (limit)" : "", (float)elapsedUs / 1000.0, reads,
+          bytes ? (float)elapsedUs / bytes : 0.0);
+    return String(line);
+}
@@ -2,7 +2,18 @@
 
 #include "IotaWatt.h"
 
-class  CSVquery {
+        // format=bin is a little-endian columnar stream:
+        //  header  "IOTB", uint8 version, uint8 columns, uint16 rows per block, uint32 begin, uint32 end,
+        //          then per column: uint8 type ('T' uint32 time, 'F' float32), int8 decimals,
+        //          uint8 length + name, uint8 length + units.
+        //  blocks  uint16 rows, then rows values of each column in turn.
+        //  trailer uint16 0, uint32 time limit was exceeded (0 if complete).
+        // Missing values are NaN (missing=null) or 0 (missing=zero).
+
+#define CSVQUERY_BIN_VERSION 1
+#define CSVQUERY_BIN_ROWS 64                    // Most rows per binary block (fewer to fit the payload share)
+
+class  CSVquery : public webStreamSource {
 
     public:
         CSVquery();
@@ -11,6 +22,7 @@ class  CSVquery {
         size_t  readResult(uint8_t* buf, int len);
         bool    isJson();
         bool    isCSV();
+        bool    isBin();
         String  failReason();
 
     private:
@@ -37,14 +49,17 @@ class  CSVquery {
                             tUnitsYears};
 
         enum        format {formatJson,         // Output format
-                            formatCSV}; 
+                            formatCSV,
+                            formatBin}; 
 
         enum        tformat {iso,
                              unix};
 
         IotaLogRecord*  _oldRec;                // -> aged logRecord
         IotaLogRecord*  _newRec;                // -> new logRecord
+        recentCursor*   _recent;                // Reads recentData when the window is within it
         xbuf            _buffer;                // work buffer to build response lines
+        payloadShare    _payload;               // _buffer and _binBlock in the payload pool
         String          _failReason;            // Error message from constructor
 
         uint32_t    _begin;                     // Beginning time - UTC
@@ -65,6 +80,9 @@ class  CSVquery {
         bool        _missingNull;               // Produce null values when no data
         bool        _missingZero;               // Produce zero values when no data
         bool        _timeOnly;                  // Query is for time only, no data needed    
+        bool        _unread;                    // _newRec not read, line came from queryResults
+        uint32_t    _cache;                     // queryResults key (0 = none)
+        localSpan   _localSpan;                 // Local offset of the time column rows
 
         struct column {                         // Output column descriptor - built lifo then made fifo    
                     column* next;               // -> next in chain
@@ -98,14 +116,32 @@ class  CSVquery {
 
         column*     _columns;                   // List head
 
+        union       binValue {                  // Binary column value
+                        uint32_t    time;
+                        float       value;
+                        };
+        binValue*   _binBlock;                  // Binary block, _binBlockRows per column
+        uint16_t    _binBlockRows;              // Rows per block
+        uint16_t    _binRows;                   // Rows in _binBlock
+        uint8_t     _binColumns;                // Number of columns
+
                 // Private functions
 
         void        buildHeader();
-        void        buildLine();
-        void        printValue(const double value, const int8_t decimals);
+        void        buildLine(xbuf& out);
+        void        buildBinHeader();
+        void        buildBinRow();
+        void        flushBin();
+        void        printValue(xbuf& out, const double value, const int8_t decimals);
         time_t      nextGroup(time_t time, tUnits units, int32_t mult);
         time_t      parseTimeArg(String timeArg);
         int         parseInt(char** ptr);
         const char* unitstr(units);
+        uint32_t    readKey(IotaLogRecord* record);
 
 };
+
+#define QUERY_BENCH_CHUNKS 32               // Most chunks produced by queryBenchmark()
+
+String  queryBenchmark(CSVquery* query);   // GET /query?...&bench - time the response without sending it
+
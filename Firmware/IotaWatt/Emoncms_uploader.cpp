@@ -69,7 +69,8 @@ uint32_t emoncms_uploader::handle_write_s(){
 
     // If not enough data to post, set wait and return.
 
-    if(Current_log.lastKey() < (_lastSent + _interval + (_interval * _bulkSend))){
+    uint32_t lastKey = dataLastKey();
+    if(lastKey < (_lastSent + _interval + (_interval * _bulkAdapt))){
         return UTCtime() + 1;
     }
 
@@ -81,14 +82,14 @@ uint32_t emoncms_uploader::handle_write_s(){
         oldRecord = new IotaLogRecord;
         newRecord = new IotaLogRecord;
         newRecord->UNIXtime = _lastSent + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
     }
 
     // Build post transaction from datalog records.
 
-    while(reqData.available() < uploaderBufferLimit && newRecord->UNIXtime < Current_log.lastKey()){
+    while(reqData.available() < postLimit() && newRecord->UNIXtime < lastKey){
 
-        if(micros() > bingoTime){
+        if( ! _budget.next()){
             return 15;
         }
 
@@ -99,7 +100,7 @@ uint32_t emoncms_uploader::handle_write_s(){
         oldRecord = newRecord;
         newRecord = swap;
         newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
 
         // Compute the time difference between log entries.
         // If zero, don't bother.
@@ -108,7 +109,7 @@ uint32_t emoncms_uploader::handle_write_s(){
         double elapsedHours = newRecord->logHours - oldRecord->logHours;
         if(elapsedHours == 0){
             trace(T_Emoncms,63);
-            if((newRecord->UNIXtime + _interval) <= Current_log.lastKey()){
+            if((newRecord->UNIXtime + _interval) <= lastKey){
                 return 1;
             }
             return UTCtime() + 1;
@@ -148,11 +149,14 @@ uint32_t emoncms_uploader::handle_write_s(){
         }
         else {
             trace(T_Emoncms,64);
+            double* values = new double[_outputs->count()];
+            _outputs->evaluate(oldRecord, newRecord, values);
+            int output = 0;
             Script* script = _outputs->first();
             int index=1;
             while(script){
                 while(index++ < String(script->name()).toInt()) reqData.write(",null");
-                double value1 = script->run(oldRecord, newRecord);
+                double value1 = values[output++];
                 if(value1 == value1){
                     if(script->precision()){
                         char valstr[20];
@@ -173,6 +177,7 @@ uint32_t emoncms_uploader::handle_write_s(){
                 }
                 script = script->next();
             }
+            delete[] values;
         }
         trace(T_Emoncms,65);
         reqData.write(']');
@@ -198,64 +203,65 @@ uint32_t emoncms_uploader::handle_write_s(){
     // Encrypted protocol, encrypt the payload
 
     trace(T_Emoncms,70);  
+    uint32_t startUs = micros();
+    uint32_t heapStart = ESP.getFreeHeap();
+    uint32_t heapLow = heapStart;
     
     uint8_t iv[16];
     for (int i = 0; i < 16; i++){
         iv[i] = random(256);
     }
 
-        // Initialize sha256, shaHMAC and cypher
+        // Reset sha256, shaHMAC and cypher, kept from post to post.
 
     trace(T_Emoncms, 70);  
-    SHA256* sha256 = new SHA256;
-    sha256->reset();
-    SHA256* shaHMAC = new SHA256;
-    shaHMAC->resetHMAC(_cryptoKey,16);
-    CBC<AES128>* cypher = new CBC<AES128>;
-    cypher->setIV(iv, 16);
-    cypher->setKey(_cryptoKey, 16);
+    if( ! _cypher){
+        _shaContext = new SHA256;
+        _hmacContext = new SHA256;
+        _cypher = new CBC<AES128>;
+    }
+    _shaContext->reset();
+    _hmacContext->resetHMAC(_cryptoKey,16);
+    _cypher->setIV(iv, 16);
+    _cypher->setKey(_cryptoKey, 16);
 
-    // Process payload while
-    // updating SHAs and encrypting. 
+    // Process payload while updating SHAs, encrypting
+    // and base64 encoding onto the end of reqData.
+    // Pieces are 48 bytes, a multiple of both the AES block and base64 group.
 
     trace(T_Emoncms,70);     
-    uint8_t* temp = new uint8_t[64+16];
+    uint8_t temp[48+16];
+    base64Stream base64(&reqData);
     size_t supply = reqData.available();
-    reqData.write(iv, 16);
+    base64.write(iv, 16);
     while(supply){
-        size_t len = supply < 64 ? supply : 64;
+        size_t len = supply < 48 ? supply : 48;
         reqData.read(temp, len);
         supply -= len;
-        sha256->update(temp, len);
-        shaHMAC->update(temp, len);
-        if(len < 64 || supply == 0){
+        _shaContext->update(temp, len);
+        _hmacContext->update(temp, len);
+        if(len < 48 || supply == 0){
             size_t padlen = 16 - (len % 16);
             for(int i=0; i<padlen; i++){
                 temp[len+i] = padlen;
             }
             len += padlen;
         }
-        cypher->encrypt(temp, temp, len);
-        reqData.write(temp, len);
+        _cypher->encrypt(temp, temp, len);
+        base64.write(temp, len);
+        heapLow = MIN(heapLow, ESP.getFreeHeap());
     }
-    trace(T_Emoncms,70);
-    delete[] temp;
-    delete cypher;
+    base64.finish();
     
     // finalize the Sha256 and shaHMAC
 
     trace(T_Emoncms,71); 
-    sha256->finalize(_sha256, 32);
+    _shaContext->finalize(_sha256, 32);
     delete[] _base64Sha;
     _base64Sha = charstar(base64encode(_sha256, 32).c_str());
-    shaHMAC->finalizeHMAC(_cryptoKey, 16, _sha256, 32);
-    delete sha256;
-    delete shaHMAC;
-
-    // Now base64 encode and send
-
-    trace(T_Emoncms,71); 
-    base64encode(&reqData); 
+    _hmacContext->finalizeHMAC(_cryptoKey, 16, _sha256, 32);
+    _encryptUs = micros() - startUs;
+    _encryptHeap = MAX(_encryptHeap, heapStart - heapLow);
     trace(T_Emoncms,71);
     _encrypted = true;
     HTTPPost("/input/bulk", checkWrite_s, "aes128cbc");
@@ -295,8 +301,7 @@ uint32_t emoncms_uploader::handle_checkWrite_s(){
         sprintf_P(msg, PSTR("Post failed %d"), _request->responseHTTPcode());
         delete[] _statusMessage;
         _statusMessage = charstar(msg);
-        delete _request;
-        _request = nullptr;
+        HTTPreturn(_request, false);
     }
 
     // Try it again in awhile;
@@ -308,6 +313,14 @@ uint32_t emoncms_uploader::handle_checkWrite_s(){
 /*****************************************************************************************
  *          setRequestHeaders()
  * **************************************************************************************/
+void emoncms_uploader::getStatusJson(JsonObject& status){
+    uploader::getStatusJson(status);
+    if(_encryptUs){
+        status.set(F("encryptms"), (float)_encryptUs / 1000);
+        status.set(F("encryptheap"), _encryptHeap);
+    }
+}
+
 void emoncms_uploader::setRequestHeaders(){
     trace(T_Emoncms,95);
     if(_encrypted){
@@ -14,13 +14,20 @@ class emoncms_uploader : public uploader
                             _base64Sha(0),
                             _revision(0),
                             _encrypt(false),
-                            _encrypted(false)
+                            _encrypted(false),
+                            _shaContext(nullptr),
+                            _hmacContext(nullptr),
+                            _cypher(nullptr),
+                            _encryptUs(0),
+                            _encryptHeap(0)
         {
             _id = charstar("emoncms");
         };
 
         ~emoncms_uploader(){
-            
+            delete _shaContext;
+            delete _hmacContext;
+            delete _cypher;
             Emoncms = nullptr;
         };
 
@@ -36,6 +43,11 @@ class emoncms_uploader : public uploader
         int _revision;
         bool _encrypt;
         bool _encrypted;
+        SHA256* _shaContext;            // Encryption contexts, allocated on first encrypted post
+        SHA256* _hmacContext;
+        CBC<AES128>* _cypher;
+        uint32_t _encryptUs;            // Time to encrypt the last post
+        uint32_t _encryptHeap;          // Most heap used encrypting a post
 
         void     queryLast();
         uint32_t handle_query_s();
@@ -45,6 +57,7 @@ class emoncms_uploader : public uploader
         bool     configCB(JsonObject &);
 
         void     setRequestHeaders();
+        void     getStatusJson(JsonObject&);
         int      scriptCompare(Script *a, Script *b);
 };
 
@@ -12,10 +12,6 @@
  *  this SERVICE returns with code 0 to cause it's serviceBlock to be deleted.  When a new /feed/data
  *  request comes in, the web server handler will reshedule this SERVICE with NewService.
  * 
- *  The process time per dispatch is determined to try to balance sampling with response time.
- *  When a new request is soon after another, the process time is decreased to maintain
- *  sampling at the expense of response time.
- * 
  *  ********NOTE*******
  *  7/22/2018 Made this a direct call from webserver so entire transaction is handled without
  *  returning to allow sampling. This seems to eliminate memory leak problems with sending the
@@ -31,266 +27,348 @@
  *  2) determine what is not being cleaned up and find a way to do so. Suspect it's 
  *     request headers as the problem is more severe when digest auth headers are collected.
  *  3) Try using asyncwebserver.
+ * 
+ *  The request is now a feedQuery holding all of its own state, and is handed to webStream
+ *  to be sent a chunk at a time by a SERVICE while the web server carries on (see webStream.h).
+ *  Memory use doesn't depend on the number of points and there is no point limit.  If no stream
+ *  is available, the chunks are sent inline as before, up to the old limit of FEED_INLINE_POINTS
+ *  as sampling stops meanwhile, and a larger request gets 503 to retry.  A short write there
+ *  means the client has gone and the request is abandoned.
+ * 
+ *  Fixed interval requests read both logs through cursors, so consecutive points are 
+ *  sequential reads rather than a search each.  Mode requests (daily etc) use logReadKey() 
+ *  to get at the rollup logs.
+ * 
+ *  Points already computed by a recent poll of the same feeds and interval come from 
+ *  queryResults.  A point is only cached when it's computed from the record an interval 
+ *  before, as the first point of a request may not be.
  *   
  **************************************************************************************************/
 
+#define FEED_INLINE_POINTS 2000             // Most points sent inline, without a stream
+
+static int feedReadKey(IotaLogRecord* record, bool modeRequest, IotaLogCursor& current, IotaLogCursor& history, recentCursor* recent);
+
+struct feedReq {
+  feedReq* next;
+  int channel;
+  char queryType;
+  Script* output;
+  feedReq(){next=nullptr; channel=0; queryType=' '; output=nullptr;};
+  ~feedReq(){delete next;};
+}; 
+
+class feedQuery : public webStreamSource {
+  public:
+    feedQuery()
+      :_reqRoot(nullptr)
+      ,_logRecord(nullptr)
+      ,_lastRecord(nullptr)
+      ,_currentCursor(&Current_log)
+      ,_historyCursor(&History_log)
+      ,_recent(nullptr)
+      ,_cache(0)
+      ,_startUnixTime(0)
+      ,_endUnixTime(0)
+      ,_intervalSeconds(0)
+      ,_unixTime(0)
+      ,_modeRequest(false)
+      ,_first(true)
+      ,_done(false)
+      {};
+    ~feedQuery(){
+      delete _reqRoot;
+      delete _logRecord;
+      delete _lastRecord;
+      delete _recent;
+    }
+    bool    setup();
+    size_t  readResult(uint8_t* buf, int len);
+    uint32_t points(){return (_endUnixTime - _startUnixTime) / _intervalSeconds;}
+
+  private:
+    feedReq*        _reqRoot;
+    IotaLogRecord*  _logRecord;
+    IotaLogRecord*  _lastRecord;
+    IotaLogCursor   _currentCursor;
+    IotaLogCursor   _historyCursor;
+    recentCursor*   _recent;                // Reads recentData when the window is within it
+    xbuf            _reply;                 // Response text not yet read
+    uint32_t        _cache;                 // queryResults key (0 = none)
+    uint32_t        _startUnixTime;
+    uint32_t        _endUnixTime;
+    uint32_t        _intervalSeconds;
+    uint32_t        _unixTime;              // Next point
+    bool            _modeRequest;
+    bool            _first;                 // No points yet
+    bool            _done;                  // Closing bracket added
+    void            buildPoint();
+};
+
 uint32_t getFeedData(){ //(struct serviceBlock* _serviceBlock){
-  // trace T_GFD
+  trace(T_GFD,0);
+  feedQuery* query = new feedQuery;
+  if( ! query->setup()){
+    server.send(400, "text/plain", "Invalid request");
+    delete query;
+    return 0;    
+  }
+  if(webStreamStart(query, "application/octet-stream")){
+    return 0;
+  }
 
-  struct req {
-    req* next;
-    int channel;
-    char queryType;
-    Script* output;
-    req(){next=nullptr; channel=0; queryType=' '; output=nullptr;};
-    ~req(){delete next;};
-  }; 
+      // No stream available, send it all now "chunky-style".
+      // A short write means the client is gone.
 
-  static IotaLogRecord* logRecord = nullptr;
-  static IotaLogRecord* lastRecord = nullptr;
-  static size_t   chunkSize = 1600;
-  static char* buf = nullptr;
-  static size_t bufPos = 0;
-  static String*  replyData = nullptr;
-  static req*     reqRoot = nullptr;
-  static uint32_t startUnixTime;
-  static uint32_t endUnixTime;
-  static uint32_t intervalSeconds;
-  static uint32_t UnixTime;
-  static uint32_t lastReqTime = 0;
-  static uint32_t processInterval;
-  static uint32_t startTime;
-  static bool     modeRequest;
-  enum   states   {setup, process} static state = setup;
-       
-  switch (state) {
-    
-    case setup: {
-      trace(T_GFD,0);
-      startTime = millis();
-      processInterval = 3000 / (uint32_t)(frequency + 0.1);
-      if((millis() - lastReqTime) > 10000){
-        processInterval = 6000 / (uint32_t)(frequency + 0.1);
-      }
-      lastReqTime = millis();
+  if(query->points() > FEED_INLINE_POINTS){
+    server.sendHeader(F("Retry-After"), F("2"));
+    server.send(503, "text/plain", "Busy, retry");
+    delete query;
+    return 0;
+  }
 
-        // Validate the request parameters
-      
-      startUnixTime = server.arg("start").substring(0,10).toInt();
-      endUnixTime = server.arg("end").substring(0,10).toInt();
-      if(server.hasArg("interval")){
-        intervalSeconds = server.arg("interval").toInt();
-        modeRequest = false;;
-      }
-      else if(server.hasArg("mode")){
-        modeRequest = true;
-        if(server.arg("mode")== "daily") intervalSeconds = 86400;
-        else if(server.arg("mode") == "weekly") intervalSeconds = 86400 * 7;
-        else if(server.arg("mode") == "monthly") intervalSeconds = 86400 * 30;
-        else if(server.arg("mode") == "yearly") intervalSeconds = 86400 * 365;
-      }
-      if((startUnixTime % 5) ||
-         (endUnixTime % 5) ||
-         (intervalSeconds % 5) ||
-         (intervalSeconds <= 0) ||
-         (endUnixTime < startUnixTime) ||
-         ((endUnixTime - startUnixTime) / intervalSeconds > 2000)) {
-        server.send(400, "text/plain", "Invalid request");
-        state = setup;
-        serverAvailable = true;
-        return 0;    
-      }
-      
-          // Parse the ID parm into a list.
-      
-      String idParm = server.arg("id");
-      if( ! reqRoot) reqRoot = new req;
-      req* reqPtr = reqRoot;
-      int i = 0;
-      if(idParm.startsWith("[")){
-        idParm[idParm.length()-1] = ',';
-        i = 1;
-      } else {
-        idParm += ",";
-      }
-      while(i < idParm.length()){
-        reqPtr->next = new req;
-        reqPtr = reqPtr->next;
-        String id = idParm.substring(i,idParm.indexOf(',',i));
-        String name = id.substring(2);
-        i = idParm.indexOf(',',i) + 1;
-        if(id.charAt(0) == 'I'){
-          for(int j=0; j<maxInputs; j++){
-            if(inputChannel[j]->isActive() &&
-               name.equals(inputChannel[j]->_name)){
-               reqPtr->channel = inputChannel[j]->_channel;
-               reqPtr->output = nullptr;
-               reqPtr->queryType = id.charAt(1);
-               break;
-            }
-          }
-        }
-        else if(id.charAt(0) == 'O'){
-          Script* script = outputs->first();
-          while(script){
-            if(name.equals(script->name())){
-              reqPtr->channel = -1;
-              reqPtr->output = script;
-              reqPtr->queryType = id.charAt(1);
-              break;
-            } 
-            script = script->next(); 
-          }  
-        }
+  const size_t chunkSize = 1600;
+  char* buf = new char[chunkSize+8];
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200,"application/octet-stream","");
+  size_t len;
+  bool abandoned = false;
+  while((len = query->readResult((uint8_t*)buf + 6, chunkSize))){
+    if(sendChunk(buf, len + 6) < len + 8){
+      abandoned = true;
+      break;
+    }
+    yield();
+  }
+  if( ! abandoned){
+    sendChunk(buf, 6);
+  }
+  server.client().stop();
+  trace(T_GFD,7);
+  delete[] buf;
+  delete query;
+  return 0;                                       // Done for now, return without scheduling.
+}
+
+bool feedQuery::setup(){
+
+      // Validate the request parameters
+  
+  _startUnixTime = server.arg("start").substring(0,10).toInt();
+  _endUnixTime = server.arg("end").substring(0,10).toInt();
+  if(server.hasArg("interval")){
+    _intervalSeconds = server.arg("interval").toInt();
+  }
+  else if(server.hasArg("mode")){
+    _modeRequest = true;
+    if(server.arg("mode")== "daily") _intervalSeconds = 86400;
+    else if(server.arg("mode") == "weekly") _intervalSeconds = 86400 * 7;
+    else if(server.arg("mode") == "monthly") _intervalSeconds = 86400 * 30;
+    else if(server.arg("mode") == "yearly") _intervalSeconds = 86400 * 365;
+  }
+  uint32_t step = 5;
+  if( ! _modeRequest && _intervalSeconds > 0 && _startUnixTime > _intervalSeconds &&
+      recentData.covers(_startUnixTime - _intervalSeconds, _endUnixTime)){
+    _recent = new recentCursor;
+    step = 1;
+  }
+  if((_startUnixTime % step) ||
+     (_endUnixTime % step) ||
+     (_intervalSeconds % step) ||
+     (_intervalSeconds <= 0) ||
+     (_endUnixTime < _startUnixTime)) {
+    return false;
+  }
+  
+      // Parse the ID parm into a list.
+  
+  String idParm = server.arg("id");
+  _reqRoot = new feedReq;
+  feedReq* reqPtr = _reqRoot;
+  int i = 0;
+  if(idParm.startsWith("[")){
+    idParm[idParm.length()-1] = ',';
+    i = 1;
+  } else {
+    idParm += ",";
+  }
+  while(i < idParm.length()){
+    reqPtr->next = new feedReq;
+    reqPtr = reqPtr->next;
+    String id = idParm.substring(i,idParm.indexOf(',',i));
+    String name = id.substring(2);
+    i = idParm.indexOf(',',i) + 1;
+    if(id.charAt(0) == 'I'){
+      IotaInputChannel* input = findInput(name.c_str());
+      if(input){
+        reqPtr->channel = input->_channel;
+        reqPtr->output = nullptr;
+        reqPtr->queryType = id.charAt(1);
       }
-          
-      logRecord = new IotaLogRecord;
-      lastRecord = new IotaLogRecord;
-     
-      if(startUnixTime >= History_log.firstKey()){   
-        lastRecord->UNIXtime = startUnixTime - intervalSeconds;
-      } else {
-        lastRecord->UNIXtime = History_log.firstKey();
+    }
+    else if(id.charAt(0) == 'O'){
+      Script* script = outputs->script(name.c_str());
+      if(script){
+        reqPtr->channel = -1;
+        reqPtr->output = script;
+        reqPtr->queryType = id.charAt(1);
       }
-      logReadKey(lastRecord);
+    }
+  }
       
-          // Using String for a large buffer abuses the heap
-          // and takes up a lot of time. We will build 
-          // relatively short response elements with String
-          // and copy them to this larger buffer.
+  _logRecord = new IotaLogRecord;
+  _lastRecord = new IotaLogRecord;
+  if( ! _recent){
+    _cache = queryResults.open(String(F("feed:")) + idParm + ':' + String(_intervalSeconds) + (_modeRequest ? "m" : ""));
+  }
+ 
+  if(_startUnixTime >= History_log.firstKey()){   
+    _lastRecord->UNIXtime = _startUnixTime - _intervalSeconds;
+  } else {
+    _lastRecord->UNIXtime = History_log.firstKey();
+  }
+  feedReadKey(_lastRecord, _modeRequest, _currentCursor, _historyCursor, _recent);
+  _unixTime = _startUnixTime;
+  _reply.write('[');
+  return true;
+}
 
-      buf = new char[chunkSize+8];
-      bufPos = 6;
-      replyData = new String();
-      
-          // Setup buffer to do it "chunky-style"
-      
-      server.setContentLength(CONTENT_LENGTH_UNKNOWN);
-      server.send(200,"application/octet-stream","");
-      *replyData= "[";
-      UnixTime = startUnixTime;
-      state = process;
+size_t feedQuery::readResult(uint8_t* buf, int len){
+  trace(T_GFD,1);
+  int written = 0;
+  while(written < len){
+    if(_reply.available()){
+      int supply = MIN(_reply.available(), len - written);
+      _reply.read(buf + written, supply);
+      written += supply;
     }
-  
-    case process: {
-      trace(T_GFD,1);
-
-          // Loop to generate entries
-      
-      while(UnixTime <= endUnixTime) {
-        int rtc;
-        logRecord->UNIXtime = UnixTime;
-        logReadKey(logRecord);
-        trace(T_GFD,2);
-        *replyData += '[';  //  + String(UnixTime) + "000,";
-        double elapsedHours = logRecord->logHours - lastRecord->logHours;
-        req* reqPtr = reqRoot;
-        while((reqPtr = reqPtr->next) != nullptr){
-          int channel = reqPtr->channel;
-          if(rtc || logRecord->logHours == lastRecord->logHours){
-            *replyData +=  "null";
-          }
-  
-            // input channel
+    else if(_done){
+      break;
+    }
+    else if(_unixTime > _endUnixTime){
+      _reply.write(']');
+      _done = true;
+    }
+    else {
+      if( ! _first){
+        _reply.write(',');
+      }
+      _first = false;
+      buildPoint();
+    }
+  }
+  return written;
+}
 
-          else if(channel >= 0){
-            trace(T_GFD,3);       
-            if(reqPtr->queryType == 'V') {
-              *replyData += String((logRecord->accum1[channel] - lastRecord->accum1[channel]) / elapsedHours,1);
-            } 
-            else if(reqPtr->queryType == 'P') {
-              *replyData += String((logRecord->accum1[channel] - lastRecord->accum1[channel]) / elapsedHours,1);
-            }
-            else if(reqPtr->queryType == 'E') {
-                *replyData += String((logRecord->accum1[channel] / 1000.0),3);              
-            } 
-            else {
-              *replyData += "null";
-            } 
-          }
-  
-           // output channel
-          
-          else {
-            trace(T_GFD,4);
-            if(reqPtr->output == nullptr){
-              *replyData += "null";
-            }
-            else if(reqPtr->queryType == 'V'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord, Volts), 1);
-            }
-            else if(reqPtr->queryType == 'P'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord, Watts), 1);
-            }
-            else if(reqPtr->queryType == 'E'){
-                *replyData += String(reqPtr->output->run(nullptr, logRecord, kWh), 3);
-            }
-            else if(reqPtr->queryType == 'O'){
-              *replyData += String(reqPtr->output->run(lastRecord, logRecord), reqPtr->output->precision());
-            }
-            else {
-              *replyData += "null";
-            }
-          }
-          if(replyData->endsWith("NaN") || replyData->endsWith("inf")){
-            replyData->remove(replyData->length()-3);
-            *replyData += "null";
-          }
-          *replyData += ',';
-        } 
-           
-        replyData->setCharAt(replyData->length()-1,']');
-        IotaLogRecord* swapRecord = lastRecord;
-        lastRecord = logRecord;
-        logRecord = swapRecord;
-        UnixTime += intervalSeconds;
+    // Add the next point to _reply,
+    // from queryResults if there.
 
-            // If not enough room in buffer for this segment, 
-            // Write the buffer chunk.
+void feedQuery::buildPoint(){
+  const char* cached = queryResults.get(_cache, _unixTime);
+  if(cached){
+    _reply.print(cached);
+    _unixTime += _intervalSeconds;
+    return;
+  }
+  if(_lastRecord->UNIXtime != _unixTime - _intervalSeconds && _unixTime != _startUnixTime){
+    _lastRecord->UNIXtime = _unixTime - _intervalSeconds;
+    feedReadKey(_lastRecord, _modeRequest, _currentCursor, _historyCursor, _recent);
+  }
+  _logRecord->UNIXtime = _unixTime;
+  int rtc = feedReadKey(_logRecord, _modeRequest, _currentCursor, _historyCursor, _recent);
+  trace(T_GFD,2);
+  String point = "[";
+  double elapsedHours = _logRecord->logHours - _lastRecord->logHours;
+  feedReq* reqPtr = _reqRoot;
+  while((reqPtr = reqPtr->next) != nullptr){
+    int channel = reqPtr->channel;
+    if(rtc || _logRecord->logHours == _lastRecord->logHours){
+      point +=  "null";
+    }
 
-        if((bufPos + replyData->length()) > (chunkSize - 3)){
-          sendChunk(buf, bufPos);
-          bufPos = 6;
-        }    
+      // input channel
 
-            // Add this segment to buf.
+    else if(channel >= 0){
+      trace(T_GFD,3);       
+      if(reqPtr->queryType == 'V') {
+        point += String((_logRecord->accum1[channel] - _lastRecord->accum1[channel]) / elapsedHours,1);
+      } 
+      else if(reqPtr->queryType == 'P') {
+        point += String((_logRecord->accum1[channel] - _lastRecord->accum1[channel]) / elapsedHours,1);
+      }
+      else if(reqPtr->queryType == 'E') {
+          point += String((_logRecord->accum1[channel] / 1000.0),3);              
+      } 
+      else {
+        point += "null";
+      } 
+    }
 
-        trace(T_GFD,5);
-        memcpy(buf + bufPos, replyData->c_str(), replyData->length());
-        bufPos += replyData->length();
-        replyData->remove(0);
-        
-        *replyData += ',';
+     // output channel
+  
+    else {
+      trace(T_GFD,4);
+      if(reqPtr->output == nullptr){
+        point += "null";
       }
-      trace(T_GFD,7);
+      else if(reqPtr->queryType == 'V'){
+        point += String(reqPtr->output->run(_lastRecord, _logRecord, Volts), 1);
+      }
+      else if(reqPtr->queryType == 'P'){
+        point += String(reqPtr->output->run(_lastRecord, _logRecord, Watts), 1);
+      }
+      else if(reqPtr->queryType == 'E'){
+          point += String(reqPtr->output->run(nullptr, _logRecord, kWh), 3);
+      }
+      else if(reqPtr->queryType == 'O'){
+        point += String(reqPtr->output->run(_lastRecord, _logRecord), reqPtr->output->precision());
+      }
+      else {
+        point += "null";
+      }
+    }
+    if(point.endsWith("NaN") || point.endsWith("inf")){
+      point.remove(point.length()-3);
+      point += "null";
+    }
+    point += ',';
+  } 
+   
+  point.setCharAt(point.length()-1,']');
+  if(_unixTime <= Current_log.lastKey() && _lastRecord->UNIXtime == _unixTime - _intervalSeconds){
+    queryResults.put(_cache, _unixTime, point.c_str());
+  }
+  _reply.print(point);
+  IotaLogRecord* swapRecord = _lastRecord;
+  _lastRecord = _logRecord;
+  _logRecord = swapRecord;
+  _unixTime += _intervalSeconds;
+}
 
-          // All entries generated, terminate Json and send.
-      
-      replyData->setCharAt(replyData->length()-1,']');
-      memcpy(buf + bufPos, replyData->c_str(), replyData->length());
-      bufPos += replyData->length();
-      sendChunk(buf, bufPos);
+/***************************************************************************************************
+ *  feedReadKey - read a point for getFeedData
+ *  
+ *  Follows logReadKey's choice of log, but reads Current_log and History_log through the
+ *  caller's cursors.  Mode requests go to logReadKey for the daily and hourly logs.  A request
+ *  for the last few minutes reads recentData.
+ **************************************************************************************************/
 
-      delete replyData;
-      replyData = nullptr;
-      
-          // Send terminating zero chunk, clean up and exit.    
-      
-      sendChunk(buf, 6);
-      server.client().stop();
-      trace(T_GFD,7);
-      delete[] buf;
-      buf = nullptr;
-      delete reqRoot;
-      reqRoot = nullptr;
-      delete logRecord;
-      logRecord = nullptr;
-      delete lastRecord;
-      lastRecord = nullptr;
-      state = setup;
-      serverAvailable = true;
-      return 0;                                       // Done for now, return without scheduling.
-    }
+static int feedReadKey(IotaLogRecord* record, bool modeRequest, IotaLogCursor& current, IotaLogCursor& history, recentCursor* recent){
+  uint32_t key = record->UNIXtime;
+  if(recent){
+    return recent->read(record);
+  }
+  if(modeRequest){
+    return logReadKey(record);
+  }
+  if( ! History_log.isOpen()){
+    return current.read(record);
+  }
+  if(key < Current_log.firstKey()){
+    return history.read(record);
+  }
+  if((key % History_log.interval()) || key > History_log.lastKey()){
+    return current.read(record);
   }
-  return 0;
-}
\ No newline at end of file
+  return history.read(record);
+}
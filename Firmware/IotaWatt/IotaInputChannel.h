@@ -32,10 +32,48 @@ union dataBuckets {
       ,accum2(0)
       ,timeThen(millis()){}
 };
+
+      // Phase correction table resolved at config time to uniform steps of var
+      // (Amps for CT, Volts for VT) so lookup is direct indexing with interpolation.
+
+      // Sampling telemetry maintained by samplePower for each channel.
+      // Histograms are samples per cycle and samplePower duration.
+
+#define SAMPLING_BINS 6                       // Histogram bins
+#define SAMPLING_SAMPLES_BASE 320             // samples: <400, 400-479, ... 720+ (80 per bin)
+#define SAMPLING_SAMPLES_BIN 80
+#define SAMPLING_US_BASE 15000                // duration: <20ms, 20-25, ... 40ms+ (5ms per bin)
+#define SAMPLING_US_BIN 5000
+
+struct samplingStats {
+    uint32_t cycles;                          // Good sample cycles
+    uint32_t lowQuality;                      // sampleCycle return code 1 (interrupted)
+    uint32_t failures;                        // sampleCycle return code 2 (no voltage)
+    uint64_t totalUs;                         // Total samplePower time
+    uint32_t maxUs;                           // Longest samplePower
+    uint32_t samples[SAMPLING_BINS];
+    uint32_t duration[SAMPLING_BINS];
+    samplingStats(){memset(this, 0, sizeof(samplingStats));}
+};
+
+#define PHASE_TABLE_SIZE 24                   // Most steps per table
+#define PHASE_GRID_CELLS 32                   // Uniform cells from the first threshold to the last
+
+struct phaseTable {
+    uint8_t count;                            // Steps
+    int16_t threshold[PHASE_TABLE_SIZE];      // var * 100 where each step starts (first unused)
+    int16_t value[PHASE_TABLE_SIZE];          // phase * 100 of each step
+    int16_t base;                             // threshold[1], start of cell 0
+    int16_t width;                            // var * 100 per cell
+    uint8_t cell[PHASE_GRID_CELLS];           // Step at the start of each cell
+    void    index();                          // Build base, width and cell from the steps
+    float   lookup(float var);
+};
 	
 class IotaInputChannel {
   public:
     dataBuckets  dataBucket;
+    samplingStats _sampling;                  // Sampling telemetry
     char*        _name;                       // External name
 	  char* 		   _model;					            // VT or CT (or ?) model
     float		     _burden;					            // Value of on-board burden resistor, zero if none	
@@ -44,8 +82,17 @@ class IotaInputChannel {
     float        _vphase;                     // Phase offset for 3-phase voltage reference
     float        _vmult;                      // Voltage multiplier (overides _double)
     float        _lastPhase; 
-    int16_t*     _p50;                        // -> 50Hz phase correction array
-    int16_t*     _p60;                        // -> 60Hz phase correction array
+    float        _skew;                       // Sampling skew degrees corrected in shared-voltage mode
+    int16_t      _samples;                    // Samples in last cycle sampled
+    uint32_t     _lastSampleMs;               // millis() when last sampled
+    uint32_t     _minRefresh;                 // Minimum refresh ms (adaptive scheduler), 0 = default
+    float        _sampleInterval;             // Damped ms between samples
+    float        _powerVar;                   // Damped variance of change between samples
+    float        _schedWeight;                // Scheduler weight from relative variation
+    phaseTable*  _p50;                        // -> 50Hz phase correction table
+    phaseTable*  _p60;                        // -> 60Hz phase correction table
+    float        _padj50;                     // Board specific phase adjustment at 50Hz
+    float        _padj60;                     // Board specific phase adjustment at 60Hz
     uint16_t     _turns;                      // Turns ratio of current type CT	
     uint16_t     _offset;                     // ADC bias 
     uint8_t      _channel;                    // Internal identifying number
@@ -67,8 +114,17 @@ class IotaInputChannel {
     ,_phase(0)
     ,_vphase(0)
     ,_vmult(0)
+    ,_skew(0)
+    ,_samples(0)
+    ,_lastSampleMs(0)
+    ,_minRefresh(0)
+    ,_sampleInterval(0)
+    ,_powerVar(0)
+    ,_schedWeight(1.0)
     ,_p50(nullptr)
     ,_p60(nullptr)
+    ,_padj50(0)
+    ,_padj60(0)
     ,_turns(0)
     ,_offset(2047)
     ,_channel(channel)
@@ -97,9 +153,9 @@ class IotaInputChannel {
     double  getPower(){return dataBucket.watts;}
     double  getPf(){return dataBucket.watts / dataBucket.VA;}
     float   getPhase(float var);
-    float   lookupPhase(int16_t* pArray, float var);
 	
   private:
+    void    sampled(double oldValue, double newValue);
 };
 
 #endif
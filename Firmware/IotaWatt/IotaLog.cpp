@@ -9,9 +9,45 @@ struct {
   uint32_t serial; 
 } recordKey;
 
+		// IotaLogRecord pool, a bit in recordPoolFree for each free slot.
+
+static uint64_t recordPool[IOTALOG_RECORD_POOL][sizeof(IotaLogRecord) / sizeof(uint64_t)];
+static uint32_t recordPoolFree = (uint32_t)((1ULL << IOTALOG_RECORD_POOL) - 1);
+IotaLogRecordPoolStats recordPoolStats = {0, 0, 0, 0};
+
+void* IotaLogRecord::operator new(size_t size){
+	if(recordPoolFree && size == sizeof(IotaLogRecord)){
+		int slot = __builtin_ctz(recordPoolFree);
+		recordPoolFree &= ~(1UL << slot);
+		recordPoolStats.pooled++;
+		if(++recordPoolStats.inUse > recordPoolStats.maxInUse){
+			recordPoolStats.maxInUse = recordPoolStats.inUse;
+		}
+		return recordPool[slot];
+	}
+	recordPoolStats.exhausted++;
+	return ::operator new(size);
+}
+
+void IotaLogRecord::operator delete(void* ptr){
+	if(ptr >= (void*)recordPool && ptr < (void*)(recordPool + IOTALOG_RECORD_POOL)){
+		int slot = ((uint8_t*)ptr - (uint8_t*)recordPool) / sizeof(recordPool[0]);
+		recordPoolFree |= 1UL << slot;
+		recordPoolStats.inUse--;
+		return;
+	}
+	::operator delete(ptr);
+}
+
 int IotaLog::begin (const char* path ){
 	if(IotaFile) return 0;
+	uint32_t beginTime = millis();
+	delete[] _path;
 	_path = charstar(path);
+	if( ! _indexPath){
+		_indexPath = sidecarPath(".ndx");
+		_superPath = sidecarPath(".sup");
+	}
 	if(!SD.exists(_path)){
 		String logPath = _path;
 		if(logPath.lastIndexOf('/') > 0){
@@ -33,15 +69,27 @@ int IotaLog::begin (const char* path ){
 	if(!IotaFile){
 		return 2;
 	}
+	if(formatBegin()){
+		IotaFile.close();
+		return 2;
+	}
 	
-	_fileSize = _physicalSize = IotaFile.size();
+	_fileSize = _physicalSize = dataSize();
+
+		// Use the superblock if it checks out,
+		// otherwise scan the file.
+
+	_superUsed = superBegin();
+	if(_superUsed){
+		_entries = _fileSize / _recordSize;
+	}
 
-	if(_fileSize){
-			IotaFile.seek(0);
+	else if(_fileSize){
+			seekData(0);
 			IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
 			_firstKey = recordKey.UNIXtime;
 			_firstSerial = recordKey.serial;
-			IotaFile.seek(_fileSize - _recordSize);
+			seekData(_fileSize - _recordSize);
 			IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
 			_lastKey = recordKey.UNIXtime;
 			_lastSerial = recordKey.serial;
@@ -51,24 +99,23 @@ int IotaLog::begin (const char* path ){
 			// If there are trailing zero recordKeys at the end,
 			// try to adjust _filesize down to match logical end of file.
 
-	while(_fileSize && _lastSerial == 0){
-		IotaLogRecord* logRec = new IotaLogRecord;
+	while( ! _superUsed && _fileSize && _lastSerial == 0){
+		IotaLogRecordHandle logRec;
 		_fileSize -= _recordSize;
-		IotaFile.seek(_fileSize - _recordSize);
-		IotaFile.read((uint8_t*)logRec, _recordSize);
+		seekData(_fileSize - _recordSize);
+		IotaFile.read((uint8_t*)logRec.get(), _recordSize);
 		_lastSerial = logRec->serial;
 		_lastKey = logRec->UNIXtime;
 		_entries--;	 
-		delete logRec;
 	}
 	
-	if(_firstKey > _lastKey){
+	if( ! _superUsed && _firstKey > _lastKey){
 		_wrap = findWrap(0,_firstKey, _fileSize - _recordSize, _lastKey);
-		IotaFile.seek(_wrap);
+		seekData(_wrap);
 		IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
 		_firstKey = recordKey.UNIXtime;
 		_firstSerial = recordKey.serial;
-		IotaFile.seek(_wrap - _recordSize);
+		seekData(_wrap - _recordSize);
 		IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
 		_lastKey = recordKey.UNIXtime;
 		_lastSerial = recordKey.serial;
@@ -85,6 +132,9 @@ int IotaLog::begin (const char* path ){
 		log("IotaLog: Deleting %s and restarting.\r\n", _path);	
 		IotaFile.close();
 		SD.remove(_path);
+		SD.remove(_indexPath);
+		SD.remove(_superPath);
+		Message_log.flush();
 		ESP.restart();
 	}
 		
@@ -93,6 +143,9 @@ int IotaLog::begin (const char* path ){
 		_cacheSerial[i] = _firstSerial;
 	}
 
+	indexBegin();
+	superSave();
+	_beginMs = millis() - beginTime;
 	return 0;
 }
 
@@ -107,7 +160,7 @@ uint32_t IotaLog::findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos,
 	}
 	uint32_t midPos = (highPos + lowPos) / 2;
 	midPos += midPos % _recordSize;
-	IotaFile.seek(midPos);
+	seekData(midPos);
 	IotaFile.read((uint8_t*)&recordKey, sizeof(recordKey));
 	uint32_t midKey = recordKey.UNIXtime;
 	if(midKey > highKey){
@@ -136,10 +189,21 @@ int IotaLog::readKey (IotaLogRecord* callerRecord){
 		return 1;
 	}
 	
+	int32_t serial = indexSerial(key);
+	if(serial >= 0){
+		readSerial(callerRecord, serial);
+		callerRecord->UNIXtime = key;
+		return 0;
+	}
+
 	uint32_t lowKey = _firstKey;
 	int32_t lowSerial = _firstSerial;
 	uint32_t highKey = _lastKey;
 	int32_t highSerial = _lastSerial;
+	if(_indexEntries && _index[0].key < highKey){			// Search below indexed range
+		highKey = _index[0].key;
+		highSerial = _index[0].serial;
+	}
 	
 	for(int i=0; i<_cacheSize; i++){
 		uint32_t cacheKey = _cacheKey[i];
@@ -215,7 +279,15 @@ int IotaLog::readNext(IotaLogRecord* callerRecord){
 	return readSerial(callerRecord, callerRecord->serial + 1);
 }
 
+IotaLogCursor IotaLog::readRange(uint32_t begin, uint32_t end, uint32_t step){
+	return IotaLogCursor(this, begin, end, step ? step : _interval);
+}
+
 int IotaLog::end(){
+	if(IotaFile){
+		writeCache(false);
+		superSave();
+	}
 	IotaFile.close();
 	return 0;
 }
@@ -232,6 +304,13 @@ int32_t IotaLog::lastSerial(){return _lastSerial;}
 uint32_t IotaLog::fileSize(){return _fileSize;}
 uint32_t IotaLog::readKeyIO(){return _readKeyIO;}
 uint32_t IotaLog::interval(){return _interval;}
+uint32_t IotaLog::beginMs(){return _beginMs;}
+uint32_t IotaLog::writeCacheFlushes(){return _writeCacheFlushes;}
+uint8_t  IotaLog::writeCacheHeld(){return _writeCacheHeld;}
+bool     IotaLog::superUsed(){return _superUsed;}
+uint32_t IotaLog::readCacheHits(){return _readCacheHits;}
+uint32_t IotaLog::readCacheMisses(){return _readCacheMisses;}
+uint8_t  IotaLog::readCacheBlocks(){return _readCacheBlocks;}
 
 uint32_t IotaLog::setDays(uint32_t days){
 	_maxFileSize = max(_fileSize, (uint32_t)(days * _recordSize * (86400UL / _interval)));
@@ -244,19 +323,56 @@ int IotaLog::readSerial(IotaLogRecord* callerRecord, int32_t serial){
 			return 1;
 	}
 	int pos = ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize;
-	if(_writeCache && pos >= _writeCachePos && pos < (_writeCachePos + IOTALOG_BLOCK_SIZE)){
-		memcpy(callerRecord, _writeCacheBuf + (pos % IOTALOG_BLOCK_SIZE), _recordSize);
+	if(_writeCache && pos >= _writeCachePos && pos < (_writeCachePos + _writeCacheLen)){
+		memcpy(callerRecord, _writeCacheBuf + (pos - _writeCachePos), _recordSize);
+	}
+	else if(_readCacheBlocks){
+		memcpy(callerRecord, readCacheBlock(pos) + (pos % IOTALOG_BLOCK_SIZE), _recordSize);
 	}
 	else {
-		IotaFile.seek(pos);
+		seekData(pos);
 		IotaFile.read((uint8_t*)callerRecord, _recordSize);
 	}
+	if(_crc && ! crcValid((uint8_t*)callerRecord)){
+		_crcErrors++;
+	}
+	unpackRecord(callerRecord);
+	_lastReadKey = callerRecord->UNIXtime;
+	_lastReadSerial = callerRecord->serial;
 	_cacheKey[_cacheWrap] = callerRecord->UNIXtime;
 	_cacheSerial[_cacheWrap++] = callerRecord->serial;
 	_cacheWrap %= _cacheSize;
 	_readKeyIO++;
 	return 0;
 };
+
+/*******************************************************************************************************
+ * verify(record, serial) - read a record straight from the file (bypassing the read cache, so a 
+ * scan doesn't flush it) and check it.
+ * 
+ * returns:	0 - record is good
+ * 			1 - serial not in the log
+ * 			2 - CRC mismatch
+ * 			3 - record isn't what should be at that position (serial, key order or interval)
+ ******************************************************************************************************/
+
+int IotaLog::verify(IotaLogRecord* callerRecord, int32_t serial){
+	if( ! IotaFile || serial < _firstSerial || serial > _lastSerial){
+		return 1;
+	}
+	uint32_t pos = ((serial - _firstSerial) * _recordSize + _wrap) % _fileSize;
+	readData(pos, (uint8_t*)callerRecord, _recordSize);
+	if(_crc && ! crcValid((uint8_t*)callerRecord)){
+		return 2;
+	}
+	unpackRecord(callerRecord);
+	if(callerRecord->serial != serial || (callerRecord->UNIXtime % _interval) ||
+	   callerRecord->UNIXtime < _firstKey || callerRecord->UNIXtime > _lastKey ||
+	   callerRecord->logHours != callerRecord->logHours){
+		return 3;
+	}
+	return 0;
+}
    
 int IotaLog::write (IotaLogRecord* callerRecord){
 
@@ -266,24 +382,35 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 	if(callerRecord->UNIXtime <= _lastKey) {
 			return 1;
 	}
+	if(_lastSerial < 0 || callerRecord->UNIXtime != _lastKey + _interval){
+		indexAdd(callerRecord->UNIXtime, _lastSerial + 1);
+	}
 	callerRecord->serial = ++_lastSerial;
 	_lastKey = callerRecord->UNIXtime;
+	uint8_t* record = packRecord(callerRecord);
 
 		// if log is (or should) wrap,
 		// overwrite oldest and set first to following record.
 
 	if(_wrap || _fileSize >= _maxFileSize){
+		uint32_t pos = _wrap;
+		_wrap = (_wrap + _recordSize) % _fileSize;
 		if(_writeCache){
-			writeCache(false);
+			cachePut(pos, record, true);
 		}
-		IotaFile.seek(_wrap);
-		_wrap = (_wrap + _recordSize) % _fileSize;
-		IotaFile.write((char*)callerRecord, _recordSize);
-		IotaFile.read((uint8_t*)callerRecord,8);
+		else {
+			seekData(pos);
+			IotaFile.write(record, _recordSize);
+			readCacheUpdate(pos, record, _recordSize);
+		}
+		readData(_wrap, (uint8_t*)callerRecord, 8);
 		_firstKey = callerRecord->UNIXtime;
 		_firstSerial = callerRecord->serial;
 		callerRecord->UNIXtime = _lastKey;
 		callerRecord->serial = _lastSerial;
+		if(++_superWrites >= IOTALOG_SUPER_RECORDS){
+			superSave();
+		}
 		return 0;
 	}
 
@@ -291,18 +418,11 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 
 		// If write cache active,
 		// Add record to cache
-		// Write cache block if full
+		// Cache is written when full
 
 	if (_writeCache){
-		memcpy(_writeCacheBuf + (_fileSize % IOTALOG_BLOCK_SIZE), callerRecord, _recordSize);
+		cachePut(_fileSize, record, false);
 		_fileSize += _recordSize;
-		if((_fileSize % IOTALOG_BLOCK_SIZE) == 0){
-			IotaFile.seek(_writeCachePos);
-			IotaFile.write(_writeCacheBuf, IOTALOG_BLOCK_SIZE);
-			_writeCachePos += IOTALOG_BLOCK_SIZE;
-			IotaFile.flush();
-			_physicalSize = IotaFile.size();
-		}
 	}
 
 		// No write cache active
@@ -311,8 +431,9 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 
 	else if(_fileSize == _physicalSize){
 		IotaLogRecord formatRecord;
-		IotaFile.seek(_fileSize);
-		IotaFile.write((char*)callerRecord, _recordSize);
+		seekData(_fileSize);
+		IotaFile.write(record, _recordSize);
+		readCacheUpdate(_fileSize, record, _recordSize);
 		_fileSize += _recordSize;
 		_physicalSize += _recordSize;
 		int count = _preformat;
@@ -327,8 +448,9 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 		// write this record over a prewrite record
 
 	else {
-		IotaFile.seek(_fileSize);
-		IotaFile.write((char*)callerRecord, _recordSize);
+		seekData(_fileSize);
+		IotaFile.write(record, _recordSize);
+		readCacheUpdate(_fileSize, record, _recordSize);
 		_fileSize += _recordSize;
 	}
 
@@ -336,31 +458,567 @@ int IotaLog::write (IotaLogRecord* callerRecord){
 	if(_firstKey == 0){
 		_firstKey = callerRecord->UNIXtime;
 	}
+	if(++_superWrites >= IOTALOG_SUPER_RECORDS){
+		superSave();
+	}
 	return 0;
 }
 
-void IotaLog::writeCache(bool on){
-	if((on && _writeCache) || (!on && !_writeCache)){
+/*******************************************************************************************************
+ * Write cache
+ * 
+ * With the write cache on, records are collected in a window of _writeCacheBlocks file blocks and 
+ * written to the file, whole blocks at a time, when the window fills or the next record falls
+ * outside it.  The window follows the write position whether appending or wrapped.  When seated,
+ * the window is loaded with what's in the file, so reads of any position in the window are 
+ * served from it.  
+ * 
+ * Records in the window are lost if the device restarts before it's written, so the caller
+ * decides how many blocks are an acceptable exposure (see dataLog for the journal of the held
+ * records that recovers them after a restart), and writeCache(false) or end() writes any
+ * partial window.
+ ******************************************************************************************************/
+
+void IotaLog::writeCache(bool on, uint8_t blocks){
+	if( ! on){
+		if(_writeCache){
+			cacheFlush();
+			delete[] _writeCacheBuf;
+			_writeCacheBuf = nullptr;
+			_writeCachePos = -IOTALOG_BLOCK_SIZE;
+			_writeCacheLen = 0;
+			_writeCache = false;
+		}
+		return;
+	}
+	blocks = RANGE(blocks, 1, IOTALOG_WRITE_CACHE_MAX);
+	if(_writeCache && blocks == _writeCacheBlocks){
+		return;
+	}
+	writeCache(false);
+	_writeCacheBlocks = blocks;
+	_writeCacheBuf = new uint8_t[blocks * IOTALOG_BLOCK_SIZE];
+	_writeCache = true;
+}
+
+uint8_t IotaLog::writeCacheBlocks(){return _writeCache ? _writeCacheBlocks : 0;}
+
+void IotaLog::cachePut(uint32_t pos, uint8_t* record, bool wrapped){
+	if(pos < _writeCachePos || pos >= (_writeCachePos + _writeCacheLen)){
+		cacheFlush();
+		_writeCachePos = pos & ~(IOTALOG_BLOCK_SIZE - 1);
+		_writeCacheLen = _writeCacheBlocks * IOTALOG_BLOCK_SIZE;
+		if(wrapped){
+			_writeCacheLen = MIN(_writeCacheLen, _fileSize - _writeCachePos);
+		}
+		if(_physicalSize > _writeCachePos){
+			seekData(_writeCachePos);
+			IotaFile.read(_writeCacheBuf, MIN(_physicalSize - _writeCachePos, _writeCacheLen));
+		}
+	}
+	uint32_t offset = pos - _writeCachePos;
+	memcpy(_writeCacheBuf + offset, record, _recordSize);
+	_writeCacheDirty = MAX(_writeCacheDirty, offset + _recordSize);
+	_writeCacheHeld++;
+	if(_writeCacheDirty == _writeCacheLen){
+		cacheFlush();
+	}
+}
+
+void IotaLog::cacheFlush(){
+	if(_writeCacheDirty == 0){
 		return;
 	}
-	if(on){
-		_writeCacheBuf = new uint8_t[IOTALOG_BLOCK_SIZE];
-		_writeCachePos = _fileSize & ~(IOTALOG_BLOCK_SIZE - 1);
-		IotaFile.seek(_writeCachePos);
-		IotaFile.read(_writeCacheBuf, MIN(_physicalSize - _writeCachePos, IOTALOG_BLOCK_SIZE));
-		_writeCache = true;
+	seekData(_writeCachePos);
+	IotaFile.write(_writeCacheBuf, _writeCacheDirty);
+	IotaFile.flush();
+	readCacheUpdate(_writeCachePos, _writeCacheBuf, _writeCacheDirty);
+	_physicalSize = MAX(_physicalSize, _writeCachePos + _writeCacheDirty);
+	_writeCacheDirty = 0;
+	_writeCacheHeld = 0;
+	_writeCacheFlushes++;
+}
+
+void IotaLog::readData(uint32_t pos, uint8_t* buf, size_t len){
+	if(_writeCache && pos >= _writeCachePos && pos < (_writeCachePos + _writeCacheLen)){
+		memcpy(buf, _writeCacheBuf + (pos - _writeCachePos), len);
 	}
 	else {
-		IotaFile.seek(_writeCachePos);
-		IotaFile.write(_writeCacheBuf, MIN(_fileSize - _writeCachePos, IOTALOG_BLOCK_SIZE));
-		IotaFile.flush();
-		_physicalSize = IotaFile.size();
-		delete[] _writeCacheBuf;
-		_writeCacheBuf = nullptr;
-		_writeCache = false;
+		seekData(pos);
+		IotaFile.read(buf, len);
 	}
 } 
 
+/*******************************************************************************************************
+ * Compact record format
+ * 
+ * A compact (format 2) log stores only the first _channels accumulator pairs of each record at
+ * full precision, in the smallest power of two record that holds them:
+ * 
+ *    UNIXtime, serial, logHours, accum1[_channels], accum2[_channels]
+ * 
+ * The file begins with a one block header describing the layout, so data blocks stay aligned
+ * and the rest of IotaLog works on data positions (seekData, dataSize) unchanged.  Records are
+ * packed on the way to the file and unpacked in readSerial(), so callers always see a full 
+ * IotaLogRecord with the unrecorded channels zero.
+ * 
+ * crc(true) adds IOTALOG_FLAG_CRC to the header of a new file (format 2 even if not compact), and
+ * each record ends with a CRC32 of the rest, in the padding where there is some.  A CRC log 
+ * holds at most IOTALOG_CHANNELS-1 channels so the record still fits an IotaLogRecord, so a new
+ * file that needs them all is created in format 1 without CRCs rather than drop the last one.
+ * readSerial() counts mismatches in crcErrors(), verify() reports them.
+ * 
+ * compact(channels) and crc() must be called before begin() and only apply when begin() creates 
+ * the file.  An existing file keeps the format it was created with.
+ ******************************************************************************************************/
+
+void IotaLog::compact(uint8_t channels){
+	if( ! IotaFile){
+		_compactChannels = MIN(channels, (uint8_t)IOTALOG_CHANNELS);
+	}
+}
+
+void IotaLog::crc(bool on){
+	if( ! IotaFile){
+		_crcRequested = on;
+	}
+}
+
+uint8_t IotaLog::channels(){return _channels;}
+bool IotaLog::hasCrc(){return _crc;}
+uint32_t IotaLog::crcErrors(){return _crcErrors;}
+uint16_t IotaLog::recordSize(){return _recordSize;}
+
+int IotaLog::formatBegin(){
+	IotaLogHeader header;
+	_dataOffset = 0;
+	if(_recordSize != sizeof(IotaLogRecord)){
+		return 0;
+	}
+
+		// New file, write header if compact.
+
+	if(IotaFile.size() == 0){
+		uint8_t channels = _compactChannels ? MIN(_compactChannels, (uint8_t)IOTALOG_CHANNELS) : IOTALOG_CHANNELS;
+		if(_crcRequested && channels >= IOTALOG_CHANNELS){
+			log("IotaLog: %s needs all %d channels, created without CRCs.", _path, IOTALOG_CHANNELS);
+		}
+		if(channels >= IOTALOG_CHANNELS){
+			return 0;
+		}
+		header.magic = IOTALOG_HEADER_MAGIC;
+		header.format = 2;
+		header.channels = channels;
+		header.interval = _interval;
+		header.flags = _crcRequested ? IOTALOG_FLAG_CRC : 0;
+		header.recordSize = 32;
+		while(header.recordSize < 16 + 16 * header.channels + (_crcRequested ? 4 : 0)){
+			header.recordSize *= 2;
+		}
+		uint8_t* block = new uint8_t[IOTALOG_BLOCK_SIZE];
+		memset(block, 0, IOTALOG_BLOCK_SIZE);
+		memcpy(block, &header, sizeof(header));
+		IotaFile.seek(0);
+		IotaFile.write(block, IOTALOG_BLOCK_SIZE);
+		IotaFile.flush();
+		delete[] block;
+	}
+
+		// Existing file, check for header.
+		// The magic would be a 1996 key in a format 1 log.
+
+	else {
+		IotaFile.seek(0);
+		IotaFile.read((uint8_t*)&header, sizeof(header));
+		if(header.magic != IOTALOG_HEADER_MAGIC){
+			return 0;
+		}
+		uint8_t crcSize = (header.flags & IOTALOG_FLAG_CRC) ? 4 : 0;
+		if(header.format != 2 || header.channels == 0 || header.channels >= IOTALOG_CHANNELS ||
+		   header.recordSize < 16 + 16 * header.channels + crcSize || (IOTALOG_BLOCK_SIZE % header.recordSize)){
+			log("IotaLog: unsupported header %s", _path);
+			return 2;
+		}
+	}
+	_dataOffset = IOTALOG_BLOCK_SIZE;
+	_channels = header.channels;
+	_crc = header.flags & IOTALOG_FLAG_CRC;
+	_maxFileSize = _maxFileSize / _recordSize * header.recordSize;
+	_recordSize = header.recordSize;
+	delete[] _packBuf;
+	_packBuf = new uint8_t[_recordSize];
+	return 0;
+}
+
+uint8_t* IotaLog::packRecord(IotaLogRecord* callerRecord){
+	if( ! _packBuf){
+		return (uint8_t*)callerRecord;
+	}
+	size_t accumSize = _channels * sizeof(double);
+	memset(_packBuf, 0, _recordSize);
+	memcpy(_packBuf, callerRecord, 16 + accumSize);
+	memcpy(_packBuf + 16 + accumSize, callerRecord->accum2, accumSize);
+	if(_crc){
+		uint32_t crc = CRC32(_packBuf, _recordSize - 4);
+		memcpy(_packBuf + _recordSize - 4, &crc, 4);
+	}
+	return _packBuf;
+}
+
+bool IotaLog::crcValid(uint8_t* record){
+	uint32_t crc;
+	memcpy(&crc, record + _recordSize - 4, 4);
+	return crc == CRC32(record, _recordSize - 4);
+}
+
+void IotaLog::unpackRecord(IotaLogRecord* callerRecord){
+	if( ! _packBuf){
+		return;
+	}
+	size_t accumSize = _channels * sizeof(double);
+	memmove(callerRecord->accum2, (uint8_t*)callerRecord + 16 + accumSize, accumSize);
+	for(int i=_channels; i<IOTALOG_CHANNELS; i++){
+		callerRecord->accum1[i] = 0.0;
+		callerRecord->accum2[i] = 0.0;
+	}
+}
+
+/*******************************************************************************************************
+ * IotaLogCursor
+ * 
+ * Records between discontinuities are one interval apart, so the serial of a later key is the 
+ * last serial read plus the intervals between.  If that record has the key, we're done with one read.
+ * If its key is higher, the requested key is in a hole.  When the predicted record immediately 
+ * follows the last one read, the answer is the last one; otherwise readKey() finds it.
+ ******************************************************************************************************/
+
+int IotaLogCursor::read(IotaLogRecord* callerRecord){
+	uint32_t interval = _log->_interval;
+	uint32_t key = callerRecord->UNIXtime - (callerRecord->UNIXtime % interval);
+	if(_log->IotaFile && _serial >= _log->_firstSerial && key >= _serialKey && 
+	   key >= _log->_firstKey && key < _log->_lastKey){
+		int32_t serial = MIN(_serial + (int32_t)((key - _serialKey) / interval), _log->_lastSerial);
+		_log->readSerial(callerRecord, serial);
+		if(callerRecord->UNIXtime == key){
+			_serial = serial;
+			_serialKey = key;
+			return 0;
+		}
+		if(callerRecord->UNIXtime > key && serial == _serial + 1){
+			_log->readSerial(callerRecord, _serial);
+			callerRecord->UNIXtime = key;
+			return 0;
+		}
+	}
+	callerRecord->UNIXtime = key;
+	int rtc = _log->readKey(callerRecord);
+	if(rtc != 2){
+		_serial = _log->_lastReadSerial;
+		_serialKey = _log->_lastReadKey;
+	}
+	return rtc;
+}
+
+bool IotaLogCursor::next(IotaLogRecord* callerRecord){
+	if(_step == 0 || _key > _end){
+		return false;
+	}
+	callerRecord->UNIXtime = _key;
+	_key += _step;
+	return read(callerRecord) != 2;
+}
+
+/*******************************************************************************************************
+ * Read cache
+ * 
+ * Keeps the most recently used file blocks.  Records never span blocks (256 and 32 byte records), 
+ * so a record is always served from a single block.  Every write to the file also updates any 
+ * cached copy of the block it lands in, so the cache stays coherent with the file and the
+ * write cache without having to be flushed.
+ * 
+ * readCache(n) with n > 0 (re)allocates n empty blocks; readCache(0) releases the cache.
+ ******************************************************************************************************/
+
+void IotaLog::readCache(uint8_t blocks){
+	blocks = MIN(blocks, IOTALOG_READ_CACHE_MAX);
+	delete[] _readCacheBuf;
+	delete[] _readCachePos;
+	delete[] _readCacheUse;
+	_readCacheBuf = nullptr;
+	_readCachePos = nullptr;
+	_readCacheUse = nullptr;
+	_readCacheBlocks = blocks;
+	if(blocks){
+		_readCacheBuf = new uint8_t[blocks * IOTALOG_BLOCK_SIZE];
+		_readCachePos = new uint32_t[blocks];
+		_readCacheUse = new uint32_t[blocks];
+		for(int i=0; i<blocks; i++){
+			_readCachePos[i] = IOTALOG_CACHE_EMPTY;
+			_readCacheUse[i] = 0;
+		}
+	}
+}
+
+uint8_t* IotaLog::readCacheBlock(uint32_t pos){
+	uint32_t blockPos = pos & ~(IOTALOG_BLOCK_SIZE - 1);
+	int lru = 0;
+	for(int i=0; i<_readCacheBlocks; i++){
+		if(_readCachePos[i] == blockPos){
+			_readCacheUse[i] = ++_readCacheClock;
+			_readCacheHits++;
+			return _readCacheBuf + i * IOTALOG_BLOCK_SIZE;
+		}
+		if(_readCacheUse[i] < _readCacheUse[lru]){
+			lru = i;
+		}
+	}
+	uint8_t* block = _readCacheBuf + lru * IOTALOG_BLOCK_SIZE;
+	seekData(blockPos);
+	IotaFile.read(block, MIN(_physicalSize - blockPos, IOTALOG_BLOCK_SIZE));
+	_readCachePos[lru] = blockPos;
+	_readCacheUse[lru] = ++_readCacheClock;
+	_readCacheMisses++;
+	return block;
+}
+
+void IotaLog::readCacheUpdate(uint32_t pos, const uint8_t* data, size_t len){
+	uint32_t blockPos = pos & ~(IOTALOG_BLOCK_SIZE - 1);
+	for(int i=0; i<_readCacheBlocks; i++){
+		if(_readCachePos[i] == blockPos){
+			memcpy(_readCacheBuf + i * IOTALOG_BLOCK_SIZE + (pos - blockPos), data, len);
+			return;
+		}
+	}
+}
+
+/*******************************************************************************************************
+ * Sidecar files are named after the log with a different extension.
+ ******************************************************************************************************/
+
+char* IotaLog::sidecarPath(const char* ext){
+	String sidecar = _path;
+	int dot = sidecar.lastIndexOf('.');
+	if(dot > sidecar.lastIndexOf('/')){
+		sidecar.remove(dot);
+	}
+	sidecar += ext;
+	return charstar(sidecar.c_str());
+}
+
+/*******************************************************************************************************
+ * Superblock
+ * 
+ * The superblock sidecar (.sup) holds the file state that begin() otherwise recovers by reading the
+ * ends of the file, backing over preformatted records and searching for the wrap point.  It's saved
+ * every IOTALOG_SUPER_RECORDS writes (deferred while the write cache holds records that aren't
+ * in the file yet), by end(), and after each begin().
+ * 
+ * begin() accepts it when the last record it names is still there.  Records written since it was
+ * saved are then rolled forward, each one either appended at _fileSize or overwriting the oldest 
+ * record at _wrap.  If it doesn't check out, or the roll forward runs too long, begin() scans as before.
+ ******************************************************************************************************/
+
+bool IotaLog::superBegin(){
+	if(_fileSize == 0){
+		return false;
+	}
+	IotaLogSuper super;
+	File superFile = SD.open(_superPath, FILE_READ);
+	if( ! superFile){
+		return false;
+	}
+	size_t len = superFile.read((uint8_t*)&super, sizeof(super));
+	superFile.close();
+	if(len != sizeof(super) || super.magic != IOTALOG_SUPER_MAGIC || super.recordSize != _recordSize ||
+	   super.fileSize == 0 || super.fileSize > _physicalSize || (super.fileSize % _recordSize) || 
+	   super.wrap >= super.fileSize || (super.wrap % _recordSize)){
+		return false;
+	}
+
+		// Check the last record.
+
+	struct {
+		uint32_t UNIXtime;
+		int32_t serial; 
+	} key;
+	seekData((super.wrap + super.fileSize - _recordSize) % super.fileSize);
+	IotaFile.read((uint8_t*)&key, sizeof(key));
+	if(key.UNIXtime != super.lastKey || key.serial != super.lastSerial){
+		return false;
+	}
+	_fileSize = super.fileSize;
+	_wrap = super.wrap;
+	_lastKey = super.lastKey;
+	_lastSerial = super.lastSerial;
+
+		// Roll forward.
+
+	int limit = IOTALOG_SUPER_RECORDS + _preformat + 1;
+	while(limit--){
+		if(_wrap == 0 && (_fileSize + _recordSize) <= _physicalSize){
+			seekData(_fileSize);
+			IotaFile.read((uint8_t*)&key, sizeof(key));
+			if(key.serial == _lastSerial + 1 && key.UNIXtime > _lastKey){
+				_fileSize += _recordSize;
+				_lastKey = key.UNIXtime;
+				_lastSerial = key.serial;
+				continue;
+			}
+		}
+		seekData(_wrap);
+		IotaFile.read((uint8_t*)&key, sizeof(key));
+		if(key.serial == _lastSerial + 1 && key.UNIXtime > _lastKey){
+			_wrap = (_wrap + _recordSize) % _fileSize;
+			_lastKey = key.UNIXtime;
+			_lastSerial = key.serial;
+			continue;
+		}
+		break;
+	}
+	if(limit < 0){
+		return false;
+	}
+
+		// First record is at the wrap point.
+
+	seekData(_wrap);
+	IotaFile.read((uint8_t*)&key, sizeof(key));
+	_firstKey = key.UNIXtime;
+	_firstSerial = key.serial;
+	return true;
+}
+
+void IotaLog::superSave(){
+	if( ! IotaFile || _writeCacheDirty || ! _superPath){
+		return;
+	}
+	_superWrites = 0;
+	IotaLogSuper super;
+	super.magic = IOTALOG_SUPER_MAGIC;
+	super.recordSize = _recordSize;
+	super.fileSize = _fileSize;
+	super.wrap = _wrap;
+	super.firstKey = _firstKey;
+	super.firstSerial = _firstSerial;
+	super.lastKey = _lastKey;
+	super.lastSerial = _lastSerial;
+	SD.remove(_superPath);
+	if(_fileSize == 0){
+		return;
+	}
+	File superFile = SD.open(_superPath, FILE_WRITE);
+	if(superFile){
+		superFile.write((uint8_t*)&super, sizeof(super));
+		superFile.close();
+	}
+}
+
+/*******************************************************************************************************
+ * Sparse index
+ * 
+ * Between discontinuities, records have consecutive serials and keys exactly one interval apart,
+ * so the serial of any key in a run is computed from the run's first (key, serial).  The index 
+ * holds those run starts.  write() adds an entry whenever a key isn't the last key plus the interval,
+ * and appends it to the sidecar file.  Entries stay valid after the log wraps as serials never 
+ * change.
+ * 
+ * begin() loads the sidecar and checks that its last run still describes the end of the log.  If not
+ * (missing, stale or from a different file), the index restarts with the last record, and keys 
+ * before the indexed range use searchKey as before.  Only the most recent IOTALOG_INDEX_MAX
+ * runs are kept; older keys also fall back to searchKey bounded by the first entry.
+ ******************************************************************************************************/
+
+void IotaLog::indexBegin(){
+	delete[] _index;
+	_index = new IotaLogIndex[IOTALOG_INDEX_MAX];
+	_indexEntries = 0;
+	if(_lastSerial < 0){
+		SD.remove(_indexPath);
+		return;
+	}
+
+		// Load the most recent entries from the sidecar.
+
+	size_t fileEntries = 0;
+	File indexFile = SD.open(_indexPath, FILE_READ);
+	if(indexFile){
+		fileEntries = indexFile.size() / sizeof(IotaLogIndex);
+		size_t skip = fileEntries > IOTALOG_INDEX_MAX ? fileEntries - IOTALOG_INDEX_MAX : 0;
+		indexFile.seek(skip * sizeof(IotaLogIndex));
+		_indexEntries = indexFile.read((uint8_t*)_index, (fileEntries - skip) * sizeof(IotaLogIndex)) / sizeof(IotaLogIndex);
+		indexFile.close();
+	}
+
+		// Validate the last run against the end of the log.
+
+	bool valid = false;
+	if(_indexEntries){
+		IotaLogIndex* last = &_index[_indexEntries - 1];
+		IotaLogRecordHandle logRec;
+		if(last->serial <= _lastSerial &&
+			 _lastKey == last->key + (uint32_t)(_lastSerial - last->serial) * _interval &&
+		   (last->serial < _firstSerial || (readSerial(logRec, last->serial) == 0 && logRec->UNIXtime == last->key))){
+			valid = true;
+		}
+	}
+
+		// Rewrite the sidecar if it's invalid or has grown past what's kept.
+
+	if( ! valid || fileEntries > IOTALOG_INDEX_MAX){
+		if( ! valid){
+			_index[0].key = _lastKey;
+			_index[0].serial = _lastSerial;
+			_indexEntries = 1;
+		}
+		SD.remove(_indexPath);
+		indexFile = SD.open(_indexPath, FILE_WRITE);
+		if(indexFile){
+			indexFile.write((uint8_t*)_index, _indexEntries * sizeof(IotaLogIndex));
+			indexFile.close();
+		}
+	}
+}
+
+void IotaLog::indexAdd(uint32_t key, int32_t serial){
+	if( ! _index){
+		return;
+	}
+	if(_indexEntries == IOTALOG_INDEX_MAX){
+		memmove(_index, _index + 1, (IOTALOG_INDEX_MAX - 1) * sizeof(IotaLogIndex));
+		_indexEntries--;
+	}
+	_index[_indexEntries].key = key;
+	_index[_indexEntries++].serial = serial;
+	File indexFile = SD.open(_indexPath, FILE_WRITE);
+	if(indexFile){
+		indexFile.write((uint8_t*)&_index[_indexEntries - 1], sizeof(IotaLogIndex));
+		indexFile.close();
+	}
+}
+
+int32_t IotaLog::indexSerial(uint32_t key){
+	if(_indexEntries == 0 || key < _index[0].key){
+		return -1;
+	}
+	int low = 0;
+	int high = _indexEntries - 1;
+	while(low < high){
+		int mid = (low + high + 1) / 2;
+		if(_index[mid].key <= key){
+			low = mid;
+		} else {
+			high = mid - 1;
+		}
+	}
+	int32_t runEnd = (low + 1 < _indexEntries) ? _index[low + 1].serial - 1 : _lastSerial;
+	int32_t serial = _index[low].serial + (int32_t)((key - _index[low].key) / _interval);
+	serial = MIN(serial, runEnd);
+	if(serial < _firstSerial){
+		return -1;
+	}
+	return serial;
+}
+
 void IotaLog::dumpFile(){
 	setLedCycle(LED_DUMPING_LOG);
 	char diagPath[] = "iotaWatt/logDiag.txt";
@@ -370,10 +1028,10 @@ void IotaLog::dumpFile(){
 		DateTime now = DateTime(localTime());
 	logDiag.printf_P(PSTR("%d/%02d/%02d %02d:%02d:%02d\r\nfilesize %d, entries %d\r\n"),
 	now.month(), now.day(), now.year()%100, now.hour(), now.minute(), now.second(),
-		IotaFile.size(), _entries);
+		dataSize(), _entries);
 		logDiag.close();
 	}
-	IotaFile.seek(0);
+	seekData(0);
 	IotaFile.read((uint8_t*)&recordKey,sizeof(recordKey));
 	uint32_t begKey = recordKey.UNIXtime;
 	uint32_t begSerial = recordKey.serial;
@@ -382,14 +1040,14 @@ void IotaLog::dumpFile(){
 	uint32_t filePos = 0;
   	do {
 		filePos += _recordSize;
-		IotaFile.seek(filePos);
+		seekData(filePos);
 		IotaFile.read((uint8_t*)&recordKey,sizeof(recordKey));
 		if(recordKey.UNIXtime - endKey != _interval || recordKey.serial - endSerial != 1 || filePos >= _fileSize){
 			Serial.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
 			logDiag = SD.open(diagPath, FILE_WRITE);
 			if(logDiag){
 				logDiag.printf_P(PSTR("%d,%d,%d,%d\r\n"), begKey, begSerial, endKey, endSerial);
-				if(filePos >= IotaFile.size()){
+				if(filePos >= dataSize()){
 					logDiag.printf_P(PSTR("End of file\r\n"));
 				}
 				logDiag.close();
@@ -399,6 +1057,92 @@ void IotaLog::dumpFile(){
 		}
 		endKey = recordKey.UNIXtime;
 		endSerial = recordKey.serial;
-	} while(filePos < IotaFile.size());
+	} while(filePos < dataSize());
 	endLedCycle();
 }
+
+/*******************************************************************************************************
+ * logBenchmark(reads) - GET /command?logbench=n
+ * 
+ * For the Current and History logs, times n (default 100) reads each way and reports the average
+ * usec per read and keyed read I/Os: readKey() of random keys, readKey() of consecutive keys,
+ * and a cursor over the same consecutive keys and at 60 and 3600 second steps. The cursor reads
+ * are checked against readKey() to the byte.
+ * 
+ * These run on the device, against the card and logs in use.  There is no host build to run
+ * them on: the only platformio.ini environments are ESP8266 ones, and IotaLog, Script and
+ * CSVquery use the ESP8266 SD, String, ESP and web server classes directly.
+ ******************************************************************************************************/
+
+static void logBench(String& response, IotaLog& log, const char* id, int reads){
+	if( ! log.isOpen() || log.lastKey() <= log.firstKey()){
+		return;
+	}
+	IotaLogRecordHandle rec;
+	IotaLogRecordHandle check;
+	uint32_t interval = log.interval();
+	uint32_t span = (log.lastKey() - log.firstKey()) / interval;
+	char line[240];
+	int len = snprintf_P(line, sizeof(line), PSTR("%s log, %u days:"), id, span * interval / 86400);
+
+	uint32_t io = log.readKeyIO();
+	uint32_t startUs = micros();
+	for(int i=0; i<reads; i++){
+		rec->UNIXtime = log.firstKey() + random(span + 1) * interval;
+		log.readKey(rec);
+		if(i % 50 == 49) yield();
+	}
+	len += snprintf_P(line + len, sizeof(line) - len, PSTR(" random %.1fus(%u),"), 
+			(float)(micros() - startUs) / reads, log.readKeyIO() - io);
+
+	uint32_t begin = log.lastKey() - MIN((uint32_t)reads - 1, span) * interval;
+	int count = 0;
+	io = log.readKeyIO();
+	startUs = micros();
+	for(uint32_t key=begin; key<=log.lastKey(); key+=interval){
+		rec->UNIXtime = key;
+		log.readKey(rec);
+		if(++count % 50 == 49) yield();
+	}
+	len += snprintf_P(line + len, sizeof(line) - len, PSTR(" sequential %.1fus(%u),"), 
+			(float)(micros() - startUs) / count, log.readKeyIO() - io);
+
+	bool identical = true;
+	uint32_t steps[] = {interval, 60, 3600};
+	for(int s=0; s<3; s++){
+		uint32_t step = MAX(steps[s], interval);
+		uint32_t first = log.lastKey() - MIN((uint32_t)reads - 1, span * interval / step) * step;
+		IotaLogCursor cursor = log.readRange(first, log.lastKey(), step);
+		count = 0;
+		io = log.readKeyIO();
+		startUs = micros();
+		while(cursor.next(rec)){
+			if(++count % 50 == 49) yield();
+		}
+		len += snprintf_P(line + len, sizeof(line) - len, PSTR(" cursor %us %.1fus(%u),"), 
+				step, count ? (float)(micros() - startUs) / count : 0.0, log.readKeyIO() - io);
+		cursor = log.readRange(first, log.lastKey(), step);
+		for(int i=0; i<100 && cursor.next(rec); i++){
+			check->UNIXtime = rec->UNIXtime;
+			log.readKey(check);
+			if(memcmp((IotaLogRecord*)rec, (IotaLogRecord*)check, sizeof(IotaLogRecord)) != 0){
+				identical = false;
+			}
+		}
+		yield();
+	}
+	snprintf_P(line + len, sizeof(line) - len, PSTR(" %s\r\n"), identical ? "identical" : "DIFFERENT");
+	response += line;
+}
+
+String  logBenchmark(int reads){
+	if(reads <= 0) reads = 100;
+	reads = MIN(reads, 2000);
+	String response;
+	logBench(response, Current_log, "Current", reads);
+	logBench(response, History_log, "History", reads);
+	if( ! response.length()){
+		return String(F("Logs not open"));
+	}
+	return response;
+}
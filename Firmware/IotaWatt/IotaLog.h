@@ -10,6 +10,16 @@
 
 #define IOTALOG_BLOCK_SIZE 512
 #define IOTALOG_PREFORMAT_RECORDS 24
+#define IOTALOG_READ_CACHE_MAX 16
+#define IOTALOG_WRITE_CACHE_MAX 8
+#define IOTALOG_CACHE_EMPTY 0xFFFFFFFF
+#define IOTALOG_INDEX_MAX 64
+#define IOTALOG_SUPER_RECORDS 720                 // Save superblock after this many writes
+#define IOTALOG_SUPER_MAGIC 0x52505553            // "SUPR"
+#define IOTALOG_CHANNELS 15                      // Accumulator pairs in IotaLogRecord
+#define IOTALOG_HEADER_MAGIC 0x32474F4C           // "LOG2"
+#define IOTALOG_FLAG_CRC 0x0001                   // Header flag: records end with CRC32
+#define IOTALOG_RECORD_POOL 8                     // IotaLogRecords in the static pool (max 32)
 
 /*******************************************************************************************************
 ********************************************************************************************************
@@ -18,6 +28,9 @@ Maintains a log of fixed length, consecutive entries.
 All entries must be written with increasing keys.
 Entries are read by key value.
 When reading by key, the entry with the requested or next lower key is returned with the requested key.
+An optional LRU cache of file blocks (readCache(blocks)) serves repeated reads of nearby records.
+A sparse index of discontinuities, kept in a sidecar file (.ndx), resolves keyed reads within
+the indexed range with a single record read.
 ********************************************************************************************************
 ********************************************************************************************************/
 struct IotaLogRecord {
@@ -38,10 +51,108 @@ struct IotaLogRecord {
       :UNIXtime(0)
       ,serial(0)
       ,logHours(0){};
+      static void* operator new(size_t size);       // From the record pool
+      static void  operator delete(void* ptr);
     };    
 
+/*******************************************************************************************************
+IotaLogRecord pool
+The uploaders, integrators, queries and logs each new and delete a pair of 256 byte records with
+every change of state, and that churn fragments the heap until large buffers can't be had.
+new IotaLogRecord takes one of IOTALOG_RECORD_POOL static slots, and only goes to the heap when
+they're all in use.  new IotaLogRecord[n] is from the heap as before.  The slots are for records
+that come and go; a record held for good, like the dataLog entry being built, or for the life
+of its owner, like the peer records, is a plain object or member so it doesn't take one.
+IotaLogRecordHandle holds a record for the life of a scope.
+********************************************************************************************************/
+
+struct IotaLogRecordPoolStats {
+      uint8_t  inUse;           // Slots in use
+      uint8_t  maxInUse;        // High water
+      uint32_t pooled;          // Records from the pool
+      uint32_t exhausted;       // Records from the heap with the pool in use
+    };
+
+extern IotaLogRecordPoolStats recordPoolStats;
+
+class IotaLogRecordHandle {
+  public:
+    IotaLogRecordHandle() : _record(new IotaLogRecord) {};
+    ~IotaLogRecordHandle(){delete _record;}
+    IotaLogRecord* operator->(){return _record;}
+    operator IotaLogRecord*(){return _record;}
+    IotaLogRecord* get(){return _record;}
+
+  private:
+    IotaLogRecord* _record;
+    IotaLogRecordHandle(const IotaLogRecordHandle&);
+    IotaLogRecordHandle& operator=(const IotaLogRecordHandle&);
+};
+
+struct IotaLogHeader {          // First block of a compact (format 2) log
+      uint32_t magic;           // IOTALOG_HEADER_MAGIC
+      uint16_t format;          // 2
+      uint16_t recordSize;      // Size of each record in the file
+      uint16_t channels;        // Accumulator pairs stored per record
+      uint16_t interval;        // Log interval
+      uint16_t flags;           // IOTALOG_FLAG_xxx
+    };
+
+struct IotaLogSuper {           // Superblock sidecar contents (see IotaLog.cpp)
+      uint32_t magic;           // IOTALOG_SUPER_MAGIC
+      uint32_t recordSize;
+      uint32_t fileSize;        // Logical file size (data bytes)
+      uint32_t wrap;
+      uint32_t firstKey;
+      int32_t  firstSerial;
+      uint32_t lastKey;
+      int32_t  lastSerial;
+    };
+
+struct IotaLogIndex {
+      uint32_t key;             // First key of a contiguous run of records
+      int32_t serial;           // Serial of that record
+    };
+
+class IotaLog;
+
+/*******************************************************************************************************
+Class IotaLogCursor
+Reads keys in ascending order from a log, predicting each record's serial from the previous one, 
+so sequential and strided scans don't search.  Falls back to readKey() when the prediction misses 
+(discontinuity) or the key is behind the cursor.  
+read() returns the record for callerRecord->UNIXtime exactly as readKey() would.
+next() steps through a range set with IotaLog::readRange(begin, end, step).
+********************************************************************************************************/
+class IotaLogCursor
+{
+  public:
+    IotaLogCursor(IotaLog* log, uint32_t begin = 0, uint32_t end = 0, uint32_t step = 0)
+      :_log(log)
+      ,_key(begin)
+      ,_end(end)
+      ,_step(step)
+      ,_serial(-1)
+      ,_serialKey(0)
+      {};
+
+    int  read(IotaLogRecord* callerRecord);
+    bool next(IotaLogRecord* callerRecord);
+    uint32_t key(){return _key;}
+
+  protected:
+    IotaLog* _log;
+    uint32_t _key;                          // Next key of range
+    uint32_t _end;                          // Last key of range
+    uint32_t _step;                         // Range step
+    int32_t  _serial;                       // Serial of last record read (-1 if none)
+    uint32_t _serialKey;                    // Actual key of that record
+};
+
 class IotaLog
 {
+  friend class IotaLogCursor;
+
   public:
 
 	IotaLog(size_t recordSize = 256, int interval=5, int days = 365, int preformat=IOTALOG_PREFORMAT_RECORDS)
@@ -64,7 +175,33 @@ class IotaLog
       ,_cacheWrap(0)
       ,_writeCacheBuf(0)
       ,_writeCachePos(-IOTALOG_BLOCK_SIZE)
+      ,_writeCacheLen(0)
+      ,_writeCacheDirty(0)
+      ,_writeCacheFlushes(0)
+      ,_writeCacheHeld(0)
+      ,_writeCacheBlocks(1)
       ,_writeCache(false)
+      ,_readCacheBlocks(0)
+      ,_readCacheBuf(0)
+      ,_readCachePos(0)
+      ,_readCacheUse(0)
+      ,_readCacheClock(0)
+      ,_readCacheHits(0)
+      ,_readCacheMisses(0)
+      ,_indexPath(0)
+      ,_index(0)
+      ,_indexEntries(0)
+      ,_dataOffset(0)
+      ,_channels(IOTALOG_CHANNELS)
+      ,_compactChannels(0)
+      ,_packBuf(0)
+      ,_crcRequested(false)
+      ,_crc(false)
+      ,_crcErrors(0)
+      ,_superPath(0)
+      ,_superWrites(0)
+      ,_superUsed(false)
+      ,_beginMs(0)
     {
     _cacheKey = new uint32_t[_cacheSize];
     _cacheSerial = new int32_t[_cacheSize];
@@ -74,9 +211,14 @@ class IotaLog
 	~IotaLog(){
     IotaFile.close();
     delete[] _path;
+    delete[] _indexPath;
+    delete[] _index;
+    delete[] _packBuf;
+    delete[] _superPath;
     delete[] _cacheKey;
     delete[] _cacheSerial;
     delete[] _writeCacheBuf;
+    readCache(0);
   }
 	      
     int begin (const char* /* filepath */);
@@ -84,7 +226,12 @@ class IotaLog
     int readKey (IotaLogRecord* /* pointer to caller's buffer */);
     int readSerial(IotaLogRecord* callerRecord, int32_t serial); 
     int readNext(IotaLogRecord* /* pointer to caller's buffer */);
-    void writeCache(bool on);
+    IotaLogCursor readRange(uint32_t begin, uint32_t end, uint32_t step);
+    void writeCache(bool on, uint8_t blocks = 1);
+    void readCache(uint8_t blocks);
+    void compact(uint8_t channels);
+    void crc(bool on);
+    int  verify(IotaLogRecord* callerRecord, int32_t serial);
     int end();
     
     boolean  isOpen();
@@ -94,6 +241,18 @@ class IotaLog
     int32_t  lastSerial();
     uint32_t fileSize();
     uint32_t readKeyIO();
+    uint32_t readCacheHits();
+    uint32_t readCacheMisses();
+    uint8_t  readCacheBlocks();
+    uint8_t  channels();
+    bool     hasCrc();
+    uint32_t crcErrors();
+    uint16_t recordSize();
+    uint32_t beginMs();
+    uint8_t  writeCacheBlocks();
+    uint32_t writeCacheFlushes();
+    uint8_t  writeCacheHeld();              // Records in the window not yet written to the file
+    bool     superUsed();
     uint32_t interval();
     uint32_t setDays(uint32_t); 
 	 	      
@@ -122,19 +281,69 @@ class IotaLog
     uint32_t* _cacheKey;
     int32_t*  _cacheSerial;
   
-    uint32_t _lastReadKey;           	      // Key of last record read with readKey
+    uint32_t _lastReadKey;           	      // Key of last record read
     int32_t  _lastReadSerial;         	    // Serial of last...
     uint32_t _readKeyIO;              	    // Running count of I/Os for keyed reads
 
     uint8_t *_writeCacheBuf;
-    uint32_t _writeCachePos;
+    uint32_t _writeCachePos;                // File position of write cache window
+    uint32_t _writeCacheLen;                // Size of window
+    uint32_t _writeCacheDirty;              // Bytes of window to be written (0 = clean)
+    uint32_t _writeCacheFlushes;            // Running count of window writes
+    uint8_t  _writeCacheHeld;               // Records put since the window was written
+    uint8_t  _writeCacheBlocks;             // Blocks in window
     bool     _writeCache;
 
+    uint8_t   _readCacheBlocks;             // Number of blocks in read cache (0 = no cache)
+    uint8_t*  _readCacheBuf;                // _readCacheBlocks * IOTALOG_BLOCK_SIZE
+    uint32_t* _readCachePos;                // File position of each block (IOTALOG_CACHE_EMPTY = empty)
+    uint32_t* _readCacheUse;                // _readCacheClock at last use of each block
+    uint32_t  _readCacheClock;
+    uint32_t  _readCacheHits;               // Running count of reads from cache
+    uint32_t  _readCacheMisses;             // Running count of block reads
+
+    char*         _indexPath;               // Sidecar index file pathname
+    IotaLogIndex* _index;                   // Start of each contiguous run, ascending
+    uint16_t      _indexEntries;            // Entries in _index
+
+    uint32_t  _dataOffset;                  // File position of first record (header size)
+    uint8_t   _channels;                    // Accumulator pairs stored per record
+    uint8_t   _compactChannels;             // Requested channels for new compact file (0 = full)
+    uint8_t*  _packBuf;                     // Packed record buffer (compact format only)
+    bool      _crcRequested;                // Requested CRC for new file
+    bool      _crc;                         // Records end with CRC32
+    uint32_t  _crcErrors;                   // Running count of CRC mismatches on read
+
+    char*     _superPath;                   // Superblock sidecar pathname
+    uint16_t  _superWrites;                 // Writes since superblock saved
+    bool      _superUsed;                   // Last begin() used the superblock
+    uint32_t  _beginMs;                     // Duration of last begin()
+
+    void      seekData(uint32_t pos){IotaFile.seek(pos + _dataOffset);}
+    uint32_t  dataSize(){return IotaFile.size() - _dataOffset;}
+
     uint32_t  findWrap(uint32_t highPos, uint32_t highKey, uint32_t lowPos, uint32_t lowKey);
+    uint8_t*  readCacheBlock(uint32_t pos);
+    void      readCacheUpdate(uint32_t pos, const uint8_t* data, size_t len);
+    void      cachePut(uint32_t pos, uint8_t* record, bool wrapped);
+    void      cacheFlush();
+    void      readData(uint32_t pos, uint8_t* buf, size_t len);
+    int       formatBegin();
+    uint8_t*  packRecord(IotaLogRecord* callerRecord);
+    void      unpackRecord(IotaLogRecord* callerRecord);
+    bool      crcValid(uint8_t* record);
+    char*     sidecarPath(const char* ext);
+    bool      superBegin();
+    void      superSave();
+    void      indexBegin();
+    void      indexAdd(uint32_t key, int32_t serial);
+    int32_t   indexSerial(uint32_t key);
     void      searchKey(IotaLogRecord* callerRecord, const uint32_t key,
                         const uint32_t lowKey, const int32_t lowSerial, 
                         const uint32_t highKey, const int32_t highSerial);
       
 };
 
+String  logBenchmark(int reads);     // GET /command?logbench=n - time keyed, sequential and range reads
+
 #endif
\ No newline at end of file
@@ -41,6 +41,11 @@ Script::Script(JsonObject& JsonScript)
       ,_constants(nullptr)
       ,_tokens(nullptr)
       ,_units(Watts)
+      ,_program(nullptr)
+      ,_values(nullptr)
+      ,_inputs(nullptr)
+      ,_inputCount(0)
+      ,_signature(0)
       
     {
       JsonVariant var = JsonScript["name"];
@@ -75,6 +80,11 @@ Script::Script(const char* name, const char* unit, const char* script)
       ,_constants(nullptr)
       ,_tokens(nullptr)
       ,_units(Watts)
+      ,_program(nullptr)
+      ,_values(nullptr)
+      ,_inputs(nullptr)
+      ,_inputCount(0)
+      ,_signature(0)
        
     {
       _name = charstar(name);
@@ -93,6 +103,9 @@ Script::~Script() {
       delete[] _name;
       delete[] _tokens;
       delete[] _constants;
+      delete[] _program;
+      delete[] _values;
+      delete[] _inputs;
     }
 
 Script*       Script::next() {return _next;}
@@ -107,9 +120,19 @@ void*         Script::getParm() {return _parm;}
 
 int           Script::precision() {return unitsPrecision[_units];}
 
+bool          Script::compiled() {return _program != nullptr;}
+
 size_t        ScriptSet::count() {return _count;}
 
-Script*       ScriptSet::first() {return _listHead;}  
+Script*       ScriptSet::first() {return _listHead;}
+
+uint32_t      ScriptSet::availableKey() {
+  uint32_t key = UINT32_MAX;
+  for(Script* script = _listHead; script; script = script->next()){
+    key = MIN(key, script->availableKey());
+  }
+  return key;
+}
 
 void    Script::print() {
         uint8_t* token = _tokens;
@@ -134,6 +157,9 @@ void    Script::print() {
           }
           else if(tokenType == tokenVirtual){
             string += SCRIPT_CHAR_VIRTUAL;
+            if(tokenDetail){
+              string += String(tokenDetail);
+            }
           }
           else if(tokenType == tokenIntegration){
             int index = tokenDetail;
@@ -205,6 +231,11 @@ bool    Script::encodeScript(const char* script){
       char* endptr;
       int n = strtol(&script[j+1], &endptr, 10);
       trace(T_Script, 20, n);
+      if(n < 0 || n > SCRIPT_VIRTUAL_MAX){
+        log("Script: virtual input ~%d out of range in script %s.", n, this->_name);
+        _tokens[0] = opEq;
+        return false;
+      }
       j = endptr - script;
       _tokens[i++] = tokenVirtual + n;
     }
@@ -263,6 +294,165 @@ bool    Script::encodeScript(const char* script){
     }
   }
   _tokens[i] = 0;
+  compile();
+  sign();
+  return true;
+}
+
+/*******************************************************************************************************
+ * sign() - develop a signature for the script so that identical scripts in different ScriptSets
+ * (the same output in several uploaders) share results in scriptResults.  Scripts that reference
+ * integrations or peer inputs aren't signed, as those logs can still be catching up.
+ ******************************************************************************************************/
+
+void    Script::sign(){
+  uint32_t hash = 2166136261UL;
+  uint8_t* token = _tokens;
+  while(*token){
+    if((*token & TOKEN_TYPE_MASK) == tokenIntegration || 
+      ((*token & TOKEN_TYPE_MASK) == tokenVirtual && (*token & ~TOKEN_TYPE_MASK))){
+      _signature = 0;
+      return;
+    }
+    uint8_t* byte = token;
+    if((*token & TOKEN_TYPE_MASK) == tokenConstant && (*token & ~TOKEN_TYPE_MASK)){
+      byte = (uint8_t*)&_constants[(*token & ~TOKEN_TYPE_MASK) - 1];
+      for(int i=0; i<sizeof(float); i++){
+        hash = (hash ^ byte[i]) * 16777619UL;
+      }
+    }
+    hash = (hash ^ *token++) * 16777619UL;
+  }
+  _signature = hash ? hash : 1;
+}
+
+/*******************************************************************************************************
+ * availableKey() - the last datalog key this Script can be evaluated to.  A peer input is only as
+ * current as its peer log and an integration as its integration log, beyond that they would give
+ * zero.  Uploaders and integrators hold back to this key so the zeros aren't sent or integrated.
+ * Scripts without either are available to the end of the datalog (UINT32_MAX).
+ ******************************************************************************************************/
+
+uint32_t Script::availableKey(){
+  uint32_t key = UINT32_MAX;
+  uint8_t* token = _tokens;
+  while(*token){
+    uint8_t tokenType = *token & TOKEN_TYPE_MASK;
+    uint8_t tokenDetail = *token & ~TOKEN_TYPE_MASK;
+    if(tokenType == tokenVirtual && tokenDetail){
+      key = MIN(key, peerLastKey(tokenDetail));
+    }
+    else if(tokenType == tokenIntegration){
+      Script* integration = integrations ? integrations->first() : nullptr;
+      for(int i=0; i<tokenDetail && integration; i++){
+        integration = integration->next();
+      }
+      if(integration && integration->getParm()){
+        key = MIN(key, ((integrator*)integration->getParm())->availableKey());
+      }
+      token++;
+    }
+    token++;
+  }
+  return key;
+}
+
+/*******************************************************************************************************
+ * compile() - translate the tokens into a flat program for runProgram().
+ * 
+ * The tokens are evaluated strictly left to right: each operator applies the pending operator to 
+ * the running result and the last operand, and a parenthesis starts a new result.  The program 
+ * is that same sequence with the decoding done once here: constants are resolved to doubles, each 
+ * input is given a slot so its value is developed once per evaluation, and the recursion for 
+ * parentheses becomes a push and pop of the running result on a fixed stack.  runProgram() 
+ * therefore reproduces runRecursive() to the bit.
+ * 
+ * Scripts with unbalanced parentheses, nesting deeper than SCRIPT_STACK_MAX, more than 
+ * SCRIPT_INPUTS_MAX inputs, inputs outside the log record or unknown tokens aren't compiled and 
+ * continue to run with runRecursive().
+ ******************************************************************************************************/
+
+bool    Script::compile(){
+  int count = 1;
+  int depth = 0;
+  int constants = 1;
+  uint8_t inputs[SCRIPT_INPUTS_MAX];
+  uint8_t inputCount = 0;
+  for(uint8_t* token = _tokens; *token; token++){
+    uint8_t tokenType = *token & TOKEN_TYPE_MASK;
+    uint8_t tokenDetail = *token & ~TOKEN_TYPE_MASK;
+    if(tokenType == tokenOperator){
+      if(tokenDetail == opPush && ++depth > SCRIPT_STACK_MAX) return false;
+      if(tokenDetail == opPop && --depth < 0) return false;
+    }
+    else if(tokenType == tokenConstant){
+      constants = MAX(constants, tokenDetail + 1);
+    }
+    else if(tokenType == tokenIntegration){
+      token++;
+    }
+    else if(tokenType > tokenVirtual){
+      return false;
+    }
+    else if(tokenType == tokenInput){
+      if(tokenDetail >= IOTALOG_CHANNELS) return false;
+      int slot = 0;
+      while(slot < inputCount && inputs[slot] != tokenDetail) slot++;
+      if(slot == inputCount){
+        if(inputCount == SCRIPT_INPUTS_MAX) return false;
+        inputs[inputCount++] = tokenDetail;
+      }
+    }
+    count++;
+  }
+  if(depth){
+    return false;
+  }
+
+  _program = new scriptInstr[count];
+  _values = new double[constants];
+  _values[0] = 0.0;
+  for(int i=1; i<constants; i++){
+    _values[i] = _constants[i - 1];
+  }
+  _inputCount = inputCount;
+  _inputs = new uint8_t[inputCount];
+  memcpy(_inputs, inputs, inputCount);
+
+  scriptInstr* instr = _program;
+  for(uint8_t* token = _tokens; *token; token++, instr++){
+    uint8_t tokenType = *token & TOKEN_TYPE_MASK;
+    uint8_t tokenDetail = *token & ~TOKEN_TYPE_MASK;
+    instr->arg = tokenDetail;
+    instr->method = 0;
+    switch(tokenType){
+      case tokenOperator:
+        instr->code = progOperator;
+        if(tokenDetail == opAbs) instr->code = progAbs;
+        if(tokenDetail == opPush) instr->code = progPush;
+        if(tokenDetail == opPop) instr->code = progPop;
+        break;
+      case tokenConstant:
+        instr->code = progConstant;
+        break;
+      case tokenInput:
+        instr->code = progInput;
+        instr->arg = 0;
+        while(_inputs[instr->arg] != tokenDetail) instr->arg++;
+        break;
+      case tokenVirtual:
+        instr->code = progVirtual;
+        break;
+      case tokenIntegration:
+        instr->code = progIntegration;
+        instr->method = *(++token);
+        break;
+      default:
+        instr->code = progConstant;
+        instr->arg = 0;
+    }
+  }
+  instr->code = progEnd;
   return true;
 }
 
@@ -280,12 +470,35 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec){
 }
 
 double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
-  double elapsedHours = 1.0;
-  if(oldRec){
-    elapsedHours = newRec->logHours - oldRec->logHours;
-  }
+        return runUnits(oldRec, newRec, Units, _program != nullptr);
+}
+
+double  Script::runInterpreted(IotaLogRecord* oldRec, IotaLogRecord* newRec){
+        return runUnits(oldRec, newRec, _units, false);
+}
+
+double  Script::runInterpreted(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
+        return runUnits(oldRec, newRec, Units, false);
+}
+
+double  Script::run(scriptDeltas& deltas){
+        return run(deltas, _units);
+}
+
+double  Script::run(scriptDeltas& deltas, units Units){
+        return runUnits(deltas.oldRec, deltas.newRec, Units, _program != nullptr, &deltas);
+}
+
+double  Script::runUnits(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, bool compiled, scriptDeltas* deltas){
   //Serial.printf("run Script %s, units %s\n", this->_name, unitstr[Units]);
   uint8_t *tokens = _tokens;
+  bool complete = true;
+  auto runScript = [&](units Units) -> double {
+    if(compiled){
+      return runProgram(oldRec, newRec, Units, complete, deltas);
+    }
+    return runRecursive(&tokens, oldRec, newRec, Units);
+  };
   double result;
 
   switch (Units)
@@ -297,33 +510,33 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
   case Wh:
   case VAR:
   case VARh:
-    result = runRecursive(&tokens, oldRec, newRec, Units);
+    result = runScript(Units);
     break;
 
   case VA:
   {
-    double var = runRecursive(&tokens, oldRec, newRec, VAR);
-    double watts = runRecursive(&tokens, oldRec, newRec, Watts);
+    double var = runScript(VAR);
+    double watts = runScript(Watts);
     result = sqrt(var * var + watts * watts);
     break;
           }
           
           case VAh:
           {
-            double varh = runRecursive(&tokens, oldRec, newRec, VARh); 
-            double wh = runRecursive(&tokens, oldRec, newRec, Wh);
+            double varh = runScript(VARh); 
+            double wh = runScript(Wh);
             result = sqrt(varh * varh + wh * wh);
             break;
           }
 
           case kWh:
-            result = runRecursive(&tokens, oldRec, newRec, Wh) / 1000.0; 
+            result = runScript(Wh) / 1000.0; 
             break;
 
           case PF:
           {
-            double watts = runRecursive(&tokens, oldRec, newRec, Watts);
-            double va = runRecursive(&tokens, oldRec, newRec, VA);
+            double watts = runScript(Watts);
+            double va = runScript(VA);
             result = watts / va;
             break;
           }
@@ -332,6 +545,9 @@ double  Script::run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
             result = 0.0;
         }
         
+        if( ! complete){
+          return runUnits(oldRec, newRec, Units, false);
+        }
         if(result != result) return 0.0;
         return result;
                 
@@ -345,7 +561,6 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
   double result = 0.0;
   double operand = 0.0;
   uint8_t pendingOp = opAdd;
-  int vchannel;
   uint8_t *token = *tokens;
   do
   {
@@ -399,95 +614,12 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
         break;
 
       case tokenInput:
-      {
-        int input = *token & ~TOKEN_TYPE_MASK;
-        double accum1 = newRec->accum1[input] - (oldRec ? oldRec->accum1[input] : 0);
-        double accum2 = newRec->accum2[input] - (oldRec ? oldRec->accum2[input] : 0);
-        ;
-        vchannel = inputChannel[input]->_vchannel;
-        double volts = (newRec->accum1[vchannel] - (oldRec ? oldRec->accum1[vchannel] : 0)) * inputChannel[input]->_vmult;
-        double hz = newRec->accum2[vchannel] - (oldRec ? oldRec->accum2[vchannel] : 0);
-
-        switch (Units)
-        {
-
-          case Watts:
-            operand = accum1 / elapsedHours;
-            break;
-
-          case Volts:
-            operand = volts / elapsedHours;
-            break;
-
-          case Amps:
-          {
-            double va = accum2 / elapsedHours;
-            operand = volts / elapsedHours;
-            if (operand != 0.0)
-            {
-              operand = va / operand;
-            }
-            break;
-          }
-
-          case VA:
-            operand = accum2 / elapsedHours;
-            break;
-
-          case VAh:
-            operand = accum2;
-            break;
-
-          case Hz:
-            operand = hz / elapsedHours;
-            break;
-
-          case Wh:
-            operand = accum1;
-            break;
-
-          case VAR:
-          {
-            double va = accum2 / elapsedHours;
-            double watts = accum1 / elapsedHours;
-            operand = sqrt(va * va - watts * watts);
-            break;
-          }
-
-          case VARh:
-          {
-            double vah = accum2;
-            double wh = accum1;
-            operand = sqrt(vah * vah - wh * wh);
-            break;
-          }
-
-          default:
-            operand = 0.0;
-            break;
-             
-        } // switch (units)
+        operand = inputOperand(tokenDetail, oldRec, newRec, Units, elapsedHours);
         break;
-      }
 
       case tokenVirtual:
-      {
-        operand = 0;
-        if (tokenDetail == 0 && simsolar)
-        {
-          if (oldRec) {
-            double elapsed = newRec->logHours - oldRec->logHours;
-            operand = simsolar->energy(localTime(oldRec->UNIXtime), localTime(newRec->UNIXtime)) * elapsed / (double(newRec->UNIXtime - oldRec->UNIXtime) / 3600);
-            if(Units == Watts){
-              operand /= double(newRec->UNIXtime - oldRec->UNIXtime) / 3600;
-            }
-          }
-          else {
-            operand = simsolar->power(localTime(newRec->UNIXtime));
-          }
-        }
+        operand = virtualOperand(tokenDetail, oldRec, newRec, Units);
         break;
-      }
 
       case tokenIntegration:
       {
@@ -523,6 +655,209 @@ double  Script::runRecursive(uint8_t** tokens, IotaLogRecord* oldRec, IotaLogRec
   return 0;
 }
 
+double  Script::inputOperand(int input, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, double elapsedHours){
+  double accum1 = newRec->accum1[input] - (oldRec ? oldRec->accum1[input] : 0);
+  double accum2 = newRec->accum2[input] - (oldRec ? oldRec->accum2[input] : 0);
+  int vchannel = inputChannel[input]->_vchannel;
+  double volts = (newRec->accum1[vchannel] - (oldRec ? oldRec->accum1[vchannel] : 0)) * inputChannel[input]->_vmult;
+  double hz = newRec->accum2[vchannel] - (oldRec ? oldRec->accum2[vchannel] : 0);
+  return unitsOperand(Units, accum1, accum2, volts, hz, elapsedHours);
+}
+
+double  Script::inputOperand(int input, scriptDeltas* deltas, units Units){
+  int vchannel = inputChannel[input]->_vchannel;
+  return unitsOperand(Units, deltas->accum1[input], deltas->accum2[input], 
+                      deltas->accum1[vchannel] * inputChannel[input]->_vmult, deltas->accum2[vchannel], deltas->elapsedHours);
+}
+
+double  Script::unitsOperand(units Units, double accum1, double accum2, double volts, double hz, double elapsedHours){
+  double operand;
+  switch (Units)
+  {
+
+    case Watts:
+      operand = accum1 / elapsedHours;
+      break;
+
+    case Volts:
+      operand = volts / elapsedHours;
+      break;
+
+    case Amps:
+    {
+      double va = accum2 / elapsedHours;
+      operand = volts / elapsedHours;
+      if (operand != 0.0)
+      {
+        operand = va / operand;
+      }
+      break;
+    }
+
+    case VA:
+      operand = accum2 / elapsedHours;
+      break;
+
+    case VAh:
+      operand = accum2;
+      break;
+
+    case Hz:
+      operand = hz / elapsedHours;
+      break;
+
+    case Wh:
+      operand = accum1;
+      break;
+
+    case VAR:
+    {
+      double va = accum2 / elapsedHours;
+      double watts = accum1 / elapsedHours;
+      operand = sqrt(va * va - watts * watts);
+      break;
+    }
+
+    case VARh:
+    {
+      double vah = accum2;
+      double wh = accum1;
+      operand = sqrt(vah * vah - wh * wh);
+      break;
+    }
+
+    default:
+      operand = 0.0;
+      break;
+       
+  } // switch (units)
+  return operand;
+}
+
+double  Script::virtualOperand(int detail, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units){
+  double operand = 0;
+  if (detail == 0 && simsolar)
+  {
+    if (oldRec) {
+      double elapsed = newRec->logHours - oldRec->logHours;
+      operand = simsolar->energy(localTime(oldRec->UNIXtime), localTime(newRec->UNIXtime)) * elapsed / (double(newRec->UNIXtime - oldRec->UNIXtime) / 3600);
+      if(Units == Watts){
+        operand /= double(newRec->UNIXtime - oldRec->UNIXtime) / 3600;
+      }
+    }
+    else {
+      operand = simsolar->power(localTime(newRec->UNIXtime));
+    }
+  }
+  else if(detail > 0)
+  {
+    double accum1, accum2, elapsedHours;
+    if(peerDeltas(detail, oldRec, newRec, accum1, accum2, elapsedHours) && elapsedHours > 0){
+      operand = unitsOperand(Units, accum1, accum2, accum1, accum2, elapsedHours);
+    }
+  }
+  return operand;
+}
+
+/*******************************************************************************************************
+ * runProgram() - evaluate the compiled program.  Same arithmetic, in the same order, as 
+ * runRecursive().  Input operands come from the shared deltas if a ScriptSet or caller has 
+ * computed them for the record pair, otherwise from the records.  If a referenced integration no longer exists, complete is set false and the 
+ * caller reruns with runRecursive() so the (odd) result of that case is also unchanged.
+ ******************************************************************************************************/
+
+double  Script::runProgram(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, bool &complete, scriptDeltas* deltas){
+  double inputs[SCRIPT_INPUTS_MAX];
+  if(deltas){
+    for(int i=0; i<_inputCount; i++){
+      inputs[i] = inputOperand(_inputs[i], deltas, Units);
+    }
+  }
+  else {
+    double elapsedHours = 1.0;
+    if(oldRec){
+      elapsedHours = newRec->logHours - oldRec->logHours;
+    }
+    for(int i=0; i<_inputCount; i++){
+      inputs[i] = inputOperand(_inputs[i], oldRec, newRec, Units, elapsedHours);
+    }
+  }
+  struct {
+    double  result;
+    uint8_t pendingOp;
+  } stack[SCRIPT_STACK_MAX];
+  int depth = 0;
+  double result = 0.0;
+  double operand = 0.0;
+  uint8_t pendingOp = opAdd;
+  for(scriptInstr* instr = _program; ; instr++){
+    switch (instr->code)
+    {
+      case progEnd:
+        return operate(result, pendingOp, operand);
+
+      case progConstant:
+        operand = _values[instr->arg];
+        break;
+
+      case progInput:
+        operand = inputs[instr->arg];
+        break;
+
+      case progVirtual:
+        operand = virtualOperand(instr->arg, oldRec, newRec, Units);
+        break;
+
+      case progIntegration:
+      {
+        int index = instr->arg;
+        Script *integration = integrations->first();
+        while (index && integration)
+        {
+          integration = integration->next();
+          index--;
+        }
+        if (!integration)
+        {
+          complete = false;
+          return 0;
+        }
+        operand = ((integrator *)(integration->getParm()))->run(oldRec, newRec, Units, instr->method);
+        break;
+      }
+
+      case progOperator:
+        result = operate(result, pendingOp, operand);
+        pendingOp = instr->arg;
+        operand = 0;
+        if (instr->arg == opDiv || instr->arg == opMult)
+          operand = 1;
+        continue;
+
+      case progAbs:
+        if (operand < 0)
+          operand = 0 - operand;
+        continue;
+
+      case progPush:
+        stack[depth].result = result;
+        stack[depth++].pendingOp = pendingOp;
+        result = 0.0;
+        operand = 0.0;
+        pendingOp = opAdd;
+        continue;
+
+      case progPop:
+        operand = operate(result, pendingOp, operand);
+        result = stack[--depth].result;
+        pendingOp = stack[depth].pendingOp;
+        break;
+    }
+    if (operand != operand)
+      operand = 0;
+  }
+}
+
 double    Script::operate(double result, uint8_t token, double operand){
         switch (token) {
           case opAdd:  return result + operand;
@@ -535,17 +870,160 @@ double    Script::operate(double result, uint8_t token, double operand){
         }
 }
 
-Script* ScriptSet::script(const char *name){
-  Script *script = _listHead;
-  while (script) {
-    if(strcmp(script->name(), name) == 0){
-      return script;
+/*******************************************************************************************************
+ * scriptDeltas - the input accumulator deltas and elapsed hours of a record pair.  Computed once
+ * and shared by every Script run over the pair, they are exactly what each Script would compute 
+ * on its own, so results are unchanged.
+ ******************************************************************************************************/
+
+scriptDeltas::scriptDeltas(IotaLogRecord* oldRec, IotaLogRecord* newRec)
+      :oldRec(oldRec)
+      ,newRec(newRec)
+      ,elapsedHours(1.0)
+{
+  if(oldRec){
+    elapsedHours = newRec->logHours - oldRec->logHours;
+  }
+  for(int i=0; i<IOTALOG_CHANNELS; i++){
+    accum1[i] = newRec->accum1[i] - (oldRec ? oldRec->accum1[i] : 0);
+    accum2[i] = newRec->accum2[i] - (oldRec ? oldRec->accum2[i] : 0);
+  }
+}
+
+          // Run every Script in the set over a record pair.
+          // results[i] is the value of the i'th Script in its own units.
+
+          // Results are shared with other sets through scriptResults.
+
+void  ScriptSet::evaluate(IotaLogRecord* oldRec, IotaLogRecord* newRec, double* results){
+  scriptDeltas deltas(oldRec, newRec);
+  Script* script = _listHead;
+  for(int i=0; script; i++){
+    if( ! script->_signature || ! scriptResults.get(script->_signature, script->_units, oldRec, newRec, results[i])){
+      results[i] = script->run(deltas);
+      if(script->_signature){
+        scriptResults.put(script->_signature, script->_units, oldRec, newRec, results[i]);
+      }
     }
     script = script->next();
   }
+}
+
+/*******************************************************************************************************
+ * scriptCache - results of Scripts run over a record pair, shared by all ScriptSet::evaluate()
+ * callers.  When several uploaders work through the same intervals (catching up after an outage),
+ * the first to evaluate an output saves the result and the others use it.
+ * 
+ * Entries are keyed on the Script signature and units and the keys of the record pair, so any
+ * interval is cached.  The records' serials are also kept and must match, so results over
+ * records from a different log, or a read past the end of the log that has since been written,
+ * aren't reused.  The cache is direct mapped, each new result replaces whatever was in its slot.
+ * 
+ * The size is set with device config "scriptcache" (entries, 0 = off), and it's cleared when
+ * the inputs are configured as that changes what a Script computes.
+ ******************************************************************************************************/
+
+scriptCache scriptResults;
+
+void  scriptCache::size(uint16_t entries){
+  entries = MIN(entries, SCRIPT_CACHE_MAX);
+  if(entries != _size){
+    delete[] _entries;
+    _entries = nullptr;
+    _size = entries;
+    if(_size){
+      _entries = new scriptCacheEntry[_size];
+    }
+  }
+  clear();
+}
+
+void  scriptCache::clear(){
+  for(int i=0; i<_size; i++){
+    _entries[i].signature = 0;
+  }
+  _hits = 0;
+  _misses = 0;
+}
+
+scriptCacheEntry* scriptCache::slot(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec){
+  uint32_t hash = signature ^ (newRec->UNIXtime * 2654435761UL) ^ Units;
+  if(oldRec){
+    hash ^= (newRec->UNIXtime - oldRec->UNIXtime) * 40503UL;
+  }
+  return &_entries[hash % _size];
+}
+
+bool  scriptCache::get(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec, double &value){
+  if( ! _size){
+    return false;
+  }
+  scriptCacheEntry* entry = slot(signature, Units, oldRec, newRec);
+  if(entry->signature == signature && entry->units == Units &&
+     entry->newKey == newRec->UNIXtime && entry->newSerial == newRec->serial &&
+     entry->oldKey == (oldRec ? oldRec->UNIXtime : 0) && entry->oldSerial == (oldRec ? oldRec->serial : -1)){
+    _hits++;
+    value = entry->value;
+    return true;
+  }
+  _misses++;
+  return false;
+}
+
+void  scriptCache::put(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec, double value){
+  if( ! _size){
+    return;
+  }
+  scriptCacheEntry* entry = slot(signature, Units, oldRec, newRec);
+  entry->value = value;
+  entry->signature = signature;
+  entry->units = Units;
+  entry->newKey = newRec->UNIXtime;
+  entry->newSerial = newRec->serial;
+  entry->oldKey = oldRec ? oldRec->UNIXtime : 0;
+  entry->oldSerial = oldRec ? oldRec->serial : -1;
+}
+
+          // Find a Script by name.
+          // Uses the hash index, built when the set is created or sorted,
+          // returns the first Script in the set with the name.
+
+Script* ScriptSet::script(const char *name){
+  if( ! _index){
+    return nullptr;
+  }
+  uint16_t slot = hashIndex(name) & _indexMask;
+  while(_index[slot]){
+    if(strcmp(_index[slot]->name(), name) == 0){
+      return _index[slot];
+    }
+    slot = (slot + 1) & _indexMask;
+  }
   return nullptr;
 }
 
+void  ScriptSet::buildIndex(){
+  delete[] _index;
+  _index = nullptr;
+  if( ! _count){
+    return;
+  }
+  size_t size = 4;
+  while(size < _count * 2) size *= 2;
+  _indexMask = size - 1;
+  _index = new Script*[size];
+  memset(_index, 0, size * sizeof(Script*));
+  for(Script* script = _listHead; script; script = script->next()){
+    if(script->name() && ! this->script(script->name())){
+      uint16_t slot = hashIndex(script->name()) & _indexMask;
+      while(_index[slot]){
+        slot = (slot + 1) & _indexMask;
+      }
+      _index[slot] = script;
+    }
+  }
+}
+
           // Sort the Scripts in the set
           // Uses callback comparison
           // Simple bubble sort
@@ -574,4 +1052,80 @@ void  ScriptSet::sort(std::function<int(Script*, Script*)> scriptCompare){
       b = a->_next;
     }
   }
-}
\ No newline at end of file
+  buildIndex();
+}
+
+/*******************************************************************************************************
+ * scriptBenchmark(iterations) - GET /command?scriptbench=n
+ * 
+ * Runs each output Script n times (default 100) with each interpreter over the last hour of the 
+ * current log and reports the average usec per run.  Every units is also run once both ways, and
+ * over the shared scriptDeltas, to check that the results are identical to the bit, and the
+ * whole set once with ScriptSet::evaluate() against each Script run on its own.
+ ******************************************************************************************************/
+
+String  scriptBenchmark(int iterations){
+  if(iterations <= 0) iterations = 100;
+  iterations = MIN(iterations, 10000);
+  if( ! Current_log.isOpen()){
+    return String(F("Current log not open"));
+  }
+  IotaLogRecordHandle oldRec;
+  IotaLogRecordHandle newRec;
+  newRec->UNIXtime = Current_log.lastKey();
+  Current_log.readKey(newRec);
+  oldRec->UNIXtime = newRec->UNIXtime - 3600;
+  Current_log.readKey(oldRec);
+  
+  String response;
+  char line[120];
+  scriptDeltas deltas(oldRec, newRec);
+  Script* script = outputs->first();
+  while(script){
+    bool identical = true;
+    for(int i=0; i<unitsNone; i++){
+      double compiled = script->run(oldRec, newRec, (units)i);
+      double interpreted = script->runInterpreted(oldRec, newRec, (units)i);
+      double shared = script->run(deltas, (units)i);
+      if(memcmp(&compiled, &interpreted, sizeof(double)) != 0 ||
+         memcmp(&shared, &interpreted, sizeof(double)) != 0){
+        identical = false;
+      }
+    }
+    uint32_t startUs = micros();
+    for(int i=0; i<iterations; i++){
+      script->runInterpreted(oldRec, newRec);
+    }
+    uint32_t interpretedUs = micros() - startUs;
+    startUs = micros();
+    for(int i=0; i<iterations; i++){
+      script->run(oldRec, newRec);
+    }
+    uint32_t compiledUs = micros() - startUs;
+    snprintf_P(line, sizeof(line), PSTR("%s(%s): interpreted %.2fus, %s %.2fus, %s\r\n"), 
+          script->name(), script->getUnits(), (float)interpretedUs / iterations,
+          script->compiled() ? "compiled" : "not compiled", (float)compiledUs / iterations,
+          identical ? "identical" : "DIFFERENT");
+    response += line;
+    script = script->next();
+    yield();
+  }
+  if(outputs->count()){
+    double* results = new double[outputs->count()];
+    outputs->evaluate(oldRec, newRec, results);
+    bool identical = true;
+    int n = 0;
+    script = outputs->first();
+    while(script){
+      double single = script->run(oldRec, newRec);
+      if(memcmp(&single, &results[n++], sizeof(double)) != 0){
+        identical = false;
+      }
+      script = script->next();
+    }
+    delete[] results;
+    snprintf_P(line, sizeof(line), PSTR("evaluate(): %d scripts, %s\r\n"), n, identical ? "identical" : "DIFFERENT");
+    response += line;
+  }
+  return response;
+}
@@ -42,6 +42,7 @@ enum opCodes // Must match opChars[] in .cpp
 #define SCRIPT_CHAR_CONSTANT '#'
 #define SCRIPT_CHAR_INTEGRATION '!'
 #define SCRIPT_CHAR_VIRTUAL '~'
+#define SCRIPT_VIRTUAL_MAX 30           // ~1 to ~30, peer inputs (five bits of token detail)
 
 enum tokenTypes
 {
@@ -52,6 +53,76 @@ enum tokenTypes
   tokenVirtual = 0x80
 };
 
+  // Compiled program (see Script::compile in .cpp)
+
+#define SCRIPT_STACK_MAX 8          // Parenthesis nesting in a compiled program
+#define SCRIPT_INPUTS_MAX 15        // Distinct inputs in a compiled program
+
+enum programCodes
+{
+  progEnd = 0,                      // Result
+  progConstant = 1,                 // operand = _values[arg]
+  progInput = 2,                    // operand = value of _inputs[arg]
+  progVirtual = 3,                  // operand = virtual input arg
+  progIntegration = 4,              // operand = integration arg, method
+  progOperator = 5,                 // Apply pending operator, arg is next
+  progAbs = 6,                      // operand = |operand|
+  progPush = 7,                     // Save result and operator, start subexpression
+  progPop = 8                       // operand = subexpression, restore result and operator
+};
+
+class scriptDeltas {            // Input deltas of a record pair, shared by the Scripts run over it
+  public:
+    scriptDeltas(IotaLogRecord* oldRec, IotaLogRecord* newRec);
+    IotaLogRecord*  oldRec;
+    IotaLogRecord*  newRec;
+    double  elapsedHours;
+    double  accum1[IOTALOG_CHANNELS];
+    double  accum2[IOTALOG_CHANNELS];
+};
+
+  // Shared cache of Script results for record pairs (see .cpp)
+
+#define SCRIPT_CACHE_DEFAULT 64     // Entries (32 bytes each)
+#define SCRIPT_CACHE_MAX 512
+
+struct scriptCacheEntry {
+  double    value;
+  uint32_t  signature;              // Script signature (0 = empty)
+  uint32_t  oldKey;                 // Record pair
+  uint32_t  newKey;
+  int32_t   oldSerial;
+  int32_t   newSerial;
+  uint8_t   units;
+};
+
+class scriptCache {
+  public:
+    scriptCache() : _entries(nullptr), _size(0), _hits(0), _misses(0) {};
+    void      size(uint16_t entries);   // Set size (0 = off), clears
+    void      clear();
+    bool      get(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec, double &value);
+    void      put(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec, double value);
+    uint16_t  entries(){return _size;}
+    uint32_t  hits(){return _hits;}
+    uint32_t  misses(){return _misses;}
+
+  private:
+    scriptCacheEntry* _entries;
+    uint16_t  _size;
+    uint32_t  _hits;
+    uint32_t  _misses;
+    scriptCacheEntry* slot(uint32_t signature, units Units, IotaLogRecord* oldRec, IotaLogRecord* newRec);
+};
+
+extern scriptCache scriptResults;
+
+struct scriptInstr {
+  uint8_t   code;                   // programCodes
+  uint8_t   arg;
+  uint8_t   method;                 // Integration method
+};
+
 class Script {
 
   friend class ScriptSet;
@@ -72,6 +143,12 @@ class Script {
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec); // Run this Script
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec, units); // Run w/overide units
     double  run(IotaLogRecord* oldRec, IotaLogRecord* newRec, const char* overideUnits);
+    double  run(scriptDeltas&);  // Run over precomputed deltas
+    double  run(scriptDeltas&, units);
+    double  runInterpreted(IotaLogRecord* oldRec, IotaLogRecord* newRec); // Run tokens (reference)
+    double  runInterpreted(IotaLogRecord* oldRec, IotaLogRecord* newRec, units);
+    bool    compiled();          // Has compiled program
+    uint32_t availableKey();     // Last datalog key the peer inputs and integrations cover
 
     void    print();
     int     precision();
@@ -84,10 +161,23 @@ class Script {
     float*      _constants; // Constant values referenced in Script
     uint8_t*    _tokens;    // Script tokens
     units       _units;     // Units to be computed              
+    scriptInstr* _program;  // Compiled program (nullptr if not compiled)
+    double*     _values;    // Constant operands of program
+    uint8_t*    _inputs;    // Distinct inputs referenced by program
+    uint8_t     _inputCount;
+    uint32_t    _signature; // Hash of tokens and constants for scriptResults (0 = don't cache)
 
+    double    runUnits(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, bool compiled, scriptDeltas* deltas = nullptr);
     double    runRecursive(uint8_t**, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units);
+    double    runProgram(IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, bool &complete, scriptDeltas* deltas);
+    double    inputOperand(int input, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units, double elapsedHours);
+    double    inputOperand(int input, scriptDeltas* deltas, units Units);
+    double    unitsOperand(units Units, double accum1, double accum2, double volts, double hz, double elapsedHours);
+    double    virtualOperand(int detail, IotaLogRecord* oldRec, IotaLogRecord* newRec, units Units);
     double    operate(double, byte, double);
     bool      encodeScript(const char* script);
+    bool      compile();
+    void      sign();
 
 };
 
@@ -97,12 +187,16 @@ class ScriptSet {
     ScriptSet()
       :_count(0)
       ,_listHead(0)
+      ,_index(nullptr)
+      ,_indexMask(0)
       {}
 
 
     ScriptSet (JsonArray& JsonScriptSet) {
       _count = JsonScriptSet.size();
       _listHead = nullptr;
+      _index = nullptr;
+      _indexMask = 0;
       if(_count){
         JsonObject& obj = JsonScriptSet.get<JsonObject>(0);
         _listHead = new Script(obj);
@@ -113,6 +207,7 @@ class ScriptSet {
           script = script->_next;
         }
       }
+      buildIndex();
     }
 
     ~ScriptSet(){
@@ -121,6 +216,7 @@ class ScriptSet {
         _listHead = script->next();
         delete script;
       }
+      delete[] _index;
     }
 
     //typedef std::function<int(Script*, Script*)> scriptCompare;
@@ -128,15 +224,22 @@ class ScriptSet {
     void sort(std::function<int(Script*, Script*)> scriptCompare);
 
     size_t    count();      // Retrieve count of Scripts in the set.
+    void      evaluate(IotaLogRecord* oldRec, IotaLogRecord* newRec, double* results); // Run all, results[count()]
     Script*   first();      // Get -> first Script in set
-    Script*   script(const char *name);
+    Script*   script(const char *name);  // Find by name (hashed)
+    uint32_t  availableKey(); // Last datalog key all of the Scripts cover
 
   private:
 
     size_t    _count;       // The actual count
     Script*   _listHead;      // -> first Script
+    Script**  _index;       // Open addressed hash table of Scripts by name
+    uint16_t  _indexMask;   // Index size - 1
+
+    void      buildIndex();
 
 };
 
+String  scriptBenchmark(int iterations);   // Compare compiled and interpreted outputs
 
 #endif // IotaScript_h
@@ -60,16 +60,30 @@
 #include "webServer.h"
 #include "updater.h"
 #include "samplePower.h"
+#include "serviceBudget.h"
+#include "payloadPool.h"
+#include "connectionPool.h"
 #include "uploader.h"
+#include "influxLines.h"
+#include "gzip.h"
 #include "integrator.h"
 #include "auth.h"
 #include "spiffs.h"
 #include "timeServices.h"
 #include "PVoutput.h"
+#include "webStream.h"
+#include "recentLog.h"
 #include "CSVquery.h"
+#include "queryCache.h"
 #include "xbuf.h"
 #include "xurl.h"
 #include "simSolar.h"
+#include "simLoad.h"
+#include "channelScheduler.h"
+#include "waveform.h"
+#include "scrubLog.h"
+#include "liveStream.h"
+#include "peerSync.h"
 
       // Declare global instances of classes
 
@@ -78,11 +92,14 @@ extern WiFiManager wifiManager;
 extern ESP8266WebServer server;
 extern IotaLog Current_log;
 extern IotaLog History_log;
+extern IotaLog Hourly_log;
+extern IotaLog Daily_log;
 extern IotaLog *Export_log;
 extern RTC rtc;
 extern Ticker Led_timer;
 extern messageLog Message_log;
 extern simSolar *simsolar;
+extern simLoad *simload;
 
 #define SECONDS_PER_MINUTE 60
 #define SECONDS_PER_HOUR 3600
@@ -96,6 +113,8 @@ extern simSolar *simsolar;
 #define IOTA_EXPORT_LOG_PATH  "/iotawatt/export.log"
 #define IOTA_CURRENT_LOG_PATH "/iotawatt/iotalog.log"
 #define IOTA_HISTORY_LOG_PATH "/iotawatt/histlog.log"
+#define IOTA_HOURLY_LOG_PATH  "/iotawatt/hourlog.log"
+#define IOTA_DAILY_LOG_PATH   "/iotawatt/daylog.log"
 #define IOTA_MESSAGE_LOG_PATH "/iotawatt/iotamsgs.txt"
 #define IOTA_AUTH_PATH        "/iotawatt/auth.txt"
 #define IOTA_CONFIG_PATH      "/config.txt"
@@ -140,6 +159,20 @@ union traceUnion {
 
 extern traceUnion traceEntry;
 
+      // Timed trace ring (device config "tracering" entries, 0 = off), dumped by GET /trace
+
+#define TRACE_RING_MAX 1024
+
+struct traceRingEntry {
+      uint32_t    micros;                 // micros() when trace() was called
+      traceUnion  entry;                  // seq, mod, id, det
+};
+
+extern traceRingEntry* traceRing;
+extern uint16_t   traceRingMask;              // Entries - 1 (power of two)
+extern uint32_t   traceRingNext;              // Entries recorded
+extern bool       traceRingHold;              // Not recording while dumped
+
       // Structure of EEPROM
 
 struct EEprom {
@@ -196,6 +229,15 @@ struct EEprom {
 #define T_integrator 33    // Integrator class  
 #define T_Script 34
 #define T_Scriptset 35                        
+#define T_waveform 36      // Waveform streaming
+#define T_rollup 37        // Hourly rollup log
+#define T_scrub 38         // Datalog scrub
+#define T_mqtt 39          // mqtt_uploader
+#define T_webStream 40     // Streamed web responses
+#define T_live 41          // Live stream of statService values
+#define T_msgLog 42        // Message log writes
+#define T_connection 43    // Pooled HTTP connections
+#define T_peer 44          // Peer sync
 
       // LED codes
 
@@ -226,17 +268,67 @@ enum priorities: byte { priorityLow=2,
                         priorityHigh=8
                       };
 typedef std::function<uint32_t(struct serviceBlock*)> Service;
+struct serviceStatistics {             // Per taskID CPU accounting (see comments in Loop)
+  serviceStatistics* next;             // Next in serviceStatsList
+  uint32_t  calls;                     // Times dispatched
+  uint32_t  overruns;                  // Times returned after bingoTime
+  uint32_t  maxUs;                     // Longest dispatch
+  uint64_t  totalUs;                   // Total micros in service
+  uint32_t  heapLow;                   // Lowest free heap after a dispatch
+  uint32_t  heapDrop;                  // Most free heap taken by a dispatch
+  uint16_t  blockLow;                  // Largest free block at heapLow
+  uint8_t   fragHigh;                  // Fragmentation % at heapLow
+  uint8_t   taskID;
+  serviceStatistics(uint8_t id){next=nullptr; calls=0; overruns=0; maxUs=0; totalUs=0; taskID=id; resetHeap();}
+  void resetHeap(){heapLow=UINT32_MAX; heapDrop=0; blockLow=0; fragHigh=0;}
+};
 struct serviceBlock {                  // Scheduler/Dispatcher list item (see comments in Loop)
-  serviceBlock* next;                  // Next serviceBlock in list
+  serviceBlock* next;                  // Next serviceBlock in ready list
   uint32_t scheduleTime;               // Time in millis to dispatch
   Service service;                     // the Service function
   void *serviceParm;                   // Service specific parameter   
   priorities priority;                 // All things equal tie breaker
   uint8_t   taskID;
-  serviceBlock(){next=NULL; scheduleTime=1; priority=priorityMed; service=NULL; taskID=0;}
+  uint16_t  seq;                       // Order added, breaks scheduleTime ties
+  serviceStatistics* stats;            // Accounting for this taskID
+  serviceBlock(){next=NULL; scheduleTime=1; priority=priorityMed; service=NULL; taskID=0; seq=0; stats=nullptr;}
+};
+
+#define SERVICE_PRIORITIES (priorityHigh+1)
+#define SERVICE_HEAP_INITIAL 16
+#define HEAP_LOG_HYSTERESIS 2000       // Free heap above "heaplog" to log again
+
+struct serviceList {                   // FIFO list of dispatchable services
+  serviceBlock* head;
+  serviceBlock* tail;
+};
+
+struct dispatchStatistics {            // Scheduler overhead accounting
+  uint32_t dispatches;                 // Services dispatched
+  uint64_t selectUs;                   // Total micros selecting the next service
+  uint64_t addUs;                      // Total micros rescheduling 
+};
+
+struct heapStatistics {                // Low water heap after a dispatch (see comments in Loop)
+  uint32_t low;                        // Lowest free heap
+  uint16_t lowBlock;                   // Largest free block then
+  uint8_t  lowFrag;                    // Fragmentation % then
+  uint8_t  lowTask;                    // taskID of the dispatch
+  uint32_t lowTime;                    // UTCtime
+  uint32_t logBelow;                   // Log when free heap falls below (0 = never)
+  bool     logged;                     // Below logBelow, logged
 };
 
-extern serviceBlock* serviceQueue;     // Head of ordered list of services
+extern serviceBlock** serviceHeap;     // Min-heap of pending services by scheduleTime
+extern uint16_t serviceCount;          // Entries in serviceHeap
+extern uint16_t serviceHeapSize;       // Allocated size of serviceHeap
+extern uint16_t serviceSeq;            // Next serviceBlock seq
+extern serviceList serviceReady[SERVICE_PRIORITIES]; // Due services by priority
+extern dispatchStatistics dispatchStats;
+extern heapStatistics heapStats;
+extern serviceStatistics* serviceStatsList; // Service accounting by taskID
+extern uint32_t serviceStatsSince;     // UTCtime service accounting reset
+extern uint32_t serviceLogUs;          // Log dispatches longer than this (0 = never)
 
       // Define maximum number of input channels.
       // Create pointer for array of pointers to incidences of input channels
@@ -248,11 +340,15 @@ extern serviceBlock* serviceQueue;     // Head of ordered list of services
 #define MAXINPUTS 15                          // Compile time input channels, can't be changed easily 
 extern IotaInputChannel* *inputChannel;       // -->s to incidences of input channels (maxInputs entries)
 extern uint8_t  maxInputs;                    // channel limit based on configured hardware (set in Config)
+extern bool     compactLog;                   // Create new datalogs in compact format
+extern bool     logCRC;                       // Create new datalogs with record CRCs
+extern uint8_t  logCoalesce;                  // Current_log write cache blocks requested (device.logcoalesce)
 extern uint8_t  deviceMajorVersion;           // Major version of hardware 
 extern uint8_t  deviceMinorVersion;           // Minor version of hardware 
 extern float    VrefVolts;                    // Voltage reference shunt value used to calibrate
                                               // the ADCs. (can be specified in config.device.refvolts)
-extern int16_t* masterPhaseArray;             // Single array containing all individual phase shift arrays    
+extern int16_t* masterPhaseArray;             // Single array containing all individual phase shift arrays
+extern phaseTable* masterPhaseTables;         // Resolved phase tables referenced by the inputs    
 #define Vadj_3 13                             // Voltage channel attenuation ratio
 
       // ****************************************************************************
@@ -299,8 +395,7 @@ extern char *HTTPSproxy;                  // Host for nginx (or other) reverse H
 extern uploader *influxDB_v1;
 extern uploader *influxDB_v2;
 extern uploader *Emoncms;
-extern int32_t uploaderBufferLimit;       // Dynamic limit to try to control overload during recovery
-extern int32_t uploaderBufferTotal;       // Total aggregate target of uploader buffers       
+extern uploader *MQTT;
 
       // ******************* WiFi connection  *************************************
 
@@ -325,6 +420,7 @@ extern uint32_t timeRefNTP;                    // Last time from NTP server (NTP
 extern uint32_t timeRefMs;                     // Internal MS clock corresponding to timeRefNTP
 extern uint32_t timeSynchInterval;             // Interval (sec) to roll NTP forward and try to refresh
 extern uint32_t statServiceInterval;           // Interval (sec) to invoke statService
+extern uint32_t statServiceRuns;               // Times statService has updated statRecord
 extern uint32_t updaterServiceInterval;        // Interval (sec) to check for software updates
 
 extern bool     hasRTC;
@@ -356,16 +452,33 @@ extern int16_t  samples;                          // Number of samples taken in
 extern int16_t  Vsample [MAX_SAMPLES];            // voltage/current pairs during sampling
 extern int16_t  Isample [MAX_SAMPLES];
 
+      // Shared-voltage (multi-CT) sampling.  When multiCT > 1, up to multiCT power channels
+      // that share a voltage reference are sampled together by sampleCycleMulti.
+
+#define MULTICT_MAX 3                             // Max current channels per sample cycle
+#define MULTICT_SAMPLES (MAX_SAMPLES * 2 / 3)     // Sample limit for each channel in multi-CT mode
+
+extern uint8_t  multiCT;                          // Current channels per sample cycle (config device.multict)
+extern int16_t* IsampleMulti[MULTICT_MAX];        // -> Isample array for each current channel ([0] is Isample)
+extern uint32_t sumIsqMulti[MULTICT_MAX];         // Sum of squares for each current channel
+extern float    multiSamplesPerCycle;             // Damped samples per cycle in multi-CT mode
+
       // ************************ Declare global functions
 void      setup();
 void      loop();
 void      trace(const uint8_t module, const uint8_t id, const uint8_t det=0); 
 void      logTrace(void);
+void      traceRingSize(uint16_t entries);
 
 serviceBlock* NewService(Service, const uint8_t taskID=0, void* parm=0);
 void      AddService(struct serviceBlock*);
+serviceBlock* nextService();
+serviceStatistics* getServiceStats(uint8_t taskID);
+void      heapAccount(serviceStatistics*, uint32_t heapBefore);
 uint32_t  dataLog(struct serviceBlock*);
 uint32_t  historyLog(struct serviceBlock*);
+void      historyStatus(JsonObject&);   // Add history log catch-up to /status
+uint32_t  rollupLog(struct serviceBlock*);
 uint32_t  statService(struct serviceBlock*);
 uint32_t  EmonService(struct serviceBlock*);
 uint32_t  influxService(struct serviceBlock*);
@@ -376,6 +489,13 @@ uint32_t  exportLog(struct serviceBlock *_serviceBlock);
 uint32_t  getFeedData(); //(struct serviceBlock*);
 
 uint32_t  logReadKey(IotaLogRecord* callerRecord);
+uint8_t   logChannels();
+bool      logDropsInputs(IotaLog& datalog);     // Compact log without all of the configured inputs
+void      logChannelsCheck(IotaLog& datalog, const char* id);
+void      journalCoalesce();                // Set Current_log write cache within the recovery journal
+
+void      indexInputs();
+IotaInputChannel* findInput(const char* name);
 
 void      setLedCycle(const char*);
 void      endLedCycle();
@@ -1,4 +1,6 @@
 #include "IotaWatt.h"
+
+static bool serviceBefore(serviceBlock* a, serviceBlock* b);
  
 void loop()
 {
@@ -31,17 +33,19 @@ void loop()
     // Determine next channel to sample.
 
     trace(T_LOOP,1,lastChannel);
-    int nextChannel = (lastChannel + 1) % maxInputs;
-    while( (! inputChannel[nextChannel]->isActive()) && nextChannel != lastChannel){
-      nextChannel = ++nextChannel % maxInputs;
-    }
+    bool waveform = waveformCapture();
+    int nextChannel = waveform ? waveformChannel : selectChannel(lastChannel);
     trace(T_LOOP,2,nextChannel);
 
     // Sample it.
+    // In shared-voltage mode, more than one channel may be sampled.
 
     ESP.wdtFeed();
-    samplePower(nextChannel, 0);
+    int sampledChannel = samplePower(nextChannel, 0);
     ESP.wdtFeed();
+    if(waveform){
+      waveformSampled();
+    }
 
     // Set "bingo" time to micros when Services should return control in order to catch next AC cycle.
 
@@ -52,12 +56,18 @@ void loop()
       bingoTime = lastCrossUs + 6333;
     }
     
-    // Indicate sampling active after one pass through inputs 
+    // Indicate sampling active after one pass through inputs.
+    // A waveform capture doesn't advance the channel selection.
 
-    if(nextChannel <= lastChannel){
-      sampling = true;
+    if( ! waveform){
+      if(nextChannel <= lastChannel){
+        if( ! sampling){
+          log("Sampling started %dms after boot.", millis());
+        }
+        sampling = true;
+      }
+      lastChannel = sampledChannel;
     }
-    lastChannel = nextChannel;
   }
 
   // Give web server a shout out.
@@ -89,37 +99,55 @@ void loop()
     }
   }
 
-// If the head of the service queue is dispatchable
-// Find the highest priority Service that is dispatchable.
-// Remove it from the serviceQueue
+// Move any services that have come due to their priority ready list.
+// Take the highest priority ready Service.
 // call it
 // Reschedule it.
 
-  if(micros() < bingoTime && serviceQueue != NULL && millis() >= serviceQueue->scheduleTime){
-    trace(T_LOOP,6,1);
-    serviceBlock *selPtr = (serviceBlock*)&serviceQueue;
-    serviceBlock *tstPtr = selPtr->next;
-    while(tstPtr->next && tstPtr->next->scheduleTime <= millis()){
-      trace(T_LOOP,6,2);
-      if(tstPtr->next->priority > selPtr->next->priority){
-        selPtr = tstPtr;
+  if(micros() < bingoTime){
+    uint32_t startUs = micros();
+    serviceBlock *selPtr = nextService();
+    if(selPtr){
+      dispatchStats.selectUs += micros() - startUs;
+      if( ! selPtr->stats){
+        selPtr->stats = getServiceStats(selPtr->taskID);
       }
-      tstPtr = tstPtr->next;
-    }
-    trace(T_LOOP,6,3);
-    tstPtr = selPtr;
-    selPtr = selPtr->next;
-    tstPtr->next = tstPtr->next->next;
-    ESP.wdtFeed();
-    trace(T_LOOP,5,selPtr->taskID);
-    trace(T_LOOP,6,4);
-    selPtr->scheduleTime = selPtr->service(selPtr);
-    yield();
-    trace(T_LOOP,6,6);
-    if(selPtr->scheduleTime > 0){
-      AddService(selPtr); 
-    } else {
-      delete selPtr;    
+      ESP.wdtFeed();
+      trace(T_LOOP,5,selPtr->taskID);
+      trace(T_LOOP,6,4);
+      uint32_t heapBefore = ESP.getFreeHeap();
+      uint32_t serviceUs = micros();
+      dispatchStartUs = serviceUs;
+      selPtr->scheduleTime = selPtr->service(selPtr);
+      startUs = micros();
+      serviceUs = startUs - serviceUs;
+      heapAccount(selPtr->stats, heapBefore);
+      
+          // Account for the time used.
+          // Log new high water marks over the threshold.
+
+      serviceStatistics* stats = selPtr->stats;
+      stats->calls++;
+      stats->totalUs += serviceUs;
+      if((int32_t)(startUs - bingoTime) > 0){
+        stats->overruns++;
+      }
+      if(serviceUs > stats->maxUs){
+        stats->maxUs = serviceUs;
+        if(serviceLogUs && serviceUs > serviceLogUs){
+          log("Service %d ran %dms", selPtr->taskID, serviceUs / 1000);
+        }
+      }
+      yield();
+      trace(T_LOOP,6,6);
+      startUs = micros();
+      if(selPtr->scheduleTime > 0){
+        AddService(selPtr); 
+      } else {
+        delete selPtr;    
+      }
+      dispatchStats.addUs += micros() - startUs;
+      dispatchStats.dispatches++;
     }
   } 
 }
@@ -155,18 +183,40 @@ void loop()
  * So if a service just wants to relinquish in deference to sampling but is not finished with its
  * business, just reeturn 1 to be redispatched at the next available opportunity.
  * 
- * The schedule itself is kept as an ordered list of control blocks in ascending order of time + priority
- * called serviceQueue. Loop invokes the service with the highest priority that is dispatchable.
+ * The schedule itself is kept in two parts:
+ * 
+ * serviceHeap is a binary min-heap of pending serviceBlocks keyed on scheduleTime, with a sequence
+ * number to keep services scheduled for the same time in the order they were added.
+ * 
+ * serviceReady is an array of FIFO lists, one per priority, of serviceBlocks that have come due.
+ * Each time Loop looks for work, due services are popped from the heap into the ready list for their
+ * priority, and the head of the highest priority non-empty list is dispatched.  That's the same
+ * choice the old ordered list made - highest priority dispatchable, earliest first within a priority -
+ * but insertion is O(log n) and selection doesn't depend on the number of queued services.
  * 
- * The following two functions are used to maintain the serviceQueue.
+ * The following two functions are used to maintain the schedule.
  * 
  * NewService creates a new serviceBlock that is immediately dispatchable. This is used to create an
  * instance of a Service and is mostly used at startup.  Ad-hoc Services can be created as well at any
  * time and they can terminate by simply returning zero.
  * 
- * AddService is the workhorse.  It inserts a serviceBlock into the serviceQueue in the appropriate
- * order based on its scheduleTime and priority.  When Services are dispatched, they are removed 
- * from the serviceQueue and then reinserted into the serviceQueue upon return using AddService.
+ * AddService is the workhorse.  It converts the Service return value to a millis() scheduleTime and
+ * inserts the serviceBlock into serviceHeap. When Services are dispatched, they are removed 
+ * from the schedule and then reinserted upon return using AddService.
+ * 
+ * Time spent in the scheduler itself (excluding the services) is accumulated in dispatchStats
+ * and reported in the status stats.
+ * 
+ * Time spent in each service is accumulated by taskID in serviceStatsList, along with the number
+ * of times the service returned after bingoTime (overrun).  Ad-hoc services with the same taskID
+ * share an entry.  These are reported in status "services".  If device config "servicelog" is 
+ * specified, a new maximum longer than that many milliseconds is logged.
+ * 
+ * Free heap is checked after each dispatch, and the most a dispatch took and the lowest it left
+ * are kept with the service's accounting.  The largest free block and fragmentation take a walk
+ * of the heap, so they're only sampled at a new low.  The overall low and the taskID that left
+ * it are in heapStats, reported in status stats "heap".  If device config "heaplog" is specified,
+ * free heap falling below that many bytes is logged once until it recovers.
  * 
  ********************************************************************************************************/
 
@@ -191,24 +241,151 @@ void AddService(struct serviceBlock* newBlock){
     newBlock->scheduleTime = millisAtUTCTime(MAX(newBlock->scheduleTime, UTCtime()));
   }
   
-  if(serviceQueue == NULL ||
-    (newBlock->scheduleTime < serviceQueue->scheduleTime) ||
-    (newBlock->scheduleTime == serviceQueue->scheduleTime && newBlock->priority > serviceQueue->priority)){
-    newBlock->next = serviceQueue;
-    serviceQueue = newBlock;
+  newBlock->seq = serviceSeq++;
+
+      // Grow the heap if necessary.
+
+  if(serviceCount == serviceHeapSize){
+    uint16_t newSize = serviceHeapSize ? serviceHeapSize * 2 : SERVICE_HEAP_INITIAL;
+    serviceBlock** newHeap = new serviceBlock*[newSize];
+    for(int i=0; i<serviceCount; i++){
+      newHeap[i] = serviceHeap[i];
+    }
+    delete[] serviceHeap;
+    serviceHeap = newHeap;
+    serviceHeapSize = newSize;
   }
-  else {
-    serviceBlock* link = serviceQueue;
-    while(link->next != NULL){
-      if((newBlock->scheduleTime < link->next->scheduleTime) ||
-        (newBlock->scheduleTime == link->next->scheduleTime && newBlock->priority > link->next->priority)){
+
+      // Sift up from the bottom.
+
+  uint16_t slot = serviceCount++;
+  while(slot > 0){
+    uint16_t parent = (slot - 1) / 2;
+    if( ! serviceBefore(newBlock, serviceHeap[parent])){
+      break;
+    }
+    serviceHeap[slot] = serviceHeap[parent];
+    slot = parent;
+  }
+  serviceHeap[slot] = newBlock;
+}
+
+/************************************************************************************************
+ *  nextService() - Return the next serviceBlock to dispatch, or NULL if none is due.
+ *  
+ *  Due services are popped from serviceHeap to the tail of their priority's ready list, 
+ *  then the head of the highest priority ready list is removed and returned.
+ ************************************************************************************************/
+serviceBlock* nextService(){
+  trace(T_LOOP,6,1);
+  uint32_t _millis = millis();
+  while(serviceCount && serviceHeap[0]->scheduleTime <= _millis){
+    trace(T_LOOP,6,2);
+    serviceBlock* dueBlock = serviceHeap[0];
+
+        // Sift the last entry down from the top.
+
+    serviceBlock* last = serviceHeap[--serviceCount];
+    uint16_t slot = 0;
+    while(true){
+      uint16_t child = slot * 2 + 1;
+      if(child >= serviceCount){
         break;
-      }        
-      link = link->next;
-    } 
-    newBlock->next = link->next;
-    link->next = newBlock;
+      }
+      if(child + 1 < serviceCount && serviceBefore(serviceHeap[child + 1], serviceHeap[child])){
+        child++;
+      }
+      if( ! serviceBefore(serviceHeap[child], last)){
+        break;
+      }
+      serviceHeap[slot] = serviceHeap[child];
+      slot = child;
+    }
+    if(serviceCount){
+      serviceHeap[slot] = last;
+    }
+
+        // Append to ready list.
+
+    int level = MIN(dueBlock->priority, SERVICE_PRIORITIES - 1);
+    dueBlock->next = NULL;
+    if(serviceReady[level].head){
+      serviceReady[level].tail->next = dueBlock;
+    } else {
+      serviceReady[level].head = dueBlock;
+    }
+    serviceReady[level].tail = dueBlock;
+  }
+
+  trace(T_LOOP,6,3);
+  for(int level=SERVICE_PRIORITIES-1; level>=0; level--){
+    serviceBlock* selPtr = serviceReady[level].head;
+    if(selPtr){
+      serviceReady[level].head = selPtr->next;
+      selPtr->next = NULL;
+      return selPtr;
+    }
   }
+  return NULL;
+}
+
+/************************************************************************************************
+ *  heapAccount() - Heap accounting after a dispatch.
+ ************************************************************************************************/
+void heapAccount(serviceStatistics* stats, uint32_t heapBefore){
+  uint32_t heap = ESP.getFreeHeap();
+  if(heapBefore > heap && (heapBefore - heap) > stats->heapDrop){
+    stats->heapDrop = heapBefore - heap;
+  }
+  if(heap < stats->heapLow){
+    uint16_t maxBlock;
+    uint8_t frag;
+    ESP.getHeapStats(nullptr, &maxBlock, &frag);
+    stats->heapLow = heap;
+    stats->blockLow = maxBlock;
+    stats->fragHigh = frag;
+    if(heap < heapStats.low){
+      heapStats.low = heap;
+      heapStats.lowBlock = maxBlock;
+      heapStats.lowFrag = frag;
+      heapStats.lowTask = stats->taskID;
+      heapStats.lowTime = UTCtime();
+    }
+  }
+  if(heapStats.logBelow && heap < heapStats.logBelow && ! heapStats.logged){
+    uint16_t maxBlock;
+    uint8_t frag;
+    ESP.getHeapStats(nullptr, &maxBlock, &frag);
+    log("Heap low after service %d: %d free, %d largest block, %d%% fragmented", stats->taskID, heap, maxBlock, frag);
+    heapStats.logged = true;
+  }
+  else if(heapStats.logged && heap > heapStats.logBelow + HEAP_LOG_HYSTERESIS){
+    heapStats.logged = false;
+  }
+}
+
+/************************************************************************************************
+ *  getServiceStats() - Find or create the accounting entry for a taskID.
+ ************************************************************************************************/
+serviceStatistics* getServiceStats(uint8_t taskID){
+  serviceStatistics* stats = serviceStatsList;
+  while(stats){
+    if(stats->taskID == taskID){
+      return stats;
+    }
+    stats = stats->next;
+  }
+  stats = new serviceStatistics(taskID);
+  stats->next = serviceStatsList;
+  serviceStatsList = stats;
+  return stats;
+}
+
+static bool serviceBefore(serviceBlock* a, serviceBlock* b){
+  if(a->scheduleTime != b->scheduleTime){
+    return a->scheduleTime < b->scheduleTime;
+  }
+  return int16_t(a->seq - b->seq) < 0;
 }
 
 /************************************************************************************************
@@ -221,13 +398,48 @@ void AddService(struct serviceBlock* newBlock){
  *  invoking trace() puts a 32 bit entry into the RTC_USER_MEM area.  
  *  After a restart, the 32 most recent entries are logged, oldest to most rent, 
  *  using logTrace.
+ * 
+ *  When the trace ring is on, each entry is also kept in RAM with the micros() time,
+ *  so GET /trace can show the time between trace points on a running unit. 
  *************************************************************************************************/
+
+traceRingEntry* traceRing = nullptr;
+uint16_t  traceRingMask = 0;
+uint32_t  traceRingNext = 0;
+bool      traceRingHold = false;
+
 void trace(const uint8_t module, const uint8_t id, const uint8_t det){
   traceEntry.seq++;
   traceEntry.mod = module;
   traceEntry.id = id;
   traceEntry.det = det;
   WRITE_PERI_REG(RTC_USER_MEM + 96 + (traceEntry.seq & 0x1F), (uint32_t) traceEntry.traceWord);
+  if(traceRing && ! traceRingHold){
+    traceRingEntry* ringEntry = &traceRing[traceRingNext++ & traceRingMask];
+    ringEntry->micros = micros();
+    ringEntry->entry.traceWord = traceEntry.traceWord;
+  }
+}
+
+    // Size the ring, rounded down to a power of two (0 = off).
+
+void traceRingSize(uint16_t entries){
+  entries = MIN(entries, TRACE_RING_MAX);
+  uint16_t size = entries ? 1 : 0;
+  while(size && (size << 1) <= entries){
+    size <<= 1;
+  }
+  if(size == traceRingMask + (traceRing ? 1 : 0)){
+    return;
+  }
+  delete[] traceRing;
+  traceRing = nullptr;
+  traceRingMask = 0;
+  traceRingNext = 0;
+  if(size){
+    traceRingMask = size - 1;
+    traceRing = new traceRingEntry[size];
+  }
 }
 
 void logTrace(void){
@@ -12,6 +12,7 @@ PVoutput* pvoutput = nullptr;
 const char P_getstatus[] PROGMEM = "getstatus.jsp";
 const char P_getsystem[] PROGMEM = "getsystem.jsp";
 const char P_addbatchstatus[] PROGMEM = "addbatchstatus.jsp";
+const char P_addstatus[] PROGMEM = "addstatus.jsp";
 
     // This is the worm hole that the scheduler uses to get into the class state machine.
     // It invokes the tick method of the class.
@@ -231,6 +232,7 @@ uint32_t PVoutput::tickGotStatus(){
     delete response;
     response = nullptr;
     reqData.flush();
+    _payload.release();
     _reqEntries = 0;
     _lastReqTime = _lastPostTime;
     _state = uploadStatus;
@@ -245,6 +247,17 @@ uint32_t PVoutput::tickGotStatus(){
         // we subtract interval to get the timestamp of each status.
         // Report maximum statuses unless current where we revert to single writes.
 
+            // Outputs using peer inputs or integrations wait for those logs,
+            // rather than post zeros for the intervals they don't have yet.
+
+uint32_t PVoutput::dataLastKey(){
+    uint32_t key = History_log.lastKey();
+    if(_outputs){
+        key = MIN(key, _outputs->availableKey());
+    }
+    return key;
+}
+
 uint32_t PVoutput::tickUploadStatus(){
     trace(T_PVoutput,80);
 
@@ -258,8 +271,7 @@ uint32_t PVoutput::tickUploadStatus(){
         oldRecord = nullptr;
         delete newRecord;
         newRecord = nullptr;
-        delete request;
-        request = nullptr;
+        HTTPreturn(request);
         delete response;
         response = nullptr;
         _state = stopped;
@@ -282,15 +294,11 @@ uint32_t PVoutput::tickUploadStatus(){
         }
         oldRecord->UNIXtime = local2UTC(_lastReqTime - _lastReqTime % UNIX_DAY);
         History_log.readKey(oldRecord);
-        Script* script = _outputs->first();
-        while(script){
-            if(strcmp(script->name(),"generation") == 0){
-                _baseGeneration = script->run(nullptr, oldRecord, Wh);
-            }
-            else if(strcmp(script->name(),"consumption") == 0){
-                _baseConsumption = script->run(nullptr, oldRecord, Wh);
-            }
-            script = script->next();
+        if(_generation){
+            _baseGeneration = _generation->run(nullptr, oldRecord, Wh);
+        }
+        if(_consumption){
+            _baseConsumption = _consumption->run(nullptr, oldRecord, Wh);
         }
         _baseTime = _lastReqTime - _lastReqTime % UNIX_DAY;
     }
@@ -299,36 +307,38 @@ uint32_t PVoutput::tickUploadStatus(){
             // Maximum enries per write
             // reqData larger than PV_REQDATA_LIMIT
             // Last entry is current
-            // Last entry is last entry for a day
+            // Each entry has its date, so a batch can run across days when catching up.
+            // A single current status is sent with addstatus.
             
+    int32_t reqDataLimit = _payload.limit(reqData.available());
+    reqDataLimit = MIN(reqDataLimit, PV_REQDATA_LIMIT);
     if(_reqEntries &&
       (_reqEntries >= (_donator ? PV_DONATOR_STATUS_LIMIT : PV_DEFAULT_STATUS_LIMIT) ||
-      (reqData.available() >= PV_REQDATA_LIMIT) ||
-      (_lastReqTime + _interval) > UTC2Local(History_log.lastKey()) ||
-      (_lastReqTime % UNIX_DAY) == 0)){
+      (reqData.available() >= reqDataLimit) ||
+      (_lastReqTime + _interval) > UTC2Local(dataLastKey()))){
         delete oldRecord;
         oldRecord = nullptr;
         delete newRecord;
         newRecord = nullptr;  
-        HTTPPost(FPSTR(P_addbatchstatus), checkUploadStatus);
+        HTTPPost(_singleStatus ? FPSTR(P_addstatus) : FPSTR(P_addbatchstatus), checkUploadStatus);
         _reqEntries = 0;
         return 1;
     }
 
             // If up-to-date, just return.
 
-    if((_lastReqTime + _interval) > UTC2Local(History_log.lastKey())){
+    if((_lastReqTime + _interval) > UTC2Local(dataLastKey())){
         trace(T_PVoutput,85);
         delete oldRecord;
         oldRecord = nullptr;
         delete newRecord;
         newRecord = nullptr;
-        delete request;
-        request = nullptr;
+        HTTPreturn(request);
         delete response;
         response = nullptr;
         delete _POSTrequest;
         reqData.flush();
+        _payload.release();
         _POSTrequest = nullptr;
         return UTCtime() + 1;
     }
@@ -349,11 +359,11 @@ uint32_t PVoutput::tickUploadStatus(){
             newRecord = temp;
         } else {
             oldRecord->UNIXtime = local2UTC(_lastReqTime);
-            History_log.readKey(oldRecord);
+            _cursor.read(oldRecord);
         }
     }
     newRecord->UNIXtime = local2UTC(_lastReqTime + _interval);
-    History_log.readKey(newRecord);
+    _cursor.read(newRecord);
 
             // See if there was any measurement during this interval
             // Skip ahead if not.
@@ -370,14 +380,23 @@ uint32_t PVoutput::tickUploadStatus(){
 
             // Got all the ingredients,
             // prep reqData for new status.
+            // A lone current status is a single addstatus,
+            // otherwise an entry in an addbatchstatus.
 
     trace(T_PVoutput,87);
     if(_reqEntries++ == 0){
-        reqData.print("data=");
+        _singleStatus = (_lastReqTime + _interval * 2) > UTC2Local(dataLastKey());
+        if(_singleStatus){
+            reqData.printf_P(PSTR("d=%s&t=%s"), datef(_lastReqTime,"YYYYMMDD").c_str(), datef(_lastReqTime, "hh:mm").c_str());
+        } else {
+            reqData.print("data=");
+        }
     } else {
         reqData.print(';');
     }
-    reqData.printf_P("%s,%s", datef(_lastReqTime,"YYYYMMDD").c_str(), datef(_lastReqTime, "hh:mm").c_str());
+    if( ! _singleStatus){
+        reqData.printf_P("%s,%s", datef(_lastReqTime,"YYYYMMDD").c_str(), datef(_lastReqTime, "hh:mm").c_str());
+    }
 
             // run the scripts to collect the data.
 
@@ -391,65 +410,89 @@ uint32_t PVoutput::tickUploadStatus(){
     int    lastExtended(-1); 
     bool   haveExtended[6]{false,false,false,false,false,false};
 
-    Script* script = _outputs->first();
+    scriptDeltas deltas(oldRecord, newRecord);
+    scriptDeltas totals(nullptr, newRecord);
     trace(T_PVoutput,88);
-    while(script){
-        if(strcmp(script->name(),"generation") == 0){
-            energyGeneration = script->run(nullptr, newRecord, Wh) - _baseGeneration;
-            powerGeneration = script->run(oldRecord, newRecord, Watts);
-        }
-        else if(strcmp(script->name(),"consumption") == 0){
-            energyConsumption = script->run(nullptr, newRecord, Wh) - _baseConsumption;
-            powerConsumption = script->run(oldRecord, newRecord, Watts);  
-        }
-        else if(strcmp(script->name(),"voltage") == 0){
-            voltage = script->run(oldRecord, newRecord, Volts);    
+    if(_generation){
+        energyGeneration = _generation->run(totals, Wh) - _baseGeneration;
+        powerGeneration = _generation->run(deltas, Watts);
+    }
+    if(_consumption){
+        energyConsumption = _consumption->run(totals, Wh) - _baseConsumption;
+        powerConsumption = _consumption->run(deltas, Watts);  
+    }
+    if(_voltage){
+        voltage = _voltage->run(deltas, Volts);    
+    }
+    for(int ndx=0; ndx<6; ndx++){
+        if(_extended[ndx]){
+            lastExtended = ndx;
+            haveExtended[ndx] = true;
+            extended[ndx] = _extended[ndx]->run(deltas);
+            extendedPrecision[ndx] = _extended[ndx]->precision();
         }
-        else if(strstr(script->name(),"extended_") == script->name()){
-            long ndx = strtol(script->name()+9,nullptr,10) - 1;
-            if(ndx >= 0 && ndx <=5){
-                if(ndx > lastExtended){
-                    lastExtended = ndx;
-                }
-                haveExtended[ndx] = true;
-                extended[ndx] = script->run(oldRecord, newRecord);
-                extendedPrecision[ndx] = script->precision();
-            }
-        }
-        script = script->next();
     }
 
             // Add the collected data to the status
 
     trace(T_PVoutput,88);
-    if(powerGeneration >= 0){
-        reqData.printf(",%.0f,%.0f", energyGeneration, powerGeneration);
-    } else {
-        reqData.print(",,");
-    }
-    if(powerConsumption >= 0){
-        reqData.printf(",%.0f,%.0f", energyConsumption, powerConsumption);
-    } else {
-        reqData.print(",,");
-    }
-    if(voltage >= 0){
-        reqData.printf(",,%.1f", voltage);
-    } else {
-        reqData.print(",,");
+    if(_singleStatus){
+        if(powerGeneration >= 0){
+            reqData.printf_P(PSTR("&v1=%.0f&v2=%.0f"), energyGeneration, powerGeneration);
+        }
+        if(powerConsumption >= 0){
+            reqData.printf_P(PSTR("&v3=%.0f&v4=%.0f"), energyConsumption, powerConsumption);
+        }
+        if(voltage >= 0){
+            reqData.printf_P(PSTR("&v6=%.1f"), voltage);
+        }
+        if(_donator){
+            for(int ndx=0; ndx<=lastExtended; ndx++){
+                if(haveExtended[ndx]){
+                    reqData.printf_P(PSTR("&v%d=%.*f"), ndx + 7, extendedPrecision[ndx], extended[ndx]);
+                }
+            }
+        }
     }
-    if(_donator && lastExtended >= 0){
-        for(int ndx=0; ndx<=lastExtended; ndx++){
-            reqData.print(',');
-            if(haveExtended[ndx]){
-                reqData.printf("%.*f", extendedPrecision[ndx], extended[ndx]);
+    else {
+        if(powerGeneration >= 0){
+            reqData.printf(",%.0f,%.0f", energyGeneration, powerGeneration);
+        } else {
+            reqData.print(",,");
+        }
+        if(powerConsumption >= 0){
+            reqData.printf(",%.0f,%.0f", energyConsumption, powerConsumption);
+        } else {
+            reqData.print(",,");
+        }
+        if(voltage >= 0){
+            reqData.printf(",,%.1f", voltage);
+        } else {
+            reqData.print(",,");
+        }
+        if(_donator && lastExtended >= 0){
+            for(int ndx=0; ndx<=lastExtended; ndx++){
+                reqData.print(',');
+                if(haveExtended[ndx]){
+                    reqData.printf("%.*f", extendedPrecision[ndx], extended[ndx]);
+                }
             }
         }
     }
 
             // Increment interval and do it again.
+            // A single status is the whole request, post it now.
 
     trace(T_PVoutput,89);
     _lastReqTime += _interval;
+    if(_singleStatus){
+        delete oldRecord;
+        oldRecord = nullptr;
+        delete newRecord;
+        newRecord = nullptr;
+        HTTPPost(FPSTR(P_addstatus), checkUploadStatus);
+        _reqEntries = 0;
+    }
     return 1;
 }
 
@@ -543,11 +586,7 @@ uint32_t PVoutput::handle_HTTPpost_s(){
         return 15;
     }
 
-    if( ! request){
-        request = new asyncHTTPrequest;
-    }
-    request->setTimeout(3);
-    request->setDebug(false);
+    HTTPreturn(request);
     {
         String URL;
         if(HTTPSproxy){
@@ -558,11 +597,14 @@ uint32_t PVoutput::handle_HTTPpost_s(){
         }
         URL = URL + "/service/r2/" + _POSTrequest->URI;
 
-        if( ! request->open("POST", URL.c_str())){
+        request = HTTPlease("POST", URL.c_str());
+        if( ! request){
             HTTPrelease(_HTTPtoken);
             return UTCtime() + 10;
         }
     }
+    request->setTimeout(3);
+    request->setDebug(false);
     if(HTTPSproxy){
         request->setReqHeader(F("X-proxypass"),  "HTTPS://pvoutput.org");
     }
@@ -735,11 +777,23 @@ bool PVoutput::config(const char* configObj){
     _systemID = charstar(config["systemid"].as<char*>());
     trace(T_PVoutput,203);
     delete _outputs;
+    _outputs = nullptr;
     JsonVariant var = config["outputs"];
     if(var.success()){
         trace(T_PVoutput,204);
         _outputs = new ScriptSet(var.as<JsonArray>());
     }
+
+        // Resolve the named outputs.
+
+    _generation = _outputs ? _outputs->script("generation") : nullptr;
+    _consumption = _outputs ? _outputs->script("consumption") : nullptr;
+    _voltage = _outputs ? _outputs->script("voltage") : nullptr;
+    for(int i=0; i<6; i++){
+        char name[12];
+        sprintf_P(name, PSTR("extended_%d"), i + 1);
+        _extended[i] = _outputs ? _outputs->script(name) : nullptr;
+    }
     trace(T_PVoutput,205);
     if( ! _started) {
         trace(T_PVoutput,206);
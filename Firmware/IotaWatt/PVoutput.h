@@ -79,6 +79,10 @@ public:
         ,_reload(false)
         ,_HTTPtoken(0)
         ,_outputs(nullptr)
+        ,_generation(nullptr)
+        ,_consumption(nullptr)
+        ,_voltage(nullptr)
+        ,_extended{nullptr,nullptr,nullptr,nullptr,nullptr,nullptr}
         ,request(nullptr)
         ,response(nullptr)
         ,_lastPostTime(0)
@@ -91,6 +95,8 @@ public:
         ,_errorCode(0)
         ,_errorCount(0)
         ,_baseTime(0)
+        ,_singleStatus(false)
+        ,_cursor(&History_log)
         {};
 
     ~PVoutput(){
@@ -101,7 +107,7 @@ public:
         delete oldRecord;
         delete newRecord;
         delete _outputs;
-        delete request;
+        HTTPreturn(request);
         delete response;
         delete _POSTrequest;
     };
@@ -109,6 +115,7 @@ public:
         // Methods available
 
     bool config(const char* jsonText);                  // Process configuration as a string of Json
+    void reconfig(){_revision = -1;}                    // Next config() rebuilds, even at the same revision
     void stop();                                        // stop the state machine ASAP
     void end();                                         // Destroy this instance of the class ASAP
     void restart();                                     // Force a restart of the state machine ASAP
@@ -146,6 +153,7 @@ private:
     uint32_t    handle_HTTPwait_s();
     uint32_t    tickLimitWait();
     uint32_t    handle_stopped_s();
+    uint32_t    dataLastKey();              // History_log.lastKey(), or the last the outputs' peer logs cover
 
         // Possible response from any HTTP request
 
@@ -189,9 +197,14 @@ private:
     bool        _reload;                    // Reload all PVoutput data from _beginPosting as appropriate             
     uint32_t    _HTTPtoken;                 // Token used as identifier for HTTP subsystem resource          
     ScriptSet*  _outputs;                   // Output scripts
+    Script*     _generation;                // Named outputs in _outputs (nullptr if not configured)
+    Script*     _consumption;
+    Script*     _voltage;
+    Script*     _extended[6];
     asyncHTTPrequest* request;              // Instance of asyncHTTPrequest used for HTTP GET/PUT
     PVresponse* response;                   // Instance of response class used to parse response data
     xbuf        reqData;                    // Instance of xbuf used to build output and status batches
+    payloadShare _payload;                  // reqData's share of the payload pool
     uint32_t    _lastPostTime;              // Local time of last output or status posted to PVoutput
     uint32_t    _lastReqTime;               // Local time of last output or status in reqData or posted not confirmed
     IotaLogRecord* oldRecord;               // Older of two log records bracketing a reporting interval
@@ -210,6 +223,8 @@ private:
     double      _baseConsumption;           // Energy consumption at start of current reporting day
     double      _baseGeneration;            // Energy generation at start of current reporting day
     uint32_t    _baseTime;                  // Local date (UNIXtime 00:00:00) of above base values
+    bool        _singleStatus;              // reqData is one current status for addstatus
+    IotaLogCursor _cursor;                  // Sequential reads of History_log
 
 };
 
@@ -299,4 +299,230 @@ int sampleCycle(IotaInputChannel *Vchannel, IotaInputChannel *Ichannel, int cycl
   cycleSamples++;
   
   return 0;
-}
\ No newline at end of file
+}
+/**********************************************************************************************
+  * 
+  *  sampleCycleMulti(Vchannel, Ichannels, count)
+  *  
+  *  Shared-voltage variant of sampleCycle.  One voltage channel and up to MULTICT_MAX
+  *  current channels that use it as reference are sampled in a single balanced loop:
+  * 
+  *         I[0], I[1], ... I[count-1], V, I[0], I[1], ...
+  * 
+  *  So one voltage crossing detection covers several CTs.  The cost is a lower sample
+  *  rate, (count + 1) ADC reads per V sample instead of 2, and a fixed sampling skew
+  *  between the current channels.  Voltage is interpolated to the time of I[0], and
+  *  I[k] lags that by k ADC slots, which samplePower removes as part of the phase
+  *  correction.
+  * 
+  *  Current samples are written to IsampleMulti[k] and their sum of squares to 
+  *  sumIsqMulti[k].  IsampleMulti[0] is Isample so sumIsq and Isample are also valid
+  *  for I[0].
+  * 
+  *  Return codes are the same as sampleCycle.
+  *   
+  ****************************************************************************************************/
+
+int sampleCycleMulti(IotaInputChannel *Vchannel, IotaInputChannel **Ichannels, int count)
+{
+  int Vchan = Vchannel->_channel;
+
+  uint32_t dataMask = ((ADC_BITS + 6) << SPILMOSI) | ((ADC_BITS + 6) << SPILMISO);
+  const uint32_t mask = ~((SPIMMOSI << SPILMOSI) | (SPIMMISO << SPILMISO));
+  volatile uint8_t * fifoPtr8 = (volatile uint8_t *) &SPI1W0;
+  
+  uint8_t  Vport = Vchannel->_addr % 8;                     // Port on ADC
+  int16_t  offsetV = Vchannel->_offset;                     // Bias offset
+  byte ADC_VselectPin = ADC_selectPin[Vchannel->_addr >> 3];  // Chip select pin
+  uint32_t ADC_VselectMask = 1 << ADC_VselectPin;           // Mask for hardware chip select (pins 0-15)
+
+  uint8_t  Iport[MULTICT_MAX];                              // Same for each current channel
+  int16_t  offsetI[MULTICT_MAX];
+  uint32_t ADC_IselectMask[MULTICT_MAX];
+  int16_t  rawI[MULTICT_MAX];
+  int16_t* IsamplePtr[MULTICT_MAX];
+  for(int k=0; k<count; k++){
+    Iport[k] = Ichannels[k]->_addr % 8;
+    offsetI[k] = Ichannels[k]->_offset;
+    ADC_IselectMask[k] = 1 << ADC_selectPin[Ichannels[k]->_addr >> 3];
+    rawI[k] = 0;
+    IsamplePtr[k] = IsampleMulti[k];
+  }
+  
+  int16_t rawV = 0;                           // Raw ADC readings
+  int16_t lastV = 0;
+  int16_t * VsamplePtr = Vsample;             // -> to sample storage array
+  int32_t Vstep = 32768 / (count + 1);        // Q15 interpolation from lastV to the I[0] slot
+  int16_t sampleLimit = count > 1 ? MULTICT_SAMPLES : MAX_SAMPLES;
+    
+  int16_t crossLimit = 3;                     // number of crossings in total
+  int16_t crossCount = 0;                     // number of crossings encountered
+  int16_t crossGuard = 4;                     // Guard against faux crossings (must be >= 2 initially), more to detect no voltage
+
+  uint32_t startMs = millis();                // Start of current half cycle
+  uint32_t timeoutMs = 12;                    // Maximum time allowed per half cycle
+  
+  int16_t midCrossSamples;                    // Sample count at mid cycle and end of cycle
+
+  bool Vsensed = false;                       // Voltage greater than 5 counts sensed.
+  bool Vreverse = Vchannel->_reverse;
+  
+  SPI.beginTransaction(SPISettings(2000000,MSBFIRST,SPI_MODE0));
+ 
+  rawV = readADC(Vchan) - offsetV;                    // Prime the pump
+  lastV = rawV;
+  samples = 0;                                        // Start with nothing
+
+          // Have at it.
+
+  ESP.wdtFeed();                                     // Red meat for the silicon dog
+  WDT_FEED();
+  do{  
+                      /************************************
+                       * Sample the Current (I) channels  *
+                       ************************************/
+
+        for(int k=0; k<count; k++){
+          GPOC = ADC_IselectMask[k];                         // Select the ADC
+          SPI1U1 = (SPI1U1 & mask) | dataMask;               // Set number of bits 
+          SPI1W0 = (0x18 | Iport[k]) << 3;                   // Data left aligned in low byte 
+          SPI1CMD |= SPIBUSY;                                // Start the SPI clock  
+
+                // Do the loop housekeeping asynchronously while the first SPI runs.
+
+          if(k == 0){
+            for(int j=0; j<count; j++){
+              *IsamplePtr[j] = rawI[j];
+            }
+            *VsamplePtr = lastV + (((rawV - lastV) * Vstep) >> 15);
+            lastV = rawV;
+            if(crossCount) {                                // If past first crossing 
+              VsamplePtr++;                                 // Accumulate samples
+              for(int j=0; j<count; j++){
+                IsamplePtr[j]++;
+              }
+              samples++;                                    // Count samples
+              if(samples >= sampleLimit){                   // If over the legal limit
+                trace(T_SAMP,10);                           // shut down and return
+                while(SPI1CMD & SPIBUSY) {}
+                GPOS = ADC_IselectMask[k];                  // (Chip select high) 
+                Serial.println(F("Max samples exceeded."));
+                return 2;
+              }
+            }
+            else if(rawV < -10 || rawV > 10){
+              Vsensed = true;
+            }
+            crossGuard--;    
+          }
+
+                // Now wait for SPI to complete
+          
+          while(SPI1CMD & SPIBUSY) {}                        // Loop till SPI completes
+          GPOS = ADC_IselectMask[k];                         // Deselect the ADC 
+          rawI[k] = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetI[k];
+          if(rawI[k] >= -1 && rawI[k] <= 1) rawI[k] = 0;
+        }
+
+                      /************************************
+                       *  Sample the Voltage (V) channel  *
+                       ************************************/
+         
+        GPOC = ADC_VselectMask;                             // Select the ADC
+        SPI1U1 = (SPI1U1 & mask) | dataMask;
+        SPI1W0 = (0x18 | Vport) << 3;
+        SPI1CMD |= SPIBUSY;
+        
+              // Check for timeout or no voltage as in sampleCycle.
+                      
+          if((uint32_t)(millis()-startMs)>timeoutMs){                   // Something is wrong
+            trace(T_SAMP,12,Vchan);                                     // Leave a meaningful trace
+            while(SPI1CMD & SPIBUSY) {}
+            GPOS = ADC_VselectMask;                                     // ADC select pin high
+            lastCrossUs = micros();                       
+            return 2;                                                   // Return a failure
+          }
+          else if(!crossGuard && !Vsensed){
+            trace(T_SAMP,13,Vchan);                                     // Leave a meaningful trace
+            while(SPI1CMD & SPIBUSY) {}
+            GPOS = ADC_VselectMask;                                     // ADC select pin high
+            lastCrossUs = micros();                       
+            return 2;                                                   // Return a failure
+          }
+                              
+        while(SPI1CMD & SPIBUSY) {}                                 
+        GPOS = ADC_VselectMask;                           // Deselect the ADC                       
+        rawV = (word(*fifoPtr8 & 0x01, *(fifoPtr8+1)) << 3) + (*(fifoPtr8+2) >> 5) - offsetV;
+               
+        // Finish up loop cycle by checking for zero crossing.
+
+        if(((rawV ^ lastV) & crossGuard) >> 15) {        // If crossed unambiguously
+          startMs = millis();                            // Reset the cycle clock 
+          crossCount++;                                  // Count the crossings 
+          if(crossCount == 1){
+            trace(T_SAMP,14);
+            firstCrossUs = micros();
+            crossGuard = 10;                              // No more crosses for awhile  
+          }
+          else if(crossCount == crossLimit) {
+            trace(T_SAMP,16);
+            lastCrossUs = micros();                       // To compute frequency
+            *VsamplePtr = lastV + (((rawV - lastV) * Vstep) >> 15);                                   
+            for(int j=0; j<count; j++){
+              *IsamplePtr[j] = rawI[j];
+            }
+            crossGuard = 0;                               // No more crosses for awhile
+          }
+          else if(crossCount == ((crossLimit + 1) / 2)){
+            midCrossSamples = samples;
+            crossGuard = 10;                              // No more crosses for awhile                               
+          }
+        }   
+  } while(crossCount < crossLimit || crossGuard > 0); 
+
+  trace(T_SAMP,18);
+
+          // Process raw samples.
+          // Reverse if required.
+
+  sumVsq = 0;
+  VsamplePtr = Vsample;
+  for(int i=0; i<samples; i++){
+    if(Vreverse) *VsamplePtr = - *VsamplePtr;
+    sumVsq += *VsamplePtr * *VsamplePtr;
+    VsamplePtr++;
+  }
+  for(int k=0; k<count; k++){
+    bool Ireverse = Ichannels[k]->_reverse;
+    int16_t* Iptr = IsampleMulti[k];
+    uint32_t _sumIsq = 0;
+    for(int i=0; i<samples; i++){
+      if(Ireverse) *Iptr = - *Iptr;
+      _sumIsq += *Iptr * *Iptr;
+      Iptr++;
+    }
+    sumIsqMulti[k] = _sumIsq;
+  }
+  sumIsq = sumIsqMulti[0];
+
+    // An ADC read should take 13.02us, so a sample group takes (count + 1) of those.
+    // Reject the cycle if we get 10 or more less than that.
+  
+  if(samples < MAX(640 / (count + 1), (lastCrossUs - firstCrossUs) * 100 / (1302 * (count + 1)) - 10)){
+    Serial.printf_P(PSTR("Low sample count %d\r\n"), samples);
+    return 1;
+  }
+  if(abs(samples - (midCrossSamples * 2)) > 8){
+      return 1;
+  }
+
+            // Update damped frequency and sample rate as in sampleCycle.
+
+  float Hz = 1000000.0  / float((uint32_t)(lastCrossUs - firstCrossUs));
+  Vchannel->setHz(Hz);
+  frequency = (0.9 * frequency) + (0.1 * Hz);
+  multiSamplesPerCycle = multiSamplesPerCycle * .9 + samples * .1;
+  cycleSamples += count;
+  
+  return 0;
+}
@@ -205,6 +205,7 @@ if(spiffsBegin()){
         if(! WiFi.isConnected()){
           log("Did not connect after power-fail. Restarting to reset WiFi.");
           delay(500);
+          Message_log.flush();
           ESP.restart();
         }
         break;
@@ -217,7 +218,7 @@ if(spiffsBegin()){
 
   server.on(F("/edit"), HTTP_POST, returnOK, handleFileUpload);
   server.onNotFound(handleRequest);
-  const char * headerkeys[] = {"X-configSHA256"};
+  const char * headerkeys[] = {"X-configSHA256", "If-None-Match", "Accept-Encoding"};
   size_t headerkeyssize = sizeof(headerkeys)/sizeof(char*);
   server.collectHeaders(headerkeys, headerkeyssize );
   server.begin();
@@ -232,6 +233,9 @@ if(spiffsBegin()){
   NewService(updater, T_UPDATE);
   NewService(dataLog, T_datalog);
   NewService(historyLog, T_history);
+  NewService(rollupLog, T_rollup);
+  NewService(scrubLog, T_scrub);
+  NewService(messageLogService, T_msgLog);
 
   if(! validConfig){
     setLedCycle(LED_BAD_CONFIG);
@@ -243,6 +247,7 @@ if(spiffsBegin()){
 void dropDead(void){dropDead(LED_HALT);}
 void dropDead(const char* pattern){
   log("Program halted.");
+  Message_log.flush();
   setLedCycle(pattern);
   while(1){
     delay(1000);   
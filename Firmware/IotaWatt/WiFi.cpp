@@ -55,6 +55,7 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
     else if((UTCtime() - lastDisconnect) >= restartInterval){
       log("WiFi disconnected more than %d minutes, restarting.", restartInterval / 60);
       delay(500);
+      Message_log.flush();
       ESP.restart();
     }
   }
@@ -66,6 +67,7 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
     trace(T_WiFi,10);
     log("Heap memory has degraded below safe minimum, restarting.");
     delay(500);
+    Message_log.flush();
     ESP.restart();
   }
 
@@ -78,10 +80,15 @@ uint32_t WiFiService(struct serviceBlock* _serviceBlock) {
       trace(T_WiFi,22,i);
       log("Incomplete HTTP request detected, id %d, restarting.", HTTPrequestId[i]);
       delay(500);
+      Message_log.flush();
       ESP.restart();
     }
   }    
 
+      // Close pooled HTTP connections that have gone idle.
+
+  HTTPidle();
+
       // Purge any timed out authorization sessions.
 
   trace(T_WiFi,30);
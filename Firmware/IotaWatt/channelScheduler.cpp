@@ -0,0 +1,61 @@
+#include "IotaWatt.h"
+
+channelSelector selectChannel = roundRobinChannel;
+uint32_t        schedMinRefresh = SCHED_DEFAULT_MIN_REFRESH;
+
+//**********************************************************************************************
+//
+//        roundRobinChannel(lastChannel) - next active channel after lastChannel
+//
+//**********************************************************************************************
+
+int roundRobinChannel(int lastChannel){
+  int nextChannel = (lastChannel + 1) % maxInputs;
+  while( (! inputChannel[nextChannel]->isActive()) && nextChannel != lastChannel){
+    nextChannel = ++nextChannel % maxInputs;
+  }
+  return nextChannel;
+}
+
+//**********************************************************************************************
+//
+//        adaptiveChannel(lastChannel) - most urgent active channel
+//
+//        Ties go to the first channel after lastChannel, so after a restart, when all 
+//        channels are overdue, this runs round-robin until every channel has been sampled.
+//        The weights are maintained by the channels as they are sampled, so selection is
+//        a single pass with no floating point beyond a multiply.
+//
+//**********************************************************************************************
+
+int adaptiveChannel(int lastChannel){
+  uint32_t timeNow = millis();
+  int   overdue = -1;                         // Oldest channel past its minimum refresh
+  uint32_t overdueAge = 0;
+  int   best = -1;                            // Highest weighted age otherwise
+  float bestScore = -1.0;
+
+  for(int i=1; i<=maxInputs; i++){
+    int channel = (lastChannel + i) % maxInputs;
+    IotaInputChannel* input = inputChannel[channel];
+    if( ! input->isActive()) continue;
+    uint32_t age = timeNow - input->_lastSampleMs;
+    uint32_t minRefresh = input->_minRefresh ? input->_minRefresh : schedMinRefresh;
+    if(age >= minRefresh){
+      if(overdue < 0 || age > overdueAge){
+        overdue = channel;
+        overdueAge = age;
+      }
+    }
+    else if(overdue < 0){
+      float score = age * input->_schedWeight;
+      if(score > bestScore){
+        best = channel;
+        bestScore = score;
+      }
+    }
+  }
+  if(overdue >= 0) return overdue;
+  if(best >= 0) return best;
+  return lastChannel;
+}
@@ -0,0 +1,33 @@
+#ifndef channelScheduler_h
+#define channelScheduler_h
+
+/**************************************************************************************************
+ * 
+ *  channelScheduler - select the next input channel to sample
+ * 
+ *  The main loop samples one channel (or group of channels in shared-voltage mode) each time
+ *  bingoTime comes around.  The scheduler decides which one.  
+ * 
+ *  roundRobin  Each active channel in turn.  The original behavior and the default.
+ * 
+ *  adaptive    Channels with recently varying power are sampled more often than steady
+ *              ones.  Each channel's urgency is the time since it was last sampled, weighted
+ *              by its recent relative power variation.  Any channel not sampled within its 
+ *              minimum refresh interval is taken first, oldest first.
+ * 
+ *  The selector is a plain function pointer so other policies can be plugged in.
+ * 
+ * ************************************************************************************************/
+
+#define SCHED_DEFAULT_MIN_REFRESH 3000      // Default minimum refresh (ms) in adaptive mode
+#define SCHED_MAX_WEIGHT 8.0                // Upper limit of variance weighting
+
+typedef int (*channelSelector)(int lastChannel);
+
+extern channelSelector selectChannel;       // Current selection policy
+extern uint32_t        schedMinRefresh;     // Default minimum refresh (ms) for all channels
+
+int     roundRobinChannel(int lastChannel);
+int     adaptiveChannel(int lastChannel);
+
+#endif
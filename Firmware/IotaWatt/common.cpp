@@ -131,11 +131,14 @@
 WiFiClient WifiClient;
 IotaLog Current_log(256,5,365,32);              // current data log  (1 year) 
 IotaLog History_log(256,60,3652,48);            // history data log  (10 years)
+IotaLog Hourly_log(256,3600,3652,24);           // hourly rollup log  (10 years)
+IotaLog Daily_log(256,900,400,4);               // daily rollup log  (100 years)
 IotaLog *Export_log = nullptr;                  // Optional export log    
 RTC rtc;                                        // Instance of clock handler class
 Ticker Led_timer;
 messageLog Message_log;                         // Message log handler
 simSolar *simsolar = nullptr;
+simLoad *simload = nullptr;
 
 // Define filename Strings of system files.          
 
@@ -163,10 +166,23 @@ uint32_t bingoTime = 0;                   // When just enough fuel to get to the
 
 // Various queues and lists of resources.
 
-serviceBlock* serviceQueue;               // Head of active services list in order of dispatch time.       
+serviceBlock** serviceHeap = nullptr;     // Min-heap of pending services by scheduleTime
+uint16_t    serviceCount = 0;             // Entries in serviceHeap
+uint16_t    serviceHeapSize = 0;          // Allocated size of serviceHeap
+uint16_t    serviceSeq = 0;               // Next serviceBlock seq
+serviceList serviceReady[SERVICE_PRIORITIES] = {{nullptr, nullptr}}; // Due services by priority
+dispatchStatistics dispatchStats = {0, 0, 0}; // Scheduler overhead accounting
+heapStatistics heapStats = {UINT32_MAX, 0, 0, 0, 0, 0, false}; // Heap low water by dispatch
+serviceStatistics* serviceStatsList = nullptr; // Service accounting by taskID
+uint32_t    serviceStatsSince = 0;        // UTCtime service accounting reset
+uint32_t    serviceLogUs = 0;             // Log dispatches longer than this (0 = never)
 IotaInputChannel* *inputChannel = nullptr; // -->s to incidences of input channels (maxInputs entries) 
 uint8_t     maxInputs = 0;                // channel limit based on configured hardware (set in Config)
+bool        compactLog = false;           // Create new datalogs in compact format
+bool        logCRC = false;               // Create new datalogs with record CRCs
+uint8_t     logCoalesce = 0;              // Current_log write cache blocks requested
 int16_t    *masterPhaseArray = nullptr;   // Single array containing all individual phase shift arrays          
+phaseTable *masterPhaseTables = nullptr;  // Resolved phase tables referenced by the inputs
 ScriptSet  *outputs = new ScriptSet();    // -> ScriptSet for output channels
 ScriptSet  *integrations = new ScriptSet(); // -> Scriptset for integrations
 
@@ -227,9 +243,8 @@ char *HTTPSproxy = nullptr;
 uploader *influxDB_v1 = nullptr;
 uploader *influxDB_v2 = nullptr;
 uploader *Emoncms = nullptr;
+uploader *MQTT = nullptr;
 
-int32_t uploaderBufferLimit = 3000;          // Dynamic limit to try to control overload during recovery
-int32_t uploaderBufferTotal = 6000;          // Total aggregate target of uploader buffers       
 
 // ****************************** Timing and time data **********************************
 
@@ -240,6 +255,7 @@ uint32_t timeRefNTP = SECONDS_PER_SEVENTY_YEARS;  // Last time from NTP server (
 uint32_t timeRefMs = 0;                      // Internal MS clock corresponding to timeRefNTP
 uint32_t timeSynchInterval = 3600;           // Interval (sec) to roll NTP forward and try to refresh
 uint32_t statServiceInterval = 1;            // Interval (sec) to invoke statService
+uint32_t statServiceRuns = 0;                // Times statService has updated statRecord
 uint32_t updaterServiceInterval = 60*60;     // Interval (sec) to check for software updates 
 
 bool     hasRTC = false;
@@ -273,3 +289,8 @@ int32_t   sumVI;
 int16_t   samples = 0;                              // Number of samples taken in last sampling
 int16_t   Vsample [MAX_SAMPLES];                    // voltage/current pairs during sampling
 int16_t   Isample [MAX_SAMPLES];
+
+uint8_t   multiCT = 1;                              // Current channels per sample cycle (1 = V/I pairs)
+int16_t*  IsampleMulti[MULTICT_MAX] = {Isample};    // -> Isample arrays, others allocated when configured
+uint32_t  sumIsqMulti[MULTICT_MAX];
+float     multiSamplesPerCycle = 0;
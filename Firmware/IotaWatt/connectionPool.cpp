@@ -0,0 +1,158 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * connectionPool - see connectionPool.h
+ *
+ * A connection is identified by the domain and port of the URL it was opened on.  A lease of a
+ * free connection to the same host reuses it, otherwise the least recently used free one is
+ * retired to make room.
+ * ************************************************************************************************/
+
+struct pooledConnection {
+  asyncHTTPrequest* request;                // nullptr = free slot
+  char*         host;                       // domain[:port]
+  bool          leased;
+  uint32_t      lastMs;                     // millis() when last returned
+  uint32_t      posts;                      // Running counts
+  uint32_t      reuses;
+  uint32_t      completed;
+  uint32_t      totalMs;                    // Request time of completed posts
+  uint32_t      lastPostMs;
+};
+
+static pooledConnection connections[CONNECTION_POOL_MAX];
+static uint32_t   connectionsOpened = 0;    // Running counts
+static uint32_t   connectionsRetired = 0;
+static uint32_t   connectionsBusy = 0;      // Leases refused, all connections in use
+
+static void retire(pooledConnection* conn){
+  delete conn->request;
+  conn->request = nullptr;
+  delete[] conn->host;
+  conn->host = nullptr;
+  conn->leased = false;
+  connectionsRetired++;
+}
+
+asyncHTTPrequest* HTTPlease(const char* method, const char* URL){
+  trace(T_connection,0);
+  xurl url;
+  if( ! url.parse(URL)){
+    return nullptr;
+  }
+  String host = url.domain();
+  if(url.port()){
+    host += url.port();
+  }
+
+      // Find a free connection to the host,
+      // otherwise an empty slot or the least recently used.
+
+  pooledConnection* conn = nullptr;
+  pooledConnection* spare = nullptr;
+  for(int i=0; i<CONNECTION_POOL_MAX; i++){
+    pooledConnection* c = &connections[i];
+    if(c->leased){
+      continue;
+    }
+    if(c->request && strcmp_ci(c->host, host.c_str()) == 0){
+      conn = c;
+      break;
+    }
+    if( ! spare || ( spare->request && ( ! c->request || c->lastMs < spare->lastMs))){
+      spare = c;
+    }
+  }
+  if(conn){
+    trace(T_connection,1);
+    conn->reuses++;
+  }
+  else {
+    if( ! spare){
+      connectionsBusy++;
+      return nullptr;
+    }
+    trace(T_connection,2);
+    conn = spare;
+    if(conn->request){
+      retire(conn);
+    }
+    conn->request = new asyncHTTPrequest;
+    conn->host = charstar(host.c_str());
+    conn->posts = conn->reuses = conn->completed = conn->totalMs = conn->lastPostMs = 0;
+    connectionsOpened++;
+  }
+  if( ! conn->request->open(method, URL)){
+    trace(T_connection,3);
+    retire(conn);
+    return nullptr;
+  }
+  conn->leased = true;
+  conn->posts++;
+  return conn->request;
+}
+
+void HTTPreturn(asyncHTTPrequest*& request, bool keep){
+  if( ! request){
+    return;
+  }
+  trace(T_connection,4);
+  for(int i=0; i<CONNECTION_POOL_MAX; i++){
+    pooledConnection* conn = &connections[i];
+    if(conn->request == request){
+      conn->leased = false;
+      conn->lastMs = millis();
+      if(request->readyState() == 4){
+        conn->lastPostMs = request->elapsedTime();
+        conn->totalMs += conn->lastPostMs;
+        conn->completed++;
+        keep = keep && request->responseHTTPcode() > 0;
+      }
+      else {
+        keep = false;
+      }
+      if( ! keep){
+        retire(conn);
+      }
+      request = nullptr;
+      return;
+    }
+  }
+  delete request;
+  request = nullptr;
+}
+
+void HTTPidle(){
+  for(int i=0; i<CONNECTION_POOL_MAX; i++){
+    pooledConnection* conn = &connections[i];
+    if(conn->request && ! conn->leased && (millis() - conn->lastMs) > CONNECTION_IDLE_MS){
+      trace(T_connection,5);
+      retire(conn);
+    }
+  }
+}
+
+//**********************************************************************************************
+//        connectionStatus(stats) - GET /status?stats
+//**********************************************************************************************
+
+void connectionStatus(JsonObject& status){
+  status.set(F("opened"), connectionsOpened);
+  status.set(F("retired"), connectionsRetired);
+  status.set(F("busy"), connectionsBusy);
+  JsonArray& hosts = status.createNestedArray(F("hosts"));
+  for(int i=0; i<CONNECTION_POOL_MAX; i++){
+    pooledConnection* conn = &connections[i];
+    if( ! conn->request){
+      continue;
+    }
+    JsonObject& host = hosts.createNestedObject();
+    host.set(F("host"), conn->host);
+    host.set(F("posts"), conn->posts);
+    host.set(F("reuses"), conn->reuses);
+    if(conn->completed){
+      host.set(F("lastms"), conn->lastPostMs);
+      host.set(F("avgms"), conn->totalMs / conn->completed);
+    }
+  }
+}
@@ -0,0 +1,33 @@
+#ifndef connectionPool_h
+#define connectionPool_h
+
+/**************************************************************************************************
+ *
+ *  connectionPool - HTTP connections shared by the uploaders and PVoutput
+ *
+ *  Each uploader and PVoutput had its own asyncHTTPrequest, and deleted it on every error or
+ *  when it was up to date, so a post would often open a new TCP connection to a host, often the
+ *  HTTPS proxy, that another had just finished with.  That's a handshake, an lwIP PCB and the
+ *  SYN round trip on every interval.
+ *
+ *  asyncHTTPrequest keeps its connection open between requests to the same host:port, so the
+ *  pool keeps up to CONNECTION_POOL_MAX of them, one per host:port, and lends them out.
+ *  HTTPlease() returns a request open on the URL, the pooled one for that host:port when it's
+ *  free, and the holder gives it back with HTTPreturn() once it's done with the response.
+ *  A request given back after an error, or with a failed response, is deleted, and so is one
+ *  that's idle for CONNECTION_IDLE_MS (HTTPidle() from WiFiService), which closes the
+ *  connection.
+ *
+ *  The per-host posts, reuses and average request time are in /status?stats.
+ *
+ * ************************************************************************************************/
+
+#define CONNECTION_POOL_MAX 3               // Pooled connections (hosts)
+#define CONNECTION_IDLE_MS 30000            // Retire a connection unused this long
+
+asyncHTTPrequest* HTTPlease(const char* method, const char* URL);      // Request open on URL (nullptr = none)
+void      HTTPreturn(asyncHTTPrequest*& request, bool keep = true);   // Done with it, nulls request
+void      HTTPidle();                       // Retire idle connections
+void      connectionStatus(JsonObject&);    // Add pool stats to /status
+
+#endif
@@ -21,16 +21,24 @@
  **********************************************************************************************/
  #include "IotaWatt.h"
  #define GapFill 600           // Fill in gaps of less than this seconds
+ #define JOURNAL_RTC_WORD 32   // RTC user memory word of the recovery journal
+ #define JOURNAL_BYTES 384     // RTC user memory from there
+ #define JOURNAL_MAGIC 0x4C4E524A
  void dataLogWDT();
  void logtoHistory(IotaLogRecord* logRecord);
+ void journalWrite(IotaLogRecord* logRecord);
+ void journalRecover();
 
  uint32_t dataLog(struct serviceBlock* _serviceBlock){
   enum states {initialize, synchronize, logData};
   static states state = initialize;                                                       
-  static IotaLogRecord* logRecord = new IotaLogRecord;
+  static IotaLogRecord logEntry;                         // Held for good, so not from the record pool
+  static IotaLogRecord* logRecord = &logEntry;
   static double accum1Then [MAXINPUTS];
   static double accum2Then [MAXINPUTS];
   static uint32_t msThen = 0;
+  static uint32_t firstWriteMs = 0;
+  static bool backfill = false;
   static Ticker logWDT;
 
   switch(state){
@@ -45,10 +53,20 @@
 
       // Initialize the IotaLog class
       
+      if(compactLog){
+        Current_log.compact(logChannels());
+        History_log.compact(logChannels());
+      }
+      Current_log.crc(logCRC);
+      History_log.crc(logCRC);
       if(int rtc = Current_log.begin(IOTA_CURRENT_LOG_PATH)){
         log("dataLog: Log file open failed. %d", rtc);
         dropDead();
       }
+      uploadRecords.clear();
+      journalRecover();
+      journalCoalesce();
+      logChannelsCheck(Current_log, "dataLog");
 
       // Initialize the IotaLogRecord accums in case no context.
 
@@ -62,6 +80,7 @@
       
       if(Current_log.fileSize() == 0){
         log("dataLog: New current log created.");
+        backfill = simload && simload->backfill();
         if(History_log.begin(IOTA_HISTORY_LOG_PATH) == 0 && History_log.fileSize() > 0){
           logRecord->UNIXtime = History_log.lastKey();
           History_log.readKey(logRecord);
@@ -103,8 +122,14 @@
       }
 
       // If it's been a long time since last entry, skip ahead.
+      // A simulated backfill starts the new log that many days back.
       
-      if((UTCtime() - logRecord->UNIXtime) > GapFill){
+      if(backfill){
+        logRecord->UNIXtime = UTCtime() - simload->backfill() * 86400UL;
+        logRecord->UNIXtime -= logRecord->UNIXtime % Current_log.interval();
+        log("dataLog: Simulated backfill from %s", datef(UTC2Local(logRecord->UNIXtime)).c_str());
+      }
+      else if((UTCtime() - logRecord->UNIXtime) > GapFill){
         logRecord->UNIXtime = UTCtime();
         logRecord->UNIXtime -= logRecord->UNIXtime % Current_log.interval();
       }
@@ -154,11 +179,59 @@
         }
         msThen = msNow;
         logRecord->logHours += elapsedHrs;
+        if(backfill){
+          log("dataLog: Simulated backfill complete.");
+          backfill = false;
+        }
+      }
+
+      // Catching up with a simulated backfill, 
+      // fill the interval with the simulated power and the present voltage.
+
+      else if(backfill){
+        uint32_t localEnd = UTC2Local(logRecord->UNIXtime);
+        uint32_t localBegin = localEnd - Current_log.interval();
+        double elapsedHrs = double(Current_log.interval()) / 3600.0;
+        for(int i=0; i<maxInputs; i++){
+          IotaInputChannel* _input = inputChannel[i];
+          if( ! _input || ! _input->isActive()){
+            continue;
+          }
+          if(_input->_type == channelTypeVoltage){
+            logRecord->accum1[i] += _input->dataBucket.volts * elapsedHrs;
+            logRecord->accum2[i] += _input->dataBucket.Hz * elapsedHrs;
+          }
+          else if(simload->drives(i)){
+            double Wh = simload->energy(i, localBegin, localEnd);
+            logRecord->accum1[i] += Wh;
+            logRecord->accum2[i] += fabs(Wh);
+          }
+        }
+        logRecord->logHours += elapsedHrs;
+
+            // Keep the real time accumulators current for when it catches up.
+
+        msThen = millis();
+        for(int i=0; i<maxInputs; i++){
+          if(inputChannel[i]){
+            inputChannel[i]->ageBuckets(msThen);
+            accum1Then[i] = inputChannel[i]->dataBucket.accum1;
+            accum2Then[i] = inputChannel[i]->dataBucket.accum2;
+          }
+        }
       }
 
       // Write the record
       
       Current_log.write(logRecord);
+      if(Current_log.writeCacheBlocks()){
+        journalWrite(logRecord);
+      }
+      if( ! firstWriteMs){
+        firstWriteMs = millis();
+        log("dataLog: first write %dms after boot (log open %dms%s).", firstWriteMs, 
+            Current_log.beginMs(), Current_log.superUsed() ? ", superblock" : "");
+      }
 
       // Courtesy call to History Log handler.
       // Will write appropriate records when synchronized.
@@ -169,9 +242,10 @@
       // Call their handlers to add new integration records.
 
       if(integrations->count()){
+        scriptDeltas deltas(oldRecord, logRecord);
         Script *integration = integrations->first();
         while(integration){ 
-          ((integrator*)integration->getParm())->newLogEntry(oldRecord, logRecord);
+          ((integrator*)integration->getParm())->newLogEntry(deltas);
           integration = integration->next();
         }
         delete oldRecord;
@@ -210,9 +284,165 @@
 void dataLogWDT(){
         if(! HTTPlock){
           log("dataLog: datalog WDT - restarting");
+          Message_log.flush();
           ESP.restart();
         }
 }
+
+/******************************************************************************
+ * Recovery journal
+ * 
+ * When Current_log writes are coalesced (config device.logcoalesce), recent
+ * records are held in memory until a window of blocks fills.  So a restart
+ * doesn't lose them, each held record is also kept in the ESP's RTC user 
+ * memory, which survives a software restart, WDT or crash.  On the way back
+ * up, those newer than the last record in the log are written to it.
+ * 
+ * The journal is a header and a slot for each held record, packed to the 
+ * channels of the log.  Only JOURNAL_BYTES are free (the OTA command uses the
+ * RTC user memory before JOURNAL_RTC_WORD), so the coalesce window is limited
+ * to what the slots can hold: typically one block for a full log, several for
+ * a compact one with few channels.
+ * 
+ * RTC memory does not survive loss of power, so then the held records are 
+ * lost, up to the coalesce window.  The header and each slot have a check
+ * value (a slot's in the serial field, which write() reassigns) to reject
+ * whatever the RTC memory powers up with.
+ * ***************************************************************************/
+
+struct journalHeader {
+  uint32_t check;             // JOURNAL_MAGIC ^ count
+  uint32_t count;             // Slots holding records, oldest first
+};
+
+static uint16_t journalSlotBytes(){
+  return 16 + 16 * Current_log.channels();
+}
+
+static uint8_t journalSlots(){
+  return (JOURNAL_BYTES - sizeof(journalHeader)) / journalSlotBytes();
+}
+
+static uint32_t journalCheck(uint32_t* word, uint16_t bytes){
+  uint32_t check = JOURNAL_MAGIC;
+  for(int i=0; i<bytes/4; i++){
+    if(i != 1){
+      check = (check << 1 | check >> 31) ^ word[i];
+    }
+  }
+  return check;
+}
+
+    // Set the coalesce window, within the blocks whose held records the journal can keep.
+
+void journalCoalesce(){
+  uint16_t size = Current_log.recordSize();
+  uint8_t blocks = MIN(logCoalesce, IOTALOG_WRITE_CACHE_MAX);
+  while(blocks){
+    uint32_t len = blocks * IOTALOG_BLOCK_SIZE;
+    uint32_t held = (len + size - 1) / size - (len % size ? 0 : 1);
+    if(held <= journalSlots()){
+      break;
+    }
+    blocks--;
+  }
+  if(blocks != Current_log.writeCacheBlocks()){
+    Current_log.writeCache(blocks > 0, blocks);
+  }
+}
+
+void journalWrite(IotaLogRecord* logRecord){
+  uint8_t held = MIN(Current_log.writeCacheHeld(), journalSlots());
+  uint16_t bytes = journalSlotBytes();
+  if(held){
+    uint32_t slot[(16 + 16 * IOTALOG_CHANNELS) / 4];
+    uint8_t channels = Current_log.channels();
+    memcpy(slot, logRecord, 16);
+    memcpy((uint8_t*)slot + 16, logRecord->accum1, channels * 8);
+    memcpy((uint8_t*)slot + 16 + channels * 8, logRecord->accum2, channels * 8);
+    slot[1] = journalCheck(slot, bytes);
+    ESP.rtcUserMemoryWrite(JOURNAL_RTC_WORD + (sizeof(journalHeader) + (held - 1) * bytes) / 4, slot, bytes);
+  }
+  journalHeader header;
+  header.count = held;
+  header.check = JOURNAL_MAGIC ^ held;
+  ESP.rtcUserMemoryWrite(JOURNAL_RTC_WORD, (uint32_t*)&header, sizeof(header));
+}
+
+void journalRecover(){
+  journalHeader header;
+  uint16_t bytes = journalSlotBytes();
+  uint8_t channels = Current_log.channels();
+  uint32_t lastKey = Current_log.lastKey();
+  int recovered = 0;
+  if(ESP.rtcUserMemoryRead(JOURNAL_RTC_WORD, (uint32_t*)&header, sizeof(header)) &&
+     header.check == (JOURNAL_MAGIC ^ header.count) && header.count <= journalSlots()){
+    IotaLogRecordHandle journal;
+    uint32_t slot[(16 + 16 * IOTALOG_CHANNELS) / 4];
+    for(int i=0; i<header.count; i++){
+      if( ! ESP.rtcUserMemoryRead(JOURNAL_RTC_WORD + (sizeof(journalHeader) + i * bytes) / 4, slot, bytes) ||
+          slot[1] != journalCheck(slot, bytes)){
+        break;
+      }
+      memcpy(journal.get(), slot, 16);
+      memcpy(journal->accum1, (uint8_t*)slot + 16, channels * 8);
+      memcpy(journal->accum2, (uint8_t*)slot + 16 + channels * 8, channels * 8);
+      if(journal->UNIXtime > Current_log.lastKey() &&
+         journal->UNIXtime <= UTCtime() &&
+         (journal->UNIXtime % Current_log.interval()) == 0 &&
+         Current_log.write(journal) == 0){
+        recovered++;
+      }
+    }
+  }
+  if(recovered){
+    log("dataLog: Recovered %d log entries to %s (%d seconds unwritten).", recovered,
+        datef(UTC2Local(Current_log.lastKey())).c_str(), Current_log.lastKey() - lastKey);
+
+        // Write them now, the journal is cleared.
+
+    uint8_t blocks = Current_log.writeCacheBlocks();
+    Current_log.writeCache(false);
+    Current_log.writeCache(blocks > 0, blocks);
+  }
+  header.count = 0;
+  header.check = JOURNAL_MAGIC;
+  ESP.rtcUserMemoryWrite(JOURNAL_RTC_WORD, (uint32_t*)&header, sizeof(header));
+}
+
+/******************************************************************************
+ * logChannels() - number of accumulator pairs a compact log needs to record
+ *                 the configured inputs (highest active input + 1).
+ * ***************************************************************************/
+
+uint8_t logChannels(){
+  uint8_t channels = 1;
+  for(int i=0; i<maxInputs; i++){
+    if(inputChannel[i]->isActive()){
+      channels = i + 1;
+    }
+  }
+  return channels;
+}
+
+/******************************************************************************
+ * logDropsInputs(log) - a compact log records the inputs configured when it
+ *                       was created.  Any added above them aren't logged
+ *                       until the log is deleted and created again, so that
+ *                       is logged, and reported in /status?datalogs.
+ * ***************************************************************************/
+
+bool logDropsInputs(IotaLog& datalog){
+  return datalog.isOpen() && datalog.channels() < logChannels();
+}
+
+void logChannelsCheck(IotaLog& datalog, const char* id){
+  if(logDropsInputs(datalog)){
+    log("%s: Log records %d channels, inputs above %d are not logged. Delete the log to record them.",
+        id, datalog.channels(), datalog.channels() - 1);
+  }
+}
+
 /******************************************************************************
  * logReadKey(iotaLogRecord) - read a keyed record from the combined log
  * 
@@ -229,6 +459,13 @@ void dataLogWDT(){
  * large interval (60 seconds).
  * Look ma - no holes!  direct access w/o searching.
  * 
+ * Hourly_log:
+ * the on-the-hour subset of History_log, a much smaller file.
+ * 
+ * Daily_log:
+ * the local midnight subset of History_log, a few hundred records a year,
+ * so day, week, month and year groups are read without touching the big logs.
+ * 
  * This function will decide the most appropriate log to retrieve the requested 
  * record.
  *  
@@ -244,6 +481,24 @@ uint32_t logReadKey(IotaLogRecord* callerRecord) {
     return Current_log.readKey(callerRecord);
   }
 
+      // If a local day start and in the daily log,
+      // use daily.  The rollups are subsets of history,
+      // so this goes for keys before the current log too.
+
+  if(Daily_log.isOpen() && (key % Daily_log.interval()) == 0 &&
+     key >= Daily_log.firstKey() && key <= Daily_log.lastKey() &&
+     (UTC2Local(key) % UNIX_DAY) == 0 && (UTC2Local(Daily_log.lastKey()) % UNIX_DAY) == 0){
+    return Daily_log.readKey(callerRecord);
+  }
+
+      // If on the hour and in the rollup log,
+      // use hourly
+
+  if(Hourly_log.isOpen() && (key % Hourly_log.interval()) == 0 &&
+     key >= Hourly_log.firstKey() && key <= Hourly_log.lastKey()){
+    return Hourly_log.readKey(callerRecord);
+  }
+
       // If before current log, 
       // use history
 
@@ -0,0 +1,171 @@
+/**********************************************************************************************
+ * gzip - deflate with fixed Huffman codes into a gzip member.  See gzip.h.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+#define GZIP_MIN_MATCH 3
+#define GZIP_MAX_MATCH 258
+
+static const uint16_t lengthBase[29] = {3,4,5,6,7,8,9,10,11,13,15,17,19,23,27,31,35,43,51,59,
+                                        67,83,99,115,131,163,195,227,258};
+static const uint8_t  lengthExtra[29] = {0,0,0,0,0,0,0,0,1,1,1,1,2,2,2,2,3,3,3,3,4,4,4,4,5,5,5,5,0};
+static const uint16_t distBase[22] = {1,2,3,4,5,7,9,13,17,25,33,49,65,97,129,193,257,385,513,769,
+                                      1025,1537};
+static const uint8_t  distExtra[22] = {0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9};
+
+class gzipWriter {
+  public:
+    gzipWriter(xbuf& out) : _out(out), _bits(0), _bitCount(0), _len(0), _total(0) {};
+    void bits(uint32_t value, int count){
+      _bits |= value << _bitCount;
+      _bitCount += count;
+      while(_bitCount >= 8){
+        byte(_bits);
+        _bits >>= 8;
+        _bitCount -= 8;
+      }
+    }
+    void code(uint32_t code, int count){              // Huffman codes go most significant bit first
+      uint32_t reversed = 0;
+      for(int i=0; i<count; i++){
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+      }
+      bits(reversed, count);
+    }
+    void literal(int symbol){
+      if(symbol < 144) code(0x30 + symbol, 8);
+      else if(symbol < 256) code(0x190 + symbol - 144, 9);
+      else if(symbol < 280) code(symbol - 256, 7);
+      else code(0xC0 + symbol - 280, 8);
+    }
+    void match(int length, int distance){
+      int i = 28;
+      while(lengthBase[i] > length) i--;
+      literal(257 + i);
+      bits(length - lengthBase[i], lengthExtra[i]);
+      i = 21;
+      while(distBase[i] > distance) i--;
+      code(i, 5);
+      bits(distance - distBase[i], distExtra[i]);
+    }
+    void align(){
+      if(_bitCount){
+        bits(0, 8 - _bitCount);
+      }
+    }
+    void byte(uint8_t value){
+      _buf[_len++] = value;
+      if(_len == sizeof(_buf)){
+        flush();
+      }
+    }
+    void word(uint32_t value){
+      for(int i=0; i<4; i++){
+        byte(value);
+        value >>= 8;
+      }
+    }
+    size_t flush(){
+      _out.write(_buf, _len);
+      _total += _len;
+      _len = 0;
+      return _total;
+    }
+
+  private:
+    xbuf&     _out;
+    uint32_t  _bits;
+    int       _bitCount;
+    uint8_t   _buf[64];
+    size_t    _len;
+    size_t    _total;
+};
+
+static inline int gzipHash(const uint8_t* data){
+  return ((data[0] << 6) ^ (data[1] << 3) ^ data[2]) & ((1 << GZIP_HASH_BITS) - 1);
+}
+
+size_t gzip(xbuf& in, xbuf& out){
+  uint8_t* window = new uint8_t[GZIP_WINDOW * 2];
+  int16_t* head = new int16_t[1 << GZIP_HASH_BITS];
+  for(int i=0; i<(1 << GZIP_HASH_BITS); i++){
+    head[i] = -1;
+  }
+  gzipWriter writer(out);
+  static const uint8_t header[10] = {0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF};
+  for(int i=0; i<sizeof(header); i++){
+    writer.byte(header[i]);
+  }
+  writer.bits(1, 1);                                  // BFINAL
+  writer.bits(1, 2);                                  // BTYPE fixed Huffman
+
+  uint32_t crc = 0;
+  uint32_t size = 0;
+  int fill = 0;
+  int pos = 0;
+  bool eof = false;
+  while(true){
+
+        // Top up the window.
+
+    if( ! eof && fill < GZIP_WINDOW * 2){
+      int len = in.read(window + fill, GZIP_WINDOW * 2 - fill);
+      crc = CRC32(window + fill, len, crc);
+      size += len;
+      fill += len;
+      eof = in.available() == 0;
+    }
+
+        // Encode while there's a full match of lookahead (or it's all there is).
+
+    while(pos < fill && (eof || fill - pos >= GZIP_MAX_MATCH)){
+      int length = 0;
+      int distance = 0;
+      if(fill - pos >= GZIP_MIN_MATCH){
+        int hash = gzipHash(window + pos);
+        int candidate = head[hash];
+        head[hash] = pos;
+        if(candidate >= 0){
+          int limit = MIN(GZIP_MAX_MATCH, fill - pos);
+          while(length < limit && window[candidate + length] == window[pos + length]){
+            length++;
+          }
+          distance = pos - candidate;
+        }
+      }
+      if(length >= GZIP_MIN_MATCH){
+        writer.match(length, distance);
+        for(int i=1; i<length && pos + i + GZIP_MIN_MATCH <= fill; i++){
+          head[gzipHash(window + pos + i)] = pos + i;
+        }
+        pos += length;
+      }
+      else {
+        writer.literal(window[pos++]);
+      }
+    }
+    if(eof && pos >= fill){
+      break;
+    }
+
+        // Slide the window.
+
+    if(pos >= GZIP_WINDOW){
+      memmove(window, window + GZIP_WINDOW, fill - GZIP_WINDOW);
+      fill -= GZIP_WINDOW;
+      pos -= GZIP_WINDOW;
+      for(int i=0; i<(1 << GZIP_HASH_BITS); i++){
+        head[i] = head[i] >= GZIP_WINDOW ? head[i] - GZIP_WINDOW : -1;
+      }
+    }
+  }
+  delete[] window;
+  delete[] head;
+
+  writer.literal(256);                                // End of block
+  writer.align();
+  writer.word(crc);
+  writer.word(size);
+  return writer.flush();
+}
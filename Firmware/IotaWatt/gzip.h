@@ -0,0 +1,22 @@
+#ifndef gzip_h
+#define gzip_h
+
+/**************************************************************************************************
+ *
+ *  gzip - compress an xbuf with deflate into gzip format (RFC 1951/1952) for uploader POST bodies.
+ *
+ *  The input is read through a GZIP_WINDOW * 2 byte buffer, so matches reach back at most that
+ *  far, and each 3 byte sequence keeps just its most recent position in a hash table.  Output is
+ *  a single block with the fixed Huffman codes.  That's a long way from zlib, but line protocol
+ *  repeats itself every line so it still compresses several times, and the whole thing costs
+ *  GZIP_HEAP bytes of heap while it runs.
+ *
+ * ************************************************************************************************/
+
+#define GZIP_WINDOW 1024                    // Bytes slid at a time (buffer is twice this)
+#define GZIP_HASH_BITS 9                    // Hash table of 512 positions
+#define GZIP_HEAP (GZIP_WINDOW * 2 + (2 << GZIP_HASH_BITS))
+
+size_t gzip(xbuf& in, xbuf& out);           // Compress all of in to out, returns bytes out
+
+#endif
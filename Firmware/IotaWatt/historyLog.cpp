@@ -21,8 +21,58 @@
  **********************************************************************************************/
 #include "IotaWatt.h"
 #define GapFill 600           // Fill in gaps of less than this seconds
+#define HISTORY_BULK 60       // Catch up in bulk when this many records behind
 bool synchronized = false;    // Set true when history log is synchronized with the current log
 
+      // Bulk catch-up, as after a restore or when the history log has been deleted.
+      // The write cache gathers the records into whole block writes, and the current 
+      // log is read with a cursor so consecutive keys don't search.  The window is 
+      // written when the history log is synchronized, and anything lost to a restart
+      // in between is simply caught up again.
+
+static bool     bulk = false;             // Bulk catch-up in progress
+static uint32_t bulkStartKey = 0;         // History_log.lastKey() when it began
+static uint32_t bulkStartMs = 0;
+static uint32_t bulkRecords = 0;          // Records written since
+
+static void bulkStart(){
+  if( ! bulk && Current_log.lastKey() - MIN(Current_log.lastKey(), History_log.lastKey()) >= HISTORY_BULK * History_log.interval()){
+    log("historyLog: catching up from %s", localDateString(History_log.lastKey()).c_str());
+    History_log.writeCache(true, IOTALOG_WRITE_CACHE_MAX);
+    bulk = true;
+    bulkStartKey = History_log.lastKey();
+    bulkStartMs = millis();
+    bulkRecords = 0;
+  }
+}
+
+static void bulkEnd(){
+  if(bulk){
+    History_log.writeCache(false);
+    log("historyLog: caught up %u records in %u sec", bulkRecords, (millis() - bulkStartMs) / 1000);
+    bulk = false;
+  }
+}
+
+//**********************************************************************************************
+//        historyStatus(status) - GET /status?datalogs, catch-up progress and ETA
+//**********************************************************************************************
+
+void historyStatus(JsonObject& status){
+  status.set(F("synchronized"), synchronized);
+  if(bulk){
+    uint32_t behind = Current_log.lastKey() - MIN(Current_log.lastKey(), History_log.lastKey());
+    uint32_t total = Current_log.lastKey() - MIN(Current_log.lastKey(), bulkStartKey);
+    uint32_t elapsedMs = millis() - bulkStartMs;
+    status.set(F("behind"), behind);
+    status.set(F("progress"), total ? (int)(100 - (uint64_t)behind * 100 / total) : 100);
+    if(bulkRecords && elapsedMs){
+      status.set(F("rate"), (uint32_t)((uint64_t)bulkRecords * 1000 / elapsedMs));
+      status.set(F("eta"), (uint32_t)((uint64_t)(behind / History_log.interval()) * elapsedMs / bulkRecords / 1000));
+    }
+  }
+}
+
 void logtoHistory(IotaLogRecord* logRecord){
   if(synchronized && (logRecord->UNIXtime % History_log.interval() == 0)){
     History_log.write(logRecord);
@@ -35,6 +85,8 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
   static uint32_t lastExitTime = 0;
   static uint32_t fillTarget = 0;                                         
   static IotaLogRecord* logRecord = nullptr;
+  static serviceBudget budget;
+  static IotaLogCursor cursor(&Current_log);
   trace(T_history,0);  
  
   switch(state){
@@ -54,10 +106,15 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
         // Initialize the historyLog class
      
       trace(T_history,2);   
+      if(compactLog){
+        History_log.compact(logChannels());
+      }
+      History_log.crc(logCRC);
       if(int rtc = History_log.begin(IOTA_HISTORY_LOG_PATH)){
         log("historyLog: Log file open failed: %d, service halted.", rtc);
         return 0;
       }
+      logChannelsCheck(History_log, "historyLog");
       
         // If it's not a new log, get the last entry.
      
@@ -95,36 +152,41 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
           // deleted after an interruption.
 
     case logFill: {
+      trace(T_history,10);
       if( ! logRecord) {
         logRecord = new IotaLogRecord;
         History_log.readSerial(logRecord, History_log.lastSerial());
+        bulkStart();
       }
-      logRecord->UNIXtime += History_log.interval();
-      if(logRecord->UNIXtime < fillTarget){ 
+      while(budget.next()){
+        logRecord->UNIXtime += History_log.interval();
+        if(logRecord->UNIXtime >= fillTarget){ 
+          delete logRecord;
+          logRecord = nullptr;
+          state = logData;
+          return 1;
+        }
         History_log.write(logRecord);
+        bulkRecords++;
       }
-      else {
-        delete logRecord;
-        logRecord = nullptr;
-        state = logData;
-      }
-      return 1;
+      return 15;
     }
 
     case logData: {
       trace(T_history,4);
+      bulkStart();
       while((History_log.lastKey() + History_log.interval()) <= Current_log.lastKey()){
         
         trace(T_history,5);
         if( ! logRecord){
           logRecord = new IotaLogRecord;
-          logRecord->UNIXtime = History_log.lastKey(); 
         }
-        logRecord->UNIXtime += History_log.interval();
-        if(Current_log.readKey(logRecord)){
+        logRecord->UNIXtime = History_log.lastKey() + History_log.interval();
+        if(cursor.read(logRecord)){
         log("historyLog: primary log file read failure. Service suspended.");
           delete logRecord;
           logRecord = nullptr;
+          bulkEnd();
           return 0;
         }
         trace(T_history,7); 
@@ -133,19 +195,24 @@ uint32_t historyLog(struct serviceBlock* _serviceBlock){
           Serial.println(logRecord->UNIXtime);
           delete logRecord;
           logRecord = nullptr;
+          bulkEnd();
           return 0;
         }
 
         trace(T_history,8); 
         History_log.write(logRecord);
+        bulkRecords++;
         
-        if(micros() > bingoTime){
+        if( ! budget.next()){
           delete logRecord;
           logRecord = nullptr;
           return 15;
         }
       }
       trace(T_history, 9);
+      delete logRecord;
+      logRecord = nullptr;
+      bulkEnd();
       synchronized = true;
       return 0; 
     }
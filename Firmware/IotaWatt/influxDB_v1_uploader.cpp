@@ -11,6 +11,7 @@ uint32_t influxDB_v1_uploader::handle_query_s(){
         _script = _outputs->first();
     }
     reqData.flush();
+    _payload.release();
     reqData.printf_P(PSTR("db=%s&epoch=s"), _database); 
     if(_retention){
         reqData.printf_P(PSTR("&rp=%s"), _retention);
@@ -125,7 +126,8 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
 
     // If not enough data to post, set wait and return.
 
-    if(Current_log.lastKey() < (_lastSent + _interval + (_interval * _bulkSend))){
+    uint32_t lastKey = dataLastKey();
+    if(lastKey < (_lastSent + _interval + (_interval * _bulkAdapt))){
         if(oldRecord){
             delete oldRecord;
             oldRecord = nullptr;
@@ -143,14 +145,14 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         oldRecord = new IotaLogRecord;
         newRecord = new IotaLogRecord;
         newRecord->UNIXtime = _lastSent + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
     }
 
     // Build post transaction from datalog records.
 
-    while(reqData.available() < uploaderBufferLimit && newRecord->UNIXtime < Current_log.lastKey()){
+    while(reqData.available() < postLimit() && newRecord->UNIXtime < lastKey){
 
-        if(micros() > bingoTime){
+        if( ! _budget.next()){
             return 10;
         }
         
@@ -161,7 +163,7 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         oldRecord = newRecord;
         newRecord = swap;
         newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
 
         // Compute the time difference between log entries.
         // If zero, don't bother.
@@ -170,7 +172,7 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         double elapsedHours = newRecord->logHours - oldRecord->logHours;
         if(elapsedHours == 0){
             trace(T_influx1,63);
-            if((newRecord->UNIXtime + _interval) <= Current_log.lastKey()){
+            if((newRecord->UNIXtime + _interval) <= lastKey){
                 return 1;
             }
             return UTCtime() + 1;
@@ -179,42 +181,15 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         // Build measurements for this interval
 
         trace(T_influx1,62); 
-        String lastMeasurement;
-        String thisMeasurement;
-        Script *script = _outputs->first();
-        while(script)
-        {
-            trace(T_influx1,63);     
-            double value = script->run(oldRecord, newRecord);
-            if(value == value){
-                trace(T_influx1,64);   
-                thisMeasurement = varStr(_measurement, script);
-                if(_staticKeySet && thisMeasurement.equals(lastMeasurement)){
-                    reqData.printf_P(PSTR(",%s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
-                } else {
-                    if(lastMeasurement.length()){
-                        reqData.printf(" %d\n", oldRecord->UNIXtime);
-                    }
-                    reqData.write(thisMeasurement);
-                    if(_tagSet){
-                        trace(T_influx1,64);
-                        influxTag* tag = _tagSet;
-                        while(tag){
-                            reqData.printf_P(PSTR(",%s=%s"), tag->key, varStr(tag->value, script).c_str());
-                            tag = tag->next;
-                        }
-                    }
-                    trace(T_influx1,65);
-                    reqData.printf_P(PSTR(" %s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
-                }
-            }
-            lastMeasurement = thisMeasurement;
-            script = script->next();
-        }
+        double* values = new double[_outputs->count()];
+        _outputs->evaluate(oldRecord, newRecord, values);
+        _lines.write(reqData, values, oldRecord->UNIXtime, _staticKeySet);
+        delete[] values;
         _lastPost = oldRecord->UNIXtime;
-        reqData.printf(" %d\n", _lastPost);
     }
 
+    catchup((_lastPost - _lastSent) / _interval, reqData.available() >= postLimit());
+
     // Add optional heap measurement
 
     if(_heap){
@@ -244,7 +219,7 @@ uint32_t influxDB_v1_uploader::handle_write_s(){
         endpoint += "&rp=";
         endpoint += _retention;
     }
-    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain");
+    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain", compressBody());
     return 1;
 }
 
@@ -274,8 +249,7 @@ uint32_t influxDB_v1_uploader::handle_checkWrite_s(){
     sprintf_P(msg, PSTR("Post failed %d"), _request->responseHTTPcode());
     delete[] _statusMessage;
     _statusMessage = charstar(msg);
-    delete _request;
-    _request = nullptr;
+    HTTPreturn(_request, false);
     _state = write_s;
     return UTCtime() + 10;
 }
@@ -335,6 +309,7 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
         _fieldKey = charstar(F("value"));
     }
     _stop = config.get<bool>(F("stop"));
+    _compression = config[F("compression")].as<bool>() || strcmp_ci(config[F("compression")] | "", "gzip") == 0;
 
     // Build tagSet
 
@@ -366,6 +341,21 @@ bool influxDB_v1_uploader::configCB(JsonObject& config){
         return strcmp(varStr(_measurement, a).c_str(), varStr(_measurement, b).c_str());
     });
 
+            // Precompile the line prefixes.
+
+    _lines.begin(_outputs->count());
+    int output = 0;
+    for(Script* script=_outputs->first(); script; script=script->next()){
+        String tags;
+        for(influxTag* tag=_tagSet; tag; tag=tag->next){
+            tags += ',';
+            tags += influxLines::escape(String(tag->key), ",= ");
+            tags += '=';
+            tags += influxLines::escape(varStr(tag->value, script), ",= ");
+        }
+        _lines.set(output++, varStr(_measurement, script), tags, varStr(_fieldKey, script), script->precision());
+    }
+
     // If port wasn't specified, set influxDB_v1 default port.
 
     if( ! _url->port()){
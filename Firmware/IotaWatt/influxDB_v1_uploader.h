@@ -63,6 +63,7 @@ class influxDB_v1_uploader : public uploader
         char *_measurement;
         bool _staticKeySet;
         bool _heap;
+        influxLines _lines;             // Precompiled measurement, tags and field key per output
 
         void queryLast();
         uint32_t handle_query_s();
@@ -34,6 +34,8 @@ uint32_t influxDB_v2_uploader::handle_query_s(){
     // Build a flux query to find last record in set of measurements.
     
     reqData.flush();
+    
+    _payload.release();
     reqData.printf_P(PSTR("from(bucket: \"%s\")\n"), _bucket);
     reqData.printf_P(PSTR("  |> range(start: %d, stop: %d)\n"), rangeBegin, rangeStop);
     reqData.printf_P(PSTR("  |> filter(fn: (r) =>"));
@@ -164,7 +166,8 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
 
     // If not enough data to post, set wait and return.
 
-    if(Current_log.lastKey() < (_lastSent + _interval + (_interval * _bulkSend))){
+    uint32_t lastKey = dataLastKey();
+    if(lastKey < (_lastSent + _interval + (_interval * _bulkAdapt))){
         if(oldRecord){
             delete oldRecord;
             oldRecord = nullptr;
@@ -182,14 +185,14 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
         oldRecord = new IotaLogRecord;
         newRecord = new IotaLogRecord;
         newRecord->UNIXtime = _lastSent + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
     }
 
     // Build post transaction from datalog records.
 
-    while(reqData.available() < uploaderBufferLimit && newRecord->UNIXtime < Current_log.lastKey()){
+    while(reqData.available() < postLimit() && newRecord->UNIXtime < lastKey){
         
-        if(micros() > bingoTime){
+        if( ! _budget.next()){
             return 10;
         }
 
@@ -200,7 +203,7 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
         oldRecord = newRecord;
         newRecord = swap;
         newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
-        Current_log.readKey(newRecord);
+        readFeed(newRecord);
 
         // Compute the time difference between log entries.
         // If zero, don't bother.
@@ -209,7 +212,7 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
         double elapsedHours = newRecord->logHours - oldRecord->logHours;
         if(elapsedHours == 0){
             trace(T_influx2,63);
-            if((newRecord->UNIXtime + _interval) <= Current_log.lastKey()){
+            if((newRecord->UNIXtime + _interval) <= lastKey){
                 return 1;
             }
             return UTCtime() + 1;
@@ -218,42 +221,15 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
         // Build measurements for this interval
 
         trace(T_influx2,62); 
-        String lastMeasurement;
-        String thisMeasurement;
-        Script *script = _outputs->first();
-        while(script)
-        {
-            trace(T_influx2,63);     
-            double value = script->run(oldRecord, newRecord);
-            if(value == value){
-                trace(T_influx2,64);   
-                thisMeasurement = varStr(_measurement, script);
-                if(_staticKeySet && thisMeasurement.equals(lastMeasurement)){
-                    reqData.printf_P(PSTR(",%s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
-                } else {
-                    if(lastMeasurement.length()){
-                        reqData.printf(" %d\n", oldRecord->UNIXtime);
-                    }
-                    reqData.write(thisMeasurement);
-                    if(_tagSet){
-                        trace(T_influx2,64);
-                        influxTag* tag = _tagSet;
-                        while(tag){
-                            reqData.printf_P(PSTR(",%s=%s"), tag->key, varStr(tag->value, script).c_str());
-                            tag = tag->next;
-                        }
-                    }
-                    trace(T_influx2,65);
-                    reqData.printf_P(PSTR(" %s=%.*f"), varStr(_fieldKey, script).c_str(), script->precision(), value);
-                }
-            }
-            lastMeasurement = thisMeasurement;
-            script = script->next();
-        }
+        double* values = new double[_outputs->count()];
+        _outputs->evaluate(oldRecord, newRecord, values);
+        _lines.write(reqData, values, oldRecord->UNIXtime, _staticKeySet);
+        delete[] values;
         _lastPost = oldRecord->UNIXtime;
-        reqData.printf(" %d\n", _lastPost);
     }
     
+    catchup((_lastPost - _lastSent) / _interval, reqData.available() >= postLimit());
+
     // Add optional heap measurement
 
     if(_heap){
@@ -281,7 +257,7 @@ uint32_t influxDB_v2_uploader::handle_write_s(){
     endpoint += _orgID;
     endpoint += "&bucket=";
     endpoint += _bucket;
-    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain");
+    HTTPPost(endpoint.c_str(), checkWrite_s, "text/plain", compressBody());
     return 1;
 }
 
@@ -318,8 +294,7 @@ uint32_t influxDB_v2_uploader::handle_checkWrite_s(){
     sprintf_P(msg, PSTR("Post failed %d"), _request->responseHTTPcode());
     delete[] _statusMessage;
     _statusMessage = charstar(msg);
-    delete _request;
-    _request = nullptr; 
+    HTTPreturn(_request, false);
     _state = write_s;
     return UTCtime() + 2;
 }
@@ -377,6 +352,7 @@ bool influxDB_v2_uploader::configCB(JsonObject& config){
     }
     trace(T_influx2, 102);
     _stop = config.get<bool>(F("stop"));
+    _compression = config[F("compression")].as<bool>() || strcmp_ci(config[F("compression")] | "", "gzip") == 0;
 
     // Build tagSet
 
@@ -417,6 +393,21 @@ bool influxDB_v2_uploader::configCB(JsonObject& config){
         return strcmp(varStr(_measurement, a).c_str(), varStr(_measurement, b).c_str());
     });
 
+            // Precompile the line prefixes.
+
+    _lines.begin(_outputs->count());
+    int output = 0;
+    for(Script* script=_outputs->first(); script; script=script->next()){
+        String tags;
+        for(influxTag* tag=_tagSet; tag; tag=tag->next){
+            tags += ',';
+            tags += influxLines::escape(String(tag->key), ",= ");
+            tags += '=';
+            tags += influxLines::escape(varStr(tag->value, script), ",= ");
+        }
+        _lines.set(output++, varStr(_measurement, script), tags, varStr(_fieldKey, script), script->precision());
+    }
+
     return true;
 }
     
@@ -63,6 +63,7 @@ class influxDB_v2_uploader : public uploader
         char *_fieldKey;
         bool _staticKeySet;
         bool _heap;
+        influxLines _lines;             // Precompiled measurement, tags and field key per output
 
         uint32_t handle_query_s();
         uint32_t handle_checkQuery_s();
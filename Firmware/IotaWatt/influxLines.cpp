@@ -0,0 +1,167 @@
+/**********************************************************************************************
+ * influxLines - precompiled line protocol shared by the influxDB_v1 and influxDB_v2 uploaders.
+ *
+ * The outputs are sorted by measurement, so outputs with the same measurement are adjacent and
+ * share a group.  With a static key set, consecutive values in the same group become fields of
+ * one line, as the uploaders always did.  Otherwise each value gets its own line.
+ *
+ * See influxLines.h for the benchmark.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+void influxLines::begin(int count){
+  delete[] _line;
+  _line = nullptr;
+  _count = count;
+  if(_count){
+    _line = new influxLine[_count];
+  }
+  _lastMeasurement = "";
+}
+
+void influxLines::set(int output, const String& measurement, const String& tags, const String& fieldKey, int precision){
+  if(output >= _count){
+    return;
+  }
+  influxLine* line = &_line[output];
+  String head = escape(measurement, ", ");
+  head += tags;
+  head += ' ';
+  head += escape(fieldKey, ",= ");
+  head += '=';
+  delete[] line->head;
+  line->head = charstar(head);
+  line->headLen = head.length();
+  String field = String(',') + escape(fieldKey, ",= ") + '=';
+  delete[] line->field;
+  line->field = charstar(field);
+  line->fieldLen = field.length();
+  line->precision = precision;
+  line->group = output;
+  if(output && measurement.equals(_lastMeasurement)){
+    line->group = _line[output - 1].group;
+  }
+  _lastMeasurement = measurement;
+}
+
+void influxLines::write(xbuf& buf, double* values, uint32_t timestamp, bool staticKeySet){
+  char stamp[16];
+  stamp[0] = ' ';
+  size_t stampLen = formatFixed(stamp + 1, timestamp, 0) + 1;
+  stamp[stampLen++] = '\n';
+  char value[32];
+  int lastGroup = -1;
+  for(int i=0; i<_count; i++){
+    if(values[i] == values[i]){
+      influxLine* line = &_line[i];
+      if(staticKeySet && line->group == lastGroup){
+        buf.write((uint8_t*)line->field, line->fieldLen);
+      }
+      else {
+        if(lastGroup >= 0){
+          buf.write((uint8_t*)stamp, stampLen);
+        }
+        buf.write((uint8_t*)line->head, line->headLen);
+      }
+      buf.write((uint8_t*)value, formatFixed(value, values[i], line->precision));
+      lastGroup = line->group;
+    }
+  }
+  buf.write((uint8_t*)stamp, stampLen);
+}
+
+      // Backslash escape the special characters, for
+      // measurement ", " and for tag keys, tag values and field keys ",= ".
+
+String influxLines::escape(const String& in, const char* special){
+  String out;
+  for(int i=0; i<in.length(); i++){
+    if(strchr(special, in[i])){
+      out += '\\';
+    }
+    out += in[i];
+  }
+  return out;
+}
+
+/*******************************************************************************************************
+ * influxBenchmark(records) - GET /command?influxbench=n
+ * 
+ * Uses the output Scripts over the last hour of the current log, with measurement $name, a
+ * device=$device tag and field key value.  The printf way is the per-value expansion and
+ * formatting the uploaders did before the lines were precompiled.
+ ******************************************************************************************************/
+
+String  influxBenchmark(int records){
+  if(records <= 0) records = 100;
+  records = MIN(records, 10000);
+  if( ! Current_log.isOpen()){
+    return String(F("Current log not open"));
+  }
+  if( ! outputs->count()){
+    return String(F("No outputs"));
+  }
+  IotaLogRecordHandle oldRec;
+  IotaLogRecordHandle newRec;
+  newRec->UNIXtime = Current_log.lastKey();
+  Current_log.readKey(newRec);
+  oldRec->UNIXtime = newRec->UNIXtime - 3600;
+  Current_log.readKey(oldRec);
+  double* values = new double[outputs->count()];
+  outputs->evaluate(oldRec, newRec, values);
+
+  influxLines lines;
+  lines.begin(outputs->count());
+  String tags = String(F(",device=")) + influxLines::escape(String(deviceName), ",= ");
+  int output = 0;
+  for(Script* script=outputs->first(); script; script=script->next()){
+    lines.set(output++, String(script->name()), tags, String(F("value")), script->precision());
+  }
+
+  xbuf buf;
+  size_t bytes = 0;
+  uint32_t startUs = micros();
+  for(int i=0; i<records; i++){
+    lines.write(buf, values, newRec->UNIXtime, true);
+    bytes += buf.available();
+    buf.flush();
+  }
+  uint32_t templateUs = micros() - startUs;
+  yield();
+
+  startUs = micros();
+  for(int i=0; i<records; i++){
+    String lastMeasurement;
+    String thisMeasurement;
+    output = 0;
+    for(Script* script=outputs->first(); script; script=script->next()){
+      double value = values[output++];
+      if(value == value){
+        thisMeasurement = script->name();
+        if(thisMeasurement.equals(lastMeasurement)){
+          buf.printf_P(PSTR(",%s=%.*f"), "value", script->precision(), value);
+        } else {
+          if(lastMeasurement.length()){
+            buf.printf(" %d\n", newRec->UNIXtime);
+          }
+          buf.write(thisMeasurement);
+          buf.printf_P(PSTR(",%s=%s"), "device", deviceName);
+          buf.printf_P(PSTR(" %s=%.*f"), "value", script->precision(), value);
+        }
+      }
+      lastMeasurement = thisMeasurement;
+    }
+    buf.printf(" %d\n", newRec->UNIXtime);
+    buf.flush();
+  }
+  uint32_t printfUs = micros() - startUs;
+
+  delete[] values;
+  char line[120];
+  snprintf_P(line, sizeof(line), PSTR("%d records, %d outputs, %d bytes/record\r\n"
+        "template: %.2f records/ms\r\nprintf: %.2f records/ms\r\n"),
+        records, outputs->count(), bytes / records,
+        templateUs ? (float)records * 1000 / templateUs : 0.0f,
+        printfUs ? (float)records * 1000 / printfUs : 0.0f);
+  return String(line);
+}
@@ -2,12 +2,31 @@
  
     // The integrator Service is created at startup to synchronize the 
     // integration log with the datalog, including [re]creating.
+    // The logs that are behind are caught up together by the
+    // integrator_catchup Service in one pass of the datalog.
     // When the log catches up to the datalog, the datalog Service
     // takes over with direct calls to create new entries at the
     // same time as datalog records, eliminating race conditions. 
+    // Each datalog record pair is evaluated once for all integrators
+    // at it, the Scripts sharing the input deltas as in a ScriptSet.
+    // Each integration log also has an hourly rollup, the on-the-hour
+    // records, so long range queries don't search the 5 second log.
 
 const char intDirectory_P[] PROGMEM = IOTA_INTEGRATIONS_DIR;
 
+static bool catchupActive = false;              // integrator_catchup Service is running
+static IotaLogRecord *catchupOld = nullptr;     // Datalog records of the pass
+static IotaLogRecord *catchupNew = nullptr;
+static IotaLogCursor catchupCursor(&Current_log);
+
+static String rollupPath(const char* name){
+    String path(FPSTR(intDirectory_P));
+    path += F(INTEGRATOR_ROLLUP_DIR "/");
+    path += name;
+    path += ".log";
+    return path;
+}
+
 uint32_t integrator_dispatch(struct serviceBlock* serviceBlock) {
     trace(T_integrator,0);
     integrator *_this = (integrator *)serviceBlock->serviceParm;
@@ -47,9 +66,12 @@ integrator::~integrator(){
     SD.remove(filepath.c_str());
     log("%s: Integration log %s deleted.", _id, _name);
     delete _log;
+    if(_rollup){
+        _rollup->end();
+        SD.remove(rollupPath(_name).c_str());
+        delete _rollup;
+    }
     delete[] _name;
-    delete _oldRec;
-    delete _newRec;
 };
 
 uint32_t integrator::handle_initialize_s(){
@@ -86,6 +108,27 @@ uint32_t integrator::handle_initialize_s(){
     }
     trace(T_integrator,10);
 
+    // Open the rollup log.  One ahead of the integration log is from 
+    // an earlier integration and is rebuilt.  Integration carries on
+    // without a rollup if it can't be opened.
+
+    String rollup = rollupPath(_name);
+    _rollup = new IotaLog(sizeof(intRecord), INTEGRATOR_ROLLUP, 366, 24);
+    if(_rollup->begin(rollup.c_str()) == 0 && _rollup->fileSize() && _rollup->lastKey() > _log->lastKey()){
+        _rollup->end();
+        SD.remove(rollup.c_str());
+        rollup.replace(".log", ".ndx");
+        SD.remove(rollup.c_str());
+        rollup.replace(".ndx", ".sup");
+        SD.remove(rollup.c_str());
+        _rollup->begin(rollupPath(_name).c_str());
+    }
+    if( ! _rollup->isOpen()){
+        log("%s: Couldn't open rollup file.", _id);
+        delete _rollup;
+        _rollup = nullptr;
+    }
+
     // Initialize the intRecord;
 
     _intRec.UNIXtime = _log->lastKey();
@@ -102,69 +145,199 @@ uint32_t integrator::handle_initialize_s(){
         _intRec.UNIXtime = MAX(Current_log.lastKey() - (3600 * 24), Current_log.firstKey());
         log("%s: New log starting %s", _id, localDateString(_intRec.UNIXtime).c_str());
     }
+    _catchupStart = _intRec.UNIXtime;
+    _catchupMs = millis();
+    _catchupRecords = 0;
 
+    _cursor = IotaLogCursor(_log);
     _log->writeCache(true);
     _state = integrate_s;
     return 1;
 }
 
 uint32_t integrator::handle_integrate_s(){
-    
-    // While data is available
 
-    while(Current_log.lastKey() >= _intRec.UNIXtime + _interval){
+    // integrator_catchup does the work, this fills the rollup
+    // and waits to handle end() until synchronized.
 
-        if(!_oldRec){
-            _oldRec = new IotaLogRecord;
-            _newRec = new IotaLogRecord;
-            _newRec->UNIXtime = _intRec.UNIXtime;
-            Current_log.readKey(_newRec);
-        }
+    if(_rollup && ! _rollupSynced && ! fillRollup()){
+        return 10;
+    }
+    if(_synchronized && (! _rollup || _rollupSynced)){
+        _serviceRunning = false;
+        return 0;
+    }
+    if( ! _synchronized && ! catchupActive){
+        catchupActive = true;
+        NewService(integrator_catchup, T_integrator);
+    }
+    return UTCtime() + 1;
+}
 
-        if(_newRec->UNIXtime < _intRec.UNIXtime + _interval){
-            IotaLogRecord *swapRec = _oldRec;
-            _oldRec = _newRec;
-            _newRec = swapRec;
-            _newRec->UNIXtime = _oldRec->UNIXtime + _interval;
-            _newRec->serial = _oldRec->serial;
-            Current_log.readNext(_newRec);
+    // Add the hours in the integration log to the rollup.
+    // Once caught up, integrate() adds each hour as it's logged.
+    // Returns true when caught up.
+
+bool integrator::fillRollup(){
+    static serviceBudget budget(2500);
+    while(budget.next()){
+        uint32_t key = _rollup->lastKey() + INTEGRATOR_ROLLUP;
+        if(_rollup->fileSize() == 0){
+            key = _log->firstKey() + INTEGRATOR_ROLLUP - 1;
+            key -= key % INTEGRATOR_ROLLUP;
+        }
+        if(_log->fileSize() == 0 || key > _log->lastKey()){
+            trace(T_integrator,31);
+            if(_rollup->fileSize()){
+                log("%s: Rollup synchronized %s", _id, localDateString(_rollup->lastKey()).c_str());
+            }
+            _rollupSynced = true;
+            return true;
         }
+        intRecord rollRec;
+        rollRec.UNIXtime = key;
+        if(_cursor.read((IotaLogRecord*)&rollRec) == 2){
+            log("%s: Integration log read failure, rollup stopped.", _id);
+            _rollup->end();
+            delete _rollup;
+            _rollup = nullptr;
+            return true;
+        }
+        trace(T_integrator,30);
+        rollRec.UNIXtime = key;
+        _rollup->write((IotaLogRecord*)&rollRec);
+    }
+    return false;
+}
 
-        // If this record is within interval, add to integral.
-
-        if(_newRec->UNIXtime <= _intRec.UNIXtime + _interval){
-            double elapsed = _newRec->logHours - _oldRec->logHours;
-            if(elapsed == elapsed && elapsed > 0){
-                double value = _script->run(_oldRec, _newRec, "Wh");
-                if(value > 0){
-                    _intRec.sumPositive += value;
-                }
-                else {
-                    _intRec.sumNegative += value;
-                }
-                _intRec.sumNet += value;
+    // Integrators typically start together, after a restart or when the
+    // integration logs are deleted, and would each read the same datalog
+    // records to catch up.  This Service reads them once, in one pass 
+    // from the earliest integrator, and every integrator that is at the
+    // time of the pass integrates the record pair and logs its entry. 
+    // Integrators ahead of the pass join it as it gets to them.  One behind
+    // (newly configured) restarts the pass from there.
+    // There are no integrator pointers kept between dispatches, so
+    // integrators can come and go with configuration changes.
+
+uint32_t integrator_catchup(struct serviceBlock *serviceBlock){
+    static serviceBudget budget(2500);
+    trace(T_integrator,20);
+    serviceBlock->priority = priorityLow;
+    uint32_t interval = Current_log.interval();
+
+    // Find the earliest unsynchronized integrator that can advance.
+    // Those waiting for a peer log are left until it has the next interval.
+
+    uint32_t lowKey = UINT32_MAX;
+    bool waiting = false;
+    Script *script = integrations->first();
+    while(script){
+        integrator *_this = (integrator *)script->getParm();
+        if(_this && _this->_state == integrator::integrate_s && ! _this->_synchronized){
+            if(_this->_script->availableKey() >= _this->_intRec.UNIXtime + interval){
+                lowKey = MIN(lowKey, _this->_intRec.UNIXtime);
             }
+            else {
+                waiting = true;
+            }
+        }
+        script = script->next();
+    }
+    if(lowKey == UINT32_MAX && waiting){
+        return UTCtime() + 5;
+    }
+    if(lowKey == UINT32_MAX){
+        trace(T_integrator,21);
+        delete catchupOld;
+        catchupOld = nullptr;
+        delete catchupNew;
+        catchupNew = nullptr;
+        catchupActive = false;
+        return 0;
+    }
+
+    // Start the pass, or restart from an integrator that is behind it.
+
+    if( ! catchupNew || lowKey < catchupNew->UNIXtime){
+        trace(T_integrator,22);
+        if( ! catchupNew){
+            catchupOld = new IotaLogRecord;
+            catchupNew = new IotaLogRecord;
         }
+        catchupCursor = Current_log.readRange(lowKey, UINT32_MAX, interval);
+        catchupCursor.next(catchupNew);
+    }
 
-        // If integration complete for this interval, log it.
+    // While data is available, step the pass and integrate.
+    // The range is open ended, the pass stops at the end of the datalog.
 
-        if(_newRec->UNIXtime >= _intRec.UNIXtime + _interval){
-            _intRec.UNIXtime += _interval;
-            _log->write((IotaLogRecord *)&_intRec);
+    while(Current_log.lastKey() >= catchupNew->UNIXtime + interval){
+        if( ! catchupCursor.next(catchupOld)){
+            trace(T_integrator,24);
+            catchupCursor = Current_log.readRange(catchupNew->UNIXtime + interval, UINT32_MAX, interval);
+            return UTCtime() + 5;
+        }
+        IotaLogRecord *swapRec = catchupOld;
+        catchupOld = catchupNew;
+        catchupNew = swapRec;
+
+        scriptDeltas deltas(catchupOld, catchupNew);
+        script = integrations->first();
+        while(script){
+            integrator *_this = (integrator *)script->getParm();
+            if(_this && _this->_state == integrator::integrate_s && ! _this->_synchronized &&
+               _this->_intRec.UNIXtime == catchupOld->UNIXtime &&
+               _this->_script->availableKey() >= catchupNew->UNIXtime){
+                _this->integrate(deltas);
+            }
+            script = script->next();
         }
 
-        if((micros() + 2500) >= bingoTime){
+        if( ! budget.next()){
             return 10;
         }
     }
-    
-    delete _oldRec;
-    _oldRec = nullptr;
-    delete _newRec;
-    _newRec = nullptr;
-    _log->writeCache(false);
-    _synchronized = true;
-    return 0;
+
+    // Those that have caught up are synchronized.
+
+    trace(T_integrator,23);
+    script = integrations->first();
+    while(script){
+        integrator *_this = (integrator *)script->getParm();
+        if(_this && _this->_state == integrator::integrate_s && ! _this->_synchronized &&
+           Current_log.lastKey() < _this->_intRec.UNIXtime + _this->_interval){
+            _this->_log->writeCache(false);
+            _this->_synchronized = true;
+            log("%s: Synchronized %s", _this->_id, localDateString(_this->_intRec.UNIXtime).c_str());
+        }
+        script = script->next();
+    }
+    return UTCtime() + 1;
+}
+
+    // Integrate a pair of datalog records and log the interval.
+
+void integrator::integrate(scriptDeltas& deltas){
+    double elapsed = deltas.elapsedHours;
+    if(elapsed == elapsed && elapsed > 0){
+        double value = _script->run(deltas, Wh);
+        if(value > 0){
+            _intRec.sumPositive += value;
+        }
+        else {
+            _intRec.sumNegative += value;
+        }
+        _intRec.sumNet += value;
+    }
+    _intRec.UNIXtime += _interval;
+    _log->write((IotaLogRecord *)&_intRec);
+    if( ! _synchronized){
+        _catchupRecords++;
+    }
+    if(_rollup && _rollupSynced && _intRec.UNIXtime % INTEGRATOR_ROLLUP == 0){
+        _rollup->write((IotaLogRecord *)&_intRec);
+    }
 }
 
             // This method is invoked from the datalog Service when after a new entry is written.
@@ -173,21 +346,25 @@ uint32_t integrator::handle_integrate_s(){
             // produce invalid results if there is a window between datalog and integration log records.
             // This routine tightly couples the two to eliminate that window in normal operation.
 
-void integrator::newLogEntry(IotaLogRecord* oldRecord, IotaLogRecord* newRecord){
-    if(_synchronized){
-        double elapsed = newRecord->logHours - oldRecord->logHours;
-        if(elapsed == elapsed && elapsed > 0){
-            double value = _script->run(oldRecord, newRecord, "Wh");
-            if(value >= 0){
-                _intRec.sumPositive += value;
-            }
-            else {
-                _intRec.sumNegative += value;
-            }
+            // An integration of peer inputs the peer log doesn't have yet drops back to
+            // integrator_catchup, which integrates the intervals as the peer log gets them.
+
+void integrator::newLogEntry(scriptDeltas& deltas){
+    if( ! _synchronized){
+        return;
+    }
+    if(_script->availableKey() < deltas.newRec->UNIXtime){
+        _synchronized = false;
+        _catchupStart = _intRec.UNIXtime;
+        _catchupMs = millis();
+        _catchupRecords = 0;
+        if( ! catchupActive){
+            catchupActive = true;
+            NewService(integrator_catchup, T_integrator);
         }
-        _intRec.UNIXtime += _interval;
-        _log->write((IotaLogRecord *)&_intRec);
+        return;
     }
+    integrate(deltas);
 }
 
 char *integrator::name(){
@@ -206,8 +383,31 @@ bool integrator::isSynchronized(){
     return _synchronized;
 }
 
+uint32_t integrator::availableKey(){
+    return (_state == integrate_s && ! _synchronized) ? _intRec.UNIXtime : UINT32_MAX;
+}
+
+void integrator::getStatusJson(JsonObject& status){
+    status.set(F("synchronized"), _synchronized);
+    if( ! _synchronized && _state == integrate_s){
+        uint32_t behind = Current_log.lastKey() - MIN(Current_log.lastKey(), _intRec.UNIXtime);
+        uint32_t total = Current_log.lastKey() - MIN(Current_log.lastKey(), _catchupStart);
+        uint32_t elapsedMs = millis() - _catchupMs;
+        status.set(F("behind"), behind);
+        status.set(F("progress"), total ? (int)(100 - (uint64_t)behind * 100 / total) : 100);
+        if(_catchupRecords && elapsedMs){
+            status.set(F("rate"), (uint32_t)((uint64_t)_catchupRecords * 1000 / elapsedMs));
+            status.set(F("eta"), (uint32_t)((uint64_t)(behind / _interval) * elapsedMs / _catchupRecords / 1000));
+        }
+    }
+    if(_rollup){
+        status.set(F("rollupkey"), _rollup->lastKey());
+        status.set(F("rollupsynchronized"), _rollupSynced);
+    }
+}
+
 void integrator::end(){
-    if(_synchronized){
+    if( ! _serviceRunning){
         delete this;
     }
     else {
@@ -223,7 +423,8 @@ uint32_t integrator::handle_end_s(){
 
 double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units Units, char method){
     trace(T_integrator, 0);
-    if( ! _synchronized || newRecord->UNIXtime < _log->firstKey()){
+    if(_state != integrate_s || newRecord->UNIXtime < _log->firstKey() ||
+       (! _synchronized && newRecord->UNIXtime > _intRec.UNIXtime)){
         return 0;
     }
     
@@ -277,32 +478,8 @@ double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units
     // Fetch the integration log records.
 
     trace(T_integrator, 8);
-
-    // See if we already have either record (very likely).
-    // If so, move to correct position.
-
-    if(oldRecord->UNIXtime == newInt->UNIXtime || newRecord->UNIXtime == oldInt->UNIXtime){
-        trace(T_integrator, 8, 1);
-        intRecord *swap = oldInt;
-        oldInt = newInt;
-        newInt = swap;
-    }
-
-        // Now read if necessary.
-
-    if(oldRecord->UNIXtime != oldInt->UNIXtime){
-        oldInt->UNIXtime = oldRecord->UNIXtime;
-        trace(T_integrator, 9);
-        int rtc = _log->readKey((IotaLogRecord*)oldInt); 
-        trace(T_integrator, 9, rtc);
-    }
-
-    if(newRecord->UNIXtime != newInt->UNIXtime){
-        newInt->UNIXtime = newRecord->UNIXtime;
-        trace(T_integrator, 10);
-        int rtc = _log->readKey((IotaLogRecord*)newInt);
-        trace(T_integrator, 10, rtc);
-    }
+    intRecord *oldInt = readCache(oldRecord->UNIXtime);
+    intRecord *newInt = readCache(newRecord->UNIXtime, oldInt);
 
     trace(T_integrator, 11);
 
@@ -322,6 +499,48 @@ double integrator::run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units
     return 0;
 }
 
+    // Find or read the integration log record for a key, without replacing keep.
+    // Only records within the log are kept, as those outside may yet be written or wrapped.
+
+integrator::intRecord* integrator::readCache(uint32_t key, intRecord *keep){
+    key -= key % _interval;
+    bool inLog = key >= _log->firstKey() && key <= _log->lastKey();
+    int slot = (keep == &_cache[0].rec) ? 1 : 0;
+    for(int i=0; i<INTEGRATOR_CACHE_ROWS; i++){
+        if(inLog && _cache[i].used && _cache[i].rec.UNIXtime == key){
+            _cache[i].used = ++_cacheClock;
+            return &_cache[i].rec;
+        }
+        if(&_cache[i].rec == keep){
+            continue;
+        }
+        if(_cache[i].rank < _cache[slot].rank ||
+          (_cache[i].rank == _cache[slot].rank && _cache[i].used < _cache[slot].used)){
+            slot = i;
+        }
+    }
+    trace(T_integrator, 9);
+    cacheRow *row = &_cache[slot];
+    row->rec.UNIXtime = key;
+    int rtc;
+    if(inLog && _rollup && _rollup->fileSize() && key % INTEGRATOR_ROLLUP == 0 &&
+       key >= _rollup->firstKey() && key <= _rollup->lastKey()){
+        rtc = _rollup->readKey((IotaLogRecord*)&row->rec);
+    }
+    else {
+        rtc = _cursor.read((IotaLogRecord*)&row->rec);
+    }
+    trace(T_integrator, 9, rtc);
+    if(rtc || ! inLog){
+        row->used = 0;
+        row->rank = 0;
+        return &row->rec;
+    }
+    row->used = ++_cacheClock;
+    row->rank = (UTC2Local(key) % 86400 == 0) ? 2 : (key % 3600 == 0) ? 1 : 0;
+    return &row->rec;
+}
+
 bool integrator::config(Script* script){
     trace(T_integrator,105);
     _id = charstar(script->name());
@@ -331,6 +550,7 @@ bool integrator::config(Script* script){
         trace(T_integrator,105);
         serviceBlock *sb = NewService(integrator_dispatch, T_integrator);
         sb->serviceParm = (void *)this;
+        _serviceRunning = true;
     }
     trace(T_integrator,106);
     return true;
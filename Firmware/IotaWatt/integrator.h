@@ -4,17 +4,31 @@
 #include "iotaScript.h"
 class Script;
 
+#define INTEGRATOR_CACHE_ROWS 8         // Integration log records kept for queries
+#define INTEGRATOR_ROLLUP 3600          // Rollup log interval (sec)
+#define INTEGRATOR_ROLLUP_DIR "hourly"  // Rollup logs subdirectory of the integrations
+
+uint32_t integrator_catchup(struct serviceBlock*);  // Synchronizes all integrators in one datalog pass
+
 class integrator {
 
+    friend uint32_t integrator_catchup(struct serviceBlock*);
+
     public:
         integrator() :  _name(0),
                         _id(0),
                         _script(0),
                         _interval(5),
                         _synchronized(false),
+                        _serviceRunning(false),
                         _log(0),
-                        _oldRec(0),
-                        _newRec(0),
+                        _rollup(0),
+                        _rollupSynced(false),
+                        _catchupStart(0),
+                        _catchupMs(0),
+                        _catchupRecords(0),
+                        _cursor(nullptr),
+                        _cacheClock(0),
                         _state(initialize_s){};
 
         ~integrator();
@@ -24,10 +38,11 @@ class integrator {
         void getStatusJson(JsonObject&);
         uint32_t dispatch(struct serviceBlock *serviceBlock);
         double run(IotaLogRecord *oldRecord, IotaLogRecord *newRecord, units Units, char method);
-        void newLogEntry(IotaLogRecord *oldRecord, IotaLogRecord *newRecord);
+        void newLogEntry(scriptDeltas& deltas);
         char *name();
         IotaLog* get_log();
         bool isSynchronized();
+        uint32_t availableKey();        // Last datalog key integrated
         void end();
 
     protected:
@@ -36,9 +51,13 @@ class integrator {
         Script *_script;                // --> integration Script
         int _interval;                  // aggregation interval
         bool _synchronized;             // integration log is up to date with datalog
+        bool _serviceRunning;           // integrator Service holds a pointer to this
         IotaLog *_log;                  // integration log
-        IotaLogRecord *_oldRec;         // datalog records used during synchronization
-        IotaLogRecord *_newRec;
+        IotaLog *_rollup;               // hourly records of the integration log
+        bool _rollupSynced;             // rollup log is up to date with integration log
+        uint32_t _catchupStart;         // Log key when synchronization started
+        uint32_t _catchupMs;            // millis() when synchronization started
+        uint32_t _catchupRecords;       // Records integrated since then
 
         struct intRecord {
             uint32_t UNIXtime;          // Time period represented by this record
@@ -49,9 +68,17 @@ class integrator {
             intRecord() : UNIXtime(0), serial(0), sumPositive(0), sumNegative(0), sumNet(0){}; 
         } _intRec;
 
-        intRecord _cache1, _cache2;     // The integration log cache reduces reads during queries
-        intRecord *oldInt = &_cache1;
-        intRecord *newInt = &_cache2;
+            // The integration log cache reduces reads during queries.
+            // Query rows share boundaries, and repeated reports share
+            // hour and day boundaries, which are kept in preference.
+
+        struct cacheRow {
+            intRecord rec;
+            uint32_t used = 0;          // _cacheClock when last used (0 = empty)
+            uint8_t rank = 0;           // 0 = interval, 1 = hour, 2 = local day boundary
+        } _cache[INTEGRATOR_CACHE_ROWS];
+        IotaLogCursor _cursor;          // Reads of the integration log
+        uint32_t _cacheClock;
 
         enum states {
             initialize_s,
@@ -59,6 +86,9 @@ class integrator {
             end_s
         } _state;
 
+        void integrate(scriptDeltas& deltas);
+        intRecord* readCache(uint32_t key, intRecord *keep = nullptr);
+        bool fillRollup();
         uint32_t handle_initialize_s();
         uint32_t handle_integrate_s();
         uint32_t handle_end_s();
@@ -16,6 +16,7 @@ void IotaInputChannel::reset(){
     _signed = false; 
     _reverse = false;
     _double = false;
+    _minRefresh = 0;
 }
 
 void IotaInputChannel::ageBuckets(uint32_t timeNow) {
@@ -35,6 +36,7 @@ void IotaInputChannel::setVoltage(float volts, float Hz){
 
 void IotaInputChannel::setVoltage(float volts){
     if(_type != channelTypeVoltage) return;
+    sampled(dataBucket.volts, volts);
     dataBucket.volts = volts;
     ageBuckets(millis());
 }
@@ -46,40 +48,110 @@ void IotaInputChannel::setHz(float Hz){
 
 void IotaInputChannel::setPower(float watts, float VA){
     if(_type != channelTypePower) return;
+    sampled(dataBucket.watts, watts);
     dataBucket.watts = watts;
     dataBucket.VA = VA;
     ageBuckets(millis());
 }
 
+        // Maintain the sampling statistics used by the channel scheduler.
+        // Weight is 1 for a steady value, rising with the damped change
+        // between samples relative to the value (with a 10 unit floor).
+
+void IotaInputChannel::sampled(double oldValue, double newValue){
+    uint32_t timeNow = millis();
+    if(_lastSampleMs){
+        _sampleInterval = _sampleInterval * 0.9 + (uint32_t)(timeNow - _lastSampleMs) * 0.1;
+    }
+    _lastSampleMs = timeNow;
+    float delta = newValue - oldValue;
+    _powerVar = _powerVar * 0.75 + delta * delta * 0.25;
+    _schedWeight = MIN(SCHED_MAX_WEIGHT, 1.0 + 4.0 * sqrt(_powerVar) / (fabs(newValue) + 10.0));
+}
+
 float IotaInputChannel::getPhase(const float var){
-    float frequency;
-    float phase = _phase;                                   
-    if(_type == channelTypeVoltage){
-        frequency = dataBucket.Hz;
-    } else {
-        frequency = inputChannel[_vchannel]->dataBucket.Hz;
+    float frequency = (_type == channelTypeVoltage) ? dataBucket.Hz : inputChannel[_vchannel]->dataBucket.Hz;
+    if(frequency >= 55){
+        return (_p60 ? _p60->lookup(var) : _phase) + _padj60;
+    }
+    return (_p50 ? _p50->lookup(var) : _phase) + _padj50;
+}
+
+    // The step of var is the last whose threshold it has reached,
+    // as the configured array is read.  The thresholds are indexed on a
+    // uniform grid, so var is indexed to its cell, clamped to the grid,
+    // and the step at the start of the cell is only moved past thresholds
+    // inside the cell, usually none.  The configured thresholds needn't be
+    // evenly spaced and are kept exactly, and the steps aren't interpolated
+    // as the tables are step functions.
+
+void phaseTable::index(){
+    base = count > 1 ? threshold[1] : 0;
+    int32_t span = count > 1 ? MAX(threshold[count - 1] - base, 0) : 0;
+    width = span / PHASE_GRID_CELLS + 1;
+    int step = 0;
+    for(int i=0; i<PHASE_GRID_CELLS; i++){
+        int32_t start = base + i * width;
+        while(step + 1 < count && threshold[step + 1] <= start){
+            step++;
+        }
+        cell[i] = step;
     }
-    if(frequency < 55 && _p50){
-        phase = lookupPhase(_p50, var);
+}
+
+float phaseTable::lookup(const float var){
+    float intVar = var * 100;
+    if(count < 2 || ! (intVar >= base)){          // (and NaN)
+        return value[0] * 0.01f;
     }
-    if(frequency >= 55 && _p60){
-        phase = lookupPhase(_p60, var);
+    float pos = (intVar - base) / width;
+    int step = cell[pos < PHASE_GRID_CELLS ? (int)pos : PHASE_GRID_CELLS - 1];
+    while(step + 1 < count && threshold[step + 1] <= intVar){
+        step++;
     }
+    return value[step] * 0.01f;
+} 
 
-            // Pre 5.0 PCB had 10uF capacitor on channel 0
-            // Add capacitive shift if so
+/**************************************************************************************************
+ * Input name index
+ * 
+ * indexInputs() builds an open addressed hash table of the active input names at the end of
+ * configInputs().  findInput(name) returns the active input with that name or nullptr, the same
+ * (lowest numbered) input that a scan of inputChannel would find.
+ * ************************************************************************************************/
 
-    if(_channel == 0 && deviceMajorVersion < 5){
-        phase += (frequency >= 55) ? 1.45 : 1.71;
+static uint8_t*  inputIndex = nullptr;          // channel + 1 by hash slot (0 = empty)
+static uint8_t   inputIndexMask = 0;
+
+void indexInputs(){
+  delete[] inputIndex;
+  size_t size = 4;
+  while(size < maxInputs * 2) size *= 2;
+  inputIndexMask = size - 1;
+  inputIndex = new uint8_t[size];
+  memset(inputIndex, 0, size);
+  for(int i=0; i<maxInputs; i++){
+    if(inputChannel[i]->isActive() && inputChannel[i]->_name && ! findInput(inputChannel[i]->_name)){
+      uint32_t slot = hashIndex(inputChannel[i]->_name) & inputIndexMask;
+      while(inputIndex[slot]){
+        slot = (slot + 1) & inputIndexMask;
+      }
+      inputIndex[slot] = i + 1;
     }
-    return phase;
+  }
 }
 
-float IotaInputChannel::lookupPhase(int16_t* pArray, const float var){
-    int16_t* array = pArray;
-    int16_t intVar = var * 100;
-    while(*(array+1) && *(array+1) <= intVar){
-        array += 2;
+IotaInputChannel* findInput(const char* name){
+  if( ! inputIndex){
+    return nullptr;
+  }
+  uint32_t slot = hashIndex(name) & inputIndexMask;
+  while(inputIndex[slot]){
+    IotaInputChannel* input = inputChannel[inputIndex[slot] - 1];
+    if(input->isActive() && strcmp(input->_name, name) == 0){
+      return input;
     }
-    return (float)*array / 100.0;
-} 
+    slot = (slot + 1) & inputIndexMask;
+  }
+  return nullptr;
+}
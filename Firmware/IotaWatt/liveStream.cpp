@@ -0,0 +1,246 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * liveStream - see liveStream.h
+ *
+ * liveSent holds the rounded values as last sent.  Each step the new values are rounded and
+ * compared to make the delta event, which is written to every subscriber in step.  Subscribers
+ * that aren't yet are then sent one full event built from liveSent, so they're in step as well.
+ * ************************************************************************************************/
+
+uint16_t liveRate = LIVE_DEFAULT_RATE;
+
+struct liveSubscriber {
+  WiFiClient*   client;                     // Copy of the web server client (nullptr = free)
+  uint32_t      lastMs;                     // millis() of last event written
+  uint32_t      lastSec;                    // UTCtime() of last write, for keepalive
+  bool          synced;                     // Has every event since its last full event
+};
+
+struct liveValue {
+  int32_t       value1;                     // Watts, or volts x 10
+  int32_t       value2;                     // Hz x 100
+  bool          changed;
+};
+
+static liveSubscriber subscribers[LIVE_SUBSCRIBERS_MAX];
+static liveValue      liveSent[MAXINPUTS];
+static uint8_t        liveActive = 0;
+static bool           liveRunning = false;  // Service started and hasn't returned 0
+static uint32_t       liveEvents = 0;       // Running counts
+static uint32_t       liveBytes = 0;
+static uint32_t       liveResyncs = 0;
+static uint32_t       liveDropped = 0;
+
+//**********************************************************************************************
+//        liveUpdate() - round the statRecord values and note which have changed
+//**********************************************************************************************
+
+static void liveUpdate(){
+  for(int i=0; i<maxInputs; i++){
+    liveValue* sent = &liveSent[i];
+    int32_t value1 = INT32_MIN;
+    int32_t value2 = 0;
+    if(inputChannel[i]->isActive()){
+      if(inputChannel[i]->_type == channelTypeVoltage){
+        value1 = lround(statRecord.accum1[i] * 10.0);
+        value2 = lround(statRecord.accum2[i] * 100.0);
+      }
+      else if(inputChannel[i]->_type == channelTypePower){
+        value1 = (statRecord.accum1[i] > -2 && statRecord.accum1[i] < 2) ? 0 : lround(statRecord.accum1[i]);
+      }
+    }
+    sent->changed = value1 != sent->value1 || value2 != sent->value2;
+    sent->value1 = value1;
+    sent->value2 = value2;
+  }
+}
+
+//**********************************************************************************************
+//        liveEvent(buf, full) - format an event, all channels or changed only (0 = nothing new)
+//**********************************************************************************************
+
+static int liveEvent(char* buf, bool full){
+  int len = sprintf_P(buf, PSTR("event: %s\ndata: {\"t\":%u"), full ? "full" : "delta", UTCtime());
+  bool none = true;
+  for(int type=channelTypePower; type>=channelTypeVoltage; type--){
+    bool first = true;
+    for(int i=0; i<maxInputs; i++){
+      liveValue* sent = &liveSent[i];
+      if(sent->value1 == INT32_MIN || inputChannel[i]->_type != type || ! (full || sent->changed)){
+        continue;
+      }
+      if(first){
+        len += sprintf_P(buf + len, type == channelTypePower ? PSTR(",\"w\":[") : PSTR(",\"v\":["));
+        first = false;
+      }
+      else {
+        buf[len++] = ',';
+      }
+      if(type == channelTypePower){
+        len += sprintf_P(buf + len, PSTR("[%d,%d]"), inputChannel[i]->_channel, sent->value1);
+      }
+      else {
+        len += sprintf_P(buf + len, PSTR("[%d,%d.%01d,%d.%02d]"), inputChannel[i]->_channel,
+                         sent->value1 / 10, abs(sent->value1 % 10), sent->value2 / 100, abs(sent->value2 % 100));
+      }
+    }
+    if( ! first){
+      buf[len++] = ']';
+      none = false;
+    }
+  }
+  if(none && ! full){
+    return 0;
+  }
+  len += sprintf_P(buf + len, PSTR("}\n\n"));
+  return len;
+}
+
+static void liveDrop(liveSubscriber* sub){
+  sub->client->stop();
+  delete sub->client;
+  sub->client = nullptr;
+  liveActive--;
+}
+
+//**********************************************************************************************
+//        liveWrite(sub, buf, len) - write an event if there's room, otherwise it's missed
+//**********************************************************************************************
+
+static void liveWrite(liveSubscriber* sub, const char* buf, int len){
+  if(sub->client->availableForWrite() < len){
+    if(sub->synced){
+      liveResyncs++;
+    }
+    sub->synced = false;
+    if((millis() - sub->lastMs) > LIVE_IDLE_MS){
+      trace(T_live,2);
+      liveDropped++;
+      liveDrop(sub);
+    }
+    return;
+  }
+  if(sub->client->write((const uint8_t*)buf, len) != len){
+    trace(T_live,3);
+    liveDropped++;
+    liveDrop(sub);
+    return;
+  }
+  sub->lastMs = millis();
+  sub->lastSec = UTCtime();
+  liveEvents++;
+  liveBytes += len;
+}
+
+//**********************************************************************************************
+//
+//        handleLive() - GET /live
+//
+//        Take the connection, send the header and first full event, and leave the rest to
+//        the SERVICE.
+//
+//**********************************************************************************************
+
+void handleLive(){
+  trace(T_live,0);
+  if( ! liveRate){
+    server.send(503, txtPlain_P, F("Live stream is off"));
+    return;
+  }
+  liveSubscriber* sub = nullptr;
+  for(int i=0; i<LIVE_SUBSCRIBERS_MAX; i++){
+    if( ! subscribers[i].client){
+      sub = &subscribers[i];
+      break;
+    }
+  }
+  if( ! sub || ESP.getFreeHeap() < LIVE_HEAP_MIN){
+    server.send(503, txtPlain_P, F("Too many live streams"));
+    return;
+  }
+  sub->client = new WiFiClient(server.client());
+  sub->client->print(F("HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n"));
+  sub->lastMs = millis();
+  sub->lastSec = UTCtime();
+  sub->synced = false;
+  liveActive++;
+  if( ! liveRunning){
+    liveRunning = true;
+    liveUpdate();
+    NewService(liveStream, T_live);
+  }
+  char* buf = new char[LIVE_EVENT_MAX];
+  uint32_t events = liveEvents;
+  liveWrite(sub, buf, liveEvent(buf, true));
+  if(sub->client && liveEvents != events){
+    sub->synced = true;
+  }
+  delete[] buf;
+}
+
+//**********************************************************************************************
+//        liveStream - SERVICE to send the events
+//**********************************************************************************************
+
+uint32_t liveStream(struct serviceBlock* _serviceBlock){
+  trace(T_live,1);
+  for(int i=0; i<LIVE_SUBSCRIBERS_MAX; i++){
+    if(subscribers[i].client && ( ! liveRate || ! subscribers[i].client->connected())){
+      liveDrop(&subscribers[i]);
+    }
+  }
+  if( ! liveActive){
+    trace(T_live,4);
+    liveRunning = false;
+    return 0;
+  }
+
+  char* buf = new char[LIVE_EVENT_MAX];
+  liveUpdate();
+  int len = liveEvent(buf, false);
+  for(int i=0; i<LIVE_SUBSCRIBERS_MAX; i++){
+    liveSubscriber* sub = &subscribers[i];
+    if( ! sub->client || ! sub->synced){
+      continue;
+    }
+    if(len){
+      liveWrite(sub, buf, len);
+    }
+    else if((UTCtime() - sub->lastSec) >= LIVE_KEEPALIVE_SEC){
+      liveWrite(sub, ":\n\n", 3);
+    }
+  }
+
+      // Bring the rest into step.
+
+  len = 0;
+  for(int i=0; i<LIVE_SUBSCRIBERS_MAX; i++){
+    liveSubscriber* sub = &subscribers[i];
+    if( ! sub->client || sub->synced){
+      continue;
+    }
+    if( ! len){
+      len = liveEvent(buf, true);
+    }
+    uint32_t events = liveEvents;
+    liveWrite(sub, buf, len);
+    if(sub->client && liveEvents != events){
+      sub->synced = true;
+    }
+  }
+  delete[] buf;
+  return UTCtime() + liveRate;
+}
+
+//**********************************************************************************************
+//        liveStatus(stats) - GET /status?stats
+//**********************************************************************************************
+
+void liveStatus(JsonObject& status){
+  status.set(F("subscribers"), liveActive);
+  status.set(F("events"), liveEvents);
+  status.set(F("bytes"), liveBytes);
+  status.set(F("resyncs"), liveResyncs);
+  status.set(F("dropped"), liveDropped);
+}
@@ -0,0 +1,44 @@
+#ifndef liveStream_h
+#define liveStream_h
+
+/**************************************************************************************************
+ *
+ *  liveStream - server-sent events stream of the statService input values
+ *
+ *  GET /live
+ *
+ *  Live displays polled /status?inputs every second, each poll building a full JSON document and
+ *  response.  Instead, a display can open /live once as an EventSource.  The connection is taken
+ *  from the web server and added to the subscribers, and the liveStream SERVICE then pushes the
+ *  per-channel watts, volts and Hz from statRecord every device config "liverate" seconds
+ *  (default 1, 0 = off).
+ *
+ *  Each event is built once and written to all subscribers:
+ *
+ *      event: full                         event: delta
+ *      data: {"t":<UTCtime>,"w":[[channel,watts],...],"v":[[channel,volts,Hz],...]}
+ *
+ *  A subscriber gets a "full" event with all active channels when it starts, and thereafter
+ *  "delta" events with only the channels whose rounded value (watts 1, volts 0.1, Hz 0.01)
+ *  has changed.  No event is sent when nothing has changed, but a comment line is sent every
+ *  LIVE_KEEPALIVE_SEC so dead connections are found.
+ *
+ *  A subscriber that hasn't room for an event misses it and gets a "full" event when it does.
+ *  One that stays backed up for LIVE_IDLE_MS is dropped.
+ *
+ * ************************************************************************************************/
+
+#define LIVE_SUBSCRIBERS_MAX 4              // Concurrent /live connections
+#define LIVE_DEFAULT_RATE 1                 // Seconds between events
+#define LIVE_EVENT_MAX 640                  // Event buffer, fits MAXINPUTS channels
+#define LIVE_HEAP_MIN 12000                 // Free heap needed to subscribe
+#define LIVE_KEEPALIVE_SEC 15               // Comment line when nothing has changed this long
+#define LIVE_IDLE_MS 30000                  // Drop a subscriber backed up this long
+
+extern uint16_t   liveRate;                 // Seconds between events (0 = off)
+
+void      handleLive();                     // Web server handler
+uint32_t  liveStream(struct serviceBlock*);
+void      liveStatus(JsonObject&);          // Add live stream stats to /status
+
+#endif
@@ -1,21 +1,32 @@
 #include "IotaWatt.h"
 
             messageLog::messageLog()
-                :bufPos(0)
-                ,bufLen(60)
-                ,newMsg(true)
+                :newMsg(true)
                 ,restart(true)
+                ,hashing(false)
+                ,parted(false)
+                ,linePos(0)
+                ,ringIn(0)
+                ,ringOut(0)
+                ,ringWaitMs(0)
+                ,hash(0)
+                ,lastHash(0)
+                ,lastTime(0)
+                ,repeats(0)
                 {}
 
 void        messageLog::endMsg(){
                 this->println();
-                Serial.write(buf, bufPos);
-                msgFile = SD.open(IOTA_MESSAGE_LOG_PATH, FILE_WRITE);
-                if(msgFile) {
-                    msgFile.write(buf, bufPos);
-                    msgFile.close();
+                if( ! parted && hash == lastHash && (UTCtime() - lastTime) < MSG_REPEAT_SEC){
+                    Serial.write(line, linePos);
+                    repeats++;
                 }
-                delete[] buf;
+                else {
+                    putLine();
+                    lastHash = hash;
+                    lastTime = UTCtime();
+                }
+                linePos = 0;
                 newMsg= true;
                 return;
             }
@@ -23,8 +34,9 @@ void        messageLog::endMsg(){
 size_t      messageLog::write(const uint8_t byte){
                 if(newMsg){
                     newMsg = false;
-                    buf = new uint8_t[bufLen];
-                    bufPos = 0;
+                    hashing = false;
+                    parted = false;
+                    linePos = 0;
                     if(restart){
                         restart = false;
                         this->printf_P("\r\n** Restart **\r\n\n");
@@ -32,27 +44,21 @@ size_t      messageLog::write(const uint8_t byte){
                     if(RTCrunning){
                         this->printf("%s ", datef(localTime(),"M/DD/YY hh:mm:ss").c_str());
                         if(localTimeDiff == 0){
-                            buf[bufPos-1] = 'z';
-                            buf[bufPos++] = ' ';
+                            line[linePos-1] = 'z';
+                            line[linePos++] = ' ';
                         }
                     }
+                    hashing = true;
+                    hash = 2166136261UL;
                 }
-                if(bufPos >= bufLen) {
-                    Serial.write(buf, bufPos);
-                    msgFile = SD.open(IOTA_MESSAGE_LOG_PATH, FILE_WRITE);
-                    if(! msgFile){
-                        String msgDir = IOTA_MESSAGE_LOG_PATH;
-                        msgDir.remove(msgDir.indexOf('/',1));
-                        SD.mkdir(msgDir.c_str());
-                        msgFile = SD.open(IOTA_MESSAGE_LOG_PATH, FILE_WRITE);
-                    }
-                    if(msgFile) {
-                        msgFile.write(buf, bufPos);
-                        msgFile.close();
-                    }
-                    bufPos = 0;
+                if(linePos >= MSG_LINE_MAX) {
+                    putLine();
+                    parted = true;
+                }
+                line[linePos++] = byte;
+                if(hashing){
+                    hash = (hash ^ byte) * 16777619UL;
                 }
-                buf[bufPos++] = byte;
                 return 1;
             }
 
@@ -61,6 +67,74 @@ size_t      messageLog::write(const uint8_t* buf, const size_t len){
                 return len;
             }
 
+void        messageLog::putLine(){
+                if(repeats){
+                    putRepeats();
+                }
+                Serial.write(line, linePos);
+                put(line, linePos);
+                linePos = 0;
+            }
+
+void        messageLog::putRepeats(){
+                char msg[48];
+                int len = snprintf_P(msg, sizeof(msg), PSTR("** Last message repeated %d times **\r\n"), repeats);
+                put((uint8_t*)msg, len);
+                repeats = 0;
+            }
+
+void        messageLog::put(const uint8_t* buf, size_t len){
+                for(int i=0; i<len; i++){
+                    if((ringIn - ringOut) >= MSG_RING_SIZE){
+                        flush();
+                    }
+                    if(ringIn == ringOut){
+                        ringWaitMs = millis();
+                    }
+                    ring[ringIn++ & (MSG_RING_SIZE - 1)] = buf[i];
+                }
+            }
 
-  
-  
+void        messageLog::flush(){
+                if(ringIn == ringOut){
+                    return;
+                }
+                msgFile = SD.open(IOTA_MESSAGE_LOG_PATH, FILE_WRITE);
+                if(! msgFile){
+                    String msgDir = IOTA_MESSAGE_LOG_PATH;
+                    msgDir.remove(msgDir.indexOf('/',1));
+                    SD.mkdir(msgDir.c_str());
+                    msgFile = SD.open(IOTA_MESSAGE_LOG_PATH, FILE_WRITE);
+                }
+                if(msgFile) {
+                    while(ringOut != ringIn){
+                        uint32_t pos = ringOut & (MSG_RING_SIZE - 1);
+                        size_t len = MIN(ringIn - ringOut, MSG_RING_SIZE - pos);
+                        msgFile.write(ring + pos, len);
+                        ringOut += len;
+                    }
+                    msgFile.close();
+                }
+                ringOut = ringIn;
+            }
+
+            // Write a block when there is one, or when messages have waited long enough,
+            // and log the repeats of a message that hasn't been seen for a while.
+
+uint32_t    messageLog::service(){
+                if(repeats && (UTCtime() - lastTime) >= MSG_REPEAT_SEC){
+                    putRepeats();
+                    lastHash = 0;
+                }
+                if((ringIn - ringOut) >= MSG_FLUSH_SIZE ||
+                   (ringIn != ringOut && (millis() - ringWaitMs) >= MSG_FLUSH_MS)){
+                    flush();
+                }
+                return UTCtime() + 1;
+            }
+
+uint32_t    messageLogService(struct serviceBlock* _serviceBlock){
+                trace(T_msgLog,0);
+                _serviceBlock->priority = priorityLow;
+                return Message_log.service();
+            }
@@ -1,6 +1,17 @@
 #pragma once
 #include <Arduino.h>
 
+        // Messages are composed in _line and then put in _ring, which the messageLogService
+        // writes to the SD in blocks, so a burst of messages isn't a burst of SD writes.
+        // flush() writes the ring now, and should precede a restart.
+        // A message identical to the last within MSG_REPEAT_SEC is counted instead of logged.
+
+#define MSG_LINE_MAX 120            // Message composed here, longer ones are put in the ring in parts
+#define MSG_RING_SIZE 1024          // Messages waiting to be written (power of two)
+#define MSG_FLUSH_SIZE 512          // Write when this much is waiting (an SD block)
+#define MSG_FLUSH_MS 2000           // or the oldest has waited this long
+#define MSG_REPEAT_SEC 60           // Repeats of the last message within this are counted, not logged (Serial gets them all)
+
 class messageLog: public Print {
 
     public:
@@ -10,15 +21,32 @@ class messageLog: public Print {
         size_t      write(const uint8_t);
         size_t      write(const uint8_t*, const size_t);
         void        endMsg();
+        void        flush();                    // Write waiting messages to SD
+        uint32_t    service();                  // Called by messageLogService
 
     protected:
 
         File        msgFile;
         bool        newMsg;
         bool        restart;
-        uint8_t*    buf;
-        uint8_t     bufLen;
-        uint8_t     bufPos;
+        bool        hashing;                    // Past the timestamp, hashing the text
+        bool        parted;                     // Part of this message is in the ring
+        uint8_t     line[MSG_LINE_MAX];
+        uint8_t     linePos;
+        uint8_t     ring[MSG_RING_SIZE];
+        uint32_t    ringIn;                     // Bytes put in ring
+        uint32_t    ringOut;                    // Bytes written from ring
+        uint32_t    ringWaitMs;                 // millis() when oldest waiting byte was put
+        uint32_t    hash;                       // Hash of this message text
+        uint32_t    lastHash;                   // Hash of last message logged
+        uint32_t    lastTime;                   // UTCtime() of last message or repeat
+        uint16_t    repeats;                    // Repeats of last message not logged
+
+        void        putLine();                  // Move line to ring
+        void        putRepeats();               // Put repeat count line in ring (not Serial)
+        void        put(const uint8_t*, size_t);
 };
 
+uint32_t messageLogService(struct serviceBlock*);
+
 #define log(format,...)  Message_log.printf_P(PSTR(format),##__VA_ARGS__); Message_log.endMsg()
@@ -0,0 +1,472 @@
+#include "mqtt_uploader.h"
+
+/*****************************************************************************************
+ *          handle_query_s()
+ * 
+ * MQTT has no way to ask where the last upload left off, so start at begdate or now.
+ * A restart resumes from the checkpoint before this is called (uploader::dispatch).
+ * **************************************************************************************/
+uint32_t mqtt_uploader::handle_query_s(){
+    trace(T_mqtt,20);
+    _lastSent = UTCtime();
+    if(_uploadStartDate){
+        _lastSent = MAX(Current_log.firstKey(), _uploadStartDate);
+    }
+    _lastSent -= _lastSent % _interval;
+    log("%s: Start posting %s", _id, localDateString(_lastSent + _interval).c_str());
+    _state = write_s;
+    return 1;
+}
+
+/*****************************************************************************************
+ *          handle_checkQuery_s()
+ * **************************************************************************************/
+uint32_t mqtt_uploader::handle_checkQuery_s(){
+    trace(T_mqtt,30);
+    _state = write_s;
+    return 1;
+}
+
+/*****************************************************************************************
+ *          handle_write_s()
+ * **************************************************************************************/
+uint32_t mqtt_uploader::handle_write_s(){
+    trace(T_mqtt,40);
+    if(_stop){
+        stop();
+        return 1;
+    }
+
+    // Get connected.
+
+    if(_connection != ready_c){
+        return connect();
+    }
+    if(_connectMs){
+        trace(T_mqtt,71);
+        log("%s: Connected to %s", _id, _url->build().c_str());
+        delete[] _statusMessage;
+        _statusMessage = nullptr;
+        _connectMs = 0;
+    }
+
+    // If not enough data to post, keep the connection alive, set wait and return.
+
+    uint32_t lastKey = dataLastKey();
+    if(lastKey < (_lastSent + _interval + (_interval * _bulkAdapt))){
+        if(millis() - _activityMs > (uint32_t)_keepAlive * 500){
+            uint8_t ping[2] = {0xC0, 0};
+            send(ping, 2);
+        }
+        if(oldRecord){
+            delete oldRecord;
+            oldRecord = nullptr;
+            delete newRecord;
+            newRecord = nullptr;
+        }
+        return UTCtime() + 1;
+    }
+
+    // If datalog buffers not allocated, do so now and prime latest.
+
+    trace(T_mqtt,60);
+    if(! oldRecord){
+        trace(T_mqtt,61);
+        oldRecord = new IotaLogRecord;
+        newRecord = new IotaLogRecord;
+        newRecord->UNIXtime = _lastSent + _interval;
+        readFeed(newRecord);
+        reqData.flush();
+        _payload.release();
+        _published = 0;
+        _acked = 0;
+    }
+
+    // Build a PUBLISH for each interval.
+
+    size_t topicLen = strlen(_topic);
+    while(reqData.available() < postLimit() && newRecord->UNIXtime < lastKey){
+
+        if( ! _budget.next()){
+            return 10;
+        }
+
+        // Swap newRecord top oldRecord, read next into newRecord.
+
+        trace(T_mqtt,62);
+        IotaLogRecord *swap = oldRecord;
+        oldRecord = newRecord;
+        newRecord = swap;
+        newRecord->UNIXtime = oldRecord->UNIXtime + _interval;
+        readFeed(newRecord);
+
+        // Compute the time difference between log entries.
+        // If zero, don't bother.
+
+        double elapsedHours = newRecord->logHours - oldRecord->logHours;
+        if(elapsedHours == 0){
+            trace(T_mqtt,63);
+            if((newRecord->UNIXtime + _interval) <= lastKey){
+                return 1;
+            }
+            return UTCtime() + 1;
+        }
+
+        // Json payload for this interval
+
+        trace(T_mqtt,64);
+        String payload;
+        payload.reserve(16 + _outputs->count() * 16);
+        payload = F("{\"time\":");
+        payload += oldRecord->UNIXtime;
+        double* values = new double[_outputs->count()];
+        _outputs->evaluate(oldRecord, newRecord, values);
+        int output = 0;
+        char value[32];
+        for(Script* script=_outputs->first(); script; script=script->next()){
+            if(values[output] == values[output]){
+                formatFixed(value, values[output], script->precision());
+                payload += F(",\"");
+                payload += script->name();
+                payload += F("\":");
+                payload += value;
+            }
+            output++;
+        }
+        delete[] values;
+        payload += '}';
+
+        // PUBLISH QoS 1
+
+        uint8_t header[5];
+        header[0] = 0x32;
+        size_t len = 1 + putLength(header + 1, 2 + topicLen + 2 + payload.length());
+        reqData.write(header, len);
+        header[0] = topicLen >> 8;
+        header[1] = topicLen;
+        reqData.write(header, 2);
+        reqData.write((uint8_t*)_topic, topicLen);
+        if(++_packetID == 0){
+            _packetID = 1;
+        }
+        header[0] = _packetID >> 8;
+        header[1] = _packetID;
+        reqData.write(header, 2);
+        reqData.write(payload);
+        _published++;
+        _lastPost = oldRecord->UNIXtime;
+    }
+    catchup(_published, reqData.available() >= postLimit());
+
+    delete oldRecord;
+    oldRecord = nullptr;
+    delete newRecord;
+    newRecord = nullptr;
+
+    // Write the batch and wait for the acknowledgements.
+
+    trace(T_mqtt,65);
+    _batchMs = millis();
+    _state = checkWrite_s;
+    return 1;
+}
+
+/*****************************************************************************************
+ *          handle_checkWrite_s()
+ * 
+ * Feed the batch to the connection as it has room, then wait for a PUBACK for each PUBLISH.
+ * **************************************************************************************/
+uint32_t mqtt_uploader::handle_checkWrite_s(){
+    trace(T_mqtt,91);
+    const __FlashStringHelper* failure = nullptr;
+    if(_connection != ready_c){
+        failure = F("Connection lost");
+    }
+    else {
+        uint8_t chunk[128];
+        size_t len;
+        while(reqData.available() && (len = MIN(MIN(reqData.available(), sizeof(chunk)), _client->space()))){
+            reqData.read(chunk, len);
+            _client->add((const char*)chunk, len, ASYNC_WRITE_FLAG_COPY);
+        }
+        _client->send();
+        _activityMs = millis();
+        if( ! reqData.available() && _acked >= _published){
+            trace(T_mqtt,93);
+            delete[] _statusMessage;
+            _statusMessage = nullptr;
+            adapt(true, millis() - _batchMs);
+            _lastSent = _lastPost;
+            _state = write_s;
+            return 1;
+        }
+        if(millis() - _batchMs > MQTT_ACK_TIMEOUT){
+            failure = F("Publish not acknowledged");
+        }
+    }
+    if( ! failure){
+        return 10;
+    }
+
+    // Deal with failure, start again from _lastSent.
+
+    trace(T_mqtt,92);
+    delete[] _statusMessage;
+    _statusMessage = charstar(failure);
+    reqData.flush();
+    _payload.release();
+    adapt(false, 0);
+    disconnect();
+    _state = write_s;
+    return UTCtime() + 2;
+}
+
+void mqtt_uploader::stop(){
+    disconnect();
+    uploader::stop();
+}
+
+//********************************************************************************************************************
+//
+//      Connection.  The AsyncClient callbacks only note what happened, the work is done in the service.
+//
+//********************************************************************************************************************
+
+uint32_t mqtt_uploader::connect(){
+    switch(_connection){
+        case closed_c: {
+            trace(T_mqtt,70);
+            if( ! WiFi.isConnected()){
+                return UTCtime() + 1;
+            }
+            if( ! _client){
+                _client = new AsyncClient;
+                _client->onConnect([this](void* arg, AsyncClient* client){
+                    _connection = handshake_c;
+                    sendConnect();
+                }, nullptr);
+                _client->onData([this](void* arg, AsyncClient* client, void* data, size_t len){
+                    receive((uint8_t*)data, len);
+                }, nullptr);
+                _client->onDisconnect([this](void* arg, AsyncClient* client){
+                    _connection = failed_c;
+                }, nullptr);
+                _client->onError([this](void* arg, AsyncClient* client, int8_t error){
+                    _connection = failed_c;
+                }, nullptr);
+            }
+            _rxLen = 0;
+            _rxSkip = 0;
+            _connectMs = millis();
+            _connection = connecting_c;
+            if( ! _client->connect(_url->domain(), atoi(_url->port() + 1))){
+                _connection = failed_c;
+            }
+            return 100;
+        }
+
+        case connecting_c:
+        case handshake_c:
+            if(millis() - _connectMs > MQTT_CONNECT_TIMEOUT){
+                delete[] _statusMessage;
+                _statusMessage = charstar(F("Connect timeout"));
+                _connection = failed_c;
+            }
+            return 100;
+
+        case ready_c:
+            return 1;
+
+        case failed_c:
+        default:
+            trace(T_mqtt,72);
+            disconnect();
+            return UTCtime() + 5;
+    }
+}
+
+void mqtt_uploader::disconnect(){
+    if(_client){
+        trace(T_mqtt,73);
+        if(_connection == ready_c){
+            uint8_t disconnect[2] = {0xE0, 0};
+            send(disconnect, 2);
+        }
+        _client->onConnect(nullptr, nullptr);
+        _client->onData(nullptr, nullptr);
+        _client->onDisconnect(nullptr, nullptr);
+        _client->onError(nullptr, nullptr);
+        _client->close(true);
+        delete _client;
+        _client = nullptr;
+    }
+    _connection = closed_c;
+}
+
+void mqtt_uploader::sendConnect(){
+    size_t len = 10 + 2 + strlen(_clientID);
+    uint8_t flags = 0x02;                                       // Clean session
+    if(_user){
+        len += 2 + strlen(_user);
+        flags |= 0x80;
+    }
+    if(_pwd){
+        len += 2 + strlen(_pwd);
+        flags |= 0x40;
+    }
+    uint8_t* buf = new uint8_t[len + 5];
+    buf[0] = 0x10;
+    size_t pos = 1 + putLength(buf + 1, len);
+    pos += putString(buf + pos, "MQTT");
+    buf[pos++] = 4;                                             // 3.1.1
+    buf[pos++] = flags;
+    buf[pos++] = _keepAlive >> 8;
+    buf[pos++] = _keepAlive;
+    pos += putString(buf + pos, _clientID);
+    if(_user){
+        pos += putString(buf + pos, _user);
+    }
+    if(_pwd){
+        pos += putString(buf + pos, _pwd);
+    }
+    send(buf, pos);
+    delete[] buf;
+}
+
+void mqtt_uploader::send(const uint8_t* data, size_t len){
+    if(_client && _client->connected()){
+        _client->add((const char*)data, len, ASYNC_WRITE_FLAG_COPY);
+        _client->send();
+        _activityMs = millis();
+    }
+}
+
+    // Collect packets from the stream.  The broker only sends
+    // small ones, anything that doesn't fit _rx is skipped.
+
+void mqtt_uploader::receive(uint8_t* data, size_t len){
+    while(len){
+        if(_rxSkip){
+            size_t skip = MIN(_rxSkip, len);
+            _rxSkip -= skip;
+            data += skip;
+            len -= skip;
+            continue;
+        }
+        _rx[_rxLen++] = *data++;
+        len--;
+        if(_rxLen < 2){
+            continue;
+        }
+        uint32_t remaining = 0;
+        uint32_t multiplier = 1;
+        int i = 1;
+        while(i < _rxLen){
+            remaining += (_rx[i] & 0x7F) * multiplier;
+            if( ! (_rx[i] & 0x80)){
+                break;
+            }
+            multiplier *= 128;
+            i++;
+        }
+        if(i == _rxLen){
+            if(_rxLen >= 5){
+                _connection = failed_c;
+                _rxLen = 0;
+            }
+            continue;
+        }
+        int header = i + 1;
+        if(remaining > sizeof(_rx) - header){
+            _rxSkip = remaining - (_rxLen - header);
+            _rxLen = 0;
+            continue;
+        }
+        if(_rxLen < header + remaining){
+            continue;
+        }
+        packet(_rx[0] >> 4, _rx + header, remaining);
+        _rxLen = 0;
+    }
+}
+
+void mqtt_uploader::packet(uint8_t type, const uint8_t* data, uint32_t len){
+    if(type == 2){                                              // CONNACK
+        _connection = (len >= 2 && data[1] == 0) ? ready_c : failed_c;
+    }
+    else if(type == 4){                                         // PUBACK
+        _acked++;
+    }
+}
+
+size_t mqtt_uploader::putLength(uint8_t* buf, uint32_t len){
+    size_t pos = 0;
+    do {
+        buf[pos] = len % 128;
+        len /= 128;
+        if(len){
+            buf[pos] |= 0x80;
+        }
+        pos++;
+    } while(len);
+    return pos;
+}
+
+size_t mqtt_uploader::putString(uint8_t* buf, const char* str){
+    size_t len = strlen(str);
+    buf[0] = len >> 8;
+    buf[1] = len;
+    memcpy(buf + 2, str, len);
+    return len + 2;
+}
+
+//********************************************************************************************************************
+//
+//               CCC     OOO    N   N   FFFFF   III    GGG    CCC   BBBB
+//              C   C   O   O   NN  N   F        I    G      C   C  B   B
+//              C       O   O   N N N   FFF      I    G  GG  C      BBBB
+//              C   C   O   O   N  NN   F        I    G   G  C   C  B   B
+//               CCC     OOO    N   N   F       III    GGG    CCC   B BBB
+//
+//********************************************************************************************************************
+bool mqtt_uploader::configCB(JsonObject& config){
+    trace(T_mqtt, 100);
+    if(strcmp_ci(_url->method(), "mqtt://") != 0){
+        log("%s: url must be mqtt://", _id);
+        return false;
+    }
+    if( ! _url->port()){
+        _url->port(MQTT_DEFAULT_PORT);
+    }
+    delete[] _topic;
+    _topic = charstar(varStr(config[F("topic")] | "iotawatt/$device"));
+    delete[] _clientID;
+    _clientID = charstar(config[F("clientid")] | (const char*)deviceName);
+    delete[] _user;
+    _user = charstar(config.get<const char*>(F("user")));
+    delete[] _pwd;
+    _pwd = charstar(config.get<const char*>(F("pwd")));
+    _keepAlive = constrain(config[F("keepalive")] | 60, 10, 3600);
+
+        // Reconnect with the new settings.
+
+    disconnect();
+    return true;
+}
+
+String mqtt_uploader::varStr(const char* in)
+{
+    // Return String with $device substituted.
+
+  String out;
+  while(*in){ 
+    if(memcmp(in,"$device",7) == 0){
+      out += deviceName;
+      in += 7;
+    }
+    else {
+      out += *(in++);
+    }
+  } 
+  return out;
+}
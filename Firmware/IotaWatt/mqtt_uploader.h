@@ -0,0 +1,110 @@
+#ifndef mqtt_uploader_h
+#define mqtt_uploader_h
+
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ *
+ *  mqtt_uploader - publish the outputs to an MQTT (3.1.1) broker over one long-lived connection.
+ *
+ *  Each interval is a QoS 1 PUBLISH to the configured topic with a Json payload:
+ *
+ *      {"time":1700000000,"Solar":1234.5,"Grid":-321}
+ *
+ *  A batch of intervals, up to the uploader's buffer limit, is written to the connection and
+ *  _lastSent moves to the end of the batch when every message has been acknowledged.  If the
+ *  connection drops or the acknowledgements don't all arrive, the batch is sent again from
+ *  _lastSent.  That can repeat messages, which QoS 1 allows.
+ *
+ *  There's nothing to ask the broker where it left off, so a new upload starts at begdate or
+ *  now, and a restart resumes from the uploader checkpoint.  No TLS, as there's no proxy for it.
+ *
+ *  Config "mqtt": url (mqtt://host:port, default port 1883), topic (default iotawatt/$device),
+ *  clientid (default the device name), user, pwd, keepalive (seconds, default 60), and the
+ *  usual postInterval, bulksend, begdate, stop and outputs.
+ *
+ * ************************************************************************************************/
+
+#define MQTT_DEFAULT_PORT ":1883"
+#define MQTT_ACK_TIMEOUT 10000              // ms to wait for a batch to be acknowledged
+#define MQTT_CONNECT_TIMEOUT 10000          // ms to wait for CONNACK
+
+class mqtt_uploader : public uploader 
+{
+    public:
+        mqtt_uploader():
+            _client(nullptr),
+            _topic(nullptr),
+            _clientID(nullptr),
+            _user(nullptr),
+            _pwd(nullptr),
+            _keepAlive(60),
+            _connection(closed_c),
+            _connectMs(0),
+            _activityMs(0),
+            _batchMs(0),
+            _packetID(0),
+            _published(0),
+            _acked(0),
+            _rxLen(0),
+            _rxSkip(0)
+        {
+            _id = charstar("mqtt");
+        };
+
+        ~mqtt_uploader(){
+            disconnect();
+            delete[] _topic;
+            delete[] _clientID;
+            delete[] _user;
+            delete[] _pwd;
+            delete _outputs;
+            MQTT = nullptr;
+        };
+
+        void stop();
+
+    private:
+
+        AsyncClient* _client;
+        char*    _topic;
+        char*    _clientID;
+        char*    _user;
+        char*    _pwd;
+        uint16_t _keepAlive;
+
+        volatile enum connections {
+            closed_c,
+            connecting_c,                   // TCP connect in progress
+            handshake_c,                    // CONNECT sent, waiting for CONNACK
+            ready_c,
+            failed_c                        // Dropped or refused, close and retry
+        } _connection;
+        uint32_t _connectMs;                // millis() connect started (0 = connection logged)
+        uint32_t _activityMs;               // millis() last packet sent
+        uint32_t _batchMs;                  // millis() batch written
+        uint16_t _packetID;
+        uint16_t _published;                // PUBLISHes in the batch
+        volatile uint16_t _acked;           // PUBACKs received
+        uint8_t  _rx[8];                    // Packet being received
+        uint8_t  _rxLen;
+        uint32_t _rxSkip;                   // Bytes of an unexpected packet to skip
+
+        uint32_t handle_query_s();
+        uint32_t handle_checkQuery_s();
+        uint32_t handle_write_s();
+        uint32_t handle_checkWrite_s();
+        bool configCB(JsonObject &);
+
+        uint32_t connect();                 // Start or progress the connection
+        void     disconnect();
+        void     sendConnect();
+        void     receive(uint8_t* data, size_t len);
+        void     packet(uint8_t type, const uint8_t* data, uint32_t len);
+        size_t   putLength(uint8_t* buf, uint32_t len);    // MQTT remaining length
+        size_t   putString(uint8_t* buf, const char* str); // Length prefixed string
+        void     send(const uint8_t* data, size_t len);
+        String   varStr(const char* in);
+};
+
+#endif
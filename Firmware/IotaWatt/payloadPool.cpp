@@ -0,0 +1,49 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * payloadPool - see payloadPool.h
+ * ************************************************************************************************/
+
+uint32_t payloadCap = PAYLOAD_POOL_DEFAULT;
+
+static uint16_t   payloadShares = 0;
+static uint32_t   payloadHeld = 0;          // Bytes held by all shares
+static uint32_t   payloadPeak = 0;
+static uint32_t   payloadFull = 0;          // Times a share found the cap all held
+
+payloadShare::payloadShare() : _held(0) {
+  payloadShares++;
+}
+
+payloadShare::~payloadShare(){
+  release();
+  payloadShares--;
+}
+
+void payloadShare::hold(uint32_t held){
+  payloadHeld = payloadHeld - _held + held;
+  _held = held;
+  payloadPeak = MAX(payloadPeak, payloadHeld);
+}
+
+int32_t payloadShare::limit(uint32_t held){
+  hold(held);
+  uint32_t fair = payloadCap / MAX(payloadShares, 1);
+  uint32_t unused = payloadHeld < payloadCap ? payloadCap - payloadHeld : 0;
+  if( ! unused){
+    payloadFull++;
+  }
+  return MAX(fair, _held + unused / 2);
+}
+
+//**********************************************************************************************
+//        payloadStatus(stats) - GET /status?stats
+//**********************************************************************************************
+
+void payloadStatus(JsonObject& status){
+  status.set(F("cap"), payloadCap);
+  status.set(F("shares"), payloadShares);
+  status.set(F("held"), payloadHeld);
+  status.set(F("peak"), payloadPeak);
+  status.set(F("full"), payloadFull);
+}
@@ -0,0 +1,43 @@
+#ifndef payloadPool_h
+#define payloadPool_h
+
+/**************************************************************************************************
+ *
+ *  payloadPool - shared budget for the uploader, PVoutput and query payload buffers
+ *
+ *  Each uploader's reqData, the PVoutput status batches and the CSVquery work buffer grow as
+ *  they build, independently, and their combined peak could take the heap down during a
+ *  recovery when they all catch up at once.  Each now holds a payloadShare of one budget of
+ *  device config "payloadcap" bytes.
+ *
+ *  A share may always grow to its fair part of the cap (cap / shares), and beyond that may
+ *  borrow half of what's unused, so a lone uploader catching up gets most of the cap and a
+ *  newcomer still has room when the others are full.  The buffers themselves are still xbuf
+ *  segments from the heap, the pool only decides how large each may get.
+ *
+ *  Shares join the pool when constructed and leave when destroyed.  The holder reports the
+ *  bytes it has with limit() as it builds, and release() when the buffer is sent or flushed.
+ *
+ * ************************************************************************************************/
+
+#define PAYLOAD_POOL_DEFAULT 12000          // Bytes
+#define PAYLOAD_POOL_MIN 2000
+#define PAYLOAD_POOL_MAX 32000
+
+class payloadShare {
+  public:
+    payloadShare();
+    ~payloadShare();
+    int32_t   limit(uint32_t held);         // Note bytes held, return bytes that may be held
+    void      hold(uint32_t held);          // Note bytes held
+    void      release(){hold(0);}
+
+  private:
+    uint32_t  _held;
+};
+
+extern uint32_t   payloadCap;               // Pool size in bytes
+
+void      payloadStatus(JsonObject&);       // Add pool stats to /status
+
+#endif
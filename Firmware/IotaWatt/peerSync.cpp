@@ -0,0 +1,563 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * peerSync - see peerSync.h
+ *
+ * peerStream is the webStreamSource for /peer, reading the range with a cursor and writing as
+ * many whole records as fit each chunk.  The pull side keeps a peerLink for each configured
+ * peer and the one SERVICE takes them in turn, so there is at most one request in flight.  A new
+ * configuration is held until that request is done.  peerDeltas() reads the peer logs for
+ * Script virtual inputs, keeping the last two records of each so a query reads each once.
+ * ************************************************************************************************/
+
+static const int PEER_HEADER_BYTES = 20;
+static const int PEER_TRAILER_BYTES = 8;
+
+struct peerLink {
+  char*         name;
+  char*         url;
+  char*         key;
+  uint16_t      backfill;                   // Days back to start a new log
+  IotaLog*      log;
+  IotaLogCursor cursor;                     // Reads for peerDeltas
+  IotaLogRecord rec[2];                     // Last records read for peerDeltas
+  uint8_t       recNext;                    // rec to replace next
+  uint32_t      nextPull;                   // UTCtime() of next pull
+  uint32_t      pulls;                      // Running counts
+  uint32_t      records;
+  uint32_t      failures;
+  int           lastCode;                   // HTTP code of last pull
+  peerLink() : name(nullptr), url(nullptr), key(nullptr), backfill(PEER_BACKFILL_DAYS),
+               log(nullptr), cursor(nullptr), recNext(0), nextPull(0), pulls(0), records(0),
+               failures(0), lastCode(0){};
+  ~peerLink(){
+    if(log){
+      log->end();
+      delete log;
+    }
+    delete[] name;
+    delete[] url;
+    delete[] key;
+  }
+};
+
+static char*      peerKey = nullptr;        // Bearer key for /peer
+static peerLink*  peers[PEER_MAX];
+static char*      peerPending = nullptr;    // Configuration waiting for the request to finish
+static bool       peerReconfig = false;
+static bool       peerRunning = false;
+static peerLink*  peerInflight = nullptr;   // Link with a request in flight
+static asyncHTTPrequest* peerRequest = nullptr;
+static uint32_t   peerHTTPtoken = 0;
+static uint32_t   peerServed = 0;           // Running counts of /peer
+static uint32_t   peerServedRecords = 0;
+
+//**********************************************************************************************
+//        peerStream - webStreamSource for GET /peer
+//**********************************************************************************************
+
+class peerStream : public webStreamSource {
+  public:
+    peerStream(uint32_t begin, uint32_t end, uint16_t limit)
+      :_cursor(Current_log.readRange(begin, end, Current_log.interval()))
+      ,_begin(begin)
+      ,_end(end)
+      ,_left(limit)
+      ,_channels(logChannels())
+      ,_header(false)
+      ,_done(false)
+      {};
+    size_t readResult(uint8_t* buf, int len);
+
+  private:
+    IotaLogCursor _cursor;
+    uint32_t  _begin;
+    uint32_t  _end;
+    uint16_t  _left;                        // Records still to send
+    uint8_t   _channels;
+    bool      _header;                      // Header is sent
+    bool      _done;                        // Trailer is sent
+};
+
+size_t peerStream::readResult(uint8_t* buf, int len){
+  if(_done){
+    return 0;
+  }
+  int pos = 0;
+  uint16_t recordBytes = 16 + 16 * _channels;
+  if( ! _header){
+    uint32_t interval = Current_log.interval();
+    memcpy(buf, "IOTP", 4);
+    buf[4] = PEER_FORMAT_VERSION;
+    buf[5] = _channels;
+    memcpy(buf + 6, &recordBytes, 2);
+    memcpy(buf + 8, &interval, 4);
+    memcpy(buf + 12, &_begin, 4);
+    memcpy(buf + 16, &_end, 4);
+    pos = PEER_HEADER_BYTES;
+    for(int i=0; i<_channels; i++){
+      uint8_t type = 0;
+      if(inputChannel[i]->isActive()){
+        type = inputChannel[i]->_type == channelTypeVoltage ? 'V' : 'P';
+      }
+      buf[pos++] = type;
+    }
+    _header = true;
+  }
+  IotaLogRecordHandle rec;
+  bool failed = false;
+  while(_left && _cursor.key() <= _end && pos + recordBytes + PEER_TRAILER_BYTES <= len){
+    if( ! _cursor.next(rec)){
+      failed = true;
+      break;
+    }
+    memcpy(buf + pos, &rec->UNIXtime, 4);
+    memcpy(buf + pos + 4, &rec->serial, 4);
+    memcpy(buf + pos + 8, &rec->logHours, 8);
+    pos += 16;
+    for(int i=0; i<_channels; i++){
+      memcpy(buf + pos, &rec->accum1[i], 8);
+      memcpy(buf + pos + 8, &rec->accum2[i], 8);
+      pos += 16;
+    }
+    _left--;
+    peerServedRecords++;
+  }
+      // A record that can't be read is retried as the first of the next request,
+      // and skipped if it fails again there, so a bad record can't hold the pull up.
+
+  if(failed || ! _left || _cursor.key() > _end){
+    uint32_t failedKey = _cursor.key() - Current_log.interval();
+    uint32_t next = (failed && failedKey != _begin) ? failedKey : (_cursor.key() <= _end) ? _cursor.key() : 0;
+    uint32_t zero = 0;
+    memcpy(buf + pos, &zero, 4);
+    memcpy(buf + pos + 4, &next, 4);
+    pos += PEER_TRAILER_BYTES;
+    _done = true;
+  }
+  return pos;
+}
+
+//**********************************************************************************************
+//
+//        handlePeer() - GET /peer
+//
+//**********************************************************************************************
+
+bool peerAuthorized(){
+  if( ! peerKey || ! server.hasHeader(F("Authorization"))){
+    return false;
+  }
+  String header = server.header(F("Authorization"));
+  if( ! header.startsWith(F("Bearer ")) || header.length() != strlen(peerKey) + 7){
+    return false;
+  }
+  uint8_t diff = 0;
+  for(int i=0; peerKey[i]; i++){
+    diff |= header[i + 7] ^ peerKey[i];
+  }
+  return diff == 0;
+}
+
+void handlePeer(){
+  trace(T_peer,0);
+  if( ! Current_log.isOpen() || Current_log.fileSize() == 0){
+    server.send(503, txtPlain_P, F("No datalog"));
+    return;
+  }
+  if( ! server.hasArg(F("begin"))){
+    server.send(400, txtPlain_P, F("begin required"));
+    return;
+  }
+  uint32_t interval = Current_log.interval();
+  uint32_t begin = strtoul(server.arg(F("begin")).c_str(), nullptr, 10);
+  uint32_t end = Current_log.lastKey();
+  if(server.hasArg(F("end"))){
+    end = MIN(end, strtoul(server.arg(F("end")).c_str(), nullptr, 10));
+  }
+  begin = MAX(begin + interval - 1, Current_log.firstKey());
+  begin -= begin % interval;
+  end -= end % interval;
+  uint16_t limit = PEER_RECORDS_MAX;
+  if(server.hasArg(F("limit"))){
+    limit = RANGE(server.arg(F("limit")).toInt(), 1, PEER_RECORDS_MAX);
+  }
+  peerServed++;
+  peerStream* stream = new peerStream(begin, end, limit);
+  if(webStreamStart(stream, "application/octet-stream")){
+    return;
+  }
+
+      // No stream free, send a short response inline so sampling isn't held up.
+      // The trailer has the key for the client to carry on from.
+
+  delete stream;
+  stream = new peerStream(begin, end, MIN(limit, PEER_PULL_RECORDS));
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "application/octet-stream", "");
+  uint8_t* buf = new uint8_t[1440];
+  size_t len;
+  while((len = stream->readResult(buf, 1440))){
+    server.sendContent((char*)buf, len);
+    yield();
+  }
+  delete[] buf;
+  delete stream;
+}
+
+//**********************************************************************************************
+//        peerConfig(JsonStr) - config.txt "peers"
+//**********************************************************************************************
+
+bool peerConfig(const char* JsonStr){
+  delete[] peerPending;
+  peerPending = JsonStr ? charstar(JsonStr) : nullptr;
+  peerReconfig = true;
+  if( ! peerRunning){
+    peerRunning = true;
+    NewService(peerSync, T_peer);
+  }
+  return true;
+}
+
+static void peerBuild(){
+  for(int i=0; i<PEER_MAX; i++){
+    delete peers[i];
+    peers[i] = nullptr;
+  }
+  delete[] peerKey;
+  peerKey = nullptr;
+  peerReconfig = false;
+  if( ! peerPending){
+    return;
+  }
+  DynamicJsonBuffer Json;
+  JsonObject& config = Json.parseObject(peerPending);
+  delete[] peerPending;
+  peerPending = nullptr;
+  if( ! config.success()){
+    log("peerSync: Json parse failed");
+    return;
+  }
+  const char* key = config[F("key")] | "";
+  if(key[0]){
+    peerKey = charstar(key);
+  }
+  JsonArray& pull = config[F("pull")];
+  int count = 0;
+  for(int i=0; i<pull.size(); i++){
+    JsonObject& peer = pull.get<JsonObject>(i);
+    const char* name = peer[F("name")] | "";
+    const char* url = peer[F("url")] | "";
+    if( ! name[0] || strchr(name, '/') || strncasecmp_P(url, PSTR("http://"), 7) != 0){
+      log("peerSync: invalid peer %d", i);
+      continue;
+    }
+    if(count == PEER_MAX){
+      log("peerSync: more than %d peers, %s ignored", PEER_MAX, name);
+      continue;
+    }
+    peerLink* link = new peerLink;
+    link->name = charstar(name);
+    link->url = charstar(url);
+    while(strlen(link->url) > 7 && link->url[strlen(link->url) - 1] == '/'){
+      link->url[strlen(link->url) - 1] = 0;
+    }
+    const char* key = peer[F("key")] | "";
+    if(key[0]){
+      link->key = charstar(key);
+    }
+    link->backfill = peer[F("backfill")] | PEER_BACKFILL_DAYS;
+    peers[count++] = link;
+    log("peerSync: pulling %s from %s", link->name, link->url);
+  }
+}
+
+//**********************************************************************************************
+//        peerOpen(link) - open the peer log
+//**********************************************************************************************
+
+static bool peerOpen(peerLink* link){
+  String path(F(PEER_LOG_DIR));
+  path += link->name;
+  path += ".log";
+  link->log = new IotaLog(sizeof(IotaLogRecord), Current_log.interval(), PEER_LOG_DAYS);
+  if(int rtc = link->log->begin(path.c_str())){
+    log("peerSync: %s log open failed: %d, not pulled.", link->name, rtc);
+    delete link->log;
+    link->log = nullptr;
+    return false;
+  }
+  link->cursor = IotaLogCursor(link->log);
+  if(link->log->fileSize()){
+    log("peerSync: %s last entry %s", link->name, localDateString(link->log->lastKey()).c_str());
+  }
+  return true;
+}
+
+//**********************************************************************************************
+//        peerResponse(link, request) - log the records of a pull
+//
+//        Returns true when the peer has more to send.
+//**********************************************************************************************
+
+static bool peerRead(asyncHTTPrequest* request, void* buf, size_t len){
+  return request->available() >= len && request->responseRead((uint8_t*)buf, len) == len;
+}
+
+static bool peerResponse(peerLink* link, asyncHTTPrequest* request, bool& ok){
+  ok = false;
+  uint8_t header[PEER_HEADER_BYTES + IOTALOG_CHANNELS];
+  if( ! peerRead(request, header, PEER_HEADER_BYTES) || memcmp(header, "IOTP", 4) != 0 ||
+      header[4] != PEER_FORMAT_VERSION || header[5] == 0 || header[5] > IOTALOG_CHANNELS){
+    log("peerSync: %s invalid response", link->name);
+    return false;
+  }
+  uint8_t channels = header[5];
+  uint16_t recordBytes;
+  uint32_t interval;
+  memcpy(&recordBytes, header + 6, 2);
+  memcpy(&interval, header + 8, 4);
+  if(recordBytes != 16 + 16 * channels || interval != link->log->interval() ||
+     ! peerRead(request, header + PEER_HEADER_BYTES, channels)){
+    log("peerSync: %s invalid response", link->name);
+    return false;
+  }
+  IotaLogRecordHandle rec;
+  uint8_t* buf = new uint8_t[recordBytes];
+  uint32_t next = 0;
+  while(true){
+    uint32_t key;
+    if( ! peerRead(request, &key, 4)){
+      break;
+    }
+    if(key == 0){
+      ok = peerRead(request, &next, 4);
+      break;
+    }
+    if( ! peerRead(request, buf + 4, recordBytes - 4)){
+      break;
+    }
+    if(key <= link->log->lastKey() && link->log->fileSize()){
+      continue;
+    }
+    rec->UNIXtime = key;
+    memcpy(&rec->logHours, buf + 8, 8);
+    for(int i=0; i<IOTALOG_CHANNELS; i++){
+      rec->accum1[i] = 0;
+      rec->accum2[i] = 0;
+      if(i < channels){
+        memcpy(&rec->accum1[i], buf + 16 + 16 * i, 8);
+        memcpy(&rec->accum2[i], buf + 24 + 16 * i, 8);
+      }
+    }
+    link->log->write(rec);
+    link->records++;
+  }
+  delete[] buf;
+  if( ! ok){
+    log("peerSync: %s truncated response", link->name);
+  }
+  return ok && next != 0;
+}
+
+//**********************************************************************************************
+//
+//        peerSync - SERVICE to pull the peers
+//
+//**********************************************************************************************
+
+uint32_t peerSync(struct serviceBlock* _serviceBlock){
+  trace(T_peer,1);
+  _serviceBlock->priority = priorityLow;
+
+      // Finish a request in flight.
+
+  if(peerInflight){
+    if(peerRequest->readyState() != 4){
+      return 10;
+    }
+    trace(T_peer,2);
+    HTTPrelease(peerHTTPtoken);
+    peerLink* link = peerInflight;
+    peerInflight = nullptr;
+    link->lastCode = peerRequest->responseHTTPcode();
+    bool ok = false;
+    bool more = false;
+    if(link->lastCode == 200){
+      more = peerResponse(link, peerRequest, ok);
+    }
+    HTTPreturn(peerRequest, ok);
+    if( ! ok){
+      link->failures++;
+    }
+    link->nextPull = more ? 0 : UTCtime() + PEER_PULL_SEC;
+    return 1;
+  }
+
+      // Take up a new configuration.
+
+  if(peerReconfig){
+    peerBuild();
+  }
+  if( ! peers[0]){
+    trace(T_peer,3);
+    peerRunning = false;
+    return 0;
+  }
+  if( ! Current_log.isOpen()){
+    return UTCtime() + 5;
+  }
+
+      // Pull the peer that's due first.
+
+  peerLink* link = nullptr;
+  uint32_t wake = UTCtime() + PEER_PULL_SEC;
+  for(int i=0; i<PEER_MAX && peers[i]; i++){
+    if( ! peers[i]->log && ( ! peers[i]->nextPull || peers[i]->nextPull <= UTCtime())){
+      if( ! peerOpen(peers[i])){
+        peers[i]->nextPull = UINT32_MAX;
+      }
+    }
+    if(peers[i]->log && ( ! link || peers[i]->nextPull < link->nextPull)){
+      link = peers[i];
+    }
+  }
+  if( ! link){
+    return wake;
+  }
+  if(link->nextPull > UTCtime()){
+    return link->nextPull;
+  }
+  if(ESP.getFreeHeap() < PEER_HEAP_MIN){
+    return UTCtime() + 5;
+  }
+  peerHTTPtoken = HTTPreserve(T_peer);
+  if( ! peerHTTPtoken){
+    return 15;
+  }
+  uint32_t interval = link->log->interval();
+  uint32_t begin = link->log->lastKey() + interval;
+  if(link->log->fileSize() == 0){
+    begin = UTCtime() - link->backfill * 86400UL;
+    begin -= begin % interval;
+  }
+  char URL[160];
+  snprintf_P(URL, sizeof(URL), PSTR("%s/peer?begin=%u&limit=%d"), link->url, begin, PEER_PULL_RECORDS);
+  peerRequest = HTTPlease("GET", URL);
+  if( ! peerRequest){
+    HTTPrelease(peerHTTPtoken);
+    return UTCtime() + 5;
+  }
+  trace(T_peer,4);
+  peerRequest->setTimeout(3);
+  peerRequest->setDebug(false);
+  if(link->key){
+    String auth(F("Bearer "));
+    auth += link->key;
+    peerRequest->setReqHeader(F("Authorization"), auth.c_str());
+  }
+  link->pulls++;
+  if( ! peerRequest->send()){
+    HTTPrelease(peerHTTPtoken);
+    HTTPreturn(peerRequest, false);
+    link->failures++;
+    link->nextPull = UTCtime() + PEER_PULL_SEC;
+    return UTCtime() + 5;
+  }
+  peerInflight = link;
+  return 10;
+}
+
+//**********************************************************************************************
+//        peerDeltas(input, oldRec, newRec, ...) - Script virtual input ~input
+//
+//        The accumulator deltas and elapsed hours of a peer channel over the interval of a
+//        record pair.  Without an old record, the last interval in the peer log.
+//**********************************************************************************************
+
+static IotaLogRecord* peerRecord(peerLink* link, uint32_t key){
+  for(int i=0; i<2; i++){
+    if(link->rec[i].UNIXtime == key && link->rec[i].serial >= 0){
+      link->recNext = i ^ 1;
+      return &link->rec[i];
+    }
+  }
+  IotaLogRecord* rec = &link->rec[link->recNext];
+  link->recNext ^= 1;
+  rec->UNIXtime = key;
+  if(link->cursor.read(rec) == 2){
+    rec->serial = -1;
+    return nullptr;
+  }
+  return rec;
+}
+
+bool peerDeltas(int input, IotaLogRecord* oldRec, IotaLogRecord* newRec,
+                double& accum1, double& accum2, double& elapsedHours){
+  int index = (input - 1) / IOTALOG_CHANNELS;
+  int channel = (input - 1) % IOTALOG_CHANNELS;
+  if(input < 1 || index >= PEER_MAX || ! peers[index] || ! peers[index]->log){
+    return false;
+  }
+  peerLink* link = peers[index];
+  IotaLog* log = link->log;
+  if(log->fileSize() == 0){
+    return false;
+  }
+  uint32_t newKey = oldRec ? newRec->UNIXtime : log->lastKey();
+  uint32_t oldKey = oldRec ? oldRec->UNIXtime : newKey - log->interval();
+  if(newKey > log->lastKey()){
+    return false;
+  }
+  IotaLogRecord* newPeer = peerRecord(link, newKey);
+  IotaLogRecord* oldPeer = newPeer ? peerRecord(link, oldKey) : nullptr;
+  if( ! oldPeer){
+    return false;
+  }
+  accum1 = newPeer->accum1[channel] - oldPeer->accum1[channel];
+  accum2 = newPeer->accum2[channel] - oldPeer->accum2[channel];
+  elapsedHours = newPeer->logHours - oldPeer->logHours;
+  return true;
+}
+
+    // A configured peer that has nothing logged yet covers no key.
+    // An input of no configured peer is always zero, there's nothing to wait for.
+
+uint32_t peerLastKey(int input){
+  int index = (input - 1) / IOTALOG_CHANNELS;
+  if(input < 1 || index >= PEER_MAX || ! peers[index]){
+    return UINT32_MAX;
+  }
+  IotaLog* log = peers[index]->log;
+  if( ! log || log->fileSize() == 0){
+    return 0;
+  }
+  return log->lastKey();
+}
+
+//**********************************************************************************************
+//        peerStatus(stats) - GET /status?stats
+//**********************************************************************************************
+
+void peerStatus(JsonObject& status){
+  status.set(F("served"), peerServed);
+  status.set(F("servedrecords"), peerServedRecords);
+  if( ! peers[0]){
+    return;
+  }
+  JsonArray& pull = status.createNestedArray(F("pull"));
+  for(int i=0; i<PEER_MAX && peers[i]; i++){
+    peerLink* link = peers[i];
+    JsonObject& peer = pull.createNestedObject();
+    peer.set(F("name"), link->name);
+    if(link->log){
+      peer.set(F("lastkey"), link->log->lastKey());
+      peer.set(F("behind"), link->log->fileSize() ? UTCtime() - MIN(UTCtime(), link->log->lastKey()) : 0);
+    }
+    peer.set(F("pulls"), link->pulls);
+    peer.set(F("records"), link->records);
+    peer.set(F("failures"), link->failures);
+    peer.set(F("code"), link->lastCode);
+  }
+}
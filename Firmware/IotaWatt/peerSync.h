@@ -0,0 +1,61 @@
+#ifndef peerSync_h
+#define peerSync_h
+
+/**************************************************************************************************
+ *
+ *  peerSync - raw datalog records between IoTaWatts
+ *
+ *  GET /peer?begin=<UNIXtime>[&end=<UNIXtime>][&limit=<records>]
+ *
+ *  Sites with several units aggregated them by pulling CSV from each one's /query and parsing
+ *  the text back into numbers.  /peer instead streams the Current_log records themselves, the
+ *  accumulators every query is computed from, in a little-endian binary format:
+ *
+ *    header  "IOTP", uint8 version, uint8 channels, uint16 record bytes, uint32 interval,
+ *            uint32 begin, uint32 end, then uint8 type per channel ('V', 'P' or 0 inactive).
+ *    records uint32 UNIXtime, int32 serial, double logHours, then per channel double accum1,
+ *            double accum2 (record bytes = 16 + 16 * channels).
+ *    trailer uint32 0, uint32 key to resume from (0 if the range is complete).
+ *
+ *  A response has at most "limit" records (default and max PEER_RECORDS_MAX), or at most
+ *  PEER_PULL_RECORDS when no web stream is free and it's sent inline, and the trailer is the
+ *  cursor for the next request.  begin is aligned to the log interval and clipped to
+ *  the log, end defaults to the last record.
+ *
+ *  The endpoint takes the usual user authentication, or "Authorization: Bearer <key>" with
+ *  the key in config.txt "peers", so a peer needn't do Digest.
+ *
+ *  Pull mode.  Each unit in "peers" "pull" is polled by the peerSync SERVICE, one request at a
+ *  time, into its own log in PEER_LOG_DIR, starting "backfill" days back (default 1) for a new
+ *  log, then every PEER_PULL_SEC once caught up:
+ *
+ *      "peers":{"key":"<key for this unit>",
+ *               "pull":[{"name":"panel2","url":"http://192.168.1.21","key":"<its key>"},...]}
+ *
+ *  The pulled channels are virtual inputs to Scripts: ~1 to ~15 are channels 0-14 of the first
+ *  peer, ~16 to ~30 of the second.  A power channel gives Watts, Wh, kWh, VA and VAh, and a
+ *  voltage channel Volts and Hz.  Intervals the peer log doesn't have yet are zero in queries,
+ *  uploaders and integrations using the inputs wait until the peer log has them.
+ *
+ * ************************************************************************************************/
+
+#define PEER_FORMAT_VERSION 1
+#define PEER_RECORDS_MAX 720                // Records per /peer response
+#define PEER_PULL_RECORDS 16                // Records per pull (the response is buffered)
+#define PEER_MAX 2                          // Peers pulled, IOTALOG_CHANNELS virtual inputs each
+#define PEER_PULL_SEC 60                    // Between pulls once caught up or after a failure
+#define PEER_BACKFILL_DAYS 1                // Default start of a new peer log
+#define PEER_LOG_DAYS 366                   // Peer log size
+#define PEER_HEAP_MIN 16000                 // Free heap needed to pull
+#define PEER_LOG_DIR "/iotawatt/peers/"
+
+void      handlePeer();                     // Web server handler
+bool      peerAuthorized();                 // Request has the peer key
+bool      peerConfig(const char* JsonStr);  // config.txt "peers" (nullptr = none)
+uint32_t  peerSync(struct serviceBlock*);
+bool      peerDeltas(int input, IotaLogRecord* oldRec, IotaLogRecord* newRec,
+                     double& accum1, double& accum2, double& elapsedHours);     // Virtual input ~input
+uint32_t  peerLastKey(int input);           // Last key of virtual input ~input (UINT32_MAX = none)
+void      peerStatus(JsonObject&);          // Add peer stats to /status
+
+#endif
@@ -0,0 +1,136 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * queryCache - see queryCache.h
+ *
+ * Each entry is a fixed share of one text buffer.  Points are appended in time order as
+ * uint32 time followed by the zero terminated text.  Lookups in a request are in ascending time,
+ * so get() carries on from the last point found rather than from the start.
+ * ************************************************************************************************/
+
+queryCache queryResults;
+
+void queryCache::size(uint16_t bytes){
+  bytes = MIN(bytes, QUERY_CACHE_MAX);
+  if(bytes != _size){
+    delete[] _text;
+    _text = nullptr;
+    _size = bytes;
+    if(_size){
+      _text = new char[_size];
+    }
+  }
+  clear();
+}
+
+void queryCache::clear(){
+  for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+    _entry[i].key = 0;
+    _entry[i].used = 0;
+    _entry[i].length = 0;
+  }
+  _hits = 0;
+  _misses = 0;
+}
+
+uint32_t queryCache::open(const String& key){
+  if( ! _size){
+    return 0;
+  }
+  uint32_t hash = hashIndex(key.c_str()) | 1;
+  int lru = 0;
+  for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+    if(_entry[i].key == hash){
+      _entry[i].used = ++_clock;
+      _entry[i].scan = 0;
+      return hash;
+    }
+    if(_entry[i].used < _entry[lru].used){
+      lru = i;
+    }
+  }
+  _entry[lru].key = hash;
+  _entry[lru].used = ++_clock;
+  _entry[lru].length = 0;
+  _entry[lru].scan = 0;
+  _entry[lru].lastTime = 0;
+  return hash;
+}
+
+int queryCache::find(uint32_t key){
+  if(key){
+    for(int i=0; i<QUERY_CACHE_ENTRIES; i++){
+      if(_entry[i].key == key){
+        return i;
+      }
+    }
+  }
+  return -1;
+}
+
+const char* queryCache::get(uint32_t key, uint32_t time){
+  int ndx = find(key);
+  if(ndx < 0){
+    if(key){
+      _misses++;
+    }
+    return nullptr;
+  }
+  entry* e = &_entry[ndx];
+  char* text = base(ndx);
+  uint32_t pointTime;
+  uint16_t pos = e->scan;
+  if(pos < e->length){
+    memcpy(&pointTime, text + pos, 4);
+    if(pointTime > time){
+      pos = 0;
+    }
+  }
+  while(pos < e->length){
+    memcpy(&pointTime, text + pos, 4);
+    if(pointTime == time){
+      e->scan = pos;
+      _hits++;
+      return text + pos + 4;
+    }
+    if(pointTime > time){
+      break;
+    }
+    pos += 4 + strlen(text + pos + 4) + 1;
+  }
+  _misses++;
+  return nullptr;
+}
+
+void queryCache::put(uint32_t key, uint32_t time, const char* point){
+  int ndx = find(key);
+  if(ndx < 0){
+    return;
+  }
+  entry* e = &_entry[ndx];
+  if(e->length && time <= e->lastTime){
+    return;
+  }
+  uint16_t capacity = _size / QUERY_CACHE_ENTRIES;
+  size_t need = 4 + strlen(point) + 1;
+  if(need > capacity){
+    return;
+  }
+  char* text = base(ndx);
+
+      // Drop the oldest points to make room.
+
+  uint16_t drop = 0;
+  while(e->length - drop + need > capacity){
+    drop += 4 + strlen(text + drop + 4) + 1;
+  }
+  if(drop){
+    memmove(text, text + drop, e->length - drop);
+    e->length -= drop;
+    e->scan = 0;
+  }
+  memcpy(text + e->length, &time, 4);
+  strcpy(text + e->length + 4, point);
+  e->length += need;
+  e->lastTime = time;
+}
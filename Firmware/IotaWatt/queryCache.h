@@ -0,0 +1,61 @@
+#ifndef queryCache_h
+#define queryCache_h
+
+/**************************************************************************************************
+ *
+ *  queryCache - recent /feed/data and /query result points
+ *
+ *  Dashboards poll the same query every few seconds with the window sliding forward an interval
+ *  at a time.  The formatted text of each point is kept by query and time, so a repeat poll only
+ *  computes the new points at the end.  Points are only cached once the log records they were
+ *  computed from have been written, so what's kept never changes.  The cache is cleared when the
+ *  config is loaded, as outputs and inputs may have changed.
+ *
+ *  Each entry holds one query's points in time order, oldest dropped first when full.  The size
+ *  is set with device config "querycache" (bytes, 0 = off) and shared by QUERY_CACHE_ENTRIES.
+ *  An entry only keeps the newest points that fit its share, 2K by default or roughly 100 rows
+ *  of a few columns, so a longer window still computes its earlier points on every poll.
+ *  Raise "querycache" (up to QUERY_CACHE_MAX) for dashboards with longer windows.
+ *
+ *  open() returns the hash of the query key and get() and put() take it, not the entry, so a
+ *  streamed query whose entry was reused by another query meanwhile just misses.
+ *
+ * ************************************************************************************************/
+
+#define QUERY_CACHE_DEFAULT 4096            // Bytes
+#define QUERY_CACHE_MAX 16384
+#define QUERY_CACHE_ENTRIES 2               // Queries kept
+
+class queryCache {
+  public:
+    queryCache() : _text(nullptr), _size(0), _clock(0), _hits(0), _misses(0) {};
+    void        size(uint16_t bytes);       // Set size (0 = off), clears
+    void        clear();
+    uint32_t    open(const String& key);    // Open entry for query key, returns its hash (0 = off)
+    const char* get(uint32_t key, uint32_t time);
+    void        put(uint32_t key, uint32_t time, const char* text);
+    uint16_t    bytes(){return _size;}
+    uint32_t    hits(){return _hits;}
+    uint32_t    misses(){return _misses;}
+
+  private:
+    struct entry {
+      uint32_t  key;                        // hashIndex() of query key (0 = empty)
+      uint32_t  used;                       // _clock at last open
+      uint16_t  length;                     // Bytes of points
+      uint16_t  scan;                       // Offset of last point found
+      uint32_t  lastTime;                   // Time of last point
+    };
+    entry       _entry[QUERY_CACHE_ENTRIES];
+    char*       _text;                      // Points: uint32 time, text, zero
+    uint16_t    _size;
+    uint32_t    _clock;
+    uint32_t    _hits;
+    uint32_t    _misses;
+    int         find(uint32_t key);         // Entry with key (-1 = reused by another query)
+    char*       base(int entry){return _text + entry * (_size / QUERY_CACHE_ENTRIES);}
+};
+
+extern queryCache queryResults;
+
+#endif
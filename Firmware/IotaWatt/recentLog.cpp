@@ -0,0 +1,145 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * recentLog - see recentLog.h
+ *
+ * Second key is in slot key % _seconds.  Seconds that statService missed get the same values as
+ * the second it ran, which is the average over all of them.
+ * ************************************************************************************************/
+
+recentLog recentData;
+
+static uint16_t toHalf(float value){
+  uint32_t bits;
+  memcpy(&bits, &value, 4);
+  uint16_t sign = (bits >> 16) & 0x8000;
+  int32_t exponent = (int32_t)((bits >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = bits & 0x7fffff;
+  if(exponent <= 0){
+    return sign;                            // Too small, zero
+  }
+  if(exponent >= 31){
+    return sign | 0x7bff;                   // Too large or NaN, largest
+  }
+  uint16_t half = sign | (exponent << 10) | (mantissa >> 13);
+  if(mantissa & 0x1000){
+    half++;
+    if((half & 0x7fff) > 0x7bff){
+      half = sign | 0x7bff;
+    }
+  }
+  return half;
+}
+
+static float fromHalf(uint16_t half){
+  uint32_t bits = (uint32_t)(half & 0x8000) << 16;
+  uint32_t exponent = (half >> 10) & 0x1f;
+  if(exponent){
+    bits |= ((exponent - 15 + 127) << 23) | ((uint32_t)(half & 0x3ff) << 13);
+  }
+  float value;
+  memcpy(&value, &bits, 4);
+  return value;
+}
+
+void recentLog::size(uint16_t seconds){
+  seconds = MIN(seconds, RECENT_MAX_SEC);
+  uint8_t channels = seconds ? logChannels() : 0;
+  if(seconds != _seconds || channels != _channels){
+    delete[] _data;
+    _data = nullptr;
+    _seconds = seconds;
+    _channels = channels;
+    if(_seconds){
+      _data = new uint16_t[_seconds * _channels * 2];
+    }
+  }
+  _count = 0;
+  _lastKey = 0;
+}
+
+void recentLog::add(uint32_t key, const float* value1, const float* value2){
+  if( ! _seconds){
+    return;
+  }
+  if(logChannels() != _channels){
+    size(_seconds);
+  }
+  if(key <= _lastKey){
+    return;
+  }
+  if( ! _count || (key - _lastKey) > _seconds){
+    _count = 0;
+    _lastKey = key - 1;
+  }
+  while(_lastKey < key){
+    _lastKey++;
+    uint16_t* slot = _data + (_lastKey % _seconds) * _channels * 2;
+    for(int i=0; i<_channels; i++){
+      slot[i*2] = toHalf(value1[i]);
+      slot[i*2+1] = toHalf(value2[i]);
+    }
+    _count = MIN(_count + 1, _seconds);
+  }
+}
+
+bool recentLog::covers(uint32_t begin, uint32_t end){
+  return _count && begin >= firstKey() + RECENT_MARGIN_SEC && end <= _lastKey + RECENT_MARGIN_SEC;
+}
+
+//**********************************************************************************************
+//        recentCursor
+//**********************************************************************************************
+
+int recentCursor::start(uint32_t key){
+  uint32_t seed = MIN(key, Current_log.lastKey());
+  seed -= seed % Current_log.interval();
+  if(seed + 1 < recentData.firstKey()){
+    return 1;
+  }
+  IotaLogRecordHandle record;
+  record->UNIXtime = seed;
+  if(Current_log.readKey(record)){
+    return 1;
+  }
+  _key = seed;
+  _logHours = record->logHours;
+  for(int i=0; i<IOTALOG_CHANNELS; i++){
+    _accum1[i] = record->accum1[i];
+    _accum2[i] = record->accum2[i];
+  }
+  recentData._queries++;
+  return 0;
+}
+
+int recentCursor::read(IotaLogRecord* callerRecord){
+  uint32_t key = callerRecord->UNIXtime;
+  if( ! recentData._count){
+    return 1;
+  }
+  if( ! _key || key < _key){
+    if(start(key)){
+      return 1;
+    }
+  }
+  if(_key + 1 < recentData.firstKey()){
+    return 1;
+  }
+  uint32_t target = MIN(key, recentData._lastKey);
+  while(_key < target){
+    _key++;
+    uint16_t* slot = recentData._data + (_key % recentData._seconds) * recentData._channels * 2;
+    for(int i=0; i<recentData._channels; i++){
+      _accum1[i] += fromHalf(slot[i*2]) / 3600.0;
+      _accum2[i] += fromHalf(slot[i*2+1]) / 3600.0;
+    }
+    _logHours += 1.0 / 3600.0;
+  }
+  callerRecord->serial = 0;
+  callerRecord->logHours = _logHours;
+  for(int i=0; i<IOTALOG_CHANNELS; i++){
+    callerRecord->accum1[i] = _accum1[i];
+    callerRecord->accum2[i] = _accum2[i];
+  }
+  return 0;
+}
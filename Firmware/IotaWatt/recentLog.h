@@ -0,0 +1,68 @@
+#ifndef recentLog_h
+#define recentLog_h
+
+/**************************************************************************************************
+ *
+ *  recentLog - the last few minutes of per-second input values, in RAM
+ *
+ *  The finest data a query could get was the 5 second Current_log, and on the SD, so a live
+ *  graph of the last few minutes was a steady stream of SD reads at 5 second resolution.
+ *  statService already works out each input's average watts (or volts) and VA (or Hz) every
+ *  second, so recentData keeps those in a ring of device config "recentsec" seconds
+ *  (default RECENT_DEFAULT_SEC, 0 = off) for the logged channels, as half precision floats
+ *  (about 3 significant digits, +/- 65504).
+ *
+ *  A recentCursor reads it as if it were a log.  It seeds its accumulators from the Current_log
+ *  record at or before the first key read, and from there adds each second's values, so the
+ *  records it makes have the same cumulative Wh, VAh and logHours as Current_log, to within the
+ *  difference in when statService and dataLog take their readings.  Keys must ascend; a key
+ *  past the last second gets the last second's record, as with a log, so shows as missing.
+ *
+ *  CSVquery and getFeedData use it, with one second resolution, when the whole window is
+ *  within the ring (covers()).  Those results aren't cached in queryResults.
+ *
+ * ************************************************************************************************/
+
+#define RECENT_DEFAULT_SEC 120              // Seconds kept
+#define RECENT_MAX_SEC 600
+#define RECENT_MARGIN_SEC 10                // Windows must begin this far inside the ring
+
+class recentLog {
+  friend class recentCursor;
+
+  public:
+    recentLog() : _data(nullptr), _seconds(0), _channels(0), _lastKey(0), _count(0), _queries(0) {};
+    void      size(uint16_t seconds);       // Set size (0 = off), clears
+    void      add(uint32_t key, const float* value1, const float* value2);    // Values for second key
+    bool      covers(uint32_t begin, uint32_t end);     // Can serve keys begin through end
+    uint32_t  firstKey(){return _count ? _lastKey - _count + 1 : 0;}
+    uint32_t  lastKey(){return _count ? _lastKey : 0;}
+    uint16_t  seconds(){return _seconds;}
+    uint8_t   channels(){return _channels;}
+    uint32_t  queries(){return _queries;}
+
+  private:
+    uint16_t* _data;                        // Ring of [_channels][2] half floats per second 
+    uint16_t  _seconds;                     // Ring size
+    uint8_t   _channels;                    // Channels kept
+    uint32_t  _lastKey;                     // Newest second
+    uint16_t  _count;                       // Seconds in ring
+    uint32_t  _queries;                     // Running count of cursors started
+};
+
+class recentCursor {
+  public:
+    recentCursor() : _key(0), _logHours(0) {};
+    int       read(IotaLogRecord* callerRecord);
+
+  private:
+    uint32_t  _key;                         // Key of accumulated values (0 = not started)
+    double    _logHours;
+    double    _accum1[IOTALOG_CHANNELS];
+    double    _accum2[IOTALOG_CHANNELS];
+    int       start(uint32_t key);
+};
+
+extern recentLog recentData;
+
+#endif
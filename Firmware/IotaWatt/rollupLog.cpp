@@ -0,0 +1,159 @@
+/**********************************************************************************************
+ * rollupLog is a Service that maintains the hourly and daily rollup logs.
+ * 
+ * Like the history log, the records are simply an identical subset of the entries in the 
+ * logs below it, in this case the on-the-hour entries of the history log.  Since accumulators
+ * are cumulative, no summarization is needed, and a keyed read of an hourly key returns 
+ * exactly what the history log would.
+ * 
+ * The hourly log is about 1/60th the size of the history log.  Besides fewer records, keyed 
+ * reads over long ranges avoid walking the FAT cluster chain of a multi-gigabyte file, so 
+ * logReadKey() uses it when the requested key is on an hour boundary.  Long range queries with
+ * hourly or coarser groups are serviced almost entirely from here.
+ * 
+ * When first started, the log is backfilled from the beginning of the history log, paced
+ * with a serviceBudget.  After that, the service wakes up after each hour boundary has been
+ * written to the history log and adds it.
+ * 
+ * The daily log is kept the same way with the history records at each local midnight, not
+ * UTC midnight, so its days are the local-day groups CSVquery produces.  Its interval is 
+ * 15 minutes so that any timezone's midnight is a valid key, and daylight time changes are
+ * handled as the keys needn't be evenly spaced.  A year of day, week or month
+ * groups is then a few hundred reads of a small file rather than a search of the history log
+ * per group.  The keys depend on the timezone, so when the last entry is no longer a local 
+ * midnight the log is suspended, and rebuilt at the next restart.  Deleting the history log
+ * (deletelog=history or both) deletes both rollup logs.
+ * 
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+static uint32_t nextLocalDay(uint32_t UTCtime){
+  uint32_t local = UTC2Local(UTCtime);
+  return local2UTC(local + UNIX_DAY - (local % UNIX_DAY));
+}
+
+static bool dailyAligned(){
+  return Daily_log.fileSize() == 0 || (UTC2Local(Daily_log.lastKey()) % UNIX_DAY) == 0;
+}
+
+uint32_t rollupLog(struct serviceBlock* _serviceBlock){
+  enum states {initialize, update};
+  static states state = initialize;
+  static IotaLogRecord* logRecord = nullptr;
+  static serviceBudget budget;
+  trace(T_rollup,0);
+
+  switch(state){
+
+    case initialize: {
+      trace(T_rollup,1);
+
+        // Wait until the history log has at least an hour.
+
+      if( ! History_log.isOpen() || (History_log.lastKey() - History_log.firstKey()) < Hourly_log.interval()){
+        return UTCtime() + 60;
+      }
+
+      log("rollupLog: service started.");
+      if(compactLog){
+        Hourly_log.compact(logChannels());
+      }
+      Hourly_log.crc(logCRC);
+      if(int rtc = Hourly_log.begin(IOTA_HOURLY_LOG_PATH)){
+        log("rollupLog: Log file open failed: %d, service halted.", rtc);
+        return 0;
+      }
+      if(Hourly_log.fileSize() == 0){
+        log("rollupLog: Building hourly log.");
+      } else {
+        log("rollupLog: Last log entry %s", localDateString(Hourly_log.lastKey()).c_str());
+      }
+
+      if(compactLog){
+        Daily_log.compact(logChannels());
+      }
+      Daily_log.crc(logCRC);
+      if(Daily_log.begin(IOTA_DAILY_LOG_PATH) == 0 && ! dailyAligned()){
+        log("rollupLog: Timezone changed, rebuilding daily log.");
+        Daily_log.end();
+        SD.remove(IOTA_DAILY_LOG_PATH);
+        SD.remove(F("/iotawatt/daylog.ndx"));
+        SD.remove(F("/iotawatt/daylog.sup"));
+        Daily_log.begin(IOTA_DAILY_LOG_PATH);
+      }
+      if( ! Daily_log.isOpen()){
+        log("rollupLog: Daily log open failed.");
+      }
+      state = update;
+      return 1;
+    }
+
+        // Add any hours that are in the history log.
+
+    case update: {
+      trace(T_rollup,2);
+      uint32_t interval = Hourly_log.interval();
+      while(true){
+        uint32_t key = Hourly_log.lastKey() + interval;
+        if(Hourly_log.fileSize() == 0){
+          key = History_log.firstKey() + interval - 1;
+          key -= key % interval;
+        }
+        if(key > History_log.lastKey()){
+          break;
+        }
+        if( ! logRecord){
+          logRecord = new IotaLogRecord;
+        }
+        logRecord->UNIXtime = key;
+        if(History_log.readKey(logRecord) == 2){
+          log("rollupLog: history log read failure. Service suspended.");
+          delete logRecord;
+          logRecord = nullptr;
+          return 0;
+        }
+        trace(T_rollup,3);
+        Hourly_log.write(logRecord);
+        if( ! budget.next()){
+          return 15;
+        }
+      }
+
+        // Add any local midnights that are in the history log.
+
+      if(Daily_log.isOpen() && ! dailyAligned()){
+        log("rollupLog: Timezone changed, daily log suspended until restart.");
+        Daily_log.end();
+      }
+      while(Daily_log.isOpen()){
+        uint32_t key = nextLocalDay(Daily_log.fileSize() ? Daily_log.lastKey() : History_log.firstKey() - 1);
+        if(key > History_log.lastKey()){
+          break;
+        }
+        if( ! logRecord){
+          logRecord = new IotaLogRecord;
+        }
+        logRecord->UNIXtime = key;
+        if(History_log.readKey(logRecord) == 2){
+          log("rollupLog: history log read failure. Service suspended.");
+          delete logRecord;
+          logRecord = nullptr;
+          return 0;
+        }
+        trace(T_rollup,5);
+        Daily_log.write(logRecord);
+        if( ! budget.next()){
+          return 15;
+        }
+      }
+      delete logRecord;
+      logRecord = nullptr;
+
+        // Check back after the next hour is in the history log.
+
+      trace(T_rollup,4);
+      return Hourly_log.lastKey() + interval + History_log.interval();
+    }
+  }
+  return 1000;
+}
@@ -1,49 +1,97 @@
 #include "IotaWatt.h"
+
+static void computePower(IotaInputChannel* Ichannel, IotaInputChannel* Vchannel, int16_t* Isamp, uint32_t sumIsq, float skew);
+static void noteSampling(IotaInputChannel* channel, int rtc, uint32_t startUs);
+static void noteVoltage(IotaInputChannel* Vchannel);
+
+uint32_t samplingSince = 0;                    // UTC time sampling telemetry was last reset
+uint32_t vtRefresh = VT_DEFAULT_REFRESH;       // Voltage channel own-turn interval (ms)
   
   /***************************************************************************************************
   *  samplePower()  Sample a channel.
   *  
+  *  In shared-voltage mode (multiCT > 1), the following active power channels that use
+  *  the same voltage reference are sampled in the same cycle.
+  *  Every power cycle also updates its voltage channel's Vrms (sampleCycle sets Hz), so
+  *  a voltage channel's own turn is skipped when that was within vtRefresh ms.
+  *  Returns the highest channel sampled.
+  *  
   ****************************************************************************************************/
-void samplePower(int channel, int overSample){
+int samplePower(int channel, int overSample){
   static uint32_t trapTime = 0;
   uint32_t timeNow = millis();
+  uint32_t startUs = micros();
 
   trace(T_POWER,0,channel);
   if( ! inputChannel[channel]->isActive()){
-    return;
+    return channel;
   }
   
       // If it's a voltage channel, use voltage only sample, update and return.
 
   trace(T_POWER,0);
   if(inputChannel[channel]->_type == channelTypeVoltage){
+    if(vtRefresh && (timeNow - inputChannel[channel]->_lastSampleMs) < vtRefresh){
+      return channel;
+    }
     float VRMS = sampleVoltage(channel, inputChannel[channel]->_calibration);
     if(VRMS >= 0.0){
       inputChannel[channel]->setVoltage(VRMS);                                                                        
     }
-    return;
+    noteSampling(inputChannel[channel], VRMS > 0.0 ? 0 : (VRMS < 0.0 ? 1 : 2), startUs);
+    return channel;
   }
 
          // Currently only voltage and power channels, so return if not one of those.
      
-  if(inputChannel[channel]->_type != channelTypePower) return;
+  if(inputChannel[channel]->_type != channelTypePower) return channel;
 
          // From here on, dealing with a power channel and associated voltage channel.
 
   trace(T_POWER,1);
   IotaInputChannel* Ichannel = inputChannel[channel];
   IotaInputChannel* Vchannel = inputChannel[Ichannel->_vchannel]; 
-          
-  byte Ichan = Ichannel->_channel;
-  byte Vchan = Vchannel->_channel;
-  
-  double _Irms = 0;
-  double _watts = 0;
-  double _Vrms = 0;
-  double _VA = 0;
 
-  int16_t* VsamplePtr = Vsample;
-  int16_t* IsamplePtr = Isample;
+         // Shared-voltage mode.
+         // Gather the next active channels up to the first that doesn't share this voltage.
+
+  if(multiCT > 1){
+    IotaInputChannel* group[MULTICT_MAX];
+    int count = 0;
+    int lastChannel = channel;
+    group[count++] = Ichannel;
+    for(int i=channel+1; i<maxInputs && count<multiCT; i++){
+      if( ! inputChannel[i]->isActive()) continue;
+      if(inputChannel[i]->_type != channelTypePower || inputChannel[i]->_vchannel != Ichannel->_vchannel) break;
+      group[count++] = inputChannel[i];
+      lastChannel = i;
+    }
+    if(count > 1){
+      trace(T_POWER,6,count);
+      if(int rtc = sampleCycleMulti(Vchannel, group, count)){
+        trace(T_POWER,7);
+        for(int k=0; k<count; k++){
+          if(rtc == 2){
+            group[k]->setPower(0.0, 0.0);
+          }
+          noteSampling(group[k], rtc, startUs);
+        }
+        return lastChannel;
+      }
+
+          // I[k] was sampled k ADC slots after I[0], which appears as phase lead.
+
+      noteVoltage(Vchannel);
+      for(int k=0; k<count; k++){
+        computePower(group[k], Vchannel, IsampleMulti[k], sumIsqMulti[k], 360.0 * k / ((count + 1) * samples));
+      }
+      for(int k=0; k<count; k++){
+        noteSampling(group[k], 0, startUs);
+      }
+      trace(T_POWER,9);
+      return lastChannel;
+    }
+  }
    
         // Invoke high speed sample collection.
         // If it fails, return.
@@ -53,8 +101,32 @@ void samplePower(int channel, int overSample){
     if(rtc == 2){
       Ichannel->setPower(0.0, 0.0);
     }
-    return;
-  }          
+    noteSampling(Ichannel, rtc, startUs);
+    return channel;
+  }
+  noteVoltage(Vchannel);
+  computePower(Ichannel, Vchannel, Isample, sumIsq, 0.0);
+  noteSampling(Ichannel, 0, startUs);
+  trace(T_POWER,9);                                                                               
+  return channel;
+}
+
+  /***************************************************************************************************
+  *  computePower()  Develop power for a channel from the last sample cycle.
+  *  
+  *  Isamp and sumIsq are the current samples and sum of squares for the channel.
+  *  skew is any additional apparent phase lead (degrees) from the sampling sequence.
+  *  
+  ****************************************************************************************************/
+static void computePower(IotaInputChannel* Ichannel, IotaInputChannel* Vchannel, int16_t* Isamp, uint32_t sumIsq, float skew){
+          
+  byte Ichan = Ichannel->_channel;
+  byte Vchan = Vchannel->_channel;
+  
+  double _Irms = 0;
+  double _watts = 0;
+  double _Vrms = 0;
+  double _VA = 0;
       
         // Voltage calibration is the ratio of line voltage to voltage presented at the input.
         // Input voltage is further attenuated with voltage dividing resistors (Vadj_3).
@@ -81,48 +153,58 @@ void samplePower(int channel, int overSample){
       // (CT lead - VT lead) - any gross phase correction for 3 phase measurement.
       // Note that a reversed CT can be corrected by introducing a 180deg gross correction.
 
-  float _phaseCorrection =  (Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms) - Ichannel->_vphase) * samples / 360.0;  // fractional Isamples correction
+  float _lastPhase = Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms);
+  float _phaseCorrection = (_lastPhase + skew - Ichannel->_vphase) * samples / 360.0;  // fractional Isamples correction
   int stepCorrection = int(_phaseCorrection);                                        // whole steps to correct 
   float stepFraction = _phaseCorrection - stepCorrection;                            // fractional step correction
   if(stepFraction < 0){                                                              // if current lead
     stepCorrection--;                                                                // One sample back
     stepFraction += 1.0;                                                             // and forward 1-fraction
   }
-  Ichannel->_lastPhase = Ichannel->getPhase(_Irms) - Vchannel->getPhase(_Vrms);
+  Ichannel->_lastPhase = _lastPhase;
+  Ichannel->_skew = skew;
+  Ichannel->_samples = samples;
 
   trace(T_POWER,3);
 
         // Recompute sums and squares with phase corrected samples.
-
-  int16_t rawV;
-  int16_t rawI;  
-  double _sumVI = 0;
-  double _sumVsq = 0;
-  double _sumIsq = 0;
+        // Current samples are not shifted, so sumIsq from sampleCycle stands.
             
-  Isample[samples] = Isample[0];
+  Isamp[samples] = Isamp[0];
   Vsample[samples] = Vsample[0];      
   int Vindex = (samples + stepCorrection) % samples;
-  for(int i=0; i<samples; i++){  
-    rawI = *IsamplePtr;
-    rawV = Vsample[Vindex]; 
-    rawV += int(stepFraction * (Vsample[Vindex + 1] - Vsample[Vindex]));
-    _sumVsq += rawV * rawV;
-    _sumIsq += rawI * rawI;
-    _sumVI += rawV * rawI;      
-    IsamplePtr++;
-    Vindex = ++Vindex % samples;
+  if(Vindex < 0) Vindex += samples;
+  int64_t _sumVsq = 0;
+  int64_t _sumVI = 0;
+  phaseCorrectQ15(Isamp, Vindex, int32_t(stepFraction * 32768.0f), &_sumVsq, &_sumVI);
+
+#ifdef SAMPLEPOWER_REFERENCE
+  {
+    double refVsq, refVI;
+    phaseCorrectReference(Isamp, Vindex, stepFraction, &refVsq, &refVI);
+    double errVsq = fabs(refVsq - (double)_sumVsq) / MAX(refVsq, 1.0);
+    double errVI = fabs(refVI - (double)_sumVI) / MAX(sqrt(refVsq * (double)sumIsq), 1.0);
+    if(errVsq > SAMPLEPOWER_TOLERANCE || errVI > SAMPLEPOWER_TOLERANCE){
+      Serial.printf_P(PSTR("samplePower: chan %d kernel mismatch Vsq %.6f VI %.6f\r\n"), Ichan, errVsq, errVI);
+    }
   }
+#endif
 
         // Compute Vrms, Irms, Power, etc.
 
   _Vrms = Vratio * sqrt((double)_sumVsq / samples);
-  _Irms = Iratio * sqrt((double)_sumIsq / samples);
   _watts = Vratio * Iratio * ((double)_sumVI / samples);
   _VA = _Vrms * _Irms;
 
   _watts *= Ichannel->_vmult;
   _VA *= Ichannel->_vmult;
+
+        // A simulated load replaces the measurement.
+
+  if(simload && simload->drives(Ichannel->_channel)){
+    _watts = simload->power(Ichannel->_channel, localTime());
+    _VA = fabs(_watts);
+  }
   
         // If watts is negative and the channel is not explicitely signed, reverse it (backward CT).
         // If we do reverse it, and it's significant, mark it as such for reporting in the status API.
@@ -140,10 +222,105 @@ void samplePower(int channel, int overSample){
 
   trace(T_POWER,5);
   Ichannel->setPower(_watts, _VA);
-  trace(T_POWER,9);                                                                               
-  return;
 }
 
+  /***************************************************************************************************
+  *  noteVoltage()  Update the voltage channel from the last power sample cycle.
+  *  
+  *  sampleCycle leaves the raw voltage sum of squares in sumVsq, so this is the same
+  *  Vrms that sampleVoltage would measure, without spending a cycle on it.
+  *  
+  ****************************************************************************************************/
+static void noteVoltage(IotaInputChannel* Vchannel){
+  double Vratio = Vchannel->_calibration * Vadj_3 * getAref(Vchannel->_channel) / double(ADC_RANGE);
+  Vchannel->setVoltage(Vratio * sqrt((double)sumVsq / samples));
+}
+
+  /***************************************************************************************************
+  *  noteSampling()  Update a channel's sampling telemetry.
+  *  
+  *  Called once per channel per samplePower with the sampleCycle return code.
+  *  A few adds and compares, no floating point.
+  *  
+  ****************************************************************************************************/
+static void noteSampling(IotaInputChannel* channel, int rtc, uint32_t startUs){
+  samplingStats* stats = &channel->_sampling;
+  uint32_t elapsedUs = micros() - startUs;
+  if(rtc == 0){
+    stats->cycles++;
+    int bin = (samples - SAMPLING_SAMPLES_BASE) / SAMPLING_SAMPLES_BIN;
+    stats->samples[RANGE(bin, 0, SAMPLING_BINS - 1)]++;
+  }
+  else if(rtc == 1){
+    stats->lowQuality++;
+  }
+  else {
+    stats->failures++;
+  }
+  stats->totalUs += elapsedUs;
+  if(elapsedUs > stats->maxUs){
+    stats->maxUs = elapsedUs;
+  }
+  int bin = ((int32_t)elapsedUs - SAMPLING_US_BASE) / SAMPLING_US_BIN;
+  stats->duration[RANGE(bin, 0, SAMPLING_BINS - 1)]++;
+}
+
+//**********************************************************************************************
+//
+//        phaseCorrectQ15()  -  Phase corrected sums for the last sampleCycle.
+//
+//        Interpolates each V sample forward by a Q15 fraction of a sample and
+//        accumulates sumVsq and sumVI against the unshifted Isamp samples.
+//        The V index wraps once, so the loop is split into two straight runs
+//        around the wrap point and needs neither modulo nor branch.
+//        Requires Vsample[samples] = Vsample[0] and Isamp[samples] = Isamp[0].
+//
+//**********************************************************************************************
+
+static void phaseCorrectRun(const int16_t* Vptr, const int16_t* Iptr, int count, int32_t fracQ15, 
+                            int64_t* sumVsq, int64_t* sumVI){
+  int64_t _sumVsq = 0;
+  int64_t _sumVI = 0;
+  while(count--){
+    int32_t step = fracQ15 * (*(Vptr+1) - *Vptr);
+    int32_t rawV = *Vptr + ((step + ((step >> 31) & 0x7FFF)) >> 15);  // truncate toward zero like int()
+    _sumVsq += rawV * rawV;
+    _sumVI += rawV * *Iptr;
+    Vptr++;
+    Iptr++;
+  }
+  *sumVsq += _sumVsq;
+  *sumVI += _sumVI;
+}
+
+void phaseCorrectQ15(int16_t* Isamp, int Vindex, int32_t fracQ15, int64_t* sumVsq, int64_t* sumVI){
+  int run1 = samples - Vindex;                   // Isamp[0] pairs with Vsample[Vindex]
+  phaseCorrectRun(Vsample + Vindex, Isamp, run1, fracQ15, sumVsq, sumVI);
+  phaseCorrectRun(Vsample, Isamp + run1, Vindex, fracQ15, sumVsq, sumVI);
+}
+
+#ifdef SAMPLEPOWER_REFERENCE
+//**********************************************************************************************
+//
+//        phaseCorrectReference()  -  Original floating point phase correction.
+//        Used only to cross-check phaseCorrectQ15().
+//
+//**********************************************************************************************
+
+void phaseCorrectReference(int16_t* Isamp, int Vindex, float stepFraction, double* sumVsq, double* sumVI){
+  int16_t rawV;
+  *sumVsq = 0;
+  *sumVI = 0;
+  for(int i=0; i<samples; i++){
+    rawV = Vsample[Vindex];
+    rawV += int(stepFraction * (Vsample[Vindex + 1] - Vsample[Vindex]));
+    *sumVsq += rawV * rawV;
+    *sumVI += rawV * Isamp[i];
+    Vindex = ++Vindex % samples;
+  }
+}
+#endif
+
 //**********************************************************************************************
 //
 //        readADC(uint8_t channel)
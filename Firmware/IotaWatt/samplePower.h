@@ -1,8 +1,13 @@
 #ifndef samplePower_h
 #define samplePower_h
 
-void    samplePower(int channel, int overSample);
+// #define SAMPLEPOWER_REFERENCE              // Cross-check the fixed point kernel against the double path
+#define SAMPLEPOWER_TOLERANCE 0.0005          // Max relative difference before reporting a mismatch
+#define VT_DEFAULT_REFRESH 10000              // Default voltage channel own-turn interval (ms)
+
+int     samplePower(int channel, int overSample);
 int     sampleCycle(IotaInputChannel* Vchannel, IotaInputChannel* Ichannel, int cycles = 1);
+int     sampleCycleMulti(IotaInputChannel* Vchannel, IotaInputChannel** Ichannels, int count);
 float   getAref(int channel);
 int     readADC(uint8_t channel);
 float   sampleVoltage(uint8_t Vchan, float Vcal);
@@ -10,4 +15,11 @@ float   samplePhase(uint8_t Vchan, uint8_t Ichan, int Ishift = 100);
 float   samplePhase(uint8_t Ichan, uint8_t Cchan, int shift, double *VPri, double *VSec);
 void    printSamples();
 
+extern uint32_t samplingSince;               // UTC time sampling telemetry was last reset
+extern uint32_t vtRefresh;                   // Voltage own-turn interval when power cycles update it (0 = every turn)
+void    phaseCorrectQ15(int16_t* Isamp, int Vindex, int32_t fracQ15, int64_t* sumVsq, int64_t* sumVI);
+#ifdef SAMPLEPOWER_REFERENCE
+void    phaseCorrectReference(int16_t* Isamp, int Vindex, float stepFraction, double* sumVsq, double* sumVI);
+#endif
+
 #endif
\ No newline at end of file
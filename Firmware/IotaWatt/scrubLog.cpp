@@ -0,0 +1,218 @@
+/**********************************************************************************************
+ * scrubLog is a Service that continuously reads the datalogs looking for bad records.
+ *
+ * An SD card that is going bad otherwise shows up when a record read by a query or an
+ * uploader is garbage, or when begin() can't make sense of the file.  The scrub walks each
+ * log from first to last serial, then moves on to the next log, indefinitely.
+ *
+ * Logs are taken in the order they appear in /status datalogs, by position, and the results
+ * are kept by log id, so a change in the integrations just starts a new pass.  A log that
+ * wraps during a pass carries on from its new first record.
+ *
+ * See scrubLog.h for pacing and reporting.
+ **********************************************************************************************/
+#include "IotaWatt.h"
+
+uint16_t scrubRate = SCRUB_DEFAULT_RATE;
+
+static scrubResult* scrubResults = nullptr;       // Results by log id
+static uint32_t     scrubBlocks = 0;              // Blocks read
+static uint32_t     scrubBytes = 0;               // Bytes read
+static uint64_t     scrubReadUs = 0;              // Time spent reading and checking
+static uint32_t     scrubSince = 0;               // UTCtime started
+
+//**********************************************************************************************
+//        scrubLogSelect(index, id) - resolve the index'th log and its id
+//**********************************************************************************************
+
+static IotaLog* scrubLogSelect(uint8_t index, const char* &id){
+  if(index == 0){
+    id = "Current";
+    return &Current_log;
+  }
+  if(index == 1){
+    id = "History";
+    return &History_log;
+  }
+  if(index == 2){
+    id = "Hourly";
+    return &Hourly_log;
+  }
+  if(index == 3){
+    id = "Daily";
+    return &Daily_log;
+  }
+  Script* script = integrations->first();
+  for(int i=4; script && i<index; i++){
+    script = script->next();
+  }
+  if(script){
+    id = script->name();
+    return ((integrator*)script->getParm())->get_log();
+  }
+  return nullptr;
+}
+
+static scrubResult* scrubGetResult(const char* id){
+  scrubResult* result = scrubResults;
+  while(result && strcmp(result->id, id) != 0){
+    result = result->next;
+  }
+  if( ! result){
+    result = new scrubResult;
+    result->id = charstar(id);
+    result->next = scrubResults;
+    scrubResults = result;
+  }
+  return result;
+}
+
+static void scrubBad(scrubResult* result, int32_t serial, uint32_t afterKey){
+  if(result->ranges && result->range[result->ranges - 1].lastSerial == serial - 1){
+    result->range[result->ranges - 1].lastSerial = serial;
+  }
+  else if(result->ranges < SCRUB_RANGES){
+    result->range[result->ranges].firstSerial = serial;
+    result->range[result->ranges].lastSerial = serial;
+    result->range[result->ranges].afterKey = afterKey;
+    result->ranges++;
+  }
+}
+
+uint32_t scrubLog(struct serviceBlock* _serviceBlock){
+  static uint8_t      logIndex = 0;
+  static int32_t      serial = -1;                  // Next serial to check (-1 = start pass)
+  static uint32_t     prevKey = 0;                  // Key of last good record
+  static scrubResult* result = nullptr;             // Results for the log being scrubbed
+  static uint32_t     credit = 0;                   // Blocks allowed (x1000)
+  static uint32_t     creditMs = 0;                 // millis() credit last updated
+  static serviceBudget budget(1000);
+  trace(T_scrub,0);
+
+  if( ! scrubRate || ! Current_log.isOpen()){
+    creditMs = 0;
+    return UTCtime() + 60;
+  }
+  if( ! scrubSince){
+    log("scrubLog: service started.");
+    scrubSince = UTCtime();
+    _serviceBlock->priority = priorityLow;
+  }
+
+      // Accrue credit at scrubRate, allowing up to a second's worth to build up.
+
+  uint32_t nowMs = millis();
+  if(creditMs){
+    credit = MIN(credit + (nowMs - creditMs) * scrubRate, (uint32_t)scrubRate * 1000);
+  }
+  creditMs = nowMs;
+
+  IotaLogRecordHandle record;
+  while(credit >= 1000 && budget.next()){
+
+        // Select the log. Start a pass if it's a new one.
+
+    const char* id = nullptr;
+    IotaLog* scrubbed = scrubLogSelect(logIndex, id);
+    if( ! scrubbed){
+      logIndex = 0;
+      serial = -1;
+      continue;
+    }
+    if( ! scrubbed->isOpen() || scrubbed->fileSize() == 0){
+      logIndex++;
+      serial = -1;
+      continue;
+    }
+    if(serial < 0 || strcmp(result->id, id) != 0){
+      trace(T_scrub,1);
+      result = scrubGetResult(id);
+      result->checked = 0;
+      result->crcErrors = 0;
+      result->badRecords = 0;
+      result->ranges = 0;
+      serial = scrubbed->firstSerial();
+      prevKey = 0;
+    }
+    serial = MAX(serial, scrubbed->firstSerial());
+
+        // Check a block of records.
+
+    trace(T_scrub,2);
+    uint32_t startUs = micros();
+    int records = IOTALOG_BLOCK_SIZE / scrubbed->recordSize();
+    while(records-- && serial <= scrubbed->lastSerial()){
+      int rtc = scrubbed->verify(record, serial);
+      if(rtc == 0 && record->UNIXtime <= prevKey){
+        rtc = 3;
+      }
+      if(rtc == 0){
+        prevKey = record->UNIXtime;
+      }
+      else {
+        if(rtc == 2){
+          result->crcErrors++;
+        } else {
+          result->badRecords++;
+        }
+        scrubBad(result, serial, prevKey);
+      }
+      result->checked++;
+      serial++;
+    }
+    scrubReadUs += micros() - startUs;
+    scrubBytes += IOTALOG_BLOCK_SIZE;
+    scrubBlocks++;
+    credit -= 1000;
+
+        // End of this log?
+
+    if(serial > scrubbed->lastSerial()){
+      trace(T_scrub,3);
+      result->passes++;
+      result->lastPass = UTCtime();
+      result->lastErrors = result->crcErrors + result->badRecords;
+      if(result->lastErrors){
+        log("scrubLog: %s log, %d bad records (%d CRC) in %d%s ranges.", id, result->lastErrors,
+            result->crcErrors, result->ranges, result->ranges == SCRUB_RANGES ? "+" : "");
+      }
+      logIndex++;
+      serial = -1;
+    }
+  }
+  return MAX(2, MIN(1000, 1000 / scrubRate));
+}
+
+//**********************************************************************************************
+//        scrubStatus(status) - GET /status?scrub
+//**********************************************************************************************
+
+void scrubStatus(JsonObject& status){
+  status.set(F("rate"), scrubRate);
+  status.set(F("since"), scrubSince);
+  status.set(F("blocks"), scrubBlocks);
+  status.set(F("bytes"), scrubBytes);
+  status.set(F("readms"), (uint32_t)(scrubReadUs / 1000));
+  status.set(F("kbps"), scrubReadUs ? (uint32_t)((uint64_t)scrubBytes * 1000 / scrubReadUs) : 0);
+  if(scrubSince && UTCtime() > scrubSince){
+    status.set(F("blockspersec"), (double)scrubBlocks / (UTCtime() - scrubSince));
+  }
+  JsonArray& logs = status.createNestedArray(F("logs"));
+  for(scrubResult* result = scrubResults; result; result = result->next){
+    JsonObject& logStatus = logs.createNestedObject();
+    logStatus.set(F("id"), result->id);
+    logStatus.set(F("passes"), result->passes);
+    logStatus.set(F("lastpass"), result->lastPass);
+    logStatus.set(F("lasterrors"), result->lastErrors);
+    logStatus.set(F("checked"), result->checked);
+    logStatus.set(F("crcerrors"), result->crcErrors);
+    logStatus.set(F("badrecords"), result->badRecords);
+    JsonArray& ranges = logStatus.createNestedArray(F("ranges"));
+    for(int i=0; i<result->ranges; i++){
+      JsonObject& range = ranges.createNestedObject();
+      range.set(F("first"), result->range[i].firstSerial);
+      range.set(F("last"), result->range[i].lastSerial);
+      range.set(F("after"), result->range[i].afterKey);
+    }
+  }
+}
@@ -0,0 +1,51 @@
+#ifndef scrubLog_h
+#define scrubLog_h
+
+/**************************************************************************************************
+ *
+ *  scrubLog - background verification of the datalogs
+ *
+ *  A low priority SERVICE that reads Current_log, History_log, Hourly_log, Daily_log and the
+ *  integration logs, one block of records per step, and checks each record with IotaLog::verify():
+ *  the CRC if the log has them, and that the serial, key and interval are what belong at that
+ *  position.
+ *  Runs of bad records are kept as ranges of serials (SCRUB_RANGES per log) and reported with
+ *  read statistics in GET /status?scrub.
+ *
+ *  The read rate is capped at device config "scrubrate" blocks per second (0 = off), and steps
+ *  are paced with a serviceBudget so the scrub only uses time left over in the service window.
+ *  The status reports blocks, bytes and read time so the rate can be set well below what
+ *  uploads and queries need.
+ *
+ * ************************************************************************************************/
+
+#define SCRUB_RANGES 8                      // Bad record ranges kept per log
+#define SCRUB_DEFAULT_RATE 0                // Default blocks per second (off)
+
+struct scrubRange {
+  int32_t   firstSerial;                    // First bad record
+  int32_t   lastSerial;                     // Last bad record
+  uint32_t  afterKey;                       // Key of the last good record before
+};
+
+struct scrubResult {
+  scrubResult*  next;
+  char*         id;                         // Log id as in /status datalogs
+  uint32_t      passes;                     // Completed passes
+  uint32_t      lastPass;                   // UTCtime last pass completed
+  uint32_t      lastErrors;                 // Bad records found in last pass
+  uint32_t      checked;                    // Records checked this pass
+  uint32_t      crcErrors;                  // CRC mismatches this pass
+  uint32_t      badRecords;                 // Other bad records this pass
+  uint8_t       ranges;                     // Entries in range
+  scrubRange    range[SCRUB_RANGES];
+  scrubResult() : next(nullptr), id(nullptr), passes(0), lastPass(0), lastErrors(0),
+                  checked(0), crcErrors(0), badRecords(0), ranges(0) {};
+};
+
+extern uint16_t   scrubRate;                // Blocks per second (0 = off)
+
+uint32_t  scrubLog(struct serviceBlock*);
+void      scrubStatus(JsonObject&);         // Add scrub status to /status
+
+#endif
@@ -0,0 +1,51 @@
+#include "IotaWatt.h"
+
+uint32_t serviceReserveUs = BUDGET_DEFAULT_RESERVE;
+uint32_t dispatchStartUs = 0;
+
+//**********************************************************************************************
+//
+//        budgetRemaining() - usec before bingoTime less the reserve
+//
+//**********************************************************************************************
+
+uint32_t budgetRemaining(){
+  int32_t remaining = (int32_t)(bingoTime - micros()) - (int32_t)serviceReserveUs;
+  return remaining > 0 ? remaining : 0;
+}
+
+bool budgetAvailable(uint32_t usec){
+  return budgetRemaining() >= usec;
+}
+
+//**********************************************************************************************
+//
+//        serviceBudget::next()
+//
+//        The step estimate rises immediately to a longer step and decays slowly (1/8) 
+//        toward shorter ones, so one cheap step doesn't invite an overrun.
+//
+//**********************************************************************************************
+
+bool serviceBudget::next(){
+  uint32_t now = micros();
+  if(_dispatchUs != dispatchStartUs){
+    _dispatchUs = dispatchStartUs;
+    _lastUs = now;
+    _steps = 1;
+    return true;
+  }
+  uint32_t elapsed = now - _lastUs;
+  _lastUs = now;
+  if(elapsed > _stepUs){
+    _stepUs = elapsed;
+  }
+  else {
+    _stepUs -= (_stepUs - elapsed) / 8;
+  }
+  if(budgetRemaining() < stepUs()){
+    return false;
+  }
+  _steps++;
+  return true;
+}
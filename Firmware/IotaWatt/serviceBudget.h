@@ -0,0 +1,57 @@
+#ifndef serviceBudget_h
+#define serviceBudget_h
+
+/**************************************************************************************************
+ * 
+ *  serviceBudget - how much time does a SERVICE have before the next crossing?
+ * 
+ *  Services run in the window between the end of one sample cycle and bingoTime.  Long-running
+ *  services do their work in steps and checkpoint (return 1 or a short delay with their state
+ *  saved) when the window is used up.
+ * 
+ *  budgetRemaining()     usec left in the current window, less serviceReserveUs.
+ *  budgetAvailable(n)    true if at least n usec remain.
+ * 
+ *  serviceBudget         Estimates the cost of a repeated step from its own history so a loop 
+ *                        can stop before overrunning, rather than after.  Call next() before 
+ *                        each step:
+ * 
+ *                            while(moreWork){
+ *                              if( ! _budget.next()) return 1;     // checkpoint
+ *                              ...one step...
+ *                            }
+ * 
+ *                        The first step of each dispatch is always allowed so work progresses.
+ *                        minStepUs sets a floor for the estimate, for steps with occasional
+ *                        expensive cases (SD writes).
+ * 
+ *  serviceReserveUs (device config "servicereserve") shortens every window to give more of 
+ *  the cycle to sampling at the expense of service throughput.
+ * 
+ * ************************************************************************************************/
+
+#define BUDGET_DEFAULT_RESERVE 0            // usec held back from services in each window
+
+extern uint32_t serviceReserveUs;           // usec held back from services in each window
+extern uint32_t dispatchStartUs;            // micros() when the current service was dispatched
+
+uint32_t  budgetRemaining();
+bool      budgetAvailable(uint32_t usec);
+
+class serviceBudget {
+  public:
+    serviceBudget(uint32_t minStepUs = 0) : _minStepUs(minStepUs), _stepUs(0), _lastUs(0), _dispatchUs(0), _steps(0){};
+
+    bool      next();                       // Is there time for another step?
+    uint32_t  stepUs(){return MAX(_stepUs, _minStepUs);}  // Current step cost estimate
+    uint32_t  steps(){return _steps;}       // Steps taken this dispatch
+
+  private:
+    uint32_t  _minStepUs;                   // Floor for step estimate
+    uint32_t  _stepUs;                      // Estimated step cost
+    uint32_t  _lastUs;                      // micros() at previous next()
+    uint32_t  _dispatchUs;                  // dispatchStartUs of current dispatch
+    uint32_t  _steps;                       // Steps this dispatch
+};
+
+#endif
@@ -2,17 +2,50 @@
 #include "Emoncms_uploader.h"
 #include "influxDB_v1_uploader.h"
 #include "influxDB_v2_uploader.h"
+#include "mqtt_uploader.h"
 
-bool configDevice(const char*);
-bool configDST(const char* JsonStr);
-bool configInputs(const char*);
+bool configDevice(char*);
+bool configDST(char* JsonStr);
+bool configInputs(char*);
 void configPhaseShift();
 bool configMasterPhaseArray();
-bool configOutputs(const char*);
+bool configOutputs(char*);
 void hashFile(uint8_t* sha, File file);
 bool exportLogConfig(const char *configObj);
-bool configIntegrators(const char *);
-bool configSimSolar(const char *);
+bool configIntegrators(char*);
+bool configSimSolar(char*);
+bool configSimLoad(char*);
+
+static uint32_t configHeapLow;              // Lowest free heap during setConfig
+
+static void configHeapMark(){
+  configHeapLow = MIN(configHeapLow, ESP.getFreeHeap());
+}
+
+      // Sections are hashed as configured, and a reload only reconfigures those that changed.
+      // A device change reconfigures everything.  Sections are hashed before they're parsed
+      // in place, and the hash is kept by configApplied() once the section is configured, so
+      // one that failed is tried again on the next reload.
+
+enum configSections {cfgDevice, cfgDST, cfgInputs, cfgIntegrators, cfgOutputs, cfgEmoncms,
+                     cfgInflux1, cfgInflux2, cfgMqtt, cfgPVoutput, cfgSimSolar, cfgSimLoad, cfgPeers, cfgSections};
+
+static uint32_t configHashes[cfgSections];  // hashIndex() of each section last configured (0 = absent)
+static uint8_t  configChanges;              // Sections changed this setConfig
+static uint32_t configHash;                 // Hash of the section last checked by configChanged()
+
+static bool configChanged(configSections section, const char* sectionStr){
+  configHash = sectionStr ? hashIndex(sectionStr) | 1 : 0;
+  if(configHash == configHashes[section]){
+    return false;
+  }
+  configChanges++;
+  return true;
+}
+
+static void configApplied(configSections section, bool success = true){
+  configHashes[section] = success ? configHash : 0;
+}
 
 //************************************************************************************************
 //
@@ -74,16 +107,23 @@ boolean setConfig(const char* configPath){
   DynamicJsonBuffer Json;              
         
   //************************************** Load and parse Json Config file ************************
+  //
+  // The file is read once to hash it and summarize the top level, then each section is read
+  // condensed into a char* that its consumer parses in place, and freed before the next.
 
   trace(T_CONFIG,0);
+  uint32_t startMs = millis();
+  uint32_t startHeap = ESP.getFreeHeap();
+  configHeapLow = startHeap;
+  configChanges = 0;
   File ConfigFile = SD.open(configPath, FILE_READ);
   if(!ConfigFile) {
     log("setConfig: %s open failed.", configPath);
     return false;
   }
-  hashFile(configSHA256, ConfigFile);
-  String configSummary = JsonSummary(ConfigFile, 1);
+  String configSummary = JsonSummary(ConfigFile, 1, configSHA256);
   JsonObject& Config = Json.parseObject(configSummary);
+  configHeapMark();
   trace(T_CONFIG,4);
   if (!Config.success()) {
     log("Config file parse failed.");
@@ -105,41 +145,58 @@ boolean setConfig(const char* configPath){
 
   trace(T_CONFIG,5);
   JsonArray& deviceArray = Config[F("device")];
+  bool deviceChanged = false;
   if(deviceArray.success()){
     char* deviceStr = JsonDetail(ConfigFile, deviceArray);
-    configDevice(deviceStr);
+    deviceChanged = configChanged(cfgDevice, deviceStr);
+    if(deviceChanged){
+      configApplied(cfgDevice, configDevice(deviceStr));
+      for(int i=cfgDevice+1; i<cfgSections; i++){
+        configHashes[i] = 0;
+      }
+    }
     delete[] deviceStr;
   }  
 
   //************************************ Configure DST rule *********************************
 
   trace(T_CONFIG,10);
-  delete timezoneRule;
-  timezoneRule = nullptr;
   JsonArray& dstruleArray = Config[F("dstrule")];
-  if(dstruleArray.success()){
-    char* dstruleStr = JsonDetail(ConfigFile, dstruleArray);
-    configDST(dstruleStr);
-    delete[] dstruleStr;
-  }  
+  char* dstruleStr = dstruleArray.success() ? JsonDetail(ConfigFile, dstruleArray) : nullptr;
+  if(configChanged(cfgDST, dstruleStr)){
+    delete timezoneRule;
+    timezoneRule = nullptr;
+    configApplied(cfgDST, dstruleStr ? configDST(dstruleStr) : true);
+  }
+  delete[] dstruleStr;
+  timezoneReset();
 
   //************************************ Configure input channels ***************************
 
   trace(T_CONFIG,15);
   JsonArray& inputsArray = Config[F("inputs")];
+  bool inputsChanged = false;
   if(inputsArray.success()){
     char* inputsStr = JsonDetail(ConfigFile, inputsArray);
-    configInputs(inputsStr);
+    inputsChanged = configChanged(cfgInputs, inputsStr);
+    if(inputsChanged){
+      configApplied(cfgInputs, configInputs(inputsStr));
+      logChannelsCheck(Current_log, "dataLog");
+      logChannelsCheck(History_log, "historyLog");
+    }
     delete[] inputsStr;
   }
 
   //************************************ Lookup phase shift in tables ***********************
 
   trace(T_CONFIG,20);
-  configMasterPhaseArray();
+  if(deviceChanged || inputsChanged){
+    configMasterPhaseArray();
+  }
 
   // ************************************ configure integrators *************************
 
+  bool integratorsChanged;
   {      
     trace(T_CONFIG,25);
     JsonArray& integratorsArray = Config[F("integrators")];
@@ -149,7 +206,22 @@ boolean setConfig(const char* configPath){
     } else {
       integratorsStr = charstar("[]");
     }
-    configIntegrators(integratorsStr);
+    integratorsChanged = configChanged(cfgIntegrators, integratorsStr);
+    if(integratorsChanged){
+      configApplied(cfgIntegrators, configIntegrators(integratorsStr));
+
+          // Uploader Scripts refer to integrations by position too,
+          // so rebuild them even though their own config hasn't changed.
+
+      for(int i=cfgEmoncms; i<=cfgPVoutput; i++){
+        configHashes[i] = 0;
+      }
+      uploader* uploaders[] = {Emoncms, influxDB_v1, influxDB_v2, MQTT};
+      for(int i=0; i<4; i++){
+        if(uploaders[i]) uploaders[i]->reconfig();
+      }
+      if(pvoutput) pvoutput->reconfig();
+    }
     delete[] integratorsStr;
   }
 
@@ -157,9 +229,6 @@ boolean setConfig(const char* configPath){
 
   {      
     trace(T_CONFIG,30);
-    delete outputs;
-    outputs = nullptr;
-    trace(T_CONFIG,30,1);
     JsonArray& outputsArray = Config[F("outputs")];
     char* outputsStr;
     if(outputsArray.success()){
@@ -167,11 +236,27 @@ boolean setConfig(const char* configPath){
     } else {
       outputsStr = charstar("[]");
     }
-    trace(T_CONFIG,30,2);
-    configOutputs(outputsStr);
-    trace(T_CONFIG,30,3);
+
+          // Outputs refer to integrations by position, so are rebuilt with them.
+
+    bool outputsChanged = configChanged(cfgOutputs, outputsStr);
+    if(outputsChanged || integratorsChanged || ! outputs){
+      trace(T_CONFIG,30,1);
+      delete outputs;
+      outputs = nullptr;
+      trace(T_CONFIG,30,2);
+      configApplied(cfgOutputs, configOutputs(outputsStr));
+      trace(T_CONFIG,30,3);
+    }
     delete[] outputsStr;
 
+          // Results kept from the old inputs and outputs are stale.
+
+    if( ! deviceChanged && (inputsChanged || integratorsChanged || outputsChanged)){
+      scriptResults.clear();
+      queryResults.clear();
+      statusFragmentsClear();
+    }
   }
 
          // ************************************** configure Emoncms **********************************
@@ -201,7 +286,8 @@ boolean setConfig(const char* configPath){
     }
 
     trace(T_CONFIG,35);
-    if(EmonStr){
+    bool changed = configChanged(cfgEmoncms, EmonStr);
+    if(EmonStr && (changed || ! Emoncms)){
       trace(T_CONFIG,31);   
       if(! Emoncms){
         trace(T_CONFIG,32);   
@@ -215,13 +301,14 @@ boolean setConfig(const char* configPath){
         Emoncms->end();
         Emoncms = nullptr;
       }
-      delete[] EmonStr;
     }   
-    else if(Emoncms){
+    else if( ! EmonStr && Emoncms){
       trace(T_CONFIG,37);   
       Emoncms->end();
       Emoncms = nullptr;
     }
+    configApplied(cfgEmoncms, Emoncms || ! EmonStr);
+    delete[] EmonStr;
   }
 
         // ************************************** configure influxDB1 *********************************
@@ -229,8 +316,9 @@ boolean setConfig(const char* configPath){
   {
     trace(T_CONFIG,40);
     JsonArray& influxArray = Config[F("influxdb")];
-    if(influxArray.success()){
-      char* influxStr = JsonDetail(ConfigFile, influxArray);
+    char* influxStr = influxArray.success() ? JsonDetail(ConfigFile, influxArray) : nullptr;
+    bool changed = configChanged(cfgInflux1, influxStr);
+    if(influxStr && (changed || ! influxDB_v1)){
       if(! influxDB_v1){
         influxDB_v1 = new influxDB_v1_uploader;
       }
@@ -239,12 +327,13 @@ boolean setConfig(const char* configPath){
         influxDB_v1->end();
         influxDB_v1 = nullptr;
       }
-      delete[] influxStr;
     }   
-    else if(influxDB_v1){
+    else if( ! influxStr && influxDB_v1){
       influxDB_v1->end();
       influxDB_v1 = nullptr;
     }
+    configApplied(cfgInflux1, influxDB_v1 || ! influxStr);
+    delete[] influxStr;
   }
 
         // ************************************** configure influxDB2 **********************************
@@ -252,8 +341,9 @@ boolean setConfig(const char* configPath){
   {
     trace(T_CONFIG,45);
     JsonArray& influx2Array = Config[F("influxdb2")];
-    if(influx2Array.success()){
-      char* influx2Str = JsonDetail(ConfigFile, influx2Array);
+    char* influx2Str = influx2Array.success() ? JsonDetail(ConfigFile, influx2Array) : nullptr;
+    bool changed = configChanged(cfgInflux2, influx2Str);
+    if(influx2Str && (changed || ! influxDB_v2)){
       if(! influxDB_v2){
         influxDB_v2 = new influxDB_v2_uploader;
       }
@@ -262,46 +352,101 @@ boolean setConfig(const char* configPath){
         influxDB_v2->end();
         influxDB_v2 = nullptr;
       }
-      delete[] influx2Str;
     }   
-    else if(influxDB_v2){
+    else if( ! influx2Str && influxDB_v2){
       influxDB_v2->end();
       influxDB_v2 = nullptr;
     }
+    configApplied(cfgInflux2, influxDB_v2 || ! influx2Str);
+    delete[] influx2Str;
+  }
+
+        // ************************************** configure MQTT ***************************************
+
+  {
+    trace(T_CONFIG,47);
+    JsonArray& mqttArray = Config[F("mqtt")];
+    char* mqttStr = mqttArray.success() ? JsonDetail(ConfigFile, mqttArray) : nullptr;
+    bool changed = configChanged(cfgMqtt, mqttStr);
+    if(mqttStr && (changed || ! MQTT)){
+      if(! MQTT){
+        MQTT = new mqtt_uploader;
+      }
+      if( ! MQTT->config(mqttStr)){
+        log("mqtt: Invalid configuration.");
+        MQTT->end();
+        MQTT = nullptr;
+      }
+    }   
+    else if( ! mqttStr && MQTT){
+      MQTT->end();
+      MQTT = nullptr;
+    }
+    configApplied(cfgMqtt, MQTT || ! mqttStr);
+    delete[] mqttStr;
   }
       // ************************************** configure PVoutput *****************************************
 
   {
     trace(T_CONFIG,50);
     JsonArray& PVoutputArray = Config[F("pvoutput")];
-    if(PVoutputArray.success()){
-      char* PVoutputStr = JsonDetail(ConfigFile, PVoutputArray);
+    char* PVoutputStr = PVoutputArray.success() ? JsonDetail(ConfigFile, PVoutputArray) : nullptr;
+    bool changed = configChanged(cfgPVoutput, PVoutputStr);
+    bool configured = true;
+    if(PVoutputStr && (changed || ! pvoutput)){
       if(! pvoutput){
         pvoutput = new PVoutput();
       }
       if( ! pvoutput->config(PVoutputStr)){
         log("PVoutput: Invalid configuration."); 
+        configured = false;
       } 
-      delete[] PVoutputStr;
     }   
-    else if(pvoutput){
+    else if( ! PVoutputStr && pvoutput){
       pvoutput->end();
     }    
+    configApplied(cfgPVoutput, configured);
+    delete[] PVoutputStr;
   }
 
       //***************************************** configure simsolar ***************************************
 
     trace(T_CONFIG,55);
     JsonArray& simSolarArray = Config[F("simsolar")];
-    if(simSolarArray.success()){
-      char* simSolarStr = JsonDetail(ConfigFile, simSolarArray);
-      configSimSolar(simSolarStr);
-      delete[] simSolarStr;
-    } 
-    else {
-      delete simsolar;
-      simsolar = nullptr;
+    char* simSolarStr = simSolarArray.success() ? JsonDetail(ConfigFile, simSolarArray) : nullptr;
+    if(configChanged(cfgSimSolar, simSolarStr)){
+      if(simSolarStr){
+        configApplied(cfgSimSolar, configSimSolar(simSolarStr));
+      } 
+      else {
+        delete simsolar;
+        simsolar = nullptr;
+        configApplied(cfgSimSolar);
+      }
+    }
+    delete[] simSolarStr;
+
+      //***************************************** configure simload ****************************************
+
+    trace(T_CONFIG,60);
+    JsonArray& simLoadArray = Config[F("simload")];
+    char* simLoadStr = simLoadArray.success() ? JsonDetail(ConfigFile, simLoadArray) : nullptr;
+    if(configChanged(cfgSimLoad, simLoadStr)){
+      delete simload;
+      simload = nullptr;
+      configApplied(cfgSimLoad, simLoadStr ? configSimLoad(simLoadStr) : true);
+    }
+    delete[] simLoadStr;
+
+      //***************************************** configure peers *******************************************
+
+    trace(T_CONFIG,65);
+    JsonArray& peersArray = Config[F("peers")];
+    char* peersStr = peersArray.success() ? JsonDetail(ConfigFile, peersArray) : nullptr;
+    if(configChanged(cfgPeers, peersStr)){
+      configApplied(cfgPeers, peerConfig(peersStr));
     }
+    delete[] peersStr;
 
 
       // ************************************** Code to handle array of configurations****************************
@@ -392,16 +537,18 @@ boolean setConfig(const char* configPath){
   //   }
   // }
 
-  hashFile(configSHA256, ConfigFile);
   ConfigFile.close();
+  configHeapMark();
+  log("setConfig: %s %d sections changed, %dms, heap %d, low %d.", configPath, configChanges, millis() - startMs, startHeap, configHeapLow);
   trace(T_CONFIG,70);
   return true;
 
 }  // End of setConfig
 
-bool configSimSolar(const char* JsonStr){
+bool configSimSolar(char* JsonStr){
   DynamicJsonBuffer Json;
   JsonObject& simConfig = Json.parseObject(JsonStr);
+  configHeapMark();
   if( ! simConfig.success()){
     log("simsolar: Json parse failed");
   }
@@ -414,8 +561,27 @@ bool configSimSolar(const char* JsonStr){
   simsolar->config(sunrise, sunset, power);
   return true;
 } 
+
+bool configSimLoad(char* JsonStr){
+  DynamicJsonBuffer Json;
+  JsonObject& simConfig = Json.parseObject(JsonStr);
+  configHeapMark();
+  if( ! simConfig.success()){
+    log("simload: Json parse failed");
+    return false;
+  }
+  simload = new simLoad;
+  if( ! simload->config(simConfig)){
+    log("simload: no channels");
+    delete simload;
+    simload = nullptr;
+    return false;
+  }
+  log("simload: simulating loads%s", simload->backfill() ? ", backfill new log" : "");
+  return true;
+} 
 //************************************** configDevice() ********************************************
-bool configDevice(const char* JsonStr){
+bool configDevice(char* JsonStr){
 
   hasRTC = true;
   VrefVolts = 2.5;
@@ -425,6 +591,7 @@ bool configDevice(const char* JsonStr){
   int channels = 15; 
   DynamicJsonBuffer Json;
   JsonObject& device = Json.parseObject(JsonStr);
+  configHeapMark();
   if( ! device.success()){
     log("device: Json parse failed");
   }
@@ -459,6 +626,7 @@ bool configDevice(const char* JsonStr){
   if(channels != maxInputs){
     log("Channels changing from %d to %d, restarting.", maxInputs, channels);
     delay(500);
+    Message_log.flush();
     ESP.restart();
   }
 
@@ -497,6 +665,95 @@ bool configDevice(const char* JsonStr){
     }
   }
 
+        // Channel scheduler.
+
+  selectChannel = roundRobinChannel;
+  if(device.containsKey(F("scheduler"))){
+    String scheduler = device[F("scheduler")].as<String>();
+    if(scheduler.equalsIgnoreCase("adaptive")){
+      selectChannel = adaptiveChannel;
+    }
+    else if( ! scheduler.equalsIgnoreCase("roundrobin")){
+      log("device: unsupported scheduler %s", scheduler.c_str());
+    }
+  }
+  schedMinRefresh = device[F("minrefresh")] | SCHED_DEFAULT_MIN_REFRESH;
+  serviceLogUs = (device[F("servicelog")] | 0) * 1000;
+  heapStats.logBelow = device[F("heaplog")] | 0;
+  traceRingSize(device[F("tracering")] | 0);
+  serviceReserveUs = device[F("servicereserve")] | BUDGET_DEFAULT_RESERVE;
+
+        // Compact datalog format and record CRCs for new logs.
+
+  compactLog = device[F("compactlog")] | false;
+  logCRC = device[F("logcrc")] | false;
+
+        // Datalog read cache.
+
+  uint8_t logCache = device[F("logcache")] | 0;
+  if(logCache != Current_log.readCacheBlocks()){
+    Current_log.readCache(logCache);
+  }
+
+        // Background datalog scrub rate (blocks per second, 0 = off).
+
+  scrubRate = device[F("scrubrate")] | SCRUB_DEFAULT_RATE;
+
+        // Shared Script results cache (entries, 0 = off).
+
+  scriptResults.size(device[F("scriptcache")] | SCRIPT_CACHE_DEFAULT);
+
+        // Current_log records shared by the uploaders (0 = off).
+
+  uploadRecords.size(device[F("uploadfeed")] | UPLOAD_FEED_DEFAULT);
+
+        // Recent query result points (bytes, 0 = off), cleared as the outputs may have changed.
+
+  queryResults.size(device[F("querycache")] | QUERY_CACHE_DEFAULT);
+
+        // Per-second values of the last few minutes (seconds, 0 = off).
+
+  recentData.size(device[F("recentsec")] | RECENT_DEFAULT_SEC);
+
+        // /status sections kept as built.
+
+  statusFragmentsClear();
+
+        // Payload pool shared by the uploader, PVoutput and query buffers (bytes).
+
+  payloadCap = device[F("payloadcap")] | PAYLOAD_POOL_DEFAULT;
+  payloadCap = MAX(PAYLOAD_POOL_MIN, MIN(payloadCap, PAYLOAD_POOL_MAX));
+
+        // Live stream event interval (seconds, 0 = off).
+
+  liveRate = device[F("liverate")] | LIVE_DEFAULT_RATE;
+
+        // Datalog write coalescing (blocks, 0 = write each record),
+        // within what the recovery journal can hold.
+
+  logCoalesce = device[F("logcoalesce")] | 0;
+  journalCoalesce();
+
+        // Voltage channels are updated by power sampling, own turn at most this often.
+
+  vtRefresh = device[F("vtrefresh")] | VT_DEFAULT_REFRESH;
+
+        // Shared-voltage sampling.
+        // Allocate (or release) the extra current sample arrays.
+
+  multiCT = RANGE((device[F("multict")] | 1), 1, MULTICT_MAX);
+  for(int k=1; k<MULTICT_MAX; k++){
+    if(k < multiCT){
+      if( ! IsampleMulti[k]){
+        IsampleMulti[k] = new int16_t[MULTICT_SAMPLES + 1];
+      }
+    }
+    else {
+      delete[] IsampleMulti[k];
+      IsampleMulti[k] = nullptr;
+    }
+  }
+
   delete[] HTTPSproxy;
   HTTPSproxy = nullptr;
   if(device.containsKey(F("httpsproxy"))){
@@ -507,9 +764,10 @@ bool configDevice(const char* JsonStr){
 
 //********************************** configure DST *********************************************
 
-bool configDST(const char* JsonStr){
+bool configDST(char* JsonStr){
   DynamicJsonBuffer Json;
   JsonVariant dstRule = Json.parse(JsonStr);
+  configHeapMark();
   if( ! dstRule.success()){
     log("DST: Json parse failed");
     return false;
@@ -557,13 +815,15 @@ bool configDST(const char* JsonStr){
 } 
 
 //********************************** configInputs ***********************************************
-bool configInputs(const char* JsonStr){
+bool configInputs(char* JsonStr){
   DynamicJsonBuffer Json;
   JsonVariant JsonInputs = Json.parse(JsonStr);
+  configHeapMark();
   if( ! JsonInputs.success()){
     log("inputs: Json parse failed");
     return false;
   }
+  scriptResults.clear();
 
   for(int i=0; i<MIN(maxInputs,JsonInputs.size()); i++) {
     if(JsonInputs[i].is<JsonObject>()){
@@ -591,6 +851,7 @@ bool configInputs(const char* JsonStr){
       inputChannel[i]->active(true);
       String type = input[F("type")];
       inputChannel[i]->_reverse = input[F("reverse")] | false;
+      inputChannel[i]->_minRefresh = input[F("minrefresh")] | 0;
       if(type == "VT") {
         inputChannel[i]->_type = channelTypeVoltage; 
         inputChannel[i]->_vchannel = i;
@@ -619,17 +880,26 @@ bool configInputs(const char* JsonStr){
       inputChannel[i]->reset();
     }
   }
+
+  indexInputs();
+
+      // A compact (or CRC) datalog only records the channels that were configured when it was created.
+
+  if(Current_log.isOpen() && logChannels() > Current_log.channels()){
+    log("config: datalog format does not record inputs above %d", Current_log.channels() - 1);
+  }
   return true;
 }
 
 //********************************** configIntegrators ***********************************************
 
-bool configIntegrators(const char* JsonStr){
+bool configIntegrators(char* JsonStr){
 
       // Create new ScriptSet from Json config
 
   DynamicJsonBuffer Json;
   JsonArray& integratorsArray = Json.parseArray(JsonStr);
+  configHeapMark();
   if( ! integratorsArray.success()){
     log("integrators: Json parse failed");
     return false;
@@ -643,6 +913,7 @@ bool configIntegrators(const char* JsonStr){
       // Move integrators for enduring integrations
 
   ScriptSet* newIntegrations = new ScriptSet(integratorsArray);
+  configHeapMark();
   Script *newScript = newIntegrations->first();
   while(newScript){
     Script *oldScript = oldIntegrations->first();
@@ -691,10 +962,11 @@ bool configIntegrators(const char* JsonStr){
 
 //********************************** configOutputs ***********************************************
 
-bool configOutputs(const char* JsonStr){
+bool configOutputs(char* JsonStr){
   DynamicJsonBuffer Json;
   trace(T_CONFIG,31);
   JsonArray& outputsArray = Json.parseArray(JsonStr);
+  configHeapMark();
   trace(T_CONFIG,31,1);
   if( ! outputsArray.success()){
     log("outputs: Json parse failed");
@@ -702,6 +974,7 @@ bool configOutputs(const char* JsonStr){
   }
   trace(T_CONFIG,31,2);
   outputs = new ScriptSet(outputsArray);
+  configHeapMark();
   trace(T_CONFIG,31,3);
   // outputs->sort([](Script* a, Script* b)->int{
   //   int res = strcmp(a->name(), b->name());
@@ -724,7 +997,12 @@ bool configOutputs(const char* JsonStr){
  * 2) Search the table.txt file for each model and the existence of either dynamic phase array.
  * 3) allocate a single array to contain each of the unique arrays.
  * 4) Parse each of the unique model/Hz arrays and add to the master array, zero delimited.
- * 5) Set pointers in each iotaInputChannel to their corresponding dynamic phase arrays
+ * 5) Resolve each array into a phaseTable of its steps (buildPhaseTable).
+ * 6) Set pointers in each iotaInputChannel to their corresponding phase tables.
+ * 
+ * The raw master array is only needed while building the tables and is released after.
+ * Board specific adjustments (pre 5.0 capacitor on channel 0) are also resolved here
+ * so getPhase() doesn't need to test for them.
  * 
  * **********************************************************************************************/
 
@@ -734,8 +1012,33 @@ struct  modelTable {
   int16_t   p60_pos;
   int16_t*  p50_ptr;
   int16_t*  p60_ptr;
+  phaseTable* p50_table;
+  phaseTable* p60_table;
 };
 
+        // Resolve a step array (phase, threshold, phase, ... 0) to its steps,
+        // so lookup() has the thresholds as they are configured, and index
+        // them for lookup().  Steps past PHASE_TABLE_SIZE are logged and left out.
+
+void buildPhaseTable(phaseTable* table, int16_t* pArray){
+  int16_t* entry = pArray;
+  table->count = 0;
+  table->threshold[0] = 0;
+  while(table->count < PHASE_TABLE_SIZE){
+    table->value[table->count++] = *entry;
+    if( ! *(entry+1)){
+      table->index();
+      return;
+    }
+    entry += 2;
+    if(table->count < PHASE_TABLE_SIZE){
+      table->threshold[table->count] = *(entry-1);
+    }
+  }
+  log("Phase table: more than %d steps, extra steps ignored.", PHASE_TABLE_SIZE);
+  table->index();
+}
+
 int arraySize(File tableFile){
     int commas = 0;
     char in = tableFile.read();
@@ -797,11 +1100,28 @@ bool configMasterPhaseArray(){
         table[t].p60_pos = 0;
         table[t].p50_ptr = nullptr;
         table[t].p60_ptr = nullptr;
+        table[t].p50_table = nullptr;
+        table[t].p60_table = nullptr;
         models++;
       }
     }
   }
 
+  // Reset table pointers and resolve board adjustments.
+  // Pre 5.0 PCB had 10uF capacitor on channel 0
+
+  for(int i=0; i<maxInputs; i++){
+    IotaInputChannel* input = inputChannel[i];
+    input->_p50 = nullptr;
+    input->_p60 = nullptr;
+    input->_padj50 = 0;
+    input->_padj60 = 0;
+    if(i == 0 && deviceMajorVersion < 5){
+      input->_padj50 = 1.71;
+      input->_padj60 = 1.45;
+    }
+  }
+
   // Lookup models in table file.
   // Count total masterPhaseArray entries required
 
@@ -859,18 +1179,40 @@ bool configMasterPhaseArray(){
     }
   }
 
-  // Set array pointers in inputs
+  // Resolve the arrays into phase tables,
+  // then release the raw arrays.
 
   trace(T_CONFIG, 20, 6);
+  int tables = 0;
+  for(int t=0; t<models; t++){
+    if(table[t].p50_ptr) tables++;
+    if(table[t].p60_ptr) tables++;
+  }
+  delete[] masterPhaseTables;
+  masterPhaseTables = tables ? new phaseTable[tables] : nullptr;
+  phaseTable* nextTable = masterPhaseTables;
+  for(int t=0; t<models; t++){
+    if(table[t].p50_ptr){
+      table[t].p50_table = nextTable++;
+      buildPhaseTable(table[t].p50_table, table[t].p50_ptr);
+    }
+    if(table[t].p60_ptr){
+      table[t].p60_table = nextTable++;
+      buildPhaseTable(table[t].p60_table, table[t].p60_ptr);
+    }
+  }
+  delete[] masterPhaseArray;
+  masterPhaseArray = nullptr;
+
+  // Set table pointers in inputs
+
   for(int i=0; i<maxInputs; i++){
     IotaInputChannel* input = inputChannel[i];
-    input->_p50 = nullptr;
-    input->_p60 = nullptr;
     if(input->isActive()){
       for(int t=0; t<models; t++){
         if(strcmp(input->_model, table[t].model) == 0){
-          input->_p50 = table[t].p50_ptr;
-          input->_p60 = table[t].p60_ptr;
+          input->_p50 = table[t].p50_table;
+          input->_p60 = table[t].p60_table;
           break;
         }
       }
@@ -0,0 +1,98 @@
+#include "IotaWatt.h"
+
+simLoad::simLoadChannel* simLoad::find(int channel){
+    for(int i=0; i<_count; i++){
+        if(_channels[i].channel == channel){
+            return &_channels[i];
+        }
+    }
+    return nullptr;
+}
+
+bool simLoad::drives(int channel){
+    return find(channel) != nullptr;
+}
+
+double simLoad::power(int channel, uint32_t localTime){
+    simLoadChannel* sim = find(channel);
+    if( ! sim){
+        return 0;
+    }
+    uint32_t cycle = sim->period ? (localTime + channel * 397) % sim->period : 0;
+    uint32_t day = localTime % 86400;
+    switch(sim->profile){
+        case base: {
+            uint32_t noise = ((localTime / 5) * 2654435761UL + channel) >> 24;
+            return sim->watts * (0.96 + 0.08 * noise / 255.0);
+        }
+        case step:
+            return cycle < sim->on ? sim->watts : 0;
+        case motor:
+            if(cycle >= sim->on){
+                return 0;
+            }
+            return cycle < SIMLOAD_SURGE_SEC ? sim->watts * sim->surge : sim->watts;
+        case ev:
+            return ((day + 86400 - sim->start) % 86400) < sim->on ? sim->watts : 0;
+        case solar:
+            return sim->sun.power(localTime);
+        case net:
+            return sim->watts - sim->sun.power(localTime);
+    }
+    return 0;
+}
+
+        // Profiles change within seconds, so power is summed a second at a time.
+
+double simLoad::energy(int channel, uint32_t localBegin, uint32_t localEnd){
+    double wattSeconds = 0;
+    for(uint32_t t=localBegin; t<localEnd; t++){
+        wattSeconds += power(channel, t);
+    }
+    return wattSeconds / 3600.0;
+}
+
+bool simLoad::config(JsonObject& simConfig){
+    _backfill = simConfig[F("backfill")] | 0;
+    JsonArray& channels = simConfig[F("channels")];
+    delete[] _channels;
+    _channels = nullptr;
+    _count = 0;
+    if( ! channels.success() || ! channels.size()){
+        return false;
+    }
+    _channels = new simLoadChannel[channels.size()];
+    for(JsonObject& channel : channels){
+        simLoadChannel* sim = &_channels[_count];
+        sim->channel = channel[F("channel")] | -1;
+        if(sim->channel < 0 || sim->channel >= maxInputs || find(sim->channel)){
+            log("simload: invalid channel %d", sim->channel);
+            continue;
+        }
+        String profile = channel[F("profile")] | "base";
+        if(profile.equalsIgnoreCase(F("base"))) sim->profile = base;
+        else if(profile.equalsIgnoreCase(F("step"))) sim->profile = step;
+        else if(profile.equalsIgnoreCase(F("motor"))) sim->profile = motor;
+        else if(profile.equalsIgnoreCase(F("ev"))) sim->profile = ev;
+        else if(profile.equalsIgnoreCase(F("solar"))) sim->profile = solar;
+        else if(profile.equalsIgnoreCase(F("net"))) sim->profile = net;
+        else {
+            log("simload: invalid profile %s", profile.c_str());
+            continue;
+        }
+        sim->watts = channel[F("watts")] | 0.0;
+        sim->on = channel[F("on")] | 600;
+        sim->period = MAX(sim->on, (uint32_t)(channel[F("period")] | 3600));
+        sim->surge = channel[F("surge")] | 3.0;
+        int start = channel[F("start")] | 2200;
+        sim->start = (start / 100) * 3600 + (start % 100) * 60;
+        if(sim->profile == ev){
+            sim->on = (channel[F("hours")] | 4.0) * 3600;
+            sim->period = 0;
+        }
+        sim->sun.config(channel[F("sunrise")] | 700, channel[F("sunset")] | 1700, 
+                        sim->profile == net ? (channel[F("solar")] | 0) : sim->watts);
+        _count++;
+    }
+    return _count > 0;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+/**************************************************************************************************
+ * 
+ *  simLoad - simulate loads on the input channels
+ * 
+ *  Configured in config.txt "simload", each listed power channel is driven by a profile in place
+ *  of its measured power, in local time:
+ * 
+ *      {"backfill":<days>,
+ *       "channels":[{"channel":n,"profile":"base","watts":300},
+ *                   {"channel":n,"profile":"step","watts":1500,"on":<sec>,"period":<sec>},
+ *                   {"channel":n,"profile":"motor","watts":800,"on":<sec>,"period":<sec>,"surge":<x>},
+ *                   {"channel":n,"profile":"ev","watts":7200,"start":<HHMM>,"hours":<h>},
+ *                   {"channel":n,"profile":"solar","watts":5000,"sunrise":<HHMM>,"sunset":<HHMM>},
+ *                   {"channel":n,"profile":"net","watts":800,"solar":5000,"sunrise":<HHMM>,"sunset":<HHMM>}]}
+ * 
+ *  base is steady with a little noise, step switches on for "on" of every "period" seconds, and a
+ *  motor draws "surge" times its watts for its first SIMLOAD_SURGE_SEC.  ev charges daily from
+ *  "start" for "hours".  solar is simSolar, and net is base load less solar, so it exports
+ *  in the middle of the day.  Use "signed" on a net channel to keep the export.
+ * 
+ *  With "backfill" days, a new Current_log is started that many days back and the dataLog
+ *  fills it as fast as it can write, with the simulated channels' energy, then carries on
+ *  in real time.  Uploaders, integrators and queries then have months of data to work with.
+ *  This is for test units only: it makes up data.
+ * 
+ * ************************************************************************************************/
+
+#define SIMLOAD_SURGE_SEC 3             // Motor start surge
+
+class simLoad {
+
+    public:
+        simLoad(): _channels(nullptr), _count(0), _backfill(0){};
+        ~simLoad(){delete[] _channels;};
+        bool     config(JsonObject& simConfig);
+        bool     drives(int channel);                        // Channel is simulated
+        double   power(int channel, uint32_t localTime);     // Watts at time
+        double   energy(int channel, uint32_t localBegin, uint32_t localEnd);  // Wh over period
+        uint16_t backfill(){return _backfill;}               // Days to fill a new log
+
+    protected:
+        enum profiles {base, step, motor, ev, solar, net};
+        struct simLoadChannel {
+            int       channel;
+            profiles  profile;
+            float     watts;
+            uint32_t  on;               // step/motor seconds on, ev seconds charging
+            uint32_t  period;           // step/motor cycle seconds
+            uint32_t  start;            // ev start, seconds into day
+            float     surge;            // motor start multiple
+            simSolar  sun;              // solar and net
+        };
+        simLoadChannel* _channels;
+        uint8_t         _count;
+        uint16_t        _backfill;
+
+        simLoadChannel* find(int channel);
+};
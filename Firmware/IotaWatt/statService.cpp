@@ -29,23 +29,28 @@ uint32_t statService(struct serviceBlock* _serviceBlock) {
   }
   
   double elapsedHrs = double((uint32_t)(timeNow - timeThen)) / MS_PER_HOUR;
+  float recent1[MAXINPUTS];
+  float recent2[MAXINPUTS];
 
   for(int i=0; i<maxInputs; i++){
     trace(T_stats, 2);
     inputChannel[i]->ageBuckets(timeNow);
     double newValue = (inputChannel[i]->dataBucket.accum1 - accum1Then[i]) / elapsedHrs;
+    recent1[i] = newValue;
     float damping = .75;
     if((newValue / statRecord.accum1[i]) < .98 || (newValue / statRecord.accum1[i]) > 1.02){
       damping = 0.0;
     }
     statRecord.accum1[i] = damping * statRecord.accum1[i] + (1.0 - damping) * newValue;
     newValue = (inputChannel[i]->dataBucket.accum2 - accum2Then[i]) / elapsedHrs;
+    recent2[i] = newValue;
     statRecord.accum2[i] = damping * statRecord.accum2[i] + (1.0 - damping) * newValue;
     trace(T_stats, 3);
     accum1Then[i] = inputChannel[i]->dataBucket.accum1;
     accum2Then[i] = inputChannel[i]->dataBucket.accum2;
   }
   trace(T_stats, 4);
+  recentData.add(UTCtime(), recent1, recent2);
   cycleSampleRate = .25 * cycleSampleRate + (1.0 - .25) * float(cycleSamples * 1000) / float((uint32_t)(timeNow - timeThen));
   cycleSamples = 0;
   if(heapMsPeriod > 300000){
@@ -55,6 +60,7 @@ uint32_t statService(struct serviceBlock* _serviceBlock) {
   heapMs += ESP.getFreeHeap() * (timeNow - timeThen);
   heapMsPeriod += timeNow - timeThen;
   timeThen = timeNow;
+  statServiceRuns++;
   trace(T_stats, 5);
   return UTCtime() + statServiceInterval;
 }
@@ -72,6 +72,7 @@ uint32_t timeSync(struct serviceBlock* _serviceBlock) {
   trace(T_timeSync, 1);
   if(millis() > 3628800000UL) {
     log("timeSync: Six week routine restart.");
+    Message_log.flush();
     ESP.restart();
   }
 
@@ -303,7 +304,146 @@ uint32_t millisAtUTCTime(uint32_t UnixTime){
   return (uint32_t)timeRefMs + 1000 * (UnixTime + SECONDS_PER_SEVENTY_YEARS - timeRefNTP);
  }
 
-uint32_t UTC2Local(uint32_t UTCtime){
+/********************************************************************************************
+ * 
+ *  UTC2Local - convert UTC to local time
+ * 
+ *  UTC2LocalRule() applies the timezoneRule.  The offset it produces only changes at the
+ *  DST transitions, so the spans between them are found by probing a day at a time and 
+ *  bisecting to the second where the offset changes.  The spans for the current period 
+ *  are kept in tzSpans, and conversion only falls back to the rule outside of that.
+ * 
+ *******************************************************************************************/
+
+static localSpan  tzSpans[TZ_SPANS];
+static uint8_t    tzCount = 0;                // Spans in tzSpans (0 = not built)
+static uint8_t    tzLast = 0;                 // Span of last conversion
+static uint32_t   tzRenew = 0;                // Rebuild when UTCtime() gets here
+
+static uint32_t UTC2LocalRule(uint32_t utc);
+
+static int32_t tzOffset(uint32_t utc){
+  return UTC2LocalRule(utc) - utc;
+}
+
+      // Find the time in (lo, hi] where the offset changes to that of hi.
+
+static uint32_t tzChange(uint32_t lo, uint32_t hi){
+  int32_t offset = tzOffset(hi);
+  while(hi - lo > 1){
+    uint32_t mid = lo + (hi - lo) / 2;
+    if(tzOffset(mid) == offset){
+      hi = mid;
+    }
+    else {
+      lo = mid;
+    }
+  }
+  return hi;
+}
+
+      // Find the end of the span starting at begin, up to limit.
+
+static uint32_t tzSpanEnd(uint32_t begin, int32_t offset, uint32_t limit){
+  uint32_t probe = begin;
+  while(probe < limit){
+    uint32_t next = MIN(probe + 86400UL, limit);
+    if(tzOffset(next) != offset){
+      return tzChange(probe, next);
+    }
+    probe = next;
+  }
+  return limit;
+}
+
+static void tzBuild(){
+  trace(T_timeSync, 20);
+  DateTime now(UTCtime());
+  uint32_t begin = DateTime(now.year() - 1, 1, 1).unixtime();
+  uint32_t limit = DateTime(now.year() + 2, 1, 1).unixtime();
+  tzRenew = DateTime(now.year() + 1, 1, 1).unixtime();
+  tzCount = 0;
+  tzLast = 0;
+  while(begin < limit && tzCount < TZ_SPANS){
+    localSpan* span = &tzSpans[tzCount++];
+    span->begin = begin;
+    span->offset = tzOffset(begin);
+    span->end = tzSpanEnd(begin, span->offset, limit);
+    begin = span->end;
+  }
+}
+
+void timezoneReset(){
+  tzCount = 0;
+}
+
+      // Find the span in tzSpans, building it if necessary.  nullptr if not there.
+
+static localSpan* tzFind(uint32_t utc){
+  if( ! tzCount || (RTCrunning && UTCtime() >= tzRenew)){
+    if( ! RTCrunning){
+      return nullptr;
+    }
+    tzBuild();
+  }
+  localSpan* span = &tzSpans[tzLast];
+  if(utc >= span->begin && utc < span->end){
+    return span;
+  }
+  if(utc < tzSpans[0].begin || utc >= tzSpans[tzCount - 1].end){
+    return nullptr;
+  }
+  for(tzLast = 0; utc >= tzSpans[tzLast].end; tzLast++);
+  return &tzSpans[tzLast];
+}
+
+uint32_t UTC2Local(uint32_t utc){
+  if( ! timezoneRule){
+    return utc + localTimeDiff * 60;
+  }
+  localSpan* span = tzFind(utc);
+  if(span){
+    return utc + span->offset;
+  }
+  return UTC2LocalRule(utc);
+}
+
+      // Times outside of tzSpans get a span of their own, up to a year either way.
+      // Series of times in ascending order, like query rows, then convert with a 
+      // compare and an add wherever they are.
+
+uint32_t UTC2Local(uint32_t utc, localSpan& span){
+  if(utc >= span.begin && utc < span.end){
+    return utc + span.offset;
+  }
+  if( ! timezoneRule){
+    span.begin = 0;
+    span.end = UINT32_MAX;
+    span.offset = localTimeDiff * 60;
+    return utc + span.offset;
+  }
+  localSpan* known = tzFind(utc);
+  if(known){
+    span = *known;
+    return utc + span.offset;
+  }
+  span.offset = tzOffset(utc);
+  span.end = tzSpanEnd(utc, span.offset, utc + 366UL * 86400UL);
+  uint32_t probe = utc;
+  uint32_t limit = utc > 366UL * 86400UL ? utc - 366UL * 86400UL : 0;
+  span.begin = limit;
+  while(probe > limit){
+    uint32_t prior = probe > limit + 86400UL ? probe - 86400UL : limit;
+    if(tzOffset(prior) != span.offset){
+      span.begin = tzChange(prior, probe);
+      break;
+    }
+    probe = prior;
+  }
+  return utc + span.offset;
+}
+
+static uint32_t UTC2LocalRule(uint32_t UTCtime){
     uint32_t result = UTCtime + localTimeDiff * 60;
     if( ! timezoneRule) return result;
 
@@ -51,6 +51,20 @@ struct tzRule {                 // Defines a daylight saving period and adjustme
     tzRule():useUTC(false), adjMinutes(0){};
 };  
 
+    // The timezoneRule is evaluated once per transition rather than per call.
+    // The spans from January 1 of last year to January 1 of the year after next
+    // are found when first needed after config (timezoneReset) or the year changes.
+    // UTC2Local is then a compare and an add for that period.
+
+#define TZ_SPANS 8                      // Spans kept, plenty for two transitions a year
+
+struct localSpan {              // A period of UTC time with one local offset
+    uint32_t  begin;            // First UTC time of the span
+    uint32_t  end;              // First UTC time after the span
+    int32_t   offset;           // Seconds to add to get local time
+    localSpan():begin(0), end(0), offset(0){};
+};
+
 uint32_t  NTPtime();
 uint32_t  UTCtime();
 uint32_t  UTCtime(uint32_t _localtime);
@@ -60,6 +74,8 @@ uint32_t  millisAtUTCTime(uint32_t);
 void      dateTime(uint16_t* date, uint16_t* time);
 uint32_t  littleEndian(uint32_t);
 uint32_t  UTC2Local(uint32_t UTCtime);
+uint32_t  UTC2Local(uint32_t UTCtime, localSpan& span);   // For ascending series, span carries over
+void      timezoneReset();                                  // Timezone or rule changed
 uint32_t  local2UTC(uint32_t localTime);
 bool      testRule(uint32_t standardTime, dateTimeRule);
 
@@ -5,17 +5,360 @@ bool   unpackUpdate(String updateVersion);
 static const char updateURL_P[] PROGMEM = IOTA_UPDATE_HOST;
 static const char updatePath_P[] = IOTA_VERSIONS_PATH;
 
+/**************************************************************************************************
+ * releaseUnpacker - unpack and verify a release blob as it arrives
+ *
+ * The blob is a 16 byte header, then each file as a 32 byte header followed by its data padded
+ * to a multiple of 8, and last the 64 byte Ed25519 signature of everything before it.  add()
+ * takes the blob in pieces of any size and always holds back the last 64 bytes seen, which are
+ * the signature once the blob is complete.  Everything ahead of that is hashed and written to
+ * the version directory as it comes, so there's no download file and no second pass over it.
+ *
+ * With flash true, the firmware binary goes straight to the updater rather than the SD, less its
+ * last few bytes.  finish() verifies the signature and only then writes those and ends the
+ * update, so a blob that doesn't verify can't complete the image.  On any failure the update is
+ * abandoned and the version directory deleted.
+ *************************************************************************************************/
+
+#define UNPACK_SIGNATURE 64                 // Ed25519 signature at end of blob
+#define UNPACK_BUFFER 512                   // Read buffer size
+#define UNPACK_HOLD 8                       // Firmware bytes kept back until verified
+
+class releaseUnpacker {
+  public:
+    releaseUnpacker(const String& version, bool flash)
+      :_version(version)
+      ,_flash(flash)
+      ,_state(inRelease)
+      ,_need(16)
+      ,_headerLen(0)
+      ,_tailLen(0)
+      ,_fileLeft(0)
+      ,_padLeft(0)
+      ,_binLen(0)
+      ,_binWritten(0)
+      ,_binary(false)
+      ,_binaryFound(false)
+      ,_dirMade(false)
+      ,_updating(false)
+      ,_size(0)
+      ,_flashMs(0)
+      ,_verifyMs(0)
+      {_sha.reset();}
+    ~releaseUnpacker(){fail();}
+
+    bool      add(const uint8_t* data, size_t len);     // Next piece of the blob (false = bad)
+    bool      finish();                                 // Verify and complete the firmware
+    uint32_t  size(){return _size;}
+    uint32_t  flashMs(){return _flashMs;}               // Time writing firmware to flash
+    uint32_t  verifyMs(){return _verifyMs;}             // Time verifying and ending update
+
+  private:
+    enum      states {inRelease, inFileHeader, inFileData, failed, done};
+
+    union {
+      struct {
+        char file[4];
+        uint32_t len;
+        char name[24];
+      } fileHeader;
+      struct {
+        char IotaWatt[8];
+        char release[8];
+      } updtHeader;
+      uint8_t bytes[32];
+    } _header;
+
+    String        _version;
+    bool          _flash;
+    states        _state;
+    uint8_t       _need;                    // Size of header being accumulated
+    uint8_t       _headerLen;               // Header bytes so far
+    uint8_t       _tail[UNPACK_SIGNATURE];  // Last bytes seen
+    uint8_t       _tailLen;
+    uint32_t      _fileLeft;                // Data bytes left in current file
+    uint8_t       _padLeft;                 // Then padding bytes
+    uint32_t      _binLen;                  // Firmware size
+    uint32_t      _binWritten;              // Firmware bytes taken
+    uint8_t       _binHold[UNPACK_HOLD];    // Firmware bytes not yet written
+    bool          _binary;                  // Current file is the firmware
+    bool          _binaryFound;
+    bool          _dirMade;
+    bool          _updating;                // Firmware update begun
+    uint32_t      _size;
+    uint32_t      _flashMs;
+    uint32_t      _verifyMs;
+    File          _outFile;
+    SHA256        _sha;
+    MD5Builder    _md5;
+    UpdaterClass  _update;
+
+    void          consume(const uint8_t* data, size_t len);
+    void          startRelease();
+    void          startFile();
+    void          writeFile(const uint8_t* data, size_t len);
+    void          endFile();
+    void          updateError();
+    void          fail();
+};
+
+bool releaseUnpacker::add(const uint8_t* data, size_t len){
+  if(_state == failed){
+    return false;
+  }
+  _size += len;
+  if(_tailLen + len <= UNPACK_SIGNATURE){
+    memcpy(_tail + _tailLen, data, len);
+    _tailLen += len;
+    return true;
+  }
+
+      // Consume all but the last UNPACK_SIGNATURE bytes seen, first from the tail, then data.
+
+  size_t release = _tailLen + len - UNPACK_SIGNATURE;
+  size_t fromTail = MIN(release, (size_t)_tailLen);
+  consume(_tail, fromTail);
+  consume(data, release - fromTail);
+  memmove(_tail, _tail + fromTail, _tailLen - fromTail);
+  _tailLen -= fromTail;
+  memcpy(_tail + _tailLen, data + (release - fromTail), len - (release - fromTail));
+  _tailLen = UNPACK_SIGNATURE;
+  return _state != failed;
+}
+
+void releaseUnpacker::consume(const uint8_t* data, size_t len){
+  while(len && _state != failed){
+    if(_state != inFileData){
+      size_t take = MIN(len, (size_t)(_need - _headerLen));
+      memcpy(_header.bytes + _headerLen, data, take);
+      _headerLen += take;
+      data += take;
+      len -= take;
+      if(_headerLen < _need){
+        return;
+      }
+      _sha.update(_header.bytes, _need);
+      _headerLen = 0;
+      if(_state == inRelease){
+        startRelease();
+      }
+      else {
+        startFile();
+      }
+      continue;
+    }
+    size_t take = MIN(len, (size_t)(_fileLeft + _padLeft));
+    size_t bytes = MIN(take, (size_t)_fileLeft);
+    _sha.update(data, take);
+    writeFile(data, bytes);
+    _fileLeft -= bytes;
+    _padLeft -= take - bytes;
+    data += take;
+    len -= take;
+    if(_fileLeft == 0 && _padLeft == 0){
+      endFile();
+    }
+  }
+}
+
+void releaseUnpacker::startRelease(){
+  if((memcmp(_header.updtHeader.IotaWatt, "IotaWatt", 8) != 0) ||
+     (memcmp(_header.updtHeader.release, _version.c_str(), 8) != 0)) {
+    log("Updater: release file header invalid. %.8s %.8s", _header.updtHeader.IotaWatt, _header.updtHeader.release);
+    fail();
+    return;
+  }
+  deleteRecursive(_version);
+  if( ! SD.mkdir(_version.c_str())){
+    log("Updater: Cannot create update directory");
+    fail();
+    return;
+  }
+  _dirMade = true;
+  _state = inFileHeader;
+  _need = sizeof(_header.fileHeader);
+}
+
+void releaseUnpacker::startFile(){
+  if(memcmp(_header.fileHeader.file, "FILE", 4) != 0) {
+    log("Updater: Release file format error.");
+    fail();
+    return;
+  }
+  char name[sizeof(_header.fileHeader.name) + 1];
+  memcpy(name, _header.fileHeader.name, sizeof(_header.fileHeader.name));
+  name[sizeof(_header.fileHeader.name)] = 0;
+  _fileLeft = _header.fileHeader.len;
+  _padLeft = (8 - _fileLeft % 8) % 8;
+  _binary = strcmp_ci(name, "iotawatt.bin") == 0;
+  if(_binary){
+    _binaryFound = true;
+    _binLen = _fileLeft;
+    _binWritten = 0;
+    _md5.begin();
+  }
+  if(_binary && _flash){
+    if(_updating || ! _update.begin(_binLen)){
+      updateError();
+      fail();
+      return;
+    }
+    _updating = true;
+  }
+  else {
+    String filePath = _version + "/" + name;
+    _outFile = SD.open(filePath.c_str(), FILE_WRITE);
+    if( ! _outFile){
+      log("Updater: unable to create file: %s", filePath.c_str());
+      fail();
+      return;
+    }
+  }
+  _state = inFileData;
+  if(_fileLeft == 0 && _padLeft == 0){
+    endFile();
+  }
+}
+
+void releaseUnpacker::writeFile(const uint8_t* data, size_t len){
+  if( ! len){
+    return;
+  }
+  if(_binary){
+    _md5.add(data, len);
+  }
+  if( ! (_binary && _flash)){
+    if(_outFile.write(data, len) != len){
+      log("Updater: SD write failed");
+      fail();
+    }
+    return;
+  }
+
+      // Flash all but the last UNPACK_HOLD bytes of the firmware.
+
+  uint32_t holdFrom = _binLen - MIN(_binLen, (uint32_t)UNPACK_HOLD);
+  size_t direct = _binWritten >= holdFrom ? 0 : MIN(len, (size_t)(holdFrom - _binWritten));
+  if(direct){
+    uint32_t startMs = millis();
+    if(_update.write((uint8_t*)data, direct) != direct){
+      updateError();
+      fail();
+      return;
+    }
+    _flashMs += millis() - startMs;
+  }
+  if(len > direct){
+    memcpy(_binHold + (_binWritten + direct - holdFrom), data + direct, len - direct);
+  }
+  _binWritten += len;
+}
+
+void releaseUnpacker::endFile(){
+  if(_binary){
+    char md5Char[33];
+    _md5.calculate();
+    _md5.getChars(md5Char);
+    if(_flash){
+      _update.setMD5(md5Char);
+    }
+    else {
+      _outFile.write((uint8_t*)md5Char, 32);
+    }
+  }
+  if(_outFile){
+    _outFile.close();
+  }
+  _binary = false;
+  _state = inFileHeader;
+  _need = sizeof(_header.fileHeader);
+}
+
+bool releaseUnpacker::finish(){
+  if(_state == failed){
+    return false;
+  }
+  uint32_t startMs = millis();
+  if(_state != inFileHeader || _headerLen || _tailLen < UNPACK_SIGNATURE){
+    log("Updater: Update rejected, no signature.");
+    fail();
+    return false;
+  }
+  uint8_t sha[32];
+  _sha.finalize(sha, 32);
+  uint8_t* key = new uint8_t[32];
+  memcpy_P(key, publicKey, 32);
+  bool verified = Ed25519::verify(_tail, key, sha, 32);
+  delete[] key;
+  if( ! verified){
+    log("Updater: Signature does not verify.");
+    fail();
+    return false;
+  }
+  log("Updater: signature verified");
+  if( ! _binaryFound){
+    log("Updater: Release has no firmware.");
+    fail();
+    return false;
+  }
+  if(_flash){
+    uint32_t hold = MIN(_binLen, (uint32_t)UNPACK_HOLD);
+    if(_update.write(_binHold, hold) != hold){
+      updateError();
+      fail();
+      return false;
+    }
+    _updating = false;
+    if( ! _update.end()){
+      updateError();
+      log("Updater: update failed");
+      fail();
+      return false;
+    }
+    log("Updater: firmware upgraded to version %s", _version.c_str());
+  }
+  _state = done;
+  _verifyMs = millis() - startMs;
+  return true;
+}
+
+void releaseUnpacker::updateError(){
+  xbuf errorMsg;
+  _update.printError(errorMsg);
+  log("Updater: %s", errorMsg.readStringUntil('\r').c_str());
+}
+
+    // Abandon the update.  Ending it short of its size resets the updater without
+    // committing the image.
+
+void releaseUnpacker::fail(){
+  if(_state == done){
+    return;
+  }
+  _state = failed;
+  if(_outFile){
+    _outFile.close();
+  }
+  if(_updating){
+    _updating = false;
+    _update.end();
+  }
+  if(_dirMade){
+    _dirMade = false;
+    deleteRecursive(_version);
+  }
+}
+
 /*************************************************************************************************
  * 
  *          updater - Service to check and update firmware
  * 
  *************************************************************************************************/
 uint32_t updater(struct serviceBlock* _serviceBlock) {
-  enum states {initialize, checkAutoUpdate, getVersion, waitVersion, createFile, download, waitDownload, install, getTable, waitTable};
+  enum states {initialize, checkAutoUpdate, getVersion, waitVersion, download, waitDownload, getTable, waitTable};
   static states state = initialize;
   static asyncHTTPrequest* request = nullptr;
   static String updateVersion;
-  static File releaseFile;
   static bool upToDate = false;
   static bool parseError = false;
   static int checkResponse = 0;
@@ -158,7 +501,7 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
         }
         else {
           log("Updater: Update from %s to %s", IOTAWATT_VERSION, updateVersion.c_str());
-          state = createFile;
+          state = download;
           return 1;
         }
       }
@@ -183,21 +526,6 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       return 1;
     }
 
-    case createFile: {
-      trace(T_UPDATE,5); 
-      log("Updater: download %s", updateVersion.c_str());
-      String filePath = "download/" + updateVersion + ".bin";
-      deleteRecursive(filePath);
-      releaseFile = SD.open(filePath.c_str(), FILE_WRITE);
-      if(! releaseFile){
-        log("Updater: Cannot create download file.");
-        state = checkAutoUpdate;
-        return UTCtime() + 60;
-      }
-      state = download;
-      return 1;
-    }
-      
     case download: {
       trace(T_UPDATE,6);   
       if( ! WiFi.isConnected()){
@@ -210,6 +538,7 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       if( ! request){
         request = new asyncHTTPrequest;
       }
+      log("Updater: download %s", updateVersion.c_str());
       String URL = String(FPSTR(updateURL_P)) + String(F(IOTA_VERSIONS_DIR)) + updateVersion + ".bin";
       request->setDebug(false);
       trace(T_UPDATE,6);   
@@ -222,60 +551,60 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
       }
       trace(T_UPDATE,6);   
       request->setTimeout(5);
-      request->onData([](void* arg, asyncHTTPrequest* request, size_t available){
-        uint8_t *buf = new uint8_t[500];
-        while(request->available()){
-          size_t read = request->responseRead(buf, 500);
-          releaseFile.write(buf, read);
-        }
-        delete[] buf;
-        });
       request->send();
 
           // Writing to the SD in async handler can cause problems. If we return
           // and keep sampling, the onData handler could interupt another service
-          // in the middle of SDcard work.  So we will go synchronous here and wait
-          // for the entire update blob to be transfered and written to SD.
-          // Takes about 5-10 seconds.
+          // in the middle of SDcard work.  So we will go synchronous here and 
+          // unpack the update blob as it arrives, hashing as we go and writing
+          // the firmware directly to flash.  Takes about as long as the transfer.
 
       setLedCycle(LED_UPDATING);
-      while(request->readyState() != 4){
+      releaseUnpacker* unpacker = new releaseUnpacker(updateVersion, true);
+      uint8_t* buf = new uint8_t[UNPACK_BUFFER];
+      uint32_t unpackMs = 0;
+      while(request->readyState() != 4 || request->available()){
+        if(request->readyState() >= 3 && request->available()){
+          size_t read = request->responseRead(buf, UNPACK_BUFFER);
+          if(request->responseHTTPcode() == 200){
+            uint32_t startMs = millis();
+            unpacker->add(buf, read);
+            unpackMs += millis() - startMs;
+          }
+        }
         yield();
       }
+      delete[] buf;
       trace(T_UPDATE,6);   
-      endLedCycle();
       HTTPrelease(HTTPtoken);
-      size_t fileSize = releaseFile.size();
-      releaseFile.close();
-      trace(T_UPDATE,6);   
       if(request->responseHTTPcode() != 200){
+        endLedCycle();
         log("Updater: Download failed HTTPcode %d", request->responseHTTPcode());
+        delete unpacker;
         delete request;
         request = nullptr;
-        String filePath = "download/" + updateVersion + ".bin";
-        deleteRecursive(filePath);
         state = checkAutoUpdate;
         lastVersionCheck = UTCtime();
         return 1;
       }
-      log("Updater: Release downloaded %dms, size %d", request->elapsedTime(), fileSize);
-      releaseFile.close();
+      uint32_t downloadMs = request->elapsedTime();
       delete request;
       request = nullptr;
-      state = install;
-      return 1;
-    }
-
-    case install: {
+      log("Updater: Release downloaded %dms, size %d", downloadMs, unpacker->size());
       trace(T_UPDATE,7); 
-      if(unpackUpdate(updateVersion)){
-        if(installUpdate(updateVersion)){
-          log ("Updater: Firmware updated, restarting.");
-          delay(500);
-          ESP.restart();
-        }
+      bool installed = unpacker->finish();
+      log("Updater: unpack %dms, flash %dms, verify %dms", unpackMs - unpacker->flashMs(), unpacker->flashMs(), unpacker->verifyMs());
+      delete unpacker;
+      endLedCycle();
+      if(installed){
+        log ("Updater: Firmware updated, restarting.");
+        delay(500);
+        Message_log.flush();
+        ESP.restart();
       }
       state = checkAutoUpdate;
+      lastVersionCheck = UTCtime();
+      return 1;
     }
 
     case getTable: {
@@ -356,133 +685,28 @@ uint32_t updater(struct serviceBlock* _serviceBlock) {
  * Only release files from IotaWatt.com can be verified because the private-key is needed to
  * sign with the digital signature.
  * 
+ * The auto-updater unpacks as it downloads, this is for a release file already on the SD.
+ * 
  *************************************************************************************************/
 
 bool unpackUpdate(String version){
-
-  union {
-    struct {
-      char file[4];
-      uint32_t len;
-      char name[24];
-    } fileHeader;
-    struct { 
-      char IotaWatt[8];
-      char release[8];
-    } updtHeader;
-    uint8_t header[32];
-  } headers;
-
-  bool binaryFound = false;
-  SHA256 sha256;
-  MD5Builder md5;
-
-        // open the release file and setup to sha256
-
   String filePath = "download/" + version + ".bin";
   File releaseFile = SD.open((char*)filePath.c_str(), FILE_READ);
   if(! releaseFile){
     log("Updater: %s not found", filePath.c_str());
     return false;
   }
-  int signatureSize = 64;
-  uint32_t binarySize = releaseFile.size() - signatureSize;
-  sha256.reset();
-
-        // Read and verify the header
-
-  if(true){
-    releaseFile.read(headers.header,sizeof(headers.updtHeader));
-    sha256.update(headers.header,sizeof(headers.updtHeader));
-    binarySize -= sizeof(headers.updtHeader);
-    if((memcmp(headers.updtHeader.IotaWatt, "IotaWatt", 8) != 0) ||
-       (memcmp(headers.updtHeader.release, version.c_str(), 8) != 0)) {
-      log("Updater: release file header invalid. %s %s",headers.updtHeader.IotaWatt,headers.updtHeader.release);
-      releaseFile.close();
-      return false;
-    }
-  }
-        // Create the local update directory.
-
-  deleteRecursive(String(version));
-  if( ! SD.mkdir(version.c_str())){
-    log("Updater: Cannot create update directory");
-    releaseFile.close();
-    return false;
-  }
-        // Read the update blob and create the various files.
-
-  while(binarySize){
-    releaseFile.read(headers.header,sizeof(headers.fileHeader));
-    sha256.update(headers.header,sizeof(headers.fileHeader));
-    binarySize -= sizeof(headers.fileHeader);
-    if(memcmp(headers.fileHeader.file,"FILE",4) != 0) {
-      log("Updater: Release file format error.");
-      releaseFile.close();
-      return false;
-    }
-    String filename = String(headers.fileHeader.name);
-    bool iotawattBin = filename.equalsIgnoreCase("iotawatt.bin");
-    if(iotawattBin){
-      binaryFound = true;
-      md5.begin();
-    }
-    String filePath = version + "/" + headers.fileHeader.name;
-    uint32_t fileSize = headers.fileHeader.len;
-    File outFile = SD.open((char*)filePath.c_str(), FILE_WRITE);
-    if( ! outFile){
-      log("Updater: unable to create file: %s", filePath.c_str());
-      releaseFile.close();
-      return false;
-    }
-    int buffSize = 512;
-    uint8_t* buff = new uint8_t [buffSize];
-    while(fileSize){
-      int chunk = MIN(fileSize, buffSize);
-      if(chunk % 8) chunk += 8 - chunk % 8;
-      releaseFile.read(buff, chunk);
-      sha256.update(buff, chunk);
-      binarySize -= chunk;
-      outFile.write(buff, MIN(fileSize, buffSize));
-      if(iotawattBin) md5.add(buff, MIN(fileSize, buffSize));
-      fileSize -= MIN(fileSize, buffSize);
-    }
-    delete[] buff;
-    if(iotawattBin) {
-      md5.calculate();
-      uint8_t md5Char[32];
-      md5.getChars((char*)md5Char);
-      outFile.write(md5Char, 32);
+  releaseUnpacker unpacker(version, false);
+  uint8_t* buf = new uint8_t[UNPACK_BUFFER];
+  int read;
+  while((read = releaseFile.read(buf, UNPACK_BUFFER)) > 0){
+    if( ! unpacker.add(buf, read)){
+      break;
     }
-    outFile.close();
-    if(fileSize){
-      return false;
-    } 
   }
-        // verify the signature
-
-  
-  uint8_t signature[64];
-  uint8_t sha[32];
-  sha256.finalize(sha,32);
-  if(releaseFile.available() != 64){
-    log("Updater: Update rejected, no signature.");
-    releaseFile.close();
-    return false;
-  }
-  releaseFile.read(signature, 64);
+  delete[] buf;
   releaseFile.close();
-  
-  uint8_t* key = new uint8_t[32];
-  memcpy_P(key, publicKey, 32);
-  if(! Ed25519::verify(signature, key, sha, 32)){
-    log("Updater: Signature does not verify.");
-    delete[] key;
-    return false;
-  }
-  delete[] key;
-  log("Updater: signature verified");
-  return binaryFound;
+  return unpacker.finish();
 }
 
 /***********************************************************************************************************
@@ -2,6 +2,68 @@
 #include "uploader.h"
 #include "splitstr.h"
 
+/*******************************************************************************************************
+ * uploadFeed - the Current_log records read by the uploaders.  Each uploader works through the log
+ * from its own _lastSent, but when they're caught up, or catching up together after an outage,
+ * they're all asking for the same few intervals.  The first to read a record leaves a copy here
+ * and the others take it, so the record is read once and fanned out to every uploader that needs it.
+ * 
+ * Records are kept by key, oldest replaced first.  Only records at or before Current_log.lastKey()
+ * are kept, as a read past the end returns the last record with the requested key and that
+ * interval has yet to be written, and a copy is only taken while its key is still in the log, so
+ * the oldest intervals drop out as the log wraps.  Misses read through the uploader's own cursor,
+ * so it stays sequential for that uploader.
+ * 
+ * The size is set with device config "uploadfeed" (records, 0 = off), and the buffer is allocated
+ * on the first read so a unit without uploaders doesn't carry it.  clear() is called when
+ * Current_log is opened or deleted, as the keys then refer to a different log.
+ ******************************************************************************************************/
+
+uploadFeed uploadRecords;
+
+void uploadFeed::size(uint8_t records){
+    records = MIN(records, UPLOAD_FEED_MAX);
+    if(records != _size){
+        delete[] _records;
+        _records = nullptr;
+        _size = records;
+    }
+    clear();
+    _hits = 0;
+    _reads = 0;
+}
+
+void uploadFeed::clear(){
+    if(_records){
+        for(int i=0; i<_size; i++){
+            _records[i].UNIXtime = 0;
+        }
+    }
+    _next = 0;
+}
+
+int uploadFeed::read(IotaLogRecord* record, IotaLogCursor& cursor){
+    if(_size && ! _records){
+        _records = new IotaLogRecord[_size];
+        clear();
+    }
+    uint32_t key = record->UNIXtime - (record->UNIXtime % Current_log.interval());
+    for(int i=0; i<_size; i++){
+        if(_records[i].UNIXtime == key && key && key >= Current_log.firstKey()){
+            memcpy(record, &_records[i], sizeof(IotaLogRecord));
+            _hits++;
+            return 0;
+        }
+    }
+    int rtc = cursor.read(record);
+    _reads++;
+    if(_size && rtc == 0 && key >= Current_log.firstKey() && key <= Current_log.lastKey()){
+        memcpy(&_records[_next], record, sizeof(IotaLogRecord));
+        _next = (_next + 1) % _size;
+    }
+    return rtc;
+}
+
 void uploader::getStatusJson(JsonObject& status)
 {
     // Set status information in callers's json object.
@@ -16,6 +78,24 @@ void uploader::getStatusJson(JsonObject& status)
     if(_statusMessage){
         status.set(F("message"), _statusMessage);
     }
+    status.set(F("bufferlimit"), _bufferLimit);
+    status.set(F("bulksend"), _bulkAdapt);
+    if(_rtt){
+        status.set(F("rtt"), _rtt);
+    }
+    if(_catchupMs){
+        status.set(F("catchuprate"), (float)_catchupRecords * 1000 / _catchupMs);
+    }
+    if(_compression){
+        JsonObject& compression = status.createNestedObject(F("compression"));
+        compression.set(F("rawbytes"), _rawBytes);
+        compression.set(F("sentbytes"), _sentBytes);
+        if(_sentBytes){
+            compression.set(F("ratio"), (float)_rawBytes / _sentBytes);
+        }
+        compression.set(F("ms"), _compressUs / 1000);
+        compression.set(F("heap"), _compressPeak ? GZIP_HEAP + _compressPeak : 0);
+    }
     trace(T_uploader,110);
 }
 
@@ -47,14 +127,32 @@ uint32_t uploader_dispatch(struct serviceBlock* serviceBlock) {
 uint32_t uploader::dispatch(struct serviceBlock *serviceBlock)
 {
     trace(T_uploader,2,_state);
+
+        // The pooled request is held until the state that reads the response is done.
+
+    if(_request && _state != HTTPpost_s && _state != HTTPwait_s && _state != _responseState){
+        HTTPreturn(_request);
+    }
     switch (_state) {
         case initialize_s:
             return handle_initialize_s();
         case query_s:
+            if(resumeCheckpoint()){
+                return 1;
+            }
             return handle_query_s();
         case checkQuery_s:
             return handle_checkQuery_s();
-        case write_s:              
+        case write_s:
+            if(_lastSent >= _checkpoint + UPLOADER_CHECKPOINT_SECS){
+                saveCheckpoint();
+            }
+            if(_nextFrom){
+                uint32_t reschedule = resumeNext();
+                if(reschedule){
+                    return reschedule;
+                }
+            }
             return handle_write_s();
         case checkWrite_s:
             return handle_checkWrite_s();
@@ -75,13 +173,17 @@ uint32_t uploader::dispatch(struct serviceBlock *serviceBlock)
 
 void uploader::stop(){
     log("%s: stopped, Last post %s", _id, localDateString(_lastSent).c_str());
+    if(_lastSent > _checkpoint){
+        saveCheckpoint();
+    }
     delete oldRecord;
     oldRecord = nullptr;
     delete newRecord;
     newRecord = nullptr;
-    // delete _request;
-    // _request = nullptr;
+    discardNext();
+    HTTPreturn(_request);
     reqData.flush();
+    _payload.release();
     delete _url;
     _url = nullptr;
     trace(T_uploader, 7);
@@ -103,6 +205,7 @@ uint32_t uploader::handle_stopped_s(){
     _statusMessage = nullptr;
     trace(T_uploader,8);
     _lastSent = 0;
+    _checkpointTried = false;
     _state = query_s;
     return 1;
 }
@@ -129,20 +232,29 @@ uint32_t uploader::handle_initialize_s(){
 // Subsystem to initiate HTTP transactions and wait for completion.
 // Handles directing to HTTPS proxy when configured and requested.
 
-void uploader::HTTPPost(const char* endpoint, states completionState, const char* contentType){
+void uploader::HTTPPost(const char* endpoint, states completionState, const char* contentType, const char* contentEncoding){
     
     // Build a request control block for this request,
     // set state to handle the request and return to caller.
     // Actual post is done in next tick handler.
+    // A write built ahead keeps its request until the one in flight completes.
     
-    if( ! _POSTrequest){
-        _POSTrequest = new POSTrequest;
-    }
-    delete _POSTrequest->endpoint;
-    _POSTrequest->endpoint = charstar(endpoint);
-    delete _POSTrequest->contentType;
-    _POSTrequest->contentType = charstar(contentType);
-    _POSTrequest->completionState = completionState;
+    POSTrequest* request = _prebuild ? _nextPOST : _POSTrequest;
+    if( ! request){
+        request = new POSTrequest;
+    }
+    delete request->endpoint;
+    request->endpoint = charstar(endpoint);
+    delete request->contentType;
+    request->contentType = charstar(contentType);
+    delete[] request->contentEncoding;
+    request->contentEncoding = contentEncoding ? charstar(contentEncoding) : nullptr;
+    request->completionState = completionState;
+    if(_prebuild){
+        _nextPOST = request;
+        return;
+    }
+    _POSTrequest = request;
     _state = HTTPpost_s;
 }
 
@@ -153,6 +265,9 @@ uint32_t uploader::handle_HTTPpost_s(){
     // just return.
 
     trace(T_uploader,120);
+    if(_nextFrom){
+        discardNext();
+    }
     if( ! WiFi.isConnected()){
         return UTCtime() + 1;
     }
@@ -169,18 +284,9 @@ uint32_t uploader::handle_HTTPpost_s(){
         return 15;
     }
 
-    // Setup request.
+    // Setup request on a pooled connection.
 
-    if( ! _request){
-        _request = new asyncHTTPrequest;
-    }
-    _request->setTimeout(3);
-    _request->setDebug(false);
-    if(_request->debug())    {
-        Serial.println(ESP.getFreeHeap()); 
-        Serial.println(datef(localTime(),"hh:mm:ss"));
-        Serial.println(reqData.peekString(reqData.available()));
-    }
+    HTTPreturn(_request);
     trace(T_uploader,120);
     {
         char URL[128];
@@ -193,30 +299,45 @@ uint32_t uploader::handle_HTTPpost_s(){
             size_t len = sprintf_P(URL, PSTR("%s%s"),  _url->build().c_str(), _POSTrequest->endpoint);
         }
         trace(T_uploader,123);
-        if( ! _request->open("POST", URL)){
+        _request = HTTPlease("POST", URL);
+        if( ! _request){
             trace(T_uploader,123);
             HTTPrelease(_HTTPtoken);
-            delete _request;
-            _request = nullptr;
             return UTCtime() + 5;
         }
     }
+    _request->setTimeout(3);
+    _request->setDebug(false);
+    if(_request->debug())    {
+        Serial.println(ESP.getFreeHeap()); 
+        Serial.println(datef(localTime(),"hh:mm:ss"));
+        Serial.println(reqData.peekString(reqData.available()));
+    }
     if(_useProxyServer){
         _request->setReqHeader(F("X-proxypass"),  _url->build().c_str());
     }
     _request->setReqHeader(F("content-type"), _POSTrequest->contentType);
+    if(_POSTrequest->contentEncoding){
+        _request->setReqHeader(F("Content-Encoding"), _POSTrequest->contentEncoding);
+    }
     trace(T_uploader,124);
     setRequestHeaders();
+    _postMs = millis();
+    _inflightLast = _lastPost;
     if( ! _request->send(&reqData, reqData.available())){
         trace(T_uploader,125);
+        if(_POSTrequest->completionState == checkWrite_s){
+            adapt(false, 0);
+        }
         HTTPrelease(_HTTPtoken);
         reqData.flush();
-        delete _request;
-        _request = nullptr;
+        _payload.release();
+        HTTPreturn(_request, false);
         _lastPost = _lastSent;
         return UTCtime() + 5;
     }
     reqData.flush();
+    _payload.release();
     trace(T_uploader,126);
     _state = HTTPwait_s;
     return 10; 
@@ -227,20 +348,229 @@ uint32_t uploader::handle_HTTPwait_s(){
     if(_request && _request->readyState() == 4){
         HTTPrelease(_HTTPtoken);
         trace(T_uploader,91);
+        if(_POSTrequest->completionState == checkWrite_s){
+            int code = _request->responseHTTPcode();
+            adapt(code >= 200 && code < 300, millis() - _postMs);
+        }
         delete[] _statusMessage;
         _statusMessage = nullptr;
         _state = _POSTrequest->completionState;
+        _responseState = _state;
         delete _POSTrequest;
         _POSTrequest = nullptr;
         trace(T_uploader,9);
         return 1;
     }
+    if(_pipeline && ! _stop && _POSTrequest->completionState == checkWrite_s && ! _nextPOST){
+        prebuild();
+    }
     trace(T_uploader,93);
     return 10;
 }
 
+//  Pipelining.
+//  While a write is in flight, handle_write_s() is run from HTTPwait_s to build the next one
+//  in reqData (the request has its own copy of the one in flight).  It's run as if the write
+//  in flight had already succeeded, starting after _inflightLast, and its HTTPPost() is held
+//  in _nextPOST.  _lastSent and _lastPost are swapped in for the call and back out after, so
+//  checkWrite_s sees only the write in flight.
+//
+//  When checkWrite_s goes back to write_s, the write built ahead is posted right away if the one
+//  in flight succeeded (_lastSent is now where it started), or building carries on if it wasn't
+//  finished.  Otherwise it's thrown away and the write is rebuilt from _lastSent as always.
+
+void uploader::prebuild(){
+    trace(T_uploader,94);
+    if( ! _nextFrom){
+        _nextFrom = _inflightLast;
+        _nextLast = _inflightLast;
+    }
+    uint32_t lastSent = _lastSent;
+    _lastSent = _nextFrom;
+    _lastPost = _nextLast;
+    _prebuild = true;
+    handle_write_s();
+    _prebuild = false;
+    _nextLast = _lastPost;
+    _lastPost = _inflightLast;
+    _lastSent = lastSent;
+    if(_state != HTTPwait_s){
+        discardNext();
+        _state = HTTPwait_s;
+    }
+}
+
+uint32_t uploader::resumeNext(){
+    trace(T_uploader,95);
+    if(_lastSent != _nextFrom){
+        discardNext();
+        return 0;
+    }
+    _lastPost = _nextLast;
+    _nextFrom = 0;
+    if(_nextPOST){
+        delete _POSTrequest;
+        _POSTrequest = _nextPOST;
+        _nextPOST = nullptr;
+        _state = HTTPpost_s;
+        return 1;
+    }
+    return 0;
+}
+
+void uploader::discardNext(){
+    if(_nextFrom || _nextPOST){
+        reqData.flush();
+        _payload.release();
+        delete oldRecord;
+        oldRecord = nullptr;
+        delete newRecord;
+        newRecord = nullptr;
+    }
+    delete _nextPOST;
+    _nextPOST = nullptr;
+    _nextFrom = 0;
+}
+
 void uploader::setRequestHeaders(){};
 
+// Compress the request body built in reqData when configured.
+// The body is read through gzip() into a work xbuf and copied back,
+// so the heap cost is GZIP_HEAP plus the compressed size.
+
+const char* uploader::compressBody(){
+    if( ! _compression || ! reqData.available()){
+        return nullptr;
+    }
+    trace(T_uploader,127);
+    uint32_t startUs = micros();
+    _rawBytes += reqData.available();
+    xbuf zipped;
+    size_t len = gzip(reqData, zipped);
+    _compressPeak = MAX(_compressPeak, len);
+    uint8_t chunk[64];
+    while(zipped.available()){
+        size_t chunkLen = zipped.read(chunk, sizeof(chunk));
+        reqData.write(chunk, chunkLen);
+    }
+    _sentBytes += len;
+    _compressUs += micros() - startUs;
+    return "gzip";
+}
+
+// The post size is the adapted _bufferLimit, within reqData's share of the payload pool.
+
+int32_t uploader::postLimit(){
+    int32_t share = _payload.limit(reqData.available());
+    return MIN(_bufferLimit, share);
+}
+
+// The last datalog key that can be posted.  Outputs using peer inputs or integrations
+// wait for those logs, rather than post zeros for the intervals they don't have yet.
+
+uint32_t uploader::dataLastKey(){
+    uint32_t key = Current_log.lastKey();
+    if(_outputs){
+        key = MIN(key, _outputs->availableKey());
+    }
+    return key;
+}
+
+// Adapt the post size to the link, additive increase and multiplicative decrease.
+// A quick successful write grows the buffer limit by a step, if there's heap to spare,
+// and bulk send by an interval back toward the configured value.  A failure, a slow write
+// or low heap halves both, so the next posts are smaller and go sooner.
+
+void uploader::adapt(bool ok, uint32_t rtt){
+    if(rtt){
+        _rtt = _rtt ? (_rtt * 7 + rtt) / 8 : rtt;
+    }
+    uint32_t heap = ESP.getFreeHeap();
+    if( ! ok || rtt >= UPLOADER_SLOW_MS || heap < UPLOADER_HEAP_RESERVE){
+        _bufferLimit = MAX(_bufferLimit / 2, UPLOADER_BUFFER_MIN);
+        _bulkAdapt = MAX(_bulkAdapt / 2, 1);
+    }
+    else if(heap > UPLOADER_HEAP_RESERVE + _bufferLimit * 2){
+        _bufferLimit = MIN(_bufferLimit + UPLOADER_BUFFER_STEP, UPLOADER_BUFFER_MAX);
+        _bulkAdapt = MIN(_bulkAdapt + 1, _bulkSend);
+    }
+}
+
+// Checkpoints.
+// The confirmed _lastSent is saved every UPLOADER_CHECKPOINT_SECS of progress and when stopped,
+// with the config hash and revision.  When starting, query_s trusts a checkpoint that matches
+// the config and is within the Current_log, and goes straight to write_s.  Anything written
+// after the checkpoint was saved is sent again, which both influx and Emoncms take as an
+// overwrite.  The lookback query is only needed when there's no usable checkpoint.
+
+String uploader::checkpointPath(){
+    String path(F(IOTA_SYSTEM_DIR));
+    path += _id;
+    path += F(".ckp");
+    return path;
+}
+
+void uploader::saveCheckpoint(){
+    trace(T_uploader,96);
+    uploaderCheckpoint checkpoint;
+    checkpoint.magic = UPLOADER_CHECKPOINT_MAGIC;
+    checkpoint.configHash = _configHash;
+    checkpoint.revision = _revision;
+    checkpoint.lastSent = _lastSent;
+    String path = checkpointPath();
+    SD.remove(path.c_str());
+    File file = SD.open(path.c_str(), FILE_WRITE);
+    if(file){
+        file.write((uint8_t*)&checkpoint, sizeof(checkpoint));
+        file.close();
+    }
+    _checkpoint = _lastSent;
+}
+
+bool uploader::resumeCheckpoint(){
+    if(_checkpointTried){
+        return false;
+    }
+    trace(T_uploader,97);
+    _checkpointTried = true;
+    uploaderCheckpoint checkpoint;
+    File file = SD.open(checkpointPath().c_str(), FILE_READ);
+    if( ! file){
+        return false;
+    }
+    size_t len = file.read((uint8_t*)&checkpoint, sizeof(checkpoint));
+    file.close();
+    if(len != sizeof(checkpoint) || checkpoint.magic != UPLOADER_CHECKPOINT_MAGIC ||
+       checkpoint.configHash != _configHash || checkpoint.revision != _revision ||
+       checkpoint.lastSent % _interval || checkpoint.lastSent < Current_log.firstKey() ||
+       checkpoint.lastSent > Current_log.lastKey()){
+        return false;
+    }
+    _lastSent = checkpoint.lastSent;
+    _checkpoint = _lastSent;
+    log("%s: Resume posting from checkpoint %s", _id, localDateString(_lastSent + _interval).c_str());
+    _state = write_s;
+    return true;
+}
+
+// Catch-up throughput, records per second from the first full post
+// of a catch-up to the latest.  The last rate is kept once caught up.
+
+void uploader::catchup(uint32_t records, bool full){
+    if( ! full){
+        _catchupStart = 0;
+        return;
+    }
+    if( ! _catchupStart){
+        _catchupStart = millis();
+        _catchupRecords = 0;
+        _catchupMs = 0;
+        return;
+    }
+    _catchupRecords += records;
+    _catchupMs = millis() - _catchupStart;
+}
+
 void uploader::delay(uint32_t seconds, states resumeState){
     _delayResumeTime = UTCtime() + seconds;
     _delayResumeState = resumeState;
@@ -291,6 +621,8 @@ bool uploader::config(const char *jsonConfig)
         return true;
     }
     _revision = config["revision"];
+    _configHash = hashIndex(jsonConfig);
+    _checkpointTried = false;
 
     // parse and validate url
 
@@ -326,7 +658,9 @@ bool uploader::config(const char *jsonConfig)
     }
     _bulkSend = config.get<unsigned int>("bulksend");
     _bulkSend = constrain(_bulkSend, 1, 10);
+    _bulkAdapt = _bulkSend;
     _stop = config.get<bool>("stop");
+    _pipeline = config["pipeline"] | true;
     _uploadStartDate = config.get<unsigned int>("begdate");
 
         // Build the measurement scriptset
@@ -343,20 +677,6 @@ bool uploader::config(const char *jsonConfig)
         return false;
     }
 
-    // Attempt to apportion buffer size to control overloading in the event of
-    // recovery of many uploaders.
-
-    int uploaders = 0;
-    if(influxDB_v1)
-        uploaders++;
-    if(influxDB_v2)
-        uploaders++;
-    if(Emoncms)
-        uploaders++;
-    if(uploaders){
-        uploaderBufferLimit = MIN(uploaderBufferTotal / uploaders, 4000);
-    }
-
     // Callback to derived class for unique configuration requirements
     // if that goes OK (true) then start the Service.
 
@@ -4,8 +4,50 @@
 #include "xurl.h"
 
 #define DEFAULT_BUFFER_LIMIT 4000
+#define UPLOADER_BUFFER_MIN 500         // Adaptive post size floor
+#define UPLOADER_BUFFER_MAX 8000        // and ceiling
+#define UPLOADER_BUFFER_STEP 250        // Additive increase per good post
+#define UPLOADER_SLOW_MS 1500           // A write slower than this is congestion (timeout is 3 sec)
+#define UPLOADER_HEAP_RESERVE 12000     // Free heap needed to grow
+#define UPLOADER_CHECKPOINT_SECS 600    // Save _lastSent when it has moved this far
+#define UPLOADER_CHECKPOINT_MAGIC 0x54504B43
+
+        // Saved in /iotawatt/<id>.ckp so a restart can skip the lookback query.
+
+struct uploaderCheckpoint {
+    uint32_t    magic;
+    uint32_t    configHash;             // hashIndex() of the config text
+    int32_t     revision;
+    uint32_t    lastSent;
+};
+#define UPLOAD_FEED_DEFAULT 8           // Default Current_log records shared by uploaders
+#define UPLOAD_FEED_MAX 32              // Maximum (records are 256 bytes)
 
 extern uint32_t uploader_dispatch(struct serviceBlock *serviceBlock);
+extern IotaLog Current_log;
+
+        // Current_log records recently read by uploaders, shared so that each
+        // interval is read from the SD once however many uploaders send it.
+
+class uploadFeed {
+    public:
+        uploadFeed() : _records(nullptr), _size(0), _next(0), _hits(0), _reads(0) {};
+        void      size(uint8_t records);    // Set size (0 = off), clears
+        void      clear();                  // Drop the kept records (Current_log opened or deleted)
+        int       read(IotaLogRecord* record, IotaLogCursor& cursor);
+        uint8_t   records(){return _size;}
+        uint32_t  hits(){return _hits;}
+        uint32_t  reads(){return _reads;}
+
+    private:
+        IotaLogRecord* _records;
+        uint8_t   _size;
+        uint8_t   _next;                    // Slot to replace next
+        uint32_t  _hits;
+        uint32_t  _reads;
+};
+
+extern uploadFeed uploadRecords;
 
 class uploader
 {
@@ -16,8 +58,13 @@ class uploader
                     _state(initialize_s),
                     _url(0),
                     _request(0),
+                    _responseState(initialize_s),
                     _interval(0),
                     _bulkSend(1),
+                    _bulkAdapt(1),
+                    _bufferLimit(DEFAULT_BUFFER_LIMIT),
+                    _postMs(0),
+                    _rtt(0),
                     _revision(-1),
                     _uploadStartDate(0),
                     _lastSent(0),
@@ -29,14 +76,33 @@ class uploader
                     _script(0),
                     _stop(false),
                     _end(false),
-                    _useProxyServer(true)
+                    _useProxyServer(true),
+                    _compression(false),
+                    _rawBytes(0),
+                    _sentBytes(0),
+                    _compressUs(0),
+                    _compressPeak(0),
+                    _catchupStart(0),
+                    _catchupRecords(0),
+                    _catchupMs(0),
+                    _pipeline(true),
+                    _prebuild(false),
+                    _inflightLast(0),
+                    _nextFrom(0),
+                    _nextLast(0),
+                    _nextPOST(nullptr),
+                    _configHash(0),
+                    _checkpoint(0),
+                    _checkpointTried(false),
+                    _cursor(&Current_log)
 
         {};
         
         ~uploader(){
             delete[] _statusMessage;
             delete _POSTrequest;
-            delete _request;
+            delete _nextPOST;
+            HTTPreturn(_request);
             delete newRecord;
             delete oldRecord;
             delete _url;
@@ -45,6 +111,7 @@ class uploader
         uint32_t dispatch(struct serviceBlock *serviceBlock);
         virtual bool config(const char *JsonText);
         virtual bool configCB(JsonObject&);
+        void reconfig(){_revision = -1;}    // Next config() rebuilds, even at the same revision
         virtual void getStatusJson(JsonObject&);
         virtual void stop();
         virtual void end();
@@ -72,17 +139,24 @@ class uploader
         struct POSTrequest{
             char*   endpoint;
             char*   contentType;
+            char*   contentEncoding;
             states  completionState;
-            POSTrequest():endpoint(nullptr),contentType(nullptr){};
-            ~POSTrequest(){delete[] endpoint; delete[] contentType;}
+            POSTrequest():endpoint(nullptr),contentType(nullptr),contentEncoding(nullptr){};
+            ~POSTrequest(){delete[] endpoint; delete[] contentType; delete[] contentEncoding;}
         };
 
         xurl* _url;
         xbuf reqData;
+        payloadShare _payload;          // reqData's share of the payload pool
         asyncHTTPrequest *_request;
+        states  _responseState;         // Completion state reading _request's response
 
         int16_t _interval;
         int16_t _bulkSend;
+        int16_t _bulkAdapt;             // Current bulk send, 1 to _bulkSend
+        int32_t _bufferLimit;           // Current post size limit
+        uint32_t _postMs;               // millis() write post sent
+        uint32_t _rtt;                  // Smoothed write round trip ms
         int32_t _revision;
         uint32_t _delayResumeTime;
         states _delayResumeState;
@@ -90,6 +164,22 @@ class uploader
         bool _stop;
         bool _end;
         bool _useProxyServer;
+        bool _compression;              // gzip POST bodies (compressBody)
+        uint32_t _rawBytes;             // Bytes before compression
+        uint32_t _sentBytes;            // Bytes after
+        uint32_t _compressUs;           // Time spent compressing
+        uint32_t _compressPeak;         // Largest compressed body
+        uint32_t _catchupStart;         // millis() first full post of a catch-up (0 = not catching up)
+        uint32_t _catchupRecords;       // Records posted since
+        uint32_t _catchupMs;            // Time they took
+        bool _pipeline;                 // Build the next write while one is in flight
+        bool _prebuild;                 // handle_write_s() is building ahead
+        uint32_t _inflightLast;         // _lastPost of the write in flight
+        uint32_t _nextFrom;             // Write built ahead starts after (0 = none)
+        uint32_t _nextLast;             // and has got to
+        uint32_t _configHash;           // hashIndex() of the config text
+        uint32_t _checkpoint;           // _lastSent last saved
+        bool _checkpointTried;          // Checkpoint looked at since started
 
         uint32_t _lastSent;
         uint32_t _lastPost;
@@ -97,8 +187,11 @@ class uploader
         char *_id;
         char *_statusMessage;
         POSTrequest *_POSTrequest;
+        POSTrequest *_nextPOST;         // HTTPPost() of the write built ahead
         ScriptSet *_outputs;
         Script *_script;
+        serviceBudget _budget;          // Paces building the post in handle_write_s
+        IotaLogCursor _cursor;          // Sequential reads of Current_log in handle_write_s
 
         virtual uint32_t handle_initialize_s();
         virtual uint32_t handle_query_s() = 0;
@@ -110,8 +203,21 @@ class uploader
         virtual uint32_t handle_HTTPwait_s();
         virtual uint32_t handle_delay_s();
 
-        virtual void HTTPPost(const char *endpoint, states completionState, const char *contentType);
+        virtual void HTTPPost(const char *endpoint, states completionState, const char *contentType, const char *contentEncoding = nullptr);
+        const char* compressBody();     // gzip reqData if _compression, returns the content-encoding
+        void catchup(uint32_t records, bool full);   // Account for a post of records, full if more are waiting
+        void adapt(bool ok, uint32_t rtt);           // Adjust _bufferLimit and _bulkAdapt after a write post
+        int32_t postLimit();            // reqData limit, _bufferLimit within the payload share
+        uint32_t dataLastKey();         // Current_log.lastKey(), or the last the outputs' peer logs cover
+        void prebuild();                // Build the next write while waiting
+        uint32_t resumeNext();          // Post or carry on with it, or discard it
+        void discardNext();
+        String checkpointPath();
+        void saveCheckpoint();
+        bool resumeCheckpoint();        // Start from the checkpoint rather than query
         virtual void delay(uint32_t seconds, states resumeState);
+
+        int readFeed(IotaLogRecord* record){return uploadRecords.read(record, _cursor);}
 };
 
 #endif
\ No newline at end of file
@@ -70,6 +70,71 @@ String hashName(const char* name){
   return base64encode(hash, 6);
 }
 
+/**************************************************************************************************
+ * Quick 32 bit hash of the input string for name lookup tables (FNV-1a).
+ * ************************************************************************************************/
+uint32_t hashIndex(const char* name){
+  uint32_t hash = 2166136261UL;
+  while(*name){
+    hash = (hash ^ (uint8_t)*name++) * 16777619UL;
+  }
+  return hash;
+}
+
+/**************************************************************************************************
+ * CRC-32 as used by zip and gzip, four bits at a time from a 16 entry table.
+ * Pass the previous result as crc to continue over data in pieces.
+ * ************************************************************************************************/
+uint32_t CRC32(const uint8_t* data, size_t len, uint32_t crc){
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C};
+  crc = ~crc;
+  while(len--){
+    crc ^= *data++;
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+/**************************************************************************************************
+ * Format a double with a fixed number of decimals, as printf("%.*f") but several times faster.
+ * The value is scaled and rounded half away from zero, so a value at or very near a half in the last
+ * place (0.125 to two places) can come out one higher than printf, and a value that rounds to zero
+ * has no sign.
+ * Values too large to scale into 53 bits, NaN and infinity are left to snprintf.
+ * Returns the length, buf is terminated.
+ * ************************************************************************************************/
+size_t formatFixed(char* buf, double value, int precision){
+  static const double scale[] = {1.0, 10.0, 100.0, 1000.0, 10000.0, 100000.0, 1000000.0};
+  precision = constrain(precision, 0, 6);
+  double scaled = (value < 0 ? -value : value) * scale[precision] + 0.5;
+  if( ! (scaled < 9007199254740992.0)){
+    snprintf_P(buf, 32, PSTR("%.*f"), precision, value);
+    return strlen(buf);
+  }
+  uint64_t digits = (uint64_t)scaled;
+  char temp[24];
+  int len = 0;
+  while(len <= precision || digits){
+    if(len == precision && precision){
+      temp[len++] = '.';
+    }
+    temp[len++] = '0' + (digits % 10);
+    digits /= 10;
+  }
+  char* out = buf;
+  if(value < 0 && (uint64_t)scaled){
+    *out++ = '-';
+  }
+  while(len){
+    *out++ = temp[--len];
+  }
+  *out = 0;
+  return out - buf;
+}
+
 /**************************************************************************************************
  * Convert the input to a String of hex digits.
  * ************************************************************************************************/
@@ -145,6 +210,82 @@ void base64encode(xbuf* buf){
   delete[] base64codes;
 }
 
+/**************************************************************************************************
+ * base64Stream - the same encoding as base64encode(xbuf*) for data supplied a piece at a time,
+ * so it can be encoded as it's produced.  Up to two bytes are carried between writes.
+ * ************************************************************************************************/
+void base64Stream::encode(const uint8_t* in, int len){
+  uint8_t out[4];
+  uint8_t b1 = len > 1 ? in[1] : 0;
+  uint8_t b2 = len > 2 ? in[2] : 0;
+  out[0] = (uint8_t) pgm_read_byte(base64codes_P + (in[0] >> 2));
+  out[1] = (uint8_t) pgm_read_byte(base64codes_P + ((in[0] << 4 | b1 >> 4) & 0x3f));
+  out[2] = len > 1 ? (uint8_t) pgm_read_byte(base64codes_P + ((b1 << 2 | b2 >> 6) & 0x3f)) : '=';
+  out[3] = len > 2 ? (uint8_t) pgm_read_byte(base64codes_P + (b2 & 0x3f)) : '=';
+  _out->write(out, 4);
+}
+
+void base64Stream::write(const uint8_t* in, size_t len){
+  while(_pending && _pending < 3 && len){
+    _carry[_pending++] = *in++;
+    len--;
+  }
+  if(_pending == 3){
+    encode(_carry, 3);
+    _pending = 0;
+  }
+  while(len >= 3){
+    encode(in, 3);
+    in += 3;
+    len -= 3;
+  }
+  while(len--){
+    _carry[_pending++] = *in++;
+  }
+}
+
+void base64Stream::finish(){
+  if(_pending){
+    encode(_carry, _pending);
+    _pending = 0;
+  }
+}
+
+/**************************************************************************************************
+ * base64Check(trials) - GET /command?base64check=n
+ * 
+ * Encodes n (default 100) random buffers of 0 to 200 bytes with base64encode() and again with
+ * base64Stream in random pieces, and reports any that differ.
+ * ************************************************************************************************/
+String base64Check(int trials){
+  if(trials <= 0) trials = 100;
+  trials = MIN(trials, 10000);
+  uint8_t in[200];
+  int different = 0;
+  for(int t=0; t<trials; t++){
+    size_t len = random(sizeof(in) + 1);
+    for(int i=0; i<len; i++){
+      in[i] = random(256);
+    }
+    xbuf pieces(128);
+    base64Stream stream(&pieces);
+    size_t done = 0;
+    while(done < len){
+      size_t piece = MIN((size_t)random(1, 50), len - done);
+      stream.write(in + done, piece);
+      done += piece;
+    }
+    stream.finish();
+    if( ! base64encode(in, len).equals(pieces.readString(pieces.available()))){
+      different++;
+    }
+    yield();
+  }
+  char response[80];
+  snprintf_P(response, sizeof(response), PSTR("base64Stream: %d trials, %d different\r\n"), trials, different);
+  return String(response);
+}
+
 String base64encode(const uint8_t* in, size_t len){
   trace(T_base64,0,len);
   if(len <= 0){
@@ -168,8 +309,13 @@ String base64encode(const uint8_t* in, size_t len){
  * JsonSummary produces a summary json file to the depth specified. Objects or arrays at greater 
  * depth are represented by a JsonArray with the position and condensed (no whitespace) length.
  * JsonDetail will return the condensed object or array in a char*.
+ * 
+ * Both read the file a block at a time.  If sha is given, JsonSummary reads the whole file from
+ * the start and hashes it in the same pass, so the config file is only read once to summarize.
  * ************************************************************************************************/
-String  JsonSummary(File file, int depth){
+#define JSON_READ_BLOCK 256
+
+String  JsonSummary(File file, int depth, uint8_t* sha){
     int     level = -1;
     char    delim[20];
     char    _char;
@@ -178,9 +324,29 @@ String  JsonSummary(File file, int depth){
     int     varBeg = 0;
     int     varLen = 0;
     xbuf    JsonOut;
+    SHA256  sha256;
+    char*   block = new char[JSON_READ_BLOCK];
+    int     blockLen = 0;
+    int     blockPos = 0;
     
-    while(file.available()){
-        _char = file.read();
+    if(sha){
+        file.seek(0);
+        sha256.reset();
+    }
+    size_t  position = file.position();
+    while(true){
+        if(blockPos == blockLen){
+            blockLen = file.read((uint8_t*)block, JSON_READ_BLOCK);
+            blockPos = 0;
+            if(blockLen <= 0){
+                break;
+            }
+            if(sha){
+                sha256.update(block, blockLen);
+            }
+        }
+        _char = block[blockPos++];
+        position++;
         if(escape){
           varLen++;
           escape = false;
@@ -205,14 +371,14 @@ String  JsonSummary(File file, int depth){
             else if(_char == '{'){
                 delim[++level] = '}';
                 if(level == depth){
-                    varBeg = file.position()-1;
+                    varBeg = position-1;
                     varLen = 0;
                 }
             }
             else if(_char == '['){
                 delim[++level] = ']';
                 if(level == depth){
-                    varBeg = file.position()-1;
+                    varBeg = position-1;
                     varLen = 0;
                 }
             }
@@ -229,6 +395,16 @@ String  JsonSummary(File file, int depth){
             break;
         }
     }
+
+        // Hash the rest of the file.
+
+    if(sha){
+        while((blockLen = file.read((uint8_t*)block, JSON_READ_BLOCK)) > 0){
+            sha256.update(block, blockLen);
+        }
+        sha256.finalize(sha, 32);
+    }
+    delete[] block;
     return JsonOut.readString();
 }
 
@@ -237,10 +413,21 @@ char*  JsonDetail(File file, JsonArray& locator){
     bool    escape = false;
     int segLen = locator[1].as<int>();
     char* out = new char[segLen+1];
+    char* block = new char[JSON_READ_BLOCK];
+    int blockLen = 0;
+    int blockPos = 0;
     char _char;
     file.seek(locator[0].as<int>());
     for(int i=0; i<segLen;){
-        _char = file.read();
+        if(blockPos == blockLen){
+            blockLen = file.read((uint8_t*)block, JSON_READ_BLOCK);
+            blockPos = 0;
+            if(blockLen <= 0){
+                segLen = i;
+                break;
+            }
+        }
+        _char = block[blockPos++];
         if( ! string && isspace(_char)) continue;
         if(escape){
             escape = false;
@@ -259,6 +446,7 @@ char*  JsonDetail(File file, JsonArray& locator){
         out [i++] = _char;
     }
     out[segLen] = 0;
+    delete[] block;
     return out;
 }
 
@@ -14,14 +14,30 @@ char* charstar(const char str);                     // return a pointer.
 char* charstar(const __FlashStringHelper *str, const char *str2 = nullptr);
 
 String hashName(const char* name);                  // hash the input string to an eight character base 64 string
+uint32_t hashIndex(const char* name);               // quick (FNV-1a) hash of a string for name indexes
+uint32_t CRC32(const uint8_t* data, size_t len, uint32_t crc = 0); // CRC-32 (zip/gzip), pass the last result to continue
+size_t formatFixed(char* buf, double value, int precision); // %.*f without printf, buf of at least 32
 String formatHex(uint32_t data);                    // Convert the input to a String of hex digits
 String bin2hex(const uint8_t* in, size_t len);
 void   hex2bin(uint8_t* out, const char* in, size_t len); 
 
 void   base64encode(xbuf* buf);                     // Convert the contents of an xbuf to base64
 String base64encode(const uint8_t* in, size_t len); // Convert the input buffer to a base64 String
-
-String JsonSummary(File file, int depth);           // Read a json file and return a summary Json string              
+String base64Check(int trials);                     // GET /command?base64check=n - base64Stream against base64encode
+
+class base64Stream {                                // Base64 encode to the end of an xbuf in pieces
+  public:
+    base64Stream(xbuf* out) : _out(out), _pending(0) {};
+    void write(const uint8_t* in, size_t len);
+    void finish();                                  // Encode what's left with padding
+  private:
+    xbuf*   _out;
+    uint8_t _carry[3];
+    uint8_t _pending;
+    void    encode(const uint8_t* in, int len);
+};
+
+String JsonSummary(File file, int depth, uint8_t* sha = nullptr); // Read a json file and return a summary Json string              
 char*  JsonDetail(File file, JsonArray& locator);   // Read and compress a detail segment of a json file
 
 String localDateString(uint32_t UNIXtime);          // Convert unixtime to a local data/time string
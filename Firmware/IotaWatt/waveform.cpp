@@ -0,0 +1,142 @@
+#include "IotaWatt.h"
+
+int16_t   waveformChannel = -1;
+
+static WiFiClient*  waveformClient = nullptr;   // Copy of the web server client
+static uint32_t     waveformCaptures = 0;       // Frames remaining
+static uint32_t     waveformSequence = 0;       // Next frame number
+static uint32_t     waveformCycles = 0;         // Channel good cycle count before capture
+static uint32_t     waveformLastMs = 0;         // millis() of last frame sent
+static bool         waveformReady = false;      // Vsample/Isample hold an unsent capture
+static bool         waveformInterleave = false; // Alternates capture and normal sampling
+
+//**********************************************************************************************
+//
+//        handleWaveform() - GET /waveform
+//
+//        Validate, send the response header and turn the connection over to the SERVICE.  
+//        The web server is held off (serverAvailable) until the stream completes.
+//
+//**********************************************************************************************
+
+void handleWaveform(){
+  trace(T_waveform,0);
+  if(waveformChannel >= 0){
+    server.send(409, txtPlain_P, F("Waveform stream in progress"));
+    return;
+  }
+  int channel = server.arg(F("channel")).toInt();
+  if( ! server.hasArg(F("channel")) || channel < 0 || channel >= maxInputs ||
+      ! inputChannel[channel]->isActive() || inputChannel[channel]->_type != channelTypePower){
+    server.send(400, txtPlain_P, F("Invalid channel"));
+    return;
+  }
+  uint32_t captures = 1;
+  if(server.hasArg(F("captures"))){
+    captures = server.arg(F("captures")).toInt();
+    if(captures < 1 || captures > WAVEFORM_MAX_CAPTURES){
+      server.send(400, txtPlain_P, F("Invalid captures"));
+      return;
+    }
+  }
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, F("application/octet-stream"), "");
+  
+  waveformClient = new WiFiClient(server.client());
+  waveformCaptures = captures;
+  waveformSequence = 0;
+  waveformReady = false;
+  waveformLastMs = millis();
+  waveformChannel = channel;
+  serverAvailable = false;
+  NewService(waveformService, T_waveform);
+}
+
+//**********************************************************************************************
+//
+//        waveformCapture() / waveformSampled() - hooks in the main loop sampling
+//
+//        An unsent capture is discarded when the loop moves on to another channel
+//        since the arrays are about to be overwritten.
+//
+//**********************************************************************************************
+
+bool waveformCapture(){
+  if(waveformChannel < 0){
+    return false;
+  }
+  waveformReady = false;
+  waveformInterleave = ! waveformInterleave;
+  if(waveformInterleave){
+    waveformCycles = inputChannel[waveformChannel]->_sampling.cycles;
+  }
+  return waveformInterleave;
+}
+
+void waveformSampled(){
+  waveformReady = inputChannel[waveformChannel]->_sampling.cycles != waveformCycles;
+}
+
+//**********************************************************************************************
+//
+//        waveformService() - write captures to the client
+//
+//        Each frame goes out as a single HTTP chunk written straight from the sample arrays.
+//
+//**********************************************************************************************
+
+uint32_t waveformService(struct serviceBlock* _serviceBlock){
+  trace(T_waveform,1);
+  bool done = ! waveformClient->connected() || (millis() - waveformLastMs) > WAVEFORM_TIMEOUT_MS;
+
+  if( ! done && waveformReady && budgetAvailable(WAVEFORM_FRAME_US)){
+    trace(T_waveform,2);
+    IotaInputChannel* Ichannel = inputChannel[waveformChannel];
+    IotaInputChannel* Vchannel = inputChannel[Ichannel->_vchannel];
+    waveformHeader header;
+    header.magic = WAVEFORM_MAGIC;
+    header.version = WAVEFORM_VERSION;
+    header.headerSize = sizeof(waveformHeader);
+    header.sequence = waveformSequence++;
+    header.channel = Ichannel->_channel;
+    header.vchannel = Vchannel->_channel;
+    header.samples = samples;
+    header.firstCrossUs = firstCrossUs;
+    header.lastCrossUs = lastCrossUs;
+    header.offsetV = Vchannel->_offset;
+    header.offsetI = Ichannel->_offset;
+    header.Vcal = Vchannel->_calibration;
+    header.Ical = Ichannel->_calibration;
+
+    char chunkHeader[12];
+    size_t dataSize = samples * sizeof(int16_t);
+    int len = sprintf_P(chunkHeader, PSTR("%x\r\n"), sizeof(waveformHeader) + 2 * dataSize);
+    waveformClient->write((uint8_t*)chunkHeader, len);
+    waveformClient->write((uint8_t*)&header, sizeof(waveformHeader));
+    waveformClient->write((uint8_t*)Vsample, dataSize);
+    waveformClient->write((uint8_t*)Isample, dataSize);
+    waveformClient->write((uint8_t*)"\r\n", 2);
+    waveformReady = false;
+    waveformLastMs = millis();
+    done = --waveformCaptures == 0;
+  }
+
+  if( ! done){
+    return 1;
+  }
+
+      // Stream complete or abandoned.
+      // Send the terminating chunk and release the web server.
+
+  trace(T_waveform,3);
+  if(waveformClient->connected()){
+    waveformClient->write((uint8_t*)"0\r\n\r\n", 5);
+  }
+  waveformClient->stop();
+  delete waveformClient;
+  waveformClient = nullptr;
+  waveformChannel = -1;
+  waveformReady = false;
+  serverAvailable = true;
+  return 0;
+}
@@ -0,0 +1,53 @@
+#ifndef waveform_h
+#define waveform_h
+
+/**************************************************************************************************
+ * 
+ *  waveform - binary streaming of raw sample cycles
+ * 
+ *  GET /waveform?channel=n[&captures=k]
+ * 
+ *  Streams k (default 1) sample cycles of the specified power channel as binary frames
+ *  in a chunked HTTP response, one frame per chunk.  Each frame is a waveformHeader followed 
+ *  by samples int16 V values and then samples int16 I values, all little-endian, written 
+ *  directly from the static Vsample/Isample arrays.
+ * 
+ *  Captures are ordinary samplePower cycles of the channel, so power is still developed
+ *  and logged.  The main loop alternates capture cycles with its normal channel selection 
+ *  so the other channels continue to be refreshed at half rate, and the frame is written
+ *  by the waveform SERVICE if the time remaining before bingoTime allows (a frame that
+ *  doesn't fit is dropped for the next capture).  The web server is held off for the stream,
+ *  so it is limited to WAVEFORM_MAX_CAPTURES, under a minute at the alternate cycles.
+ * 
+ * ************************************************************************************************/
+
+#define WAVEFORM_MAGIC 0x5749               // "IW"
+#define WAVEFORM_VERSION 1
+#define WAVEFORM_MAX_CAPTURES 1000
+#define WAVEFORM_TIMEOUT_MS 5000            // Abandon stream if no capture for this long
+#define WAVEFORM_FRAME_US 2000              // Service window needed to write a frame
+
+struct __attribute__((packed)) waveformHeader {
+  uint16_t  magic;                          // WAVEFORM_MAGIC
+  uint8_t   version;                        // WAVEFORM_VERSION
+  uint8_t   headerSize;                     // sizeof(waveformHeader)
+  uint32_t  sequence;                       // Frame number in this stream (0 - n)
+  uint8_t   channel;                        // Current channel
+  uint8_t   vchannel;                       // Voltage reference channel
+  uint16_t  samples;                        // Sample pairs that follow
+  uint32_t  firstCrossUs;                   // micros() at first and last V zero crossing
+  uint32_t  lastCrossUs;
+  uint16_t  offsetV;                        // ADC bias subtracted from raw readings
+  uint16_t  offsetI;
+  float     Vcal;                           // Channel calibrations
+  float     Ical;
+};
+
+extern int16_t waveformChannel;              // Channel being streamed, -1 if none
+
+bool      waveformCapture();                // Loop: sample waveformChannel now?
+void      waveformSampled();                // Loop: waveformChannel has been sampled
+void      handleWaveform();                 // Web server handler
+uint32_t  waveformService(struct serviceBlock*);
+
+#endif
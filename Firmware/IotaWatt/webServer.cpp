@@ -84,6 +84,15 @@ void handleRequest(){
   if(serverOn(authUser,  F("/query"), HTTP_GET, handleQuery)) return;
   if(serverOn(authUser,  F("/DSTtest"), HTTP_GET, handleDSTtest)) return;
   if(serverOn(authAdmin, F("/update"), HTTP_GET, handleUpdate)) return;
+  if(serverOn(authAdmin, F("/waveform"), HTTP_GET, handleWaveform)) return;
+  if(serverOn(authUser,  F("/live"), HTTP_GET, handleLive)) return;
+  if(strcmp_P(uri.c_str(), PSTR("/peer")) == 0 && server.method() == HTTP_GET){
+    if(peerAuthorized() || authenticate(authUser)){
+      handlePeer();
+    }
+    return;
+  }
+  if(serverOn(authAdmin, F("/trace"), HTTP_GET, handleTrace)) return;
 
 
   if(loadFromSdCard(uri)){
@@ -115,6 +124,56 @@ void returnFail(String msg, int HTTPcode) {
   server.send(HTTPcode, txtPlain_P, msg + "\r\n");
 }
 
+/**************************************************************************************************
+ * Static web assets (.htm, .css, .js and images) are sent with an ETag so the browser can 
+ * revalidate its copy and get a 304 instead of the whole file.  The tag is the file size and 
+ * CRC32, worked out the first time the file is sent and kept in a small table by path.  The 
+ * table is cleared whenever a file is uploaded, created or deleted.
+ * 
+ * When the browser accepts gzip and there is a .gz of the file, that is sent instead.  
+ * streamFile() adds the Content-Encoding header for a .gz file.
+ * ************************************************************************************************/
+
+#define ASSET_TAGS 16
+
+struct assetTag {
+  uint32_t  pathHash;                       // hashIndex() of path served (0 = empty)
+  uint32_t  size;
+  uint32_t  crc;
+};
+
+static assetTag assetTags[ASSET_TAGS];
+static uint8_t  assetTagNext = 0;
+
+void assetTagsClear(){
+  for(int i=0; i<ASSET_TAGS; i++){
+    assetTags[i].pathHash = 0;
+  }
+}
+
+static String assetETag(const String& path, File& file){
+  uint32_t pathHash = hashIndex(path.c_str()) | 1;
+  for(int i=0; i<ASSET_TAGS; i++){
+    if(assetTags[i].pathHash == pathHash && assetTags[i].size == file.size()){
+      return String('"') + String(assetTags[i].crc, HEX) + '-' + String(assetTags[i].size, HEX) + '"';
+    }
+  }
+  uint8_t* buf = new uint8_t[IOTALOG_BLOCK_SIZE];
+  uint32_t crc = 0;
+  int len;
+  while((len = file.read(buf, IOTALOG_BLOCK_SIZE)) > 0){
+    crc = CRC32(buf, len, crc);
+  }
+  delete[] buf;
+  file.seek(0);
+  assetTag* tag = &assetTags[assetTagNext];
+  assetTagNext = (assetTagNext + 1) % ASSET_TAGS;
+  tag->pathHash = pathHash;
+  tag->size = file.size();
+  tag->crc = crc;
+  return String('"') + String(tag->crc, HEX) + '-' + String(tag->size, HEX) + '"';
+}
+
 bool loadFromSdCard(String path){
   trace(T_WEB,13);
   if( ! path.startsWith("/")) path = '/' + path;
@@ -140,6 +199,10 @@ bool loadFromSdCard(String path){
     return loadFromSpiffs(path.substring(11), dataType);
   }
 
+  if(path.equalsIgnoreCase(F(IOTA_MESSAGE_LOG_PATH))){
+    Message_log.flush();
+  }
+
   if(path == F(IOTA_AUTH_PATH)){
     returnFail("Protected", 403);
     return false;
@@ -174,6 +237,9 @@ bool loadFromSdCard(String path){
     }
   } 
 
+  if( ! dataFile && SD.exists((path + F(".gz")).c_str())){
+    dataFile = SD.open((path + F(".gz")).c_str());
+  }
   if (!dataFile){
     return false;
   }
@@ -182,6 +248,26 @@ bool loadFromSdCard(String path){
     sendMsgFile(dataFile, server.arg(F("textpos")).toInt());
   }
 
+  else if(dataType.startsWith(F("text/html")) || dataType.startsWith(F("text/css")) ||
+          dataType.startsWith(F("application/javascript")) || dataType.startsWith(F("image/"))){
+    String gzPath = path + F(".gz");
+    if(server.header(F("Accept-Encoding")).indexOf(F("gzip")) >= 0 && SD.exists(gzPath.c_str())){
+      dataFile.close();
+      dataFile = SD.open(gzPath.c_str());
+      path = gzPath;
+    }
+    String etag = assetETag(path, dataFile);
+    server.sendHeader(F("ETag"), etag);
+    server.sendHeader(F("Cache-Control"), F("no-cache"));
+    server.sendHeader(F("Vary"), F("Accept-Encoding"));
+    if(server.header(F("If-None-Match")) == etag){
+      server.send(304);
+    }
+    else {
+      server.streamFile(dataFile, dataType);
+    }
+  }
+
   else {
     if(path.equalsIgnoreCase(F("/config.txt"))){
       server.sendHeader(F("X-configSHA256"), base64encode(configSHA256, 32));
@@ -237,6 +323,7 @@ void handleFileUpload(){
       }
     }
     if(SD.exists((char *)upload.filename.c_str())) SD.remove((char *)upload.filename.c_str());
+    assetTagsClear();
     if(uploadFile = SD.open(upload.filename.c_str(), FILE_WRITE)){
       DBG_OUTPUT_PORT.printf_P(PSTR("Upload: START, filename: %s\r\n"), upload.filename.c_str());
     }
@@ -327,11 +414,14 @@ void handleDelete(){
   if(path == F(IOTA_CONFIG_PATH) || 
      path == (F(IOTA_CURRENT_LOG_PATH)) ||
      path == (F(IOTA_HISTORY_LOG_PATH)) ||
+     path == (F(IOTA_HOURLY_LOG_PATH)) ||
+     path == (F(IOTA_DAILY_LOG_PATH)) ||
      path == (F(IOTA_AUTH_PATH)))
   {
     returnFail("Restricted File", 403);
     return;
   }
+  assetTagsClear();
   deleteRecursive(path);
   returnOK();
 }
@@ -353,6 +443,7 @@ void handleCreate(){
     return;
   }
 
+  assetTagsClear();
   if(path.indexOf('.') > 0){
     File file = SD.open((char *)path.c_str(), FILE_WRITE);
     if(file){
@@ -452,6 +543,7 @@ void handlePasswords(){
     server.send(400, txtPlain_P, F("Json parse failed."));
     return;
   }
+  statusFragmentsClear();
   if(adminH1){
     String testH1 = calcH1("admin", deviceName, request["oldadmin"].as<char*>());
     if( adminH1 && ! testH1.equals(bin2hex(adminH1,16))){
@@ -495,24 +587,91 @@ void handlePasswords(){
   return;
 }
 
+/**********************************************************************************************
+ * /status sections are each built in their own JsonBuffer and sent as a chunk, so the heap
+ * needed is that of the largest section requested rather than all of them together.  Sections
+ * that only change with their source are kept as built and resent until the source changes:
+ * device and passwords until the config or passwords change, inputs and outputs until
+ * statService runs again, datalogs until a log is written.
+ *
+ * A fragment is kept framed for sendChunk: 6 byte chunk header, separator, "name":value and
+ * room for the footer.
+ **********************************************************************************************/
+
+enum statusFragmentIds {statusDevice, statusInputs, statusOutputs, statusDatalogs, statusPasswords,
+                        statusFragmentCount};
+
+struct statusFragment {
+  char*     buf;                            // Framed section (nullptr = not built)
+  uint16_t  len;                            // Separator and section
+  uint32_t  version;                        // Of the source when built
+};
+
+typedef std::function<void(DynamicJsonBuffer&, JsonObject&)> statusBuilder;
+
+static statusFragment statusFragments[statusFragmentCount];
+static bool           statusFirst = false;  // Next section opens the object
+
+void statusFragmentsClear(){
+  for(int i=0; i<statusFragmentCount; i++){
+    delete[] statusFragments[i].buf;
+    statusFragments[i].buf = nullptr;
+  }
+}
+
+static uint32_t statusLogsVersion(){
+  uint32_t version = Current_log.lastKey() + History_log.lastKey() + Hourly_log.lastKey() + Daily_log.lastKey();
+  for(Script* script = integrations->first(); script; script = script->next()){
+    version += ((integrator*)script->getParm())->get_log()->lastKey();
+  }
+  return version;
+}
+
+static void statusSection(statusFragment* fragment, uint32_t version, statusBuilder build){
+  trace(T_WEB,30);
+  statusFragment scratch = {nullptr, 0, 0};
+  if( ! fragment){
+    fragment = &scratch;
+  }
+  if( ! fragment->buf || fragment->version != version){
+    String text;
+    {
+      DynamicJsonBuffer jsonBuffer;
+      JsonObject& root = jsonBuffer.createObject();
+      build(jsonBuffer, root);
+      root.printTo(text);
+    }
+    delete[] fragment->buf;
+    fragment->len = text.length() - 1;                  // Less the braces, plus separator
+    fragment->buf = new char[fragment->len + 8];
+    memcpy(fragment->buf + 7, text.c_str() + 1, fragment->len - 1);
+    fragment->version = version;
+  }
+  fragment->buf[6] = statusFirst ? '{' : ',';
+  statusFirst = false;
+  sendChunk(fragment->buf, fragment->len + 6);
+  delete[] scratch.buf;
+}
+
 void handleStatus(){
   trace(T_WEB,0);
-  uint32_t heapEntry = ESP.getFreeHeap();
-  String response = "";
-  {
-    DynamicJsonBuffer jsonBuffer;
-    JsonObject& root = jsonBuffer.createObject();
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, appJson_P, "");
+  statusFirst = true;
 
-    if(server.hasArg(F("device"))){
+  if(server.hasArg(F("device"))){
+    statusSection(&statusFragments[statusDevice], 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       JsonObject& device = jsonBuffer.createObject();
       device.set(F("name"), deviceName);
       device.set(F("timediff"), localTimeDiff);
       device.set(F("allowdst"), timezoneRule?true:false);
       device.set(F("update"), updateClass);
       root.set(F("device"),device);
-    }
+    });
+  }
     
-    if(server.hasArg(F("stats"))){
+  if(server.hasArg(F("stats"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,14);
       JsonObject& stats = jsonBuffer.createObject();
       trace(T_WEB,14);
@@ -533,16 +692,88 @@ void handleStatus(){
       stats.set(F("frequency"),frequency);
       trace(T_WEB,14);
       stats.set(F("lowbat"), RTClowBat);
+      stats.set(F("services"), serviceCount);
+      if(dispatchStats.dispatches){
+        stats.set(F("dispatches"), dispatchStats.dispatches);
+        stats.set(F("selectus"), (float)dispatchStats.selectUs / dispatchStats.dispatches);
+        stats.set(F("addus"), (float)dispatchStats.addUs / dispatchStats.dispatches);
+      }
+      if(scriptResults.entries()){
+        JsonObject& cache = stats.createNestedObject(F("scriptcache"));
+        cache.set(F("entries"), scriptResults.entries());
+        cache.set(F("hits"), scriptResults.hits());
+        cache.set(F("misses"), scriptResults.misses());
+      }
+      if(uploadRecords.records()){
+        JsonObject& feed = stats.createNestedObject(F("uploadfeed"));
+        feed.set(F("records"), uploadRecords.records());
+        feed.set(F("hits"), uploadRecords.hits());
+        feed.set(F("reads"), uploadRecords.reads());
+      }
+      JsonObject& pool = stats.createNestedObject(F("recordpool"));
+      pool.set(F("slots"), IOTALOG_RECORD_POOL);
+      pool.set(F("inuse"), recordPoolStats.inUse);
+      pool.set(F("maxinuse"), recordPoolStats.maxInUse);
+      pool.set(F("pooled"), recordPoolStats.pooled);
+      pool.set(F("exhausted"), recordPoolStats.exhausted);
+      JsonObject& heap = stats.createNestedObject(F("heap"));
+      uint32_t heapFree;
+      uint16_t heapBlock;
+      uint8_t heapFrag;
+      ESP.getHeapStats(&heapFree, &heapBlock, &heapFrag);
+      heap.set(F("free"), heapFree);
+      heap.set(F("maxblock"), heapBlock);
+      heap.set(F("frag"), heapFrag);
+      if(heapStats.low != UINT32_MAX){
+        heap.set(F("low"), heapStats.low);
+        heap.set(F("lowblock"), heapStats.lowBlock);
+        heap.set(F("lowfrag"), heapStats.lowFrag);
+        heap.set(F("lowtask"), heapStats.lowTask);
+        heap.set(F("lowtime"), heapStats.lowTime);
+      }
+      JsonObject& payload = stats.createNestedObject(F("payloadpool"));
+      payloadStatus(payload);
+      JsonObject& connections = stats.createNestedObject(F("connections"));
+      connectionStatus(connections);
+      JsonObject& streams = stats.createNestedObject(F("webstreams"));
+      webStreamStatus(streams);
+      JsonObject& live = stats.createNestedObject(F("live"));
+      liveStatus(live);
+      JsonObject& peers = stats.createNestedObject(F("peers"));
+      peerStatus(peers);
+      if(queryResults.bytes()){
+        JsonObject& cache = stats.createNestedObject(F("querycache"));
+        cache.set(F("bytes"), queryResults.bytes());
+        cache.set(F("hits"), queryResults.hits());
+        cache.set(F("misses"), queryResults.misses());
+      }
+      if(recentData.seconds()){
+        JsonObject& recent = stats.createNestedObject(F("recent"));
+        recent.set(F("seconds"), recentData.seconds());
+        recent.set(F("channels"), recentData.channels());
+        recent.set(F("firstkey"), recentData.firstKey());
+        recent.set(F("lastkey"), recentData.lastKey());
+        recent.set(F("queries"), recentData.queries());
+      }
+      if(multiCT > 1){
+        stats.set(F("multict"), multiCT);
+        stats.set(F("multirate"), multiSamplesPerCycle);
+      }
       root.set(F("stats"),stats);
-    }
+    });
+  }
     
-    if(server.hasArg(F("inputs"))){
+  if(server.hasArg(F("inputs"))){
+    statusSection(&statusFragments[statusInputs], statServiceRuns, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,15);
       JsonArray& channelArray = jsonBuffer.createArray();
       for(int i=0; i<maxInputs; i++){
         if(inputChannel[i]->isActive()){
           JsonObject& channelObject = jsonBuffer.createObject();
           channelObject.set(F("channel"),inputChannel[i]->_channel);
+          if(selectChannel != roundRobinChannel){
+            channelObject.set(F("interval"),(uint32_t)inputChannel[i]->_sampleInterval);
+          }
           if(inputChannel[i]->_type == channelTypeVoltage){
             channelObject.set(F("Vrms"),statRecord.accum1[i]);
             channelObject.set(F("Hz"),statRecord.accum2[i]);
@@ -563,68 +794,169 @@ void handleStatus(){
             double amps = (volts < 50) ? 0 : inputChannel[i]->dataBucket.VA / volts;
             channelObject.set("phase", inputChannel[i]->getPhase(amps));
             channelObject.set("lastphase", inputChannel[i]->_lastPhase);
+            if(multiCT > 1){
+              channelObject.set(F("samples"), inputChannel[i]->_samples);
+              channelObject.set(F("skew"), inputChannel[i]->_skew);
+            }
           }
           channelArray.add(channelObject);
         }
       }
       root["inputs"] = channelArray;
-    }
+    });
+  }
 
   if(server.hasArg(F("outputs"))){
-    trace(T_WEB,16);
-    JsonArray& outputArray = jsonBuffer.createArray();
-    Script* script = outputs->first();
-    statRecord.UNIXtime = UTCtime();
-    statRecord.logHours = 1;
-    while(script){
-      trace(T_WEB,16,1);
-      JsonObject& channelObject = jsonBuffer.createObject();
-      channelObject.set(F("name"),script->name());
-      channelObject.set(F("units"),script->getUnits());
-      double value = script->run(nullptr, &statRecord);
-      channelObject.set(F("value"),value);
-      outputArray.add(channelObject);
-      script = script->next();
-    }
-    trace(T_WEB,16,2);
-    root["outputs"] = outputArray;
-  }
-
-
-    if(server.hasArg(F("influx1"))){
+    statusSection(&statusFragments[statusOutputs], statServiceRuns, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
+      trace(T_WEB,16);
+      JsonArray& outputArray = jsonBuffer.createArray();
+      Script* script = outputs->first();
+      statRecord.UNIXtime = UTCtime();
+      statRecord.logHours = 1;
+      while(script){
+        trace(T_WEB,16,1);
+        JsonObject& channelObject = jsonBuffer.createObject();
+        channelObject.set(F("name"),script->name());
+        channelObject.set(F("units"),script->getUnits());
+        double value = script->run(nullptr, &statRecord);
+        channelObject.set(F("value"),value);
+        outputArray.add(channelObject);
+        script = script->next();
+      }
+      trace(T_WEB,16,2);
+      root["outputs"] = outputArray;
+    });
+  }
+
+
+  if(server.hasArg(F("sampling"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
+      trace(T_WEB,24);
+      JsonObject& sampling = jsonBuffer.createObject();
+      sampling.set(F("since"), samplingSince ? samplingSince : programStartTime);
+      sampling.set(F("samplesbase"), SAMPLING_SAMPLES_BASE);
+      sampling.set(F("samplesbin"), SAMPLING_SAMPLES_BIN);
+      sampling.set(F("usbase"), SAMPLING_US_BASE);
+      sampling.set(F("usbin"), SAMPLING_US_BIN);
+      JsonArray& channelArray = sampling.createNestedArray(F("channels"));
+      for(int i=0; i<maxInputs; i++){
+        if(inputChannel[i]->isActive()){
+          samplingStats* stats = &inputChannel[i]->_sampling;
+          uint32_t calls = stats->cycles + stats->lowQuality + stats->failures;
+          JsonObject& channelObject = channelArray.createNestedObject();
+          channelObject.set(F("channel"), i);
+          channelObject.set(F("cycles"), stats->cycles);
+          channelObject.set(F("low"), stats->lowQuality);
+          channelObject.set(F("fail"), stats->failures);
+          channelObject.set(F("avgus"), calls ? (uint32_t)(stats->totalUs / calls) : 0);
+          channelObject.set(F("maxus"), stats->maxUs);
+          JsonArray& samplesHist = channelObject.createNestedArray(F("samples"));
+          JsonArray& durationHist = channelObject.createNestedArray(F("us"));
+          for(int bin=0; bin<SAMPLING_BINS; bin++){
+            samplesHist.add(stats->samples[bin]);
+            durationHist.add(stats->duration[bin]);
+          }
+        }
+      }
+      root.set(F("sampling"), sampling);
+      if(server.arg(F("sampling")) == "reset"){
+        for(int i=0; i<maxInputs; i++){
+          inputChannel[i]->_sampling = samplingStats();
+        }
+        samplingSince = UTCtime();
+      }
+    });
+  }
+
+  if(server.hasArg(F("services"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
+      trace(T_WEB,25);
+      JsonObject& services = jsonBuffer.createObject();
+      services.set(F("since"), serviceStatsSince ? serviceStatsSince : programStartTime);
+      JsonArray& taskArray = services.createNestedArray(F("tasks"));
+      for(serviceStatistics* stats = serviceStatsList; stats; stats = stats->next){
+        JsonObject& taskObject = taskArray.createNestedObject();
+        taskObject.set(F("task"), stats->taskID);
+        taskObject.set(F("calls"), stats->calls);
+        taskObject.set(F("avgus"), stats->calls ? (uint32_t)(stats->totalUs / stats->calls) : 0);
+        taskObject.set(F("maxus"), stats->maxUs);
+        taskObject.set(F("overruns"), stats->overruns);
+        if(stats->calls){
+          taskObject.set(F("heaplow"), stats->heapLow);
+          taskObject.set(F("heapdrop"), stats->heapDrop);
+          taskObject.set(F("blocklow"), stats->blockLow);
+          taskObject.set(F("fraghigh"), stats->fragHigh);
+        }
+      }
+      root.set(F("services"), services);
+      if(server.arg(F("services")) == "reset"){
+        for(serviceStatistics* stats = serviceStatsList; stats; stats = stats->next){
+          stats->calls = 0;
+          stats->overruns = 0;
+          stats->maxUs = 0;
+          stats->totalUs = 0;
+          stats->resetHeap();
+        }
+        heapStats.low = UINT32_MAX;
+        serviceStatsSince = UTCtime();
+      }
+    });
+  }
+
+  if(server.hasArg(F("influx1"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,17);
       JsonObject& status = jsonBuffer.createObject();
       if(!influxDB_v1){
         status.set(F("state"),"not running");
       } else {
         influxDB_v1->getStatusJson(status);
-      }  
+      }
       root["influx1"] = status;
-    }
+    });
+  }
 
-    if(server.hasArg(F("influx2"))){
+  if(server.hasArg(F("influx2"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,17);
       JsonObject& status = jsonBuffer.createObject();
       if(!influxDB_v2){
         status.set(F("state"),"not running");
       } else {
         influxDB_v2->getStatusJson(status);
-      }  
+      }
       root["influx2"] = status;
-    }
+    });
+  }
+
+  if(server.hasArg(F("mqtt"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
+      trace(T_WEB,29);
+      JsonObject& status = jsonBuffer.createObject();
+      if(!MQTT){
+        status.set(F("state"),"not running");
+      } else {
+        MQTT->getStatusJson(status);
+      }
+      root["mqtt"] = status;
+    });
+  }
 
-    if(server.hasArg(F("emoncms"))){
+  if(server.hasArg(F("emoncms"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,18);
       JsonObject& status = jsonBuffer.createObject();
       if(!Emoncms){
         status.set(F("state"),"not running");
       } else {
         Emoncms->getStatusJson(status);
-      }  
+      }
       root["emoncms"] = status;
-    }
+    });
+  }
     
-    if(server.hasArg(F("pvoutput"))){
+  if(server.hasArg(F("pvoutput"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,23);
       JsonObject& status = jsonBuffer.createObject();
       if(!pvoutput){
@@ -633,9 +965,20 @@ void handleStatus(){
         pvoutput->getStatusJson(status);
       }
       root["pvoutput"] = status;
-    }
+    });
+  }
+
+  if(server.hasArg(F("scrub"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
+      trace(T_WEB,26);
+      JsonObject& scrub = jsonBuffer.createObject();
+      scrubStatus(scrub);
+      root.set(F("scrub"), scrub);
+    });
+  }
 
-    if(server.hasArg(F("datalogs"))){
+  if(server.hasArg(F("datalogs"))){
+    statusSection(&statusFragments[statusDatalogs], statusLogsVersion(), [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,17);
       JsonArray& datalogs = jsonBuffer.createArray();
 
@@ -645,6 +988,19 @@ void handleStatus(){
       currlog.set(F("lastkey"),Current_log.lastKey());
       currlog.set(F("size"),Current_log.fileSize());
       currlog.set(F("interval"),Current_log.interval());
+      currlog.set(F("beginms"),Current_log.beginMs());
+      if(Current_log.readCacheBlocks()){
+        currlog.set(F("cacheblocks"),Current_log.readCacheBlocks());
+        currlog.set(F("cachehits"),Current_log.readCacheHits());
+        currlog.set(F("cachemisses"),Current_log.readCacheMisses());
+      }
+      if(Current_log.hasCrc()){
+        currlog.set(F("crcerrors"),Current_log.crcErrors());
+      }
+      if(logDropsInputs(Current_log)){
+        currlog.set(F("error"), F("inputs not logged"));
+        currlog.set(F("channels"), Current_log.channels());
+      }
       //currlog.set("wrap",Current_log._wrap ? true : false);
       datalogs.add(currlog);
 
@@ -654,17 +1010,48 @@ void handleStatus(){
       histlog.set(F("lastkey"),History_log.lastKey());
       histlog.set(F("size"),History_log.fileSize());
       histlog.set(F("interval"),History_log.interval());
+      histlog.set(F("beginms"),History_log.beginMs());
+      if(History_log.hasCrc()){
+        histlog.set(F("crcerrors"),History_log.crcErrors());
+      }
+      if(logDropsInputs(History_log)){
+        histlog.set(F("error"), F("inputs not logged"));
+        histlog.set(F("channels"), History_log.channels());
+      }
+      historyStatus(histlog);
       datalogs.add(histlog);
 
+      if(Hourly_log.isOpen()){
+        JsonObject& hourlog = jsonBuffer.createObject();
+        hourlog.set(F("id"), "Hourly");
+        hourlog.set(F("firstkey"),Hourly_log.firstKey());
+        hourlog.set(F("lastkey"),Hourly_log.lastKey());
+        hourlog.set(F("size"),Hourly_log.fileSize());
+        hourlog.set(F("interval"),Hourly_log.interval());
+        datalogs.add(hourlog);
+      }
+
+      if(Daily_log.isOpen()){
+        JsonObject& daylog = jsonBuffer.createObject();
+        daylog.set(F("id"), "Daily");
+        daylog.set(F("firstkey"),Daily_log.firstKey());
+        daylog.set(F("lastkey"),Daily_log.lastKey());
+        daylog.set(F("size"),Daily_log.fileSize());
+        daylog.set(F("interval"),Daily_log.interval());
+        datalogs.add(daylog);
+      }
+
       Script *script = integrations->first();
       while(script){
-        IotaLog *log = ((integrator *)script->getParm())->get_log();
+        integrator *_integrator = (integrator *)script->getParm();
+        IotaLog *log = _integrator->get_log();
         JsonObject& intlog = jsonBuffer.createObject();
         intlog.set(F("id"), script->name());
         intlog.set(F("firstkey"),log->firstKey());
         intlog.set(F("lastkey"),log->lastKey());
         intlog.set(F("size"),log->fileSize());
         intlog.set(F("interval"),log->interval());
+        _integrator->getStatusJson(intlog);
         datalogs.add(intlog);
         script = script->next();
       }
@@ -672,9 +1059,11 @@ void handleStatus(){
 
       trace(T_WEB,17);
       root.set(F("datalogs"),datalogs);
-    }
+    });
+  }
 
-    if(server.hasArg(F("wifi"))){
+  if(server.hasArg(F("wifi"))){
+    statusSection(nullptr, 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,17);
       JsonObject& wifi = jsonBuffer.createObject();
       wifi.set(F("connecttime"),wifiConnectTime);
@@ -688,19 +1077,27 @@ void handleStatus(){
         wifi.set(F("mac"), WiFi.macAddress());
       }
       root.set(F("wifi"),wifi);
-    }
+    });
+  }
 
-    if(server.hasArg(F("passwords"))){
+  if(server.hasArg(F("passwords"))){
+    statusSection(&statusFragments[statusPasswords], 0, [&](DynamicJsonBuffer& jsonBuffer, JsonObject& root){
       trace(T_WEB,18);
       JsonObject& passwords = jsonBuffer.createObject();
       passwords.set(F("admin"),adminH1 != nullptr);
       passwords.set(F("user"),userH1 != nullptr);
       passwords.set(F("localAccess"), localAccess);
       root[F("passwords")] = passwords;
-    }
-    root.printTo(response);
+    });
   }
-  server.send(200, appJson_P, response);
+  char tail[16];
+  size_t len = 6;
+  if(statusFirst){
+    tail[len++] = '{';
+  }
+  tail[len++] = '}';
+  sendChunk(tail, len);
+  sendChunk(tail, 6);
 }
 
 void handleVcal(){
@@ -726,6 +1123,7 @@ void handleCommand(){
     server.send(200, "text/plain", "ok");
     log("Restart command received.");
     delay(500);
+    Message_log.flush();
     ESP.restart();
   }
   if(server.hasArg(F("vtphase"))){
@@ -757,6 +1155,26 @@ void handleCommand(){
     getSamples();
     return; 
   }
+  if(server.hasArg(F("scriptbench"))){
+    trace(T_WEB,27);
+    server.send(200, txtPlain_P, scriptBenchmark(server.arg(F("scriptbench")).toInt()));
+    return;
+  }
+  if(server.hasArg(F("logbench"))){
+    trace(T_WEB,31);
+    server.send(200, txtPlain_P, logBenchmark(server.arg(F("logbench")).toInt()));
+    return;
+  }
+  if(server.hasArg(F("influxbench"))){
+    trace(T_WEB,28);
+    server.send(200, txtPlain_P, influxBenchmark(server.arg(F("influxbench")).toInt()));
+    return;
+  }
+  if(server.hasArg(F("base64check"))){
+    trace(T_WEB,61);
+    server.send(200, txtPlain_P, base64Check(server.arg(F("base64check")).toInt()));
+    return;
+  }
   if(server.hasArg(F("disconnect"))) {
     trace(T_WEB,6); 
     server.send(200, txtPlain_P, "ok");
@@ -772,18 +1190,28 @@ void handleCommand(){
       trace(T_WEB,21); 
       Current_log.end();
       deleteRecursive(IOTA_CURRENT_LOG_PATH);
+      uploadRecords.clear();
     } 
     else if(arg == "history"){
       trace(T_WEB,22); 
       History_log.end();
       deleteRecursive(IOTA_HISTORY_LOG_PATH);
+      Hourly_log.end();
+      deleteRecursive(IOTA_HOURLY_LOG_PATH);
+      Daily_log.end();
+      deleteRecursive(IOTA_DAILY_LOG_PATH);
     }
     else if(arg == "both"){
       trace(T_WEB,23);
       Current_log.end();
       deleteRecursive(IOTA_CURRENT_LOG_PATH);
+      uploadRecords.clear();
       History_log.end();
       deleteRecursive(IOTA_HISTORY_LOG_PATH);
+      Hourly_log.end();
+      deleteRecursive(IOTA_HOURLY_LOG_PATH);
+      Daily_log.end();
+      deleteRecursive(IOTA_DAILY_LOG_PATH);
     }
     else {
       server.send(400, txtPlain_P, F("Specify current, history, or both."));
@@ -791,6 +1219,7 @@ void handleCommand(){
     }
     server.send(200, txtPlain_P, "ok");
     delay(1000);
+    Message_log.flush();
     ESP.restart();
   }
   server.send(400, txtPlain_P, F("Unrecognized request"));
@@ -869,7 +1298,6 @@ void handleGetFeedList(){
 }
 
 void handleGetFeedData(){
-  serverAvailable = false;
   getFeedData();
   return;
 }
@@ -903,11 +1331,20 @@ void handleQuery(){
     String response("{\"error\":\"invalid query. ");
     response += query->failReason() + "\"}";
     server.send(400, txtPlain_P, response);
+  } else if(server.hasArg(F("bench"))){
+    trace(T_WEB,60);
+    if(authenticate(authAdmin)){
+      server.send(200, txtPlain_P, queryBenchmark(query));
+    }
   } else {
     trace(T_WEB,52);
+    if(webStreamStart(query, server.hasArg(F("download")) || query->isBin() ? "application/octet-stream" :
+                             query->isJson() ? "application/json" : "text/plain")){
+      return;
+    }
     server.setContentLength(CONTENT_LENGTH_UNKNOWN);
     //server.sendHeader(String("Connection"), String("keep-alive"));
-    if(server.hasArg(F("download"))){
+    if(server.hasArg(F("download")) || query->isBin()){
       trace(T_WEB,53);
       server.send(200,"application/octet-stream","");
     }
@@ -950,6 +1387,7 @@ void handleUpdate(){
       log ("Updater: Firmware updated, restarting.");
       server.send(200, txtPlain_P, F("Firmware updated, restarting."));
       delay(1000);
+      Message_log.flush();
       ESP.restart();
     }
     else {
@@ -985,6 +1423,35 @@ void handleDSTtest(){
     }
     server.send(200, txtPlain_P, buf.readString(buf.available()).c_str());
 }
+//**********************************************************************************************
+//
+//        handleTrace() - GET /trace
+//
+//        Returns the timed trace ring, oldest first, as 8 byte little-endian entries:
+//        uint32 micros, uint8 seq, module, id, det.  Recording is held while it's sent, 
+//        so the dump is one unbroken run that ends here.
+//
+//**********************************************************************************************
+
+void handleTrace(){
+  if( ! traceRing){
+    server.send(503, txtPlain_P, F("Trace ring is off"));
+    return;
+  }
+  traceRingHold = true;
+  uint32_t size = traceRingMask + 1;
+  uint32_t count = MIN(traceRingNext, size);
+  uint32_t first = (traceRingNext - count) & traceRingMask;
+  server.setContentLength(count * sizeof(traceRingEntry));
+  server.send(200, F("application/octet-stream"), "");
+  uint32_t part = MIN(count, size - first);
+  server.client().write((uint8_t*)(traceRing + first), part * sizeof(traceRingEntry));
+  if(count > part){
+    server.client().write((uint8_t*)traceRing, (count - part) * sizeof(traceRingEntry));
+  }
+  traceRingHold = false;
+}
+
         // Seems to work better when sending chunk as a single write
         // including chunk header, body, and footer (\r\n).
         // This function accepts a char* buffer and length to send.
@@ -16,6 +16,7 @@ bool serverOn(authLevel level, const __FlashStringHelper* uri, HTTPMethod method
 void returnOK();
 void returnFail(String msg, int code=500);
 bool loadFromSdCard(String path);
+void assetTagsClear();
 bool loadFromSpiffs(String path, String dataType);
 void handleFileUpload();
 void handleSpiffsUpload();
@@ -26,6 +27,7 @@ void printDirectory();
 void printSpiffsDirectory(String path);
 void handleNotFound();
 void handleStatus();
+void statusFragmentsClear();
 void handleVcal();
 void handleCommand();
 void handleGetFeedList();
@@ -40,5 +42,6 @@ void handlePasswords();
 void handleQuery();
 void handleUpdate();
 void handleDSTtest();
+void handleTrace();
 
 #endif
\ No newline at end of file
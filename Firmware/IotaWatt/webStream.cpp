@@ -0,0 +1,145 @@
+#include "IotaWatt.h"
+
+/**************************************************************************************************
+ * webStream - see webStream.h
+ *
+ * Each chunk is framed in the stream's buffer as a 4 digit hex length, CRLF, data, CRLF, and
+ * written out as the connection has room.  When readResult() returns zero the terminating chunk
+ * is queued, and once that's sent the connection is closed and the source deleted.
+ * ************************************************************************************************/
+
+struct webStreamSlot {
+  WiFiClient*       client;                 // Copy of the web server client (nullptr = free)
+  webStreamSource*  source;
+  char*             buf;                    // Framed chunk
+  uint16_t          pos;                    // Next byte to write
+  uint16_t          len;                    // Bytes in buf
+  uint32_t          lastMs;                 // millis() of last progress
+  bool              done;                   // Terminating chunk is in buf
+};
+
+static webStreamSlot  streams[WEB_STREAMS_MAX];
+static uint8_t        streamsActive = 0;
+static uint32_t       streamsStarted = 0;   // Running counts
+static uint32_t       streamsInline = 0;    // Sent by the handler, no slot or heap
+static uint32_t       streamsAbandoned = 0;
+static uint32_t       streamBytes = 0;
+
+bool webStreamStart(webStreamSource* source, const char* contentType){
+  trace(T_webStream,0);
+  webStreamSlot* slot = nullptr;
+  for(int i=0; i<WEB_STREAMS_MAX; i++){
+    if( ! streams[i].client){
+      slot = &streams[i];
+      break;
+    }
+  }
+  if( ! slot || ESP.getFreeHeap() < WEB_STREAM_HEAP_MIN){
+    streamsInline++;
+    return false;
+  }
+  slot->client = new WiFiClient(server.client());
+  slot->client->printf_P(PSTR("HTTP/1.1 200 OK\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\nConnection: close\r\n\r\n"),
+                         contentType);
+  slot->source = source;
+  slot->buf = new char[WEB_STREAM_CHUNK + 8];
+  slot->pos = slot->len = 0;
+  slot->lastMs = millis();
+  slot->done = false;
+  streamsStarted++;
+  if(streamsActive++ == 0){
+    NewService(webStreamService, T_webStream);
+  }
+  return true;
+}
+
+static void webStreamEnd(webStreamSlot* slot){
+  slot->client->stop();
+  delete slot->client;
+  slot->client = nullptr;
+  delete slot->source;
+  slot->source = nullptr;
+  delete[] slot->buf;
+  slot->buf = nullptr;
+  streamsActive--;
+}
+
+uint32_t webStreamService(struct serviceBlock* _serviceBlock){
+  static serviceBudget budget;
+  trace(T_webStream,1);
+  bool progress = true;
+  while(progress && streamsActive && budget.next()){
+    progress = false;
+    for(int i=0; i<WEB_STREAMS_MAX; i++){
+      webStreamSlot* slot = &streams[i];
+      if( ! slot->client){
+        continue;
+      }
+      if( ! slot->client->connected() || (millis() - slot->lastMs) > WEB_STREAM_IDLE_MS){
+        trace(T_webStream,2);
+        streamsAbandoned++;
+        webStreamEnd(slot);
+        continue;
+      }
+
+          // Get the next chunk when the last is out.
+
+      if(slot->pos == slot->len){
+        if(slot->done){
+          trace(T_webStream,3);
+          webStreamEnd(slot);
+          continue;
+        }
+        if(ESP.getFreeHeap() < WEB_STREAM_HEAP_FLOOR){
+          continue;
+        }
+        trace(T_webStream,4);
+        size_t len = slot->source->readResult((uint8_t*)slot->buf + 6, WEB_STREAM_CHUNK);
+        if(len == 0){
+          memcpy(slot->buf, "0\r\n\r\n", 5);
+          slot->len = 5;
+          slot->done = true;
+        }
+        else {
+          sprintf_P(slot->buf, PSTR("%04x\r"), len);
+          slot->buf[5] = '\n';
+          memcpy(slot->buf + 6 + len, "\r\n", 2);
+          slot->len = len + 8;
+        }
+        slot->pos = 0;
+        progress = true;
+      }
+
+          // Write what the connection will take.
+
+      size_t room = slot->client->availableForWrite();
+      if(room){
+        trace(T_webStream,5);
+        size_t sent = slot->client->write((uint8_t*)slot->buf + slot->pos, MIN(room, (size_t)(slot->len - slot->pos)));
+        if(sent){
+          slot->pos += sent;
+          slot->lastMs = millis();
+          streamBytes += sent;
+          progress = true;
+        }
+      }
+    }
+  }
+  if( ! streamsActive){
+    trace(T_webStream,6);
+    return 0;
+  }
+  return progress ? 1 : 10;
+}
+
+//**********************************************************************************************
+//        webStreamStatus(stats) - GET /status?stats
+//**********************************************************************************************
+
+void webStreamStatus(JsonObject& status){
+  status.set(F("active"), streamsActive);
+  status.set(F("started"), streamsStarted);
+  status.set(F("inline"), streamsInline);
+  status.set(F("abandoned"), streamsAbandoned);
+  status.set(F("bytes"), streamBytes);
+}
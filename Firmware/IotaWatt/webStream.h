@@ -0,0 +1,44 @@
+#ifndef webStream_h
+#define webStream_h
+
+/**************************************************************************************************
+ *
+ *  webStream - long responses sent by a SERVICE while the web server goes on to other requests
+ *
+ *  ESP8266WebServer handles one request at a time, start to finish, in the handler.  A long
+ *  query or feed export held it (and sampling) for the whole transfer.  Instead, the handler
+ *  validates the request, builds a webStreamSource holding all of the request's state, and
+ *  passes it to webStreamStart().  That takes a copy of the connection, writes the response
+ *  header itself and returns, so the server is free for /status and the like.
+ *
+ *  webStreamService() then feeds up to WEB_STREAMS_MAX streams in turn, one chunk at a time
+ *  from source->readResult(), within the service budget.  It only writes what the connection
+ *  can take (availableForWrite), so a slow client slows its own stream and nothing else.
+ *
+ *  Each stream has one WEB_STREAM_CHUNK buffer.  A stream is only started with at least
+ *  WEB_STREAM_HEAP_MIN free heap, and streams wait while the heap is below WEB_STREAM_HEAP_FLOOR.
+ *  When a stream can't be started the handler sends the response inline, as before.  A stream
+ *  whose client takes nothing for WEB_STREAM_IDLE_MS is abandoned.
+ *
+ *  The server still waits up to its close timeout (2 sec) on the handed off connection before
+ *  taking the next request.
+ *
+ * ************************************************************************************************/
+
+#define WEB_STREAMS_MAX 2                   // Concurrent streamed responses
+#define WEB_STREAM_CHUNK 1440               // Data bytes per chunk (a TCP segment)
+#define WEB_STREAM_HEAP_MIN 16000           // Free heap needed to start a stream
+#define WEB_STREAM_HEAP_FLOOR 10000         // Streams wait while free heap is below this
+#define WEB_STREAM_IDLE_MS 30000            // Abandon a stream making no progress this long
+
+class webStreamSource {
+  public:
+    virtual ~webStreamSource(){};
+    virtual size_t readResult(uint8_t* buf, int len) = 0;     // Next response bytes (0 = done)
+};
+
+bool      webStreamStart(webStreamSource* source, const char* contentType);   // Takes source if true
+uint32_t  webStreamService(struct serviceBlock*);
+void      webStreamStatus(JsonObject&);       // Add stream stats to /status
+
+#endif